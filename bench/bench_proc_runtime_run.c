@@ -0,0 +1,72 @@
+// Run-start latency of the POSIX runtime worker pool, compared to spawning a thread per run
+
+#include <csp_proc/proc_runtime.h>
+#include <csp_proc/proc_store.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if RESERVED_PROC_SLOTS < 1
+#error "The benchmark runs a reserved procedure, build with -DRESERVED_PROC_SLOTS=1 or more"
+#endif
+
+#define BENCH_PROC_SLOT (0)
+#define BENCH_DEFAULT_RUNS (1000)
+
+static struct timespec started;
+
+static int bench_proc() {
+	clock_gettime(CLOCK_MONOTONIC, &started);
+	return 0;
+}
+
+static void * bench_thread(void * arg) {
+	(void)arg;
+	bench_proc();
+	return NULL;
+}
+
+static double elapsed_us(const struct timespec * from, const struct timespec * to) {
+	return (to->tv_sec - from->tv_sec) * 1e6 + (to->tv_nsec - from->tv_nsec) / 1e3;
+}
+
+int main(int argc, char ** argv) {
+	int runs = (argc > 1) ? atoi(argv[1]) : BENCH_DEFAULT_RUNS;
+
+	proc_reserved_slots_array[BENCH_PROC_SLOT] = bench_proc;
+	if (proc_store_init() != 0 || proc_runtime_init() != 0) {
+		fprintf(stderr, "Failed to initialize runtime\n");
+		return 1;
+	}
+
+	struct timespec requested;
+	double pool_us = 0, thread_us = 0;
+
+	for (int i = 0; i < runs; i++) {
+		proc_run_handle_t handle;
+		clock_gettime(CLOCK_MONOTONIC, &requested);
+		if (proc_runtime_run_async(BENCH_PROC_SLOT, &handle) != 0 || proc_runtime_await(handle, 1000, NULL) != 0) {
+			fprintf(stderr, "Run %d failed\n", i);
+			return 1;
+		}
+		pool_us += elapsed_us(&requested, &started);
+	}
+
+	for (int i = 0; i < runs; i++) {
+		pthread_t thread;
+		clock_gettime(CLOCK_MONOTONIC, &requested);
+		if (pthread_create(&thread, NULL, bench_thread, NULL) != 0) {
+			fprintf(stderr, "Thread %d failed\n", i);
+			return 1;
+		}
+		pthread_join(thread, NULL);
+		thread_us += elapsed_us(&requested, &started);
+	}
+
+	printf("Average run-start latency over %d runs:\n", runs);
+	printf("  worker pool:       %8.2f us\n", pool_us / runs);
+	printf("  thread per run:    %8.2f us\n", thread_us / runs);
+	return 0;
+}
@@ -36,6 +36,7 @@ struct proc_analysis_t {
 	uint8_t * procedure_slots;
 	size_t procedure_slot_count;
 	proc_instruction_analysis_t * instruction_analyses;
+	proc_t * relinked;  // shallow copy of the procedure relinked by the runtime once its stored link went stale, or NULL
 	int deallocation_mark;
 };
 
@@ -53,6 +54,65 @@ void free_proc_analysis(proc_analysis_t * analysis);
 
 int proc_analyze(proc_union_t proc_union, proc_analysis_t * analysis, proc_analysis_config_t * config);
 
+/**
+ * Initialize the per-slot analysis cache used by proc_analysis_acquire.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int proc_analysis_cache_init();
+
+/**
+ * Get the shared, read-only analysis of the procedure in a slot, analyzing it on first use.
+ * The analysis holds references to the snapshots of every procedure in the call graph, so it stays runnable after the slots change.
+ *
+ * @param slot The slot of the procedure
+ *
+ * @return The analysis, or NULL on failure. Must be released with proc_analysis_release.
+ */
+proc_analysis_t * proc_analysis_acquire(uint8_t slot);
+
+/**
+ * Release an analysis obtained from proc_analysis_acquire.
+ *
+ * @param analysis The analysis to release
+ */
+void proc_analysis_release(proc_analysis_t * analysis);
+
+/**
+ * Drop cached analyses of the procedure in a slot and of every procedure calling it (directly or indirectly).
+ * Called by the proc store whenever a slot is set or deleted.
+ *
+ * @param slot The slot that changed
+ */
+void __attribute__((weak)) proc_analysis_invalidate(uint8_t slot);
+
+/**
+ * Take a reference to the relinked copy of an analyzed DSL procedure (see proc_analysis_relinked_publish),
+ * if it was linked at the given parameter cache epoch.
+ *
+ * @param analysis The analysis, from proc_analysis_acquire
+ * @param epoch The current parameter cache epoch
+ *
+ * @return The copy, or NULL if it must be relinked. Must be released with proc_analysis_relinked_release.
+ */
+proc_t * proc_analysis_relinked_acquire(proc_analysis_t * analysis, uint32_t epoch);
+
+/**
+ * Share a relinked shallow copy of an analyzed DSL procedure with later runs of the analysis, replacing an older copy.
+ * The analysis takes its own reference to the copy.
+ *
+ * @param analysis The analysis, from proc_analysis_acquire
+ * @param relinked The copy, with a reference count of at least 1
+ */
+void proc_analysis_relinked_publish(proc_analysis_t * analysis, proc_t * relinked);
+
+/**
+ * Release a reference to a relinked copy, freeing the copy and its link (but not the shared instructions) with the last one.
+ *
+ * @param relinked The copy (may be NULL)
+ */
+void proc_analysis_relinked_release(proc_t * relinked);
+
 #ifdef __cplusplus
 }
 #endif
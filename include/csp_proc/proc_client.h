@@ -12,6 +12,37 @@ extern "C" {
 
 typedef int (*response_callback_t)(csp_packet_t *, void *);
 
+#ifndef PROC_SESSION_PIPELINE
+#define PROC_SESSION_PIPELINE (4)
+#endif  // requests of a session sent ahead of their responses, must fit in the connection's receive queue
+
+// Reassembly of a (possibly segmented) pull response
+typedef struct {
+	proc_t * procedure;
+	proc_segments_t segments;
+} proc_pull_t;
+
+// A request of a session awaiting its response
+typedef struct {
+	uint8_t response_type;
+	proc_pull_t pull;  // procedure is NULL unless pulling
+	int * result;
+} proc_session_request_t;
+
+/**
+ * A connection to a host kept open for several requests (see proc_session_open).
+ * Requests are sent right away and their responses read in order, once the pipeline is full or on proc_session_flush.
+ */
+typedef struct {
+	csp_conn_t * conn;
+	int host;
+	int timeout;
+	proc_session_request_t pending[PROC_SESSION_PIPELINE];
+	int pending_head;
+	int pending_count;
+	int failed;  // requests failed since the last flush
+} proc_session_t;
+
 int proc_transaction(
 	csp_packet_t * packet,
 	response_callback_t response_callback,
@@ -27,8 +58,217 @@ int proc_push_request(proc_t * procedure, uint8_t proc_slot, int host, int timeo
 
 int proc_slots_request(uint8_t * slots, uint8_t * slot_count, int host, int timeout);
 
+/**
+ * Get the occupied procedure slots of a node as a bitmap, and optionally the metadata of their procedures.
+ *
+ * @param bitmap The bitmap of PROC_SLOTS_BITMAP_SIZE bytes to fill, see PROC_SLOTS_BITMAP_TEST
+ * @param info If not NULL, an array of PROC_SLOTS_BITMAP_SIZE * 8 entries indexed by slot, filled for occupied slots
+ *             (left as PROC_TYPE_NONE where unknown, e.g. for servers without support for it)
+ * @param host The node to query
+ * @param timeout The timeout in milliseconds
+ * @return 0 on success, non-zero on failure
+ */
+int proc_slots_info_request(uint8_t * bitmap, proc_slot_info_t * info, int host, int timeout);
+
 int proc_run_request(uint8_t proc_slot, int host, int timeout);
 
+/**
+ * Run a procedure on a node ahead of its queued runs of lower priority (see proc_runtime_run_priority).
+ *
+ * @param proc_slot The slot of the procedure
+ * @param priority The priority of the run, PROC_RUN_PRIORITY_DEFAULT for runs started without one
+ * @param host The node to send the request to
+ * @param timeout The timeout in milliseconds
+ * @return 0 on success, non-zero on failure
+ */
+int proc_run_priority_request(uint8_t proc_slot, uint8_t priority, int host, int timeout);
+
+/**
+ * Run a procedure on a node every period_ms, or stop its periodic runs.
+ *
+ * @param proc_slot The slot of the procedure
+ * @param period_ms The time between runs, 0 to stop the periodic runs
+ * @param phase_ms The delay before the first run
+ * @param host The node to send the request to
+ * @param timeout The timeout in milliseconds
+ * @return 0 on success, non-zero on failure
+ */
+int proc_run_periodic_request(uint8_t proc_slot, uint32_t period_ms, uint32_t phase_ms, int host, int timeout);
+
+/**
+ * Run a procedure on a node at an absolute time of the node's clock (see proc_runtime_run_at).
+ *
+ * @param proc_slot The slot of the procedure
+ * @param tv_sec The time to run the procedure at, seconds part
+ * @param tv_nsec The time to run the procedure at, nanoseconds part
+ * @param id Populated with the id of the timed run, for cancelling it (may be NULL)
+ * @param host The node to send the request to
+ * @param timeout The timeout in milliseconds
+ * @return 0 on success, non-zero on failure
+ */
+int proc_timed_run_request(uint8_t proc_slot, uint32_t tv_sec, uint32_t tv_nsec, uint16_t * id, int host, int timeout);
+
+/**
+ * Cancel a timed run on a node before it starts.
+ *
+ * @param id The id of the timed run
+ * @param host The node to send the request to
+ * @param timeout The timeout in milliseconds
+ * @return 0 on success, non-zero on failure
+ */
+int proc_timed_cancel_request(uint16_t id, int host, int timeout);
+
+/**
+ * Get the timed runs scheduled on a node, earliest first.
+ *
+ * @param runs Array of PROC_TIMED_LIST_MAX runs to fill
+ * @param count Populated with the number of runs
+ * @param jitter Populated with how late timed runs have started on the node (may be NULL)
+ * @param host The node to send the request to
+ * @param timeout The timeout in milliseconds
+ * @return 0 on success, non-zero on failure
+ */
+int proc_timed_list_request(proc_timed_run_t * runs, int * count, proc_timed_jitter_t * jitter, int host, int timeout);
+
+/**
+ * Delete the procedures in several slots of a node in a single exchange.
+ *
+ * @param slots The slots to delete, at most CSP_BUFFER_SIZE - 1
+ * @param slot_count The number of slots
+ * @param results Filled with 0 or -1 for each slot
+ * @param host The node to send the request to
+ * @param timeout The timeout in milliseconds
+ * @return -1 if the exchange failed, otherwise the number of slots that failed
+ */
+int proc_bulk_del_request(const uint8_t * slots, int slot_count, int * results, int host, int timeout);
+
+/**
+ * Pull the procedures in several slots of a node in a single exchange.
+ *
+ * @param procedures Array of slot_count procedures to unpack into
+ * @param slots The slots to pull, at most CSP_BUFFER_SIZE - 1
+ * @param slot_count The number of slots
+ * @param results Filled with 0 or -1 (e.g. for empty slots) for each slot
+ * @param host The node to send the request to
+ * @param timeout The timeout in milliseconds
+ * @return -1 if the exchange failed, otherwise the number of slots that failed
+ */
+int proc_bulk_pull_request(proc_t * procedures, const uint8_t * slots, int slot_count, int * results, int host, int timeout);
+
+/**
+ * Push several procedures to a node over a single connection, without waiting for each response before the next push.
+ *
+ * @param procedures Array of slot_count procedures to push
+ * @param slots The slot to push each procedure to
+ * @param slot_count The number of procedures
+ * @param results Filled with 0 or -1 for each procedure
+ * @param host The node to push to
+ * @param timeout The timeout in milliseconds for each response
+ * @return -1 if the connection failed, otherwise the number of procedures that failed
+ */
+int proc_bulk_push_request(proc_t * procedures, const uint8_t * slots, int slot_count, int * results, int host, int timeout);
+
+/**
+ * Open a session with a host, reusing one connection for the requests made through it.
+ *
+ * @param session The session to initialize
+ * @param host The node to connect to
+ * @param timeout The timeout in milliseconds for each response
+ * @return 0 on success, -1 on failure
+ */
+int proc_session_open(proc_session_t * session, int host, int timeout);
+
+/**
+ * Queue a request on a session. Its result is set to 0 or -1 once its response has been read, and must stay valid until then.
+ * Requests are handled by the host in the order they are queued, e.g. a push followed by a pull and a run of the same slot.
+ *
+ * @return 0 if the request was sent, non-zero otherwise
+ */
+int proc_session_del(proc_session_t * session, uint8_t proc_slot, int * result);
+int proc_session_pull(proc_session_t * session, proc_t * procedure, uint8_t proc_slot, int * result);
+int proc_session_push(proc_session_t * session, proc_t * procedure, uint8_t proc_slot, int * result);
+int proc_session_run(proc_session_t * session, uint8_t proc_slot, int * result);
+
+/**
+ * Read the responses to all pending requests of a session.
+ *
+ * @return The number of requests that failed since the last flush
+ */
+int proc_session_flush(proc_session_t * session);
+
+/**
+ * Flush and close a session.
+ *
+ * @return The number of requests that failed since the last flush
+ */
+int proc_session_close(proc_session_t * session);
+
+#ifndef PROC_ASYNC_MAX
+#define PROC_ASYNC_MAX (16)
+#endif  // requests pending at once in a proc_async_t
+
+#ifndef PROC_ASYNC_POLL_INTERVAL
+#define PROC_ASYNC_POLL_INTERVAL (10)
+#endif  // milliseconds proc_async_wait_all blocks on one request before checking the others again
+
+/**
+ * Called once an asynchronous request completes.
+ *
+ * @param host The node the request was sent to
+ * @param proc_slot The slot of the request
+ * @param result 0 on success, -1 on failure or timeout
+ * @param arg The argument given with the request
+ */
+typedef void (*proc_async_callback_t)(int host, uint8_t proc_slot, int result, void * arg);
+
+// A pending asynchronous request, free while conn is NULL
+typedef struct {
+	csp_conn_t * conn;
+	int host;
+	uint8_t proc_slot;
+	uint32_t deadline;  // csp_get_ms() at which it times out
+	proc_session_request_t pending;
+	proc_async_callback_t callback;
+	void * callback_arg;
+} proc_async_request_t;
+
+/**
+ * Requests to any number of hosts in flight at once, each on its own connection, completed by proc_async_poll.
+ */
+typedef struct {
+	proc_async_request_t requests[PROC_ASYNC_MAX];
+	int pending;
+	int failed;  // requests failed since the last proc_async_wait_all
+} proc_async_t;
+
+void proc_async_init(proc_async_t * async);
+
+/**
+ * Send a request without waiting for its response. The callback is called from proc_async_poll once it completes,
+ * and the procedure of a pull must stay valid until then.
+ *
+ * @return 0 if the request was sent, non-zero otherwise (e.g. if PROC_ASYNC_MAX requests are already pending)
+ */
+int proc_async_del(proc_async_t * async, int host, uint8_t proc_slot, int timeout, proc_async_callback_t callback, void * callback_arg);
+int proc_async_pull(proc_async_t * async, int host, proc_t * procedure, uint8_t proc_slot, int timeout, proc_async_callback_t callback, void * callback_arg);
+int proc_async_push(proc_async_t * async, int host, proc_t * procedure, uint8_t proc_slot, int timeout, proc_async_callback_t callback, void * callback_arg);
+int proc_async_run(proc_async_t * async, int host, uint8_t proc_slot, int timeout, proc_async_callback_t callback, void * callback_arg);
+
+/**
+ * Handle the responses received so far, and complete the requests that are answered or timed out.
+ *
+ * @param wait Milliseconds to block waiting for a response if none was received, 0 to return right away
+ * @return The number of requests still pending
+ */
+int proc_async_poll(proc_async_t * async, int wait);
+
+/**
+ * Poll until all pending requests have completed.
+ *
+ * @return The number of requests that failed since the last call
+ */
+int proc_async_wait_all(proc_async_t * async);
+
 #ifdef __cplusplus
 }
 #endif
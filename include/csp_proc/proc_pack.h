@@ -5,11 +5,50 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
 #include <csp/csp_types.h>
 #include <csp_proc/proc_types.h>
 
+#ifndef PROC_MAX_PACKED_SIZE
+#define PROC_MAX_PACKED_SIZE (2048U)
+#endif  // largest packed procedure reassembled from a segmented transfer
+
+#define PROC_SEGMENT_HEADER_SIZE       (2U)   // segment index (uint16)
+#define PROC_SEGMENT_FIRST_HEADER_SIZE (10U)  // segment index, then length and CRC32 of the whole packed procedure (uint32 each)
+
+// Reassembly of a procedure packed across several segments (see proc_segment_fill)
+typedef struct {
+	uint8_t * packed;
+	uint32_t length;      // bytes received so far
+	uint32_t total;       // length announced by the first segment
+	uint32_t crc;         // CRC32 announced by the first segment
+	uint16_t next_index;  // index of the next segment expected
+} proc_segments_t;
+
 int calc_proc_size(proc_t * procedure);
 
+/**
+ * Pack a proc_t procedure into a buffer, in the format carried by push/pull packets after their two header bytes.
+ *
+ * @param procedure The procedure to pack
+ * @param buf The buffer to pack the procedure into
+ * @param size The size of the buffer
+ * @return The number of bytes packed, or -1 on failure (e.g. the buffer is too small)
+ */
+int proc_pack(proc_t * procedure, uint8_t * buf, size_t size);
+
+/**
+ * Unpack a proc_t procedure from a buffer packed by proc_pack.
+ * On failure, the procedure holds what was unpacked so far and must still be freed.
+ *
+ * @param procedure The procedure to unpack into
+ * @param buf The packed procedure
+ * @param length The length of the packed procedure
+ * @return 0 on success, -1 on failure (e.g. the packed procedure is truncated)
+ */
+int proc_unpack(proc_t * procedure, const uint8_t * buf, size_t length);
+
 /**
  * Pack a proc_t procedure into a CSP packet.
  *
@@ -28,8 +67,87 @@ int pack_proc_into_csp_packet(proc_t * procedure, csp_packet_t * packet);
  */
 int unpack_proc_from_csp_packet(proc_t * procedure, csp_packet_t * packet);
 
+/**
+ * Calculate the size of a procedure in the compact encoding, see proc_pack_compact.
+ *
+ * @param procedure The procedure to calculate the size of
+ * @return The size of the procedure in bytes or -1 on failure
+ */
+int calc_proc_compact_size(proc_t * procedure);
+
+/**
+ * Pack a procedure in the compact encoding: operand strings are stored once in a string table and referenced by index,
+ * and nodes are only stored where they change. Operand strings shared by several instructions are unpacked only once.
+ *
+ * @param procedure The procedure to pack
+ * @param buf The buffer to pack the procedure into
+ * @param size The size of the buffer
+ * @return The number of bytes packed, or -1 on failure (e.g. the buffer is too small)
+ */
+int proc_pack_compact(proc_t * procedure, uint8_t * buf, size_t size);
+
+/**
+ * Unpack a procedure packed by proc_pack_compact.
+ * On failure, the procedure holds what was unpacked so far and must still be freed.
+ *
+ * @param procedure The procedure to unpack into
+ * @param buf The packed procedure
+ * @param length The length of the packed procedure
+ * @return 0 on success, -1 on failure (e.g. the packed procedure is truncated)
+ */
+int proc_unpack_compact(proc_t * procedure, const uint8_t * buf, size_t length);
+
+/**
+ * Get the instruction count of a packed procedure without unpacking it.
+ *
+ * @param buf The packed procedure
+ * @param length The length of the packed procedure
+ * @param compact Whether the procedure was packed by proc_pack_compact rather than proc_pack
+ * @return The instruction count, or -1 if the packed procedure is truncated
+ */
+int proc_packed_instruction_count(const uint8_t * buf, size_t length, int compact);
+
+/**
+ * Fill the next segment of a packed procedure sent across several packets: the segment index (big-endian),
+ * the length and CRC32 of the whole packed procedure in the first segment, then as much of the packed procedure as fits.
+ *
+ * @param data The segment to fill
+ * @param capacity The size of the segment
+ * @param packed The packed procedure
+ * @param size The size of the packed procedure
+ * @param index The index of the segment, starting at 0
+ * @param offset The offset of the segment's data in the packed procedure, advanced past it
+ * @return The number of bytes filled in
+ */
+size_t proc_segment_fill(uint8_t * data, size_t capacity, const uint8_t * packed, size_t size, uint16_t index, size_t * offset);
+
+/**
+ * Add a segment filled by proc_segment_fill to a reassembly, starting with an empty (zeroed) one.
+ *
+ * @param segments The reassembly
+ * @param data The segment
+ * @param length The length of the segment
+ * @param last Whether the sender marked it as the last segment
+ * @return 0 if more segments are expected, 1 once the last segment completes a procedure matching its length and CRC32,
+ *         -1 if the segment is out of sequence, the procedure too large, or the completed procedure incomplete or corrupt
+ */
+int proc_segments_add(proc_segments_t * segments, const uint8_t * data, size_t length, int last);
+
+/**
+ * Free a reassembly and empty it for the next procedure.
+ */
+void proc_segments_reset(proc_segments_t * segments);
+
 void proc_free_instruction(proc_instruction_t * instruction);
 
+/**
+ * Free the operand strings of an instruction of a procedure, skipping those held in the procedure's strings arena.
+ *
+ * @param procedure The procedure the instruction belongs to
+ * @param instruction The instruction to free
+ */
+void proc_free_instruction_in(proc_t * procedure, proc_instruction_t * instruction);
+
 void free_proc(proc_t * procedure);
 
 int proc_copy_instruction(proc_instruction_t * instruction, proc_instruction_t * copy);
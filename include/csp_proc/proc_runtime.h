@@ -20,6 +20,25 @@ extern "C" {
 #define MIN_PROC_BLOCK_PERIOD_MS (250U)
 #endif
 
+#define PROC_BLOCK_POLL_FIXED   (0)  // poll every MIN_PROC_BLOCK_PERIOD_MS
+#define PROC_BLOCK_POLL_BACKOFF (1)  // start at MIN_PROC_BLOCK_PERIOD_MS, multiply by PROC_BLOCK_POLL_BACKOFF_FACTOR up to MAX_PROC_BLOCK_PERIOD_MS
+
+#ifndef PROC_BLOCK_POLL_POLICY
+#define PROC_BLOCK_POLL_POLICY PROC_BLOCK_POLL_FIXED
+#endif  // backoff trades block wake-up latency (up to MAX_PROC_BLOCK_PERIOD_MS) for fewer remote polls
+
+#ifndef MAX_PROC_BLOCK_PERIOD_MS
+#define MAX_PROC_BLOCK_PERIOD_MS (4000U)
+#endif
+
+#ifndef PROC_BLOCK_POLL_BACKOFF_FACTOR
+#define PROC_BLOCK_POLL_BACKOFF_FACTOR (2U)
+#endif
+
+#ifndef PROC_BLOCK_EVENT_RECHECK_MS
+#define PROC_BLOCK_EVENT_RECHECK_MS (MIN_PROC_BLOCK_PERIOD_MS)
+#endif  // 0 = blocks on local parameters are only re-evaluated when notified through proc_runtime_param_changed
+
 #ifndef MAX_PROC_RECURSION_DEPTH
 #define MAX_PROC_RECURSION_DEPTH (1000U)
 #endif
@@ -28,6 +47,68 @@ extern "C" {
 #define MAX_PROC_CONCURRENT (16U)
 #endif
 
+#ifndef PROC_RUN_QUEUE_LENGTH
+#define PROC_RUN_QUEUE_LENGTH (16U)
+#endif  // runs waiting for a free worker when MAX_PROC_CONCURRENT procedures are already running
+
+#define PROC_RUN_QUEUE_REJECT_NEW  (0)  // refuse new runs while the run queue is full
+#define PROC_RUN_QUEUE_DROP_OLDEST (1)  // drop the run that has waited longest to make room
+#define PROC_RUN_QUEUE_DROP_LOWEST (2)  // drop the latest run of the lowest priority to make room, unless the new run's priority is no higher
+
+#ifndef PROC_RUN_QUEUE_OVERFLOW
+#define PROC_RUN_QUEUE_OVERFLOW PROC_RUN_QUEUE_REJECT_NEW
+#endif
+
+#define PROC_RUN_PRIORITY_DEFAULT (128U)  // priority of runs started without one, higher priorities leave the run queue first
+
+#ifndef PROC_PERIODIC_MAX
+#define PROC_PERIODIC_MAX (8U)
+#endif  // procedures scheduled to run periodically at once
+
+#ifndef PROC_TIMER_WHEEL_TICK_MS
+#define PROC_TIMER_WHEEL_TICK_MS (10U)
+#endif  // resolution of periodic runs
+
+#ifndef PROC_TIMER_WHEEL_SLOTS
+#define PROC_TIMER_WHEEL_SLOTS (64U)
+#endif
+
+#ifndef PROC_TIMED_RUNS_MAX
+#define PROC_TIMED_RUNS_MAX (16U)
+#endif  // runs scheduled at absolute times at once
+
+#ifndef PROC_TIMED_RUN_MAX_LATE_MS
+#define PROC_TIMED_RUN_MAX_LATE_MS (0U)
+#endif  // timed runs due longer ago than this (e.g. while the node was off) are dropped, 0 = always run them
+
+#ifndef PROC_TIMED_RUN_RETRY_MS
+#define PROC_TIMED_RUN_RETRY_MS (1000U)
+#endif  // delay before a timed run that failed to start (e.g. the run queue was full) is started again
+
+#ifndef PROC_RUNTIME_STOP_TIMEOUT_MS
+#define PROC_RUNTIME_STOP_TIMEOUT_MS (1000U)
+#endif  // time stopping all runs waits in total for the cancelled runs to finish
+
+#ifndef PROC_COOP_MAX_RUNS
+#define PROC_COOP_MAX_RUNS (64U)
+#endif  // runs queued or in progress at once in the cooperative runtime
+
+#ifndef PROC_COOP_SLICE
+#define PROC_COOP_SLICE (32U)
+#endif  // instructions a run of the cooperative runtime executes before letting the others run
+
+#ifndef PROC_PARAM_CACHE_SIZE
+#define PROC_PARAM_CACHE_SIZE (64U)
+#endif
+
+#ifndef PROC_REMOTE_LIST_CACHE_SIZE
+#define PROC_REMOTE_LIST_CACHE_SIZE (16U)
+#endif
+
+#ifndef PROC_REMOTE_LIST_TTL_MS
+#define PROC_REMOTE_LIST_TTL_MS (0U)
+#endif  // 0 = remote parameter lists are downloaded once per session
+
 /**
  * Initialize the procedure runtime and any necessary resources.
  * This function should only be called once. Any per-procedure configuration should be done in `proc_runtime_run`.
@@ -45,6 +126,240 @@ int __attribute__((weak)) proc_runtime_init();
  */
 int __attribute__((weak)) proc_runtime_run(uint8_t proc_slot);
 
+/**
+ * Identifies a single run of a procedure.
+ */
+typedef uint32_t proc_run_handle_t;
+
+#define PROC_RUN_HANDLE_NONE (0U)
+
+/**
+ * Queue a procedure stored in a given slot for execution by the runtime's worker pool.
+ * The procedure starts immediately if a worker is idle, and otherwise waits in the run queue at PROC_RUN_PRIORITY_DEFAULT.
+ *
+ * @param proc_slot The slot of the procedure to run
+ * @param handle Populated with the handle of the run (may be NULL)
+ *
+ * @return 0 on success, -1 if the procedure was not found or the run was refused (see proc_runtime_run_priority)
+ */
+int __attribute__((weak)) proc_runtime_run_async(uint8_t proc_slot, proc_run_handle_t * handle);
+
+/**
+ * Queue a procedure stored in a given slot like proc_runtime_run_async, ahead of queued runs of lower priority.
+ * Runs of the same priority start in the order they were queued. If the run queue is full, PROC_RUN_QUEUE_OVERFLOW
+ * decides whether the new run or a queued one is dropped (dropped runs finish with a result of -1).
+ *
+ * @param proc_slot The slot of the procedure to run
+ * @param priority The priority of the run (see PROC_RUN_PRIORITY_DEFAULT)
+ * @param handle Populated with the handle of the run, or PROC_RUN_HANDLE_NONE if the runtime doesn't hand out handles (may be NULL)
+ *
+ * @return 0 on success, -1 if the procedure was not found or the run was refused
+ */
+int __attribute__((weak)) proc_runtime_run_priority(uint8_t proc_slot, uint8_t priority, proc_run_handle_t * handle);
+
+/**
+ * Get the counters of the run queue, where runs wait for a free worker.
+ *
+ * @param stats Populated with the counters
+ *
+ * @return 0 on success, -1 on failure
+ */
+int __attribute__((weak)) proc_runtime_run_queue_stats(proc_run_queue_stats_t * stats);
+
+/**
+ * Cancel a run. Queued runs are dropped, running DSL procedures stop before their next instruction
+ * (or when their current block instruction wakes up). Running reserved procedures can't be cancelled.
+ *
+ * @param handle The run to cancel
+ *
+ * @return 0 on success, -1 if the run is unknown
+ */
+int __attribute__((weak)) proc_runtime_cancel(proc_run_handle_t handle);
+
+/**
+ * Wait for a run to finish.
+ *
+ * @param handle The run to wait for
+ * @param timeout_ms The maximum time to wait
+ * @param result Populated with the return value of the procedure (may be NULL)
+ *
+ * @return 0 when the run has finished, -1 on timeout or if the run is unknown
+ */
+int __attribute__((weak)) proc_runtime_await(proc_run_handle_t handle, uint32_t timeout_ms, int * result);
+
+/**
+ * Check whether a run is still queued or running.
+ *
+ * @param handle The run to check
+ *
+ * @return 1 if the run is queued or running, 0 otherwise
+ */
+int __attribute__((weak)) proc_runtime_running(proc_run_handle_t handle);
+
+/**
+ * Run a procedure stored in a given slot every period_ms, from the runtime's scheduler instead of a self-calling procedure.
+ * A period is skipped if the previous run hasn't finished yet (where the runtime can tell, see proc_runtime_running).
+ * Scheduling a slot that already runs periodically changes its period and phase.
+ * The periodic runs stop once the procedure has been deleted from its slot.
+ *
+ * @param proc_slot The slot of the procedure to run
+ * @param period_ms The time between runs, rounded up to a multiple of PROC_TIMER_WHEEL_TICK_MS
+ * @param phase_ms The delay before the first run
+ *
+ * @return 0 on success, -1 if the procedure was not found or PROC_PERIODIC_MAX procedures already run periodically
+ */
+int __attribute__((weak)) proc_runtime_run_periodic(uint8_t proc_slot, uint32_t period_ms, uint32_t phase_ms);
+
+/**
+ * Stop the periodic runs of a procedure. A run in progress is not cancelled.
+ *
+ * @param proc_slot The slot of the procedure
+ *
+ * @return 0 on success, -1 if the procedure doesn't run periodically
+ */
+int __attribute__((weak)) proc_runtime_stop_periodic(uint8_t proc_slot);
+
+/**
+ * Run a procedure stored in a given slot at an absolute onboard time (see csp_clock_get_time).
+ * Timed runs are kept across reboots where the platform implements proc_timed_runs_save and proc_timed_runs_load,
+ * and runs due while the node was off are started when the runtime is initialized (see PROC_TIMED_RUN_MAX_LATE_MS).
+ * A run that fails to start, e.g. because the run queue is full, is kept and retried after PROC_TIMED_RUN_RETRY_MS.
+ *
+ * @param proc_slot The slot of the procedure to run
+ * @param tv_sec The time to run the procedure at, seconds part
+ * @param tv_nsec The time to run the procedure at, nanoseconds part
+ * @param id Populated with the id of the timed run, for cancelling it (may be NULL)
+ *
+ * @return 0 on success, -1 if the procedure was not found or PROC_TIMED_RUNS_MAX runs are already scheduled
+ */
+int __attribute__((weak)) proc_runtime_run_at(uint8_t proc_slot, uint32_t tv_sec, uint32_t tv_nsec, uint16_t * id);
+
+/**
+ * Cancel a timed run before it starts.
+ *
+ * @param id The id of the timed run
+ *
+ * @return 0 on success, -1 if no such run is scheduled
+ */
+int __attribute__((weak)) proc_runtime_cancel_at(uint16_t id);
+
+/**
+ * Get the scheduled timed runs in the order they will start.
+ *
+ * @param runs Array to fill
+ * @param max_runs The size of the array
+ * @param jitter Populated with how late timed runs have started, and how many starts failed (may be NULL)
+ *
+ * @return The number of runs filled in, -1 on failure
+ */
+int __attribute__((weak)) proc_runtime_timed_runs(proc_timed_run_t * runs, int max_runs, proc_timed_jitter_t * jitter);
+
+/**
+ * Save the timed runs to persistent storage, called whenever they change.
+ * A file-backed implementation is provided for POSIX, other platforms may implement it to keep timed runs across reboots.
+ *
+ * @param buf The data to save
+ * @param len The length of the data
+ * @return 0 on success, -1 on failure
+ */
+int __attribute__((weak)) proc_timed_runs_save(const void * buf, uint32_t len);
+
+/**
+ * Load the timed runs saved by proc_timed_runs_save, called when the runtime is initialized.
+ *
+ * @param buf The buffer to load into
+ * @param len The length of the data to load
+ * @return 0 on success, -1 if nothing was saved
+ */
+int __attribute__((weak)) proc_timed_runs_load(void * buf, uint32_t len);
+
+/**
+ * Link a DSL procedure against the libparam list, storing the result in `proc->link`.
+ * Operands are resolved to parameter handles and array offsets, and numeric set values are pre-parsed, so that execution
+ * doesn't have to work on operand names. Operands that cannot be resolved yet are resolved by name when executed.
+ *
+ * @param proc The procedure to link
+ *
+ * @return 0 on success, -1 on failure
+ */
+int __attribute__((weak)) proc_runtime_link(proc_t * proc);
+
+/**
+ * Drop all cached operand-to-parameter resolutions.
+ * Must be called if parameters are removed from the libparam list (e.g. param_list_remove) while the runtime is active,
+ * since cached entries hold pointers into the list. Any existing procedure links are treated as stale afterwards.
+ */
+void __attribute__((weak)) proc_runtime_param_cache_invalidate();
+
+/**
+ * Mark the downloaded parameter list of a remote node as outdated, so it is downloaded again on the next lookup.
+ * Remote lists are otherwise only re-downloaded once PROC_REMOTE_LIST_TTL_MS has passed, or once when an operand can't be found in them.
+ * Operands still not found are remembered as missing until the list is downloaded again.
+ *
+ * @param node The remote node, or -1 for all nodes
+ */
+void __attribute__((weak)) proc_runtime_remote_list_invalidate(int node);
+
+/**
+ * Notify the runtime that one or more local parameters have changed, waking any block instructions waiting on local
+ * parameters so they re-evaluate their condition. Writes made by procedures notify automatically, other writers
+ * (e.g. libparam set callbacks or application code) should call this after modifying a parameter.
+ */
+void __attribute__((weak)) proc_runtime_param_changed();
+
+struct param_s;
+
+/**
+ * libparam set callback notifying the runtime of the change (see proc_runtime_param_changed). Install it as the
+ * callback of local parameters that block instructions wait on and that are written outside of procedures, e.g.
+ * by param set requests from other nodes, or call it from an existing callback.
+ *
+ * @param param The parameter that was set
+ * @param offset The index that was set, -1 for all of an array
+ */
+void __attribute__((weak)) proc_runtime_param_callback(struct param_s * param, int offset);
+
+/**
+ * Get the number of times block instructions have polled a condition involving remote parameters since startup.
+ */
+uint32_t __attribute__((weak)) proc_runtime_block_poll_count();
+
+/**
+ * Resumable execution of a DSL procedure, for runtimes running several procedures on one thread/task.
+ */
+typedef struct proc_exec_s proc_exec_t;
+typedef struct proc_analysis_t proc_analysis_t;  // see proc_analyze.h
+
+#define PROC_EXEC_YIELD       (1)  // the run yielded, resume it after wait_ms
+#define PROC_EXEC_YIELD_LOCAL (2)  // the run waits on local parameters, resume it after wait_ms or once one changes
+
+/**
+ * Prepare the execution of a DSL procedure.
+ *
+ * @param analysis The analysis of the procedure (see proc_analysis_acquire), released by proc_exec_destroy (or here on failure)
+ * @param cooperative Whether block instructions yield (PROC_EXEC_YIELD*) instead of waiting in proc_runtime_block
+ *
+ * @return The execution, NULL on failure
+ */
+proc_exec_t * proc_exec_create(proc_analysis_t * analysis, int cooperative);
+
+/**
+ * Execute instructions of a procedure until it finishes or yields.
+ * Pre-compiled procedures and remote parameter transfers called on the way are carried out before returning.
+ *
+ * @param exec The execution
+ * @param max_instructions Number of instructions to execute before yielding
+ * @param wait_ms Populated with the time to wait before resuming, if the run yields
+ *
+ * @return 0 when the procedure has finished, PROC_EXEC_YIELD or PROC_EXEC_YIELD_LOCAL if it yielded, negative on failure
+ */
+int proc_exec_step(proc_exec_t * exec, uint32_t max_instructions, uint32_t * wait_ms);
+
+/**
+ * Free an execution, whether or not it has finished.
+ */
+void proc_exec_destroy(proc_exec_t * exec);
+
 /**
  * Used to indicate the result of an if-else instruction in an instruction handler.
  */
@@ -19,7 +19,45 @@ extern "C" {
  *	- 0b0xxx----: not end of transmission (more packets to come)
  *	- 0bx1xx----: request caused error
  *	- 0bx0xx----: request successful
- *	- remaining bits are reserved for future use
+ *	- 0bxx1x----: compact encoding (see proc_pack_compact), set on
+ *		- pull requests, to ask for a compact pull response
+ *		- push requests and pull responses carrying a procedure in the compact encoding
+ *		- all other responses of servers that understand the compact encoding, so clients know they can push with it
+ *	- 0bxxx1----: depending on the packet type
+ *		- slots response carrying a bitmap of the occupied slots rather than a list (see below)
+ *		- push request or pull response carrying a segment of a procedure larger than one packet
+ *
+ * Push requests and pull responses carry the procedure slot in the second byte, followed by the packed procedure (see proc_pack).
+ * Procedures larger than one packet are segmented: every packet is flagged segmented and carries, after the slot, a segment
+ * filled by proc_segment_fill (the segment index, the length and CRC32 of the packed procedure in the first segment, and
+ * the next bytes of the packed procedure), and only the last one has the end of transmission flag set. A push is answered
+ * once its last segment has been received, with an error if a segment was lost, out of sequence or the procedure corrupt.
+ * Segmented pushes from different connections are reassembled separately, up to PROC_PUSH_TRANSFERS at once.
+ *
+ * Slots requests with an options byte (see PROC_SLOTS_OPT_INFO) are answered with a bitmap of the occupied slots
+ * (PROC_SLOTS_BITMAP_SIZE bytes, flagged bitmap), optionally followed by a proc_slot_info_t (type, instruction count)
+ * for each occupied slot in increasing order, continued in further packets if needed.
+ * Slots requests without it, and old servers, answer with one byte per occupied slot instead, without the bitmap flag.
+ *
+ * Run requests may carry a period and a phase in milliseconds after the slot (big-endian uint32 each), to run the procedure
+ * periodically (see proc_runtime_run_periodic), or to stop its periodic runs with a period of 0. Run requests carrying a
+ * single byte after the slot run the procedure at that priority (see proc_runtime_run_priority), where the runtime supports it.
+ *
+ * Bulk requests operate on the list of slots following their first byte, over a single exchange:
+ * - bulk delete responses carry a status byte (PROC_BULK_STATUS_*) per requested slot, in the same order
+ * - bulk pull responses carry the requested procedures in order, each in one or more segments made of the slot,
+ *   a status byte (PROC_BULK_STATUS_*, PROC_BULK_SEGMENT_LAST on its last segment) and up to PROC_BULK_SEGMENT_SIZE bytes
+ *   of a segment of the packed procedure (see proc_segment_fill), and end with an empty packet with the end of transmission
+ *   flag set
+ * Several procedures are pushed over a single exchange by sending their push requests back to back on one connection.
+ *
+ * Timed requests manage runs at absolute onboard times (see proc_runtime_run_at). The second byte of requests and responses
+ * is the operation (PROC_TIMED_OP_*), followed by (all integers big-endian):
+ * - add: the slot and the time to run it at (uint32 seconds, uint32 nanoseconds), answered with the uint16 id of the run
+ * - cancel: the uint16 id of the run
+ * - list: nothing, answered with the number of runs (uint8), the last and maximum start delay of timed runs in microseconds
+ *   (uint32 each), and each run as its id (uint16), slot and time (uint32 seconds, uint32 nanoseconds), earliest first,
+ *   followed by the number of failed starts (uint32) if it fits in the packet
  */
 
 typedef enum {
@@ -34,6 +72,12 @@ typedef enum {
 	PROC_SLOTS_RESPONSE,
 	PROC_RUN_REQUEST,
 	PROC_RUN_RESPONSE,
+	PROC_BULK_DEL_REQUEST,
+	PROC_BULK_DEL_RESPONSE,
+	PROC_BULK_PULL_REQUEST,
+	PROC_BULK_PULL_RESPONSE,
+	PROC_TIMED_REQUEST,
+	PROC_TIMED_RESPONSE,
 
 } proc_packet_type_e;
 
@@ -45,6 +89,31 @@ typedef enum {
 #define PROC_FLAG_ERROR_MASK 0b01000000
 #define PROC_FLAG_ERROR      0b01000000
 
+#define PROC_FLAG_COMPACT_MASK 0b00100000
+#define PROC_FLAG_COMPACT      0b00100000
+
+#define PROC_FLAG_BITMAP_MASK 0b00010000
+#define PROC_FLAG_BITMAP      0b00010000  // slots responses only
+
+#define PROC_FLAG_SEGMENTED_MASK 0b00010000
+#define PROC_FLAG_SEGMENTED      0b00010000  // push requests and pull responses only
+
+#define PROC_SEGMENT_SIZE (CSP_BUFFER_SIZE - 2)  // bytes of a push request or pull response following the slot
+
+#define PROC_SLOTS_OPT_INFO 0b00000001  // slots request option: include the metadata of each occupied slot
+
+#define PROC_BULK_STATUS_OK     0b00000000
+#define PROC_BULK_STATUS_ERROR  0b00000001
+#define PROC_BULK_SEGMENT_LAST  0b10000000
+#define PROC_BULK_SEGMENT_SIZE  (CSP_BUFFER_SIZE - 3)  // bytes of a packed procedure carried per bulk pull response packet
+
+#define PROC_TIMED_OP_ADD    (0)
+#define PROC_TIMED_OP_CANCEL (1)
+#define PROC_TIMED_OP_LIST   (2)
+#define PROC_TIMED_LIST_HEADER_SIZE (11)  // type, operation, count, last and maximum start delay
+#define PROC_TIMED_LIST_ENTRY_SIZE  (11)  // id, slot, seconds, nanoseconds
+#define PROC_TIMED_LIST_MAX         ((CSP_BUFFER_SIZE - PROC_TIMED_LIST_HEADER_SIZE) / PROC_TIMED_LIST_ENTRY_SIZE)  // runs listed at most
+
 /**
  * Conditionally initialize sub-components of the procedure server (proc_store, proc_runtime)
  *
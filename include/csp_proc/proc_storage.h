@@ -0,0 +1,77 @@
+#ifndef CSP_PROC_STORAGE_H
+#define CSP_PROC_STORAGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * Block storage backing the persistent proc store (see src/store/proc_store_persistent.c).
+ *
+ * The storage is a region of PROC_STORE_SIZE bytes addressed from offset 0, with flash semantics:
+ * erasing sets bytes to 0xFF, and writes only ever go to erased bytes.
+ * A file-backed implementation is provided for POSIX, other platforms (e.g. a flash region on FreeRTOS) implement these functions.
+ */
+
+#ifndef PROC_STORE_SIZE
+#define PROC_STORE_SIZE (32768U)
+#endif  // split into two equally sized banks, each a multiple of PROC_STORE_ERASE_SIZE
+
+#ifndef PROC_STORE_ERASE_SIZE
+#define PROC_STORE_ERASE_SIZE (4096U)
+#endif
+
+#ifndef PROC_STORE_WRITE_ALIGN
+#define PROC_STORE_WRITE_ALIGN (4U)
+#endif  // records are padded to this (power of two) size, for flash that is programmed in words
+
+/**
+ * Initialize the storage, e.g. open the backing file.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int __attribute__((weak)) proc_storage_init();
+
+/**
+ * Read from the storage.
+ *
+ * @param offset The offset to read from
+ * @param buf The buffer to read into
+ * @param len The number of bytes to read
+ * @return 0 on success, -1 on failure
+ */
+int __attribute__((weak)) proc_storage_read(uint32_t offset, void * buf, uint32_t len);
+
+/**
+ * Write to previously erased storage.
+ *
+ * @param offset The offset to write to, a multiple of PROC_STORE_WRITE_ALIGN
+ * @param buf The data to write
+ * @param len The number of bytes to write, a multiple of PROC_STORE_WRITE_ALIGN
+ * @return 0 on success, -1 on failure
+ */
+int __attribute__((weak)) proc_storage_write(uint32_t offset, const void * buf, uint32_t len);
+
+/**
+ * Erase part of the storage.
+ *
+ * @param offset The offset to erase from, a multiple of PROC_STORE_ERASE_SIZE
+ * @param len The number of bytes to erase, a multiple of PROC_STORE_ERASE_SIZE
+ * @return 0 on success, -1 on failure
+ */
+int __attribute__((weak)) proc_storage_erase(uint32_t offset, uint32_t len);
+
+/**
+ * Make all previous writes and erases durable.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int __attribute__((weak)) proc_storage_sync();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // CSP_PROC_STORAGE_H
@@ -51,6 +51,9 @@ int __attribute__((weak)) proc_store_init();
 /**
  * Add a procedure to the procedure storage at the specified slot.
  *
+ * The store copies the proc_t itself and takes over everything it points to (instructions, strings and link).
+ * The new procedure is published atomically, runs holding a reference to a previous one keep using it.
+ *
  * @param proc The procedure to add
  * @param slot The slot to add the procedure to
  * @param overwrite If the slot is already occupied, overwrite the procedure
@@ -68,6 +71,23 @@ int __attribute__((weak)) set_proc(proc_t * proc, uint8_t slot, int overwrite);
  */
 proc_union_t __attribute__((weak)) get_proc(uint8_t slot);
 
+/**
+ * Get a reference to the procedure in a slot.
+ * DSL procedures are returned as read-only snapshots that stay valid until released, even if the slot is overwritten or deleted in the meantime.
+ *
+ * @param slot The slot to get the procedure from
+ *
+ * @return The procedure at the specified slot, which must be released with release_proc
+ */
+proc_union_t __attribute__((weak)) acquire_proc(uint8_t slot);
+
+/**
+ * Release a procedure obtained from acquire_proc. Does nothing for pre-compiled procedures.
+ *
+ * @param proc_union The procedure to release
+ */
+void __attribute__((weak)) release_proc(proc_union_t proc_union);
+
 /**
  * Get the slots of the procedures in the procedure storage with an instruction count greater than 0.
  *
@@ -75,6 +95,25 @@ proc_union_t __attribute__((weak)) get_proc(uint8_t slot);
  */
 int * __attribute__((weak)) get_proc_slots();
 
+/**
+ * Get the occupied slots of the procedure storage as a bitmap, without allocating.
+ *
+ * @param bitmap The bitmap of PROC_SLOTS_BITMAP_SIZE bytes to fill, see PROC_SLOTS_BITMAP_TEST
+ *
+ * @return 0 on success, -1 on failure
+ */
+int __attribute__((weak)) get_proc_slots_bitmap(uint8_t * bitmap);
+
+/**
+ * Get the type and instruction count of the procedure in a slot, without copying or loading it.
+ *
+ * @param slot The slot to get the metadata of
+ * @param info The metadata to fill
+ *
+ * @return 0 on success, -1 if the slot is empty
+ */
+int __attribute__((weak)) get_proc_slot_info(uint8_t slot, proc_slot_info_t * info);
+
 #ifdef __cplusplus
 }
 #endif
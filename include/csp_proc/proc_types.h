@@ -10,7 +10,7 @@ extern "C" {
 
 #ifndef MAX_INSTRUCTIONS
 #define MAX_INSTRUCTIONS 255
-#endif  // max one less than 2^8 because instruction_count would overflow back to 0 when instruction buffer is full
+#endif  // max one less than 2^8 because instruction_count would overflow back to 0 when the procedure is full
 
 #ifndef MAX_PROC_SLOT
 #define MAX_PROC_SLOT 255
@@ -20,6 +20,11 @@ extern "C" {
 #define RESERVED_PROC_SLOTS 0
 #endif
 
+// Bitmap of slots with one bit per possible slot number, independent of MAX_PROC_SLOT as it is also sent over the wire
+#define PROC_SLOTS_BITMAP_SIZE                (256 / 8)
+#define PROC_SLOTS_BITMAP_TEST(bitmap, slot)  (((bitmap)[(slot) / 8] >> ((slot) % 8)) & 1)
+#define PROC_SLOTS_BITMAP_SET(bitmap, slot)   ((bitmap)[(slot) / 8] |= (uint8_t)(1 << ((slot) % 8)))
+
 typedef enum {
 	PROC_BLOCK,
 	PROC_IFELSE,
@@ -106,10 +111,84 @@ typedef struct {
 	} instruction;
 } proc_instruction_t;
 
+struct param_s;  // libparam parameter (param_t), only referenced by pointer here
+
+/**
+ * An operand resolved against the libparam list ahead of execution.
+ */
+typedef struct {
+	struct param_s * param;  // NULL if unresolved, in which case the runtime resolves the operand by name
+	int16_t offset;          // array offset (-1 if not an array element)
+} proc_operand_link_t;
+
+#define PROC_LINK_OPERAND_A      0  // param_a (block, ifelse, binop) or param (set, unop)
+#define PROC_LINK_OPERAND_B      1  // param_b (block, ifelse, binop)
+#define PROC_LINK_OPERAND_RESULT 2  // result (unop, binop)
+
+typedef struct {
+	proc_operand_link_t operands[3];
+	uint32_t value_offset;  // offset of the pre-parsed set value from the start of this struct (0 if none)
+} proc_instruction_link_t;
+
+/**
+ * Linked form of a procedure, produced by the runtime (see proc_runtime_link).
+ * The struct, its instructions and any pre-parsed set values are stored in a single contiguous allocation of `size` bytes.
+ */
+typedef struct {
+	uint32_t size;
+	uint32_t epoch;  // parameter cache epoch at link time, the link is stale if the cache has since been invalidated
+	proc_instruction_link_t instructions[];
+} proc_link_t;
+
+/**
+ * Metadata of the procedure in an occupied slot.
+ */
+typedef struct {
+	uint8_t type;               // proc_type_t (see proc_store.h), PROC_TYPE_NONE if unknown
+	uint8_t instruction_count;  // 0 for pre-compiled procedures
+} proc_slot_info_t;
+
+/**
+ * A run of a procedure scheduled at an absolute onboard (CSP clock) time.
+ */
+typedef struct {
+	uint32_t tv_sec;
+	uint32_t tv_nsec;
+	uint16_t id;
+	uint8_t proc_slot;
+} proc_timed_run_t;
+
+/**
+ * How late timed runs have been started relative to their scheduled time.
+ */
+typedef struct {
+	uint32_t last_us;
+	uint32_t max_us;
+	uint32_t failed;  // starts that failed, including retries
+} proc_timed_jitter_t;
+
+/**
+ * Counters of the runtime's run queue, where runs wait for a free worker.
+ */
+typedef struct {
+	uint16_t depth;          // runs waiting now
+	uint16_t max_depth;      // most runs waiting at once
+	uint32_t started;        // runs that left the queue for a worker
+	uint32_t dropped;        // queued runs dropped to make room for new ones
+	uint32_t rejected;       // new runs refused because the queue was full
+	uint32_t last_wait_ms;   // time the last started run waited
+	uint32_t max_wait_ms;
+	uint32_t total_wait_ms;  // of all started runs, divide by started for the mean
+} proc_run_queue_stats_t;
+
 // Note: Using __attribute__((packed)) would be unnecessary given the manual serialization of the struct in proc_pack.c
 typedef struct {
-	proc_instruction_t instructions[MAX_INSTRUCTIONS];
+	proc_instruction_t * instructions;  // instruction_count entries, NULL if there are none
 	uint8_t instruction_count;
+	char * strings;         // arena holding the operand strings of unpacked and copied procedures, NULL if they are allocated individually
+	uint32_t strings_size;  // size of the strings arena in bytes
+	proc_link_t * link;     // optional, NULL if the procedure has not been linked
+	uint32_t refcount;      // references to a stored snapshot (see acquire_proc) or to a relinked copy (see proc_analysis_relinked_acquire)
 } proc_t;
 
 #ifdef __cplusplus
@@ -0,0 +1,61 @@
+#include <csp_proc/proc_storage.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef PROC_STORE_FILE
+#define PROC_STORE_FILE "csp_proc.store"
+#endif
+
+static int proc_storage_fd = -1;
+
+int proc_storage_init() {
+	if (proc_storage_fd >= 0) {
+		return 0;
+	}
+	proc_storage_fd = open(PROC_STORE_FILE, O_RDWR | O_CREAT, 0644);
+	if (proc_storage_fd < 0) {
+		return -1;
+	}
+
+	// A new (or short) file is extended with erased bytes
+	struct stat st;
+	int ret = (fstat(proc_storage_fd, &st) == 0) ? 0 : -1;
+	if (ret == 0 && st.st_size < PROC_STORE_SIZE) {
+		uint32_t from = st.st_size - st.st_size % PROC_STORE_ERASE_SIZE;
+		ret = proc_storage_erase(from, PROC_STORE_SIZE - from);
+	}
+	if (ret != 0) {
+		close(proc_storage_fd);  // so a later init opens the file again
+		proc_storage_fd = -1;
+	}
+	return ret;
+}
+
+int proc_storage_read(uint32_t offset, void * buf, uint32_t len) {
+	return (pread(proc_storage_fd, buf, len, offset) == (ssize_t)len) ? 0 : -1;
+}
+
+int proc_storage_write(uint32_t offset, const void * buf, uint32_t len) {
+	return (pwrite(proc_storage_fd, buf, len, offset) == (ssize_t)len) ? 0 : -1;
+}
+
+int proc_storage_erase(uint32_t offset, uint32_t len) {
+	uint8_t erased[256];
+	memset(erased, 0xFF, sizeof(erased));
+	while (len > 0) {
+		uint32_t chunk = (len < sizeof(erased)) ? len : sizeof(erased);
+		if (proc_storage_write(offset, erased, chunk) != 0) {
+			return -1;
+		}
+		offset += chunk;
+		len -= chunk;
+	}
+	return 0;
+}
+
+int proc_storage_sync() {
+	return (fsync(proc_storage_fd) == 0) ? 0 : -1;
+}
@@ -1,5 +1,6 @@
 #include <csp_proc/proc_analyze.h>
 #include <csp_proc/proc_memory.h>
+#include <csp_proc/proc_mutex.h>
 
 /**
  * Free all memory associated with a proc_analysis_t.
@@ -17,6 +18,8 @@ void free_proc_analysis(proc_analysis_t * analysis) {
 	proc_free(analysis->sub_analyses);
 	proc_free(analysis->procedure_slots);
 	proc_free(analysis->instruction_analyses);
+	proc_analysis_relinked_release(analysis->relinked);
+	release_proc(analysis->proc_union);
 	proc_free(analysis);
 }
 
@@ -74,6 +77,8 @@ int analyze_instruction(proc_t * proc, uint8_t instruction_index, proc_instructi
 
 /**
  * Run static analysis on a procedure and populate a proc_analysis_t with the results.
+ * The analysis takes over the reference to the procedure (see acquire_proc) and holds one to each called procedure,
+ * all of which are released by free_proc_analysis.
  *
  * @param procedure The procedure to analyze
  * @param analysis The proc_analysis_t to populate
@@ -90,6 +95,9 @@ int proc_analyze(proc_union_t proc_union, proc_analysis_t * analysis, proc_analy
 	analysis->procedure_slots = NULL;
 	analysis->procedure_slot_count = 0;
 
+	analysis->instruction_analyses = NULL;
+	analysis->relinked = NULL;
+
 	if (proc_union.type != PROC_TYPE_DSL) {
 		return 0;
 	}
@@ -129,7 +137,7 @@ int proc_analyze(proc_union_t proc_union, proc_analysis_t * analysis, proc_analy
 				return -1;
 			}
 
-			proc_union_t sub_proc_union = get_proc(instruction->instruction.call.procedure_slot);
+			proc_union_t sub_proc_union = acquire_proc(instruction->instruction.call.procedure_slot);
 			if (sub_proc_union.type != PROC_TYPE_DSL && sub_proc_union.type != PROC_TYPE_COMPILED) {
 				printf("Error fetching sub-procedure from procedure store\n");
 				return -1;
@@ -138,12 +146,14 @@ int proc_analyze(proc_union_t proc_union, proc_analysis_t * analysis, proc_analy
 			proc_analysis_t * sub_analysis = NULL;
 
 			if (config->analyzed_procs[instruction->instruction.call.procedure_slot] == 1) {
-				// Procedure is already in the call stack
+				// Procedure is already in the call stack, and its analysis holds a reference to it
 				sub_analysis = config->analyses[instruction->instruction.call.procedure_slot];
+				release_proc(sub_proc_union);
 			} else {
 				sub_analysis = proc_malloc(sizeof(proc_analysis_t));
 				if (sub_analysis == NULL) {
 					printf("Error allocating memory for sub_analysis\n");
+					release_proc(sub_proc_union);
 					return -1;
 				}
 
@@ -177,3 +187,156 @@ void collect_proc_slots(proc_analysis_t * analysis, uint8_t ** slots, size_t * s
 		collect_proc_slots(analysis->sub_analyses[i], slots, slot_count);
 	}
 }
+
+/**
+ * Cached analyses, one per slot. The analysis is the first member so entries can be found from the analysis pointer.
+ * Entries that are invalidated while runs still use them are freed by the last proc_analysis_release.
+ */
+typedef struct {
+	proc_analysis_t analysis;
+	uint8_t dependencies[(MAX_PROC_SLOT + 8) / 8];  // bitmap of the slots in the call graph, including the root
+	int refcount;
+	int stale;
+} proc_analysis_cache_entry_t;
+
+static proc_analysis_cache_entry_t * proc_analysis_cache[MAX_PROC_SLOT + 1];
+static proc_mutex_t * proc_analysis_cache_mutex = NULL;
+
+int proc_analysis_cache_init() {
+	if (proc_analysis_cache_mutex != NULL) {
+		return 0;
+	}
+	proc_analysis_cache_mutex = proc_mutex_create();
+	return (proc_analysis_cache_mutex != NULL) ? 0 : -1;
+}
+
+static void collect_dependencies(proc_analysis_t * analysis, uint8_t * dependencies) {
+	for (size_t i = 0; i < analysis->procedure_slot_count; i++) {
+		uint8_t slot = analysis->procedure_slots[i];
+		if (dependencies[slot / 8] & (1 << (slot % 8))) {
+			continue;  // already visited (recursive call graphs)
+		}
+		dependencies[slot / 8] |= 1 << (slot % 8);
+		collect_dependencies(analysis->sub_analyses[i], dependencies);
+	}
+}
+
+static proc_analysis_cache_entry_t * proc_analysis_cache_create(uint8_t slot) {
+	proc_union_t proc_union = acquire_proc(slot);
+	if (proc_union.type != PROC_TYPE_DSL) {
+		release_proc(proc_union);
+		return NULL;
+	}
+
+	proc_analysis_cache_entry_t * entry = proc_calloc(1, sizeof(proc_analysis_cache_entry_t));
+	proc_analysis_config_t config = {
+		.analyzed_procs = proc_calloc(MAX_PROC_SLOT + 1, sizeof(int)),
+		.analyses = proc_calloc(MAX_PROC_SLOT + 1, sizeof(proc_analysis_t *)),
+		.analyzed_proc_count = 0};
+
+	if (entry == NULL || config.analyzed_procs == NULL || config.analyses == NULL) {
+		printf("Error allocating memory for analysis\n");
+		release_proc(proc_union);
+		proc_free(entry);
+		entry = NULL;
+	} else if (proc_analyze(proc_union, &entry->analysis, &config) != 0) {
+		free_proc_analysis(&entry->analysis);
+		entry = NULL;
+	} else {
+		entry->dependencies[slot / 8] |= 1 << (slot % 8);
+		collect_dependencies(&entry->analysis, entry->dependencies);
+	}
+
+	proc_free(config.analyzed_procs);
+	proc_free(config.analyses);
+	return entry;
+}
+
+proc_analysis_t * proc_analysis_acquire(uint8_t slot) {
+	if (proc_analysis_cache_mutex == NULL || proc_mutex_take(proc_analysis_cache_mutex) != PROC_MUTEX_OK) {
+		return NULL;
+	}
+
+	proc_analysis_cache_entry_t * entry = proc_analysis_cache[slot];
+	if (entry == NULL) {
+		entry = proc_analysis_cache_create(slot);
+		proc_analysis_cache[slot] = entry;
+	}
+	if (entry != NULL) {
+		entry->refcount++;
+	}
+
+	proc_mutex_give(proc_analysis_cache_mutex);
+	return (entry != NULL) ? &entry->analysis : NULL;
+}
+
+void proc_analysis_release(proc_analysis_t * analysis) {
+	if (analysis == NULL || proc_mutex_take(proc_analysis_cache_mutex) != PROC_MUTEX_OK) {
+		return;
+	}
+
+	proc_analysis_cache_entry_t * entry = (proc_analysis_cache_entry_t *)analysis;
+	if (--entry->refcount == 0 && entry->stale) {
+		free_proc_analysis(&entry->analysis);
+	}
+
+	proc_mutex_give(proc_analysis_cache_mutex);
+}
+
+proc_t * proc_analysis_relinked_acquire(proc_analysis_t * analysis, uint32_t epoch) {
+	if (proc_analysis_cache_mutex == NULL || proc_mutex_take(proc_analysis_cache_mutex) != PROC_MUTEX_OK) {
+		return NULL;
+	}
+
+	proc_t * relinked = analysis->relinked;
+	if (relinked != NULL && relinked->link->epoch == epoch) {
+		__atomic_add_fetch(&relinked->refcount, 1, __ATOMIC_RELAXED);
+	} else {
+		relinked = NULL;
+	}
+
+	proc_mutex_give(proc_analysis_cache_mutex);
+	return relinked;
+}
+
+void proc_analysis_relinked_publish(proc_analysis_t * analysis, proc_t * relinked) {
+	if (proc_analysis_cache_mutex == NULL || proc_mutex_take(proc_analysis_cache_mutex) != PROC_MUTEX_OK) {
+		return;
+	}
+
+	// Runs still using the previous copy keep it alive until they finish
+	proc_t * previous = analysis->relinked;
+	__atomic_add_fetch(&relinked->refcount, 1, __ATOMIC_RELAXED);
+	analysis->relinked = relinked;
+
+	proc_mutex_give(proc_analysis_cache_mutex);
+	proc_analysis_relinked_release(previous);
+}
+
+void proc_analysis_relinked_release(proc_t * relinked) {
+	if (relinked != NULL && __atomic_sub_fetch(&relinked->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+		proc_free(relinked->link);
+		proc_free(relinked);
+	}
+}
+
+void proc_analysis_invalidate(uint8_t slot) {
+	if (proc_analysis_cache_mutex == NULL || proc_mutex_take(proc_analysis_cache_mutex) != PROC_MUTEX_OK) {
+		return;
+	}
+
+	for (int i = 0; i < MAX_PROC_SLOT + 1; i++) {
+		proc_analysis_cache_entry_t * entry = proc_analysis_cache[i];
+		if (entry == NULL || !(entry->dependencies[slot / 8] & (1 << (slot % 8)))) {
+			continue;
+		}
+		proc_analysis_cache[i] = NULL;
+		if (entry->refcount == 0) {
+			free_proc_analysis(&entry->analysis);
+		} else {
+			entry->stale = 1;
+		}
+	}
+
+	proc_mutex_give(proc_analysis_cache_mutex);
+}
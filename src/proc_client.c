@@ -1,4 +1,126 @@
 #include <csp_proc/proc_client.h>
+#include <csp_proc/proc_memory.h>
+#include <csp_proc/proc_mutex.h>
+
+#include <csp/arch/csp_time.h>
+#include <string.h>
+
+#ifndef PROC_CLIENT_COMPACT_HOSTS
+#define PROC_CLIENT_COMPACT_HOSTS (8)
+#endif
+
+#ifndef PROC_CLIENT_BULK_WINDOW
+#define PROC_CLIENT_BULK_WINDOW (4)
+#endif  // pushes of a bulk push sent ahead of their responses, must fit in the connection's receive queue
+
+// Most recent hosts whose responses showed they understand the compact encoding, shared by all client threads
+static int proc_compact_hosts[PROC_CLIENT_COMPACT_HOSTS];
+static int proc_compact_host_count = 0;
+static int proc_compact_host_next = 0;
+static proc_mutex_t * proc_compact_hosts_mutex = NULL;
+
+/**
+ * Lock the compact hosts, creating their mutex on first use since the client has no init function.
+ *
+ * @return 0 on success, -1 if the mutex could not be created or taken
+ */
+static int proc_compact_hosts_lock() {
+	proc_mutex_t * mutex = __atomic_load_n(&proc_compact_hosts_mutex, __ATOMIC_ACQUIRE);
+	if (mutex == NULL) {
+		proc_mutex_t * created = proc_mutex_create();
+		if (created == NULL) {
+			return -1;
+		}
+		if (__atomic_compare_exchange_n(&proc_compact_hosts_mutex, &mutex, created, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			mutex = created;
+		} else {
+			proc_mutex_destroy(created);  // created concurrently by another thread, mutex now holds it
+		}
+	}
+	return (proc_mutex_take(mutex) == PROC_MUTEX_OK) ? 0 : -1;
+}
+
+static int proc_host_is_compact_locked(int host) {
+	for (int i = 0; i < proc_compact_host_count; i++) {
+		if (proc_compact_hosts[i] == host) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int proc_host_is_compact(int host) {
+	if (proc_compact_hosts_lock() != 0) {
+		return 0;  // fall back to the plain encoding
+	}
+	int compact = proc_host_is_compact_locked(host);
+	proc_mutex_give(proc_compact_hosts_mutex);
+	return compact;
+}
+
+static void proc_host_set_compact(int host) {
+	if (proc_compact_hosts_lock() != 0) {
+		return;
+	}
+	if (!proc_host_is_compact_locked(host)) {
+		proc_compact_hosts[proc_compact_host_next] = host;
+		proc_compact_host_next = (proc_compact_host_next + 1) % PROC_CLIENT_COMPACT_HOSTS;
+		if (proc_compact_host_count < PROC_CLIENT_COMPACT_HOSTS) {
+			proc_compact_host_count++;
+		}
+	}
+	proc_mutex_give(proc_compact_hosts_mutex);
+}
+
+/**
+ * Handle a response to a request and free it.
+ *
+ * @return 1 if the response ended the transaction, with its outcome in result (-1 if the callback failed), 0 otherwise
+ */
+static int proc_transaction_handle(csp_packet_t * packet, int host, response_callback_t response_callback, void * callback_arg, int * result) {
+	int end = ((packet->data[0] & PROC_FLAG_END_MASK) == PROC_FLAG_END);
+	int error = packet->data[0] & PROC_FLAG_ERROR_MASK;
+	if ((packet->data[0] & PROC_FLAG_COMPACT_MASK) == PROC_FLAG_COMPACT) {
+		proc_host_set_compact(host);
+	}
+
+	if (response_callback != NULL && error == 0) {
+		if (response_callback(packet, callback_arg) != 0) {
+			printf("proc transaction response callback failure\n");
+			csp_buffer_free(packet);
+			*result = -1;
+			return 1;
+		}
+	}
+
+	csp_buffer_free(packet);
+
+	if (end) {
+		*result = error;
+	}
+	return end;
+}
+
+static int proc_transaction_read(csp_conn_t * conn, int host, response_callback_t response_callback, void * callback_arg, int timeout) {
+	csp_packet_t * packet;
+	int result = -1;
+	while ((packet = csp_read(conn, timeout)) != NULL) {
+		if (proc_transaction_handle(packet, host, response_callback, callback_arg, &result)) {
+			break;
+		}
+	}
+
+	return result;
+}
+
+/**
+ * Read the responses to a request until the one marked as the end of transmission, then close the connection.
+ */
+static int proc_transaction_responses(csp_conn_t * conn, int host, response_callback_t response_callback, void * callback_arg, int timeout) {
+	int result = proc_transaction_read(conn, host, response_callback, callback_arg, timeout);
+	csp_close(conn);
+	return result;
+}
 
 int proc_transaction(
 	csp_packet_t * packet,
@@ -20,122 +142,829 @@ int proc_transaction(
 		return -1;
 	}
 
-	int result = -1;
-	while ((packet = csp_read(conn, timeout)) != NULL) {
-		int end = ((packet->data[0] & PROC_FLAG_END_MASK) == PROC_FLAG_END);
-
-		if (response_callback != NULL && (packet->data[0] & PROC_FLAG_ERROR_MASK) == 0) {
-			if (response_callback(packet, callback_arg) != 0) {
-				printf("proc transaction response callback failure\n");
-				break;
-			}
-		}
-
-		csp_buffer_free(packet);
-
-		if (end) {
-			result = packet->data[0] & PROC_FLAG_ERROR_MASK;
-			break;
-		}
-	}
-
-	csp_close(conn);
-	return result;
+	return proc_transaction_responses(conn, host, response_callback, callback_arg, timeout);
 }
 
-int proc_del_request(uint8_t proc_slot, int host, int timeout) {
+/**
+ * Get a packet with a request concerning a single slot, or NULL if out of packet buffers.
+ */
+static csp_packet_t * proc_slot_request_packet(uint8_t type, uint8_t proc_slot) {
 	csp_packet_t * packet = csp_buffer_get(0);
 	if (packet == NULL)
-		return -2;
+		return NULL;
 
-	packet->data[0] = PROC_DEL_REQUEST;
+	packet->data[0] = type;
 	packet->data[0] |= PROC_FLAG_END;
+	if (type == PROC_PULL_REQUEST) {
+		packet->data[0] |= PROC_FLAG_COMPACT;
+	}
 	packet->data[1] = proc_slot;
 	packet->id.pri = CSP_PRIO_HIGH;
 	packet->length = 2;
+	return packet;
+}
+
+int proc_del_request(uint8_t proc_slot, int host, int timeout) {
+	csp_packet_t * packet = proc_slot_request_packet(PROC_DEL_REQUEST, proc_slot);
+	if (packet == NULL)
+		return -2;
 
 	return proc_transaction(packet, NULL, NULL, host, timeout);
 }
 
-int unpack_proc_callback(csp_packet_t * packet, void * arg) {
-	proc_t * procedure = (proc_t *)arg;
-	return unpack_proc_from_csp_packet(procedure, packet);
+/**
+ * Add a segment of a packed procedure, and unpack the procedure once its last segment has been added.
+ */
+static int proc_pull_segment(proc_pull_t * pull, const uint8_t * data, size_t length, int last, int compact) {
+	int ret = proc_segments_add(&pull->segments, data, length, last);
+	if (ret < 0) {
+		printf("Segment of procedure lost, out of sequence or corrupt\n");
+		proc_segments_reset(&pull->segments);
+		return -1;
+	}
+	if (ret == 0) {
+		return 0;
+	}
+	ret = compact ? proc_unpack_compact(pull->procedure, pull->segments.packed, pull->segments.total) : proc_unpack(pull->procedure, pull->segments.packed, pull->segments.total);
+	proc_segments_reset(&pull->segments);
+	return ret;
+}
+
+static int proc_pull_callback(csp_packet_t * packet, void * arg) {
+	proc_pull_t * pull = (proc_pull_t *)arg;
+	int end = ((packet->data[0] & PROC_FLAG_END_MASK) == PROC_FLAG_END);
+	int compact = ((packet->data[0] & PROC_FLAG_COMPACT_MASK) == PROC_FLAG_COMPACT);  // old servers ignore the request for it
+	if (packet->length < 2) {
+		return -1;
+	}
+	if ((packet->data[0] & PROC_FLAG_SEGMENTED_MASK) == PROC_FLAG_SEGMENTED) {
+		return proc_pull_segment(pull, packet->data + 2, packet->length - 2, end, compact);
+	}
+	if (!end || pull->segments.next_index != 0) {
+		return -1;  // only the last segment of a segmented transfer, or a whole procedure, may be unflagged
+	}
+	// The whole procedure fits in one packet
+	return compact ? proc_unpack_compact(pull->procedure, packet->data + 2, packet->length - 2) : proc_unpack(pull->procedure, packet->data + 2, packet->length - 2);
 }
 
 int proc_pull_request(proc_t * procedure, uint8_t proc_slot, int host, int timeout) {
-	csp_packet_t * packet = csp_buffer_get(0);
+	csp_packet_t * packet = proc_slot_request_packet(PROC_PULL_REQUEST, proc_slot);
 	if (packet == NULL)
 		return -2;
 
-	packet->data[0] = PROC_PULL_REQUEST;
-	packet->data[0] |= PROC_FLAG_END;
-	packet->data[1] = proc_slot;
-	packet->id.pri = CSP_PRIO_HIGH;
-	packet->length = 2;
-
-	int ret = proc_transaction(packet, unpack_proc_callback, procedure, host, timeout);
+	proc_pull_t pull = {.procedure = procedure};
+	int ret = proc_transaction(packet, proc_pull_callback, &pull, host, timeout);
+	proc_segments_reset(&pull.segments);
 	if (ret != 0) {
 		printf("Failed to unpack procedure from packet\n");
 	}
 	return ret;
 }
 
-int proc_push_request(proc_t * procedure, uint8_t proc_slot, int host, int timeout) {
+// Per slot results of a bulk delete response
+typedef struct {
+	int * results;
+	int slot_count;
+} proc_bulk_del_t;
+
+static int proc_bulk_del_callback(csp_packet_t * packet, void * arg) {
+	proc_bulk_del_t * del = (proc_bulk_del_t *)arg;
+	if (packet->length != del->slot_count + 1) {
+		return -1;
+	}
+	for (int i = 0; i < del->slot_count; i++) {
+		del->results[i] = (packet->data[i + 1] == PROC_BULK_STATUS_OK) ? 0 : -1;
+	}
+	return 0;
+}
+
+int proc_bulk_del_request(const uint8_t * slots, int slot_count, int * results, int host, int timeout) {
+	for (int i = 0; i < slot_count; i++) {
+		results[i] = -1;
+	}
+	if (slot_count < 0 || slot_count > CSP_BUFFER_SIZE - 1) {
+		printf("Too many slots for one bulk request\n");
+		return -1;
+	}
+
 	csp_packet_t * packet = csp_buffer_get(0);
 	if (packet == NULL)
 		return -2;
 
-	pack_proc_into_csp_packet(procedure, packet);
+	packet->data[0] = PROC_BULK_DEL_REQUEST;
+	packet->data[0] |= PROC_FLAG_END;
+	memcpy(packet->data + 1, slots, slot_count);
+	packet->id.pri = CSP_PRIO_HIGH;
+	packet->length = slot_count + 1;
+
+	proc_bulk_del_t del = {.results = results, .slot_count = slot_count};
+	if (proc_transaction(packet, proc_bulk_del_callback, &del, host, timeout) != 0) {
+		return -1;
+	}
+
+	int failed = 0;
+	for (int i = 0; i < slot_count; i++) {
+		failed += (results[i] != 0);
+	}
+	return failed;
+}
 
-	packet->data[0] = PROC_PUSH_REQUEST;
+// Reassembly of the procedures of a bulk pull response, in the order they were requested
+typedef struct {
+	proc_t * procedures;
+	const uint8_t * slots;
+	int * results;
+	int slot_count;
+	int index;  // procedure currently being received
+	proc_pull_t pull;
+} proc_bulk_pull_t;
+
+static int proc_bulk_pull_callback(csp_packet_t * packet, void * arg) {
+	proc_bulk_pull_t * bulk = (proc_bulk_pull_t *)arg;
+	if (packet->length == 1) {
+		return 0;  // end of transmission
+	}
+	if (packet->length < 3 || bulk->index >= bulk->slot_count || packet->data[1] != bulk->slots[bulk->index]) {
+		return -1;
+	}
+
+	int last = packet->data[2] & PROC_BULK_SEGMENT_LAST;
+	int compact = ((packet->data[0] & PROC_FLAG_COMPACT_MASK) == PROC_FLAG_COMPACT);
+	if ((packet->data[2] & ~PROC_BULK_SEGMENT_LAST) != PROC_BULK_STATUS_OK) {
+		if (!last) {
+			return -1;
+		}
+		bulk->index++;  // slot is empty or could not be packed, results[index] stays -1
+		return 0;
+	}
+
+	bulk->pull.procedure = &bulk->procedures[bulk->index];
+	if (proc_pull_segment(&bulk->pull, packet->data + 3, packet->length - 3, last, compact) != 0) {
+		return -1;
+	}
+	if (last) {
+		bulk->results[bulk->index++] = 0;
+	}
+	return 0;
+}
+
+int proc_bulk_pull_request(proc_t * procedures, const uint8_t * slots, int slot_count, int * results, int host, int timeout) {
+	for (int i = 0; i < slot_count; i++) {
+		results[i] = -1;
+	}
+	if (slot_count < 0 || slot_count > CSP_BUFFER_SIZE - 1) {
+		printf("Too many slots for one bulk request\n");
+		return -1;
+	}
+
+	csp_packet_t * packet = csp_buffer_get(0);
+	if (packet == NULL)
+		return -2;
+
+	packet->data[0] = PROC_BULK_PULL_REQUEST;
 	packet->data[0] |= PROC_FLAG_END;
-	packet->data[1] = proc_slot;
+	packet->data[0] |= PROC_FLAG_COMPACT;
+	memcpy(packet->data + 1, slots, slot_count);
 	packet->id.pri = CSP_PRIO_HIGH;
+	packet->length = slot_count + 1;
 
-	return proc_transaction(packet, NULL, NULL, host, timeout);
+	proc_bulk_pull_t bulk = {.procedures = procedures, .slots = slots, .results = results, .slot_count = slot_count};
+	int ret = proc_transaction(packet, proc_bulk_pull_callback, &bulk, host, timeout);
+	proc_segments_reset(&bulk.pull.segments);
+	if (ret != 0) {
+		return -1;
+	}
+
+	int failed = 0;
+	for (int i = 0; i < slot_count; i++) {
+		failed += (results[i] != 0);
+	}
+	return failed;
 }
 
-int process_slots_response(csp_packet_t * packet, void * arg) {
-	uint8_t * slots = ((uint8_t **)arg)[0];
-	uint8_t * slot_count = ((uint8_t **)arg)[1];
+/**
+ * Send a push request on a connection, segmented if the procedure does not fit in one packet.
+ *
+ * @return 0 on success, -1 if the procedure could not be packed, -2 if out of packet buffers
+ */
+static int proc_send_push(csp_conn_t * conn, proc_t * procedure, uint8_t proc_slot, int compact) {
+	int size = compact ? calc_proc_compact_size(procedure) : calc_proc_size(procedure);
+	uint8_t * packed = (size > 0) ? proc_malloc(size) : NULL;
+	int ret = -1;
+	if (packed != NULL) {
+		ret = compact ? proc_pack_compact(procedure, packed, size) : proc_pack(procedure, packed, size);
+	}
+	if (ret < 0) {
+		proc_free(packed);
+		return -1;
+	}
 
-	*slot_count = packet->length - 1;
-	for (int i = 0; i < *slot_count; i++) {
-		slots[i] = packet->data[1 + i];
+	// Procedures larger than one packet are segmented, the server answers once the last segment is received
+	size_t offset = 0;
+	for (uint16_t index = 0; offset < (size_t)size || index == 0; index++) {
+		csp_packet_t * packet = csp_buffer_get(0);
+		if (packet == NULL) {
+			proc_free(packed);
+			return -2;
+		}
+
+		packet->data[0] = PROC_PUSH_REQUEST;
+		if (compact) {
+			packet->data[0] |= PROC_FLAG_COMPACT;
+		}
+		packet->data[1] = proc_slot;
+		if (size <= PROC_SEGMENT_SIZE) {
+			memcpy(packet->data + 2, packed, size);
+			packet->length = size + 2;
+			offset = size;
+		} else {
+			packet->data[0] |= PROC_FLAG_SEGMENTED;
+			packet->length = proc_segment_fill(packet->data + 2, PROC_SEGMENT_SIZE, packed, size, index, &offset) + 2;
+		}
+		if (offset == (size_t)size) {
+			packet->data[0] |= PROC_FLAG_END;
+		}
+		packet->id.pri = CSP_PRIO_HIGH;
+
+		csp_send(conn, packet);
+	}
+	proc_free(packed);
+	return 0;
+}
+
+int proc_push_request(proc_t * procedure, uint8_t proc_slot, int host, int timeout) {
+	csp_conn_t * conn = csp_connect(CSP_PRIO_HIGH, host, PROC_PORT_SERVER, 0, CSP_O_CRC32);
+	if (conn == NULL) {
+		printf("proc transaction failure\n");
+		return -1;
+	}
+
+	// Only hosts known to understand the compact encoding are pushed to with it
+	int ret = proc_send_push(conn, procedure, proc_slot, proc_host_is_compact(host));
+	if (ret != 0) {
+		csp_close(conn);
+		return ret;
+	}
+
+	return proc_transaction_responses(conn, host, NULL, NULL, timeout);
+}
+
+int proc_bulk_push_request(proc_t * procedures, const uint8_t * slots, int slot_count, int * results, int host, int timeout) {
+	csp_conn_t * conn = csp_connect(CSP_PRIO_HIGH, host, PROC_PORT_SERVER, 0, CSP_O_CRC32);
+	if (conn == NULL) {
+		printf("proc transaction failure\n");
+		return -1;
+	}
+
+	// Pushes are answered in order, so up to PROC_CLIENT_BULK_WINDOW of them are sent ahead of their responses
+	int compact = proc_host_is_compact(host);
+	int answered = 0;
+	int lost = 0;  // a response went missing, those after it are not waited for
+	for (int i = 0; i < slot_count; i++) {
+		results[i] = (proc_send_push(conn, &procedures[i], slots[i], compact) == 0) ? 0 : -1;
+		for (; answered <= i && (i + 1 - answered > PROC_CLIENT_BULK_WINDOW || i == slot_count - 1); answered++) {
+			if (results[answered] != 0) {
+				continue;  // not sent, so not answered either
+			}
+			int ret = lost ? -1 : proc_transaction_read(conn, host, NULL, NULL, timeout);
+			lost = (ret == -1);
+			results[answered] = (ret == 0) ? 0 : -1;
+		}
+	}
+	csp_close(conn);
+
+	int failed = 0;
+	for (int i = 0; i < slot_count; i++) {
+		failed += (results[i] != 0);
+	}
+	return failed;
+}
+
+// Decoding of a slots response into a bitmap, and optionally the metadata of each occupied slot
+typedef struct {
+	uint8_t * bitmap;
+	proc_slot_info_t * info;  // NULL if not requested
+	int next_slot;            // slot of the next metadata entry, -1 before the first packet
+} proc_slots_response_t;
+
+static int proc_slots_callback(csp_packet_t * packet, void * arg) {
+	proc_slots_response_t * response = (proc_slots_response_t *)arg;
+	int offset = 1;
+
+	if (response->next_slot < 0) {
+		response->next_slot = 0;
+		if ((packet->data[0] & PROC_FLAG_BITMAP_MASK) != PROC_FLAG_BITMAP) {
+			// Old servers list the occupied slots, without metadata
+			memset(response->bitmap, 0, PROC_SLOTS_BITMAP_SIZE);
+			for (int i = 1; i < packet->length; i++) {
+				PROC_SLOTS_BITMAP_SET(response->bitmap, packet->data[i]);
+			}
+			return 0;
+		}
+		if (packet->length < 1 + PROC_SLOTS_BITMAP_SIZE) {
+			return -1;
+		}
+		memcpy(response->bitmap, packet->data + 1, PROC_SLOTS_BITMAP_SIZE);
+		offset += PROC_SLOTS_BITMAP_SIZE;
+	}
+
+	for (; response->info != NULL && offset + (int)sizeof(proc_slot_info_t) <= packet->length; offset += sizeof(proc_slot_info_t)) {
+		while (response->next_slot < PROC_SLOTS_BITMAP_SIZE * 8 && !PROC_SLOTS_BITMAP_TEST(response->bitmap, response->next_slot)) {
+			response->next_slot++;
+		}
+		if (response->next_slot == PROC_SLOTS_BITMAP_SIZE * 8) {
+			return -1;  // more metadata than occupied slots
+		}
+		response->info[response->next_slot].type = packet->data[offset];
+		response->info[response->next_slot].instruction_count = packet->data[offset + 1];
+		response->next_slot++;
 	}
 
 	return 0;
 }
 
-int proc_slots_request(uint8_t * slots, uint8_t * slot_count, int host, int timeout) {
+int proc_slots_info_request(uint8_t * bitmap, proc_slot_info_t * info, int host, int timeout) {
 	csp_packet_t * packet = csp_buffer_get(0);
 	if (packet == NULL)
 		return -2;
 
 	packet->data[0] = PROC_SLOTS_REQUEST;
 	packet->data[0] |= PROC_FLAG_END;
-	packet->length = 1;
+	packet->data[1] = (info != NULL) ? PROC_SLOTS_OPT_INFO : 0;
+	packet->length = 2;
 	packet->id.pri = CSP_PRIO_NORM;
 
-	void * callback_arg[] = {slots, slot_count};
-	int ret = proc_transaction(packet, process_slots_response, callback_arg, host, timeout);
+	if (info != NULL) {
+		memset(info, 0, PROC_SLOTS_BITMAP_SIZE * 8 * sizeof(proc_slot_info_t));  // PROC_TYPE_NONE: unknown
+	}
+	proc_slots_response_t response = {.bitmap = bitmap, .info = info, .next_slot = -1};
+	return proc_transaction(packet, proc_slots_callback, &response, host, timeout);
+}
+
+int proc_slots_request(uint8_t * slots, uint8_t * slot_count, int host, int timeout) {
+	uint8_t bitmap[PROC_SLOTS_BITMAP_SIZE];
+	int ret = proc_slots_info_request(bitmap, NULL, host, timeout);
 	if (ret != 0) {
 		return ret;
 	}
 
-	return ret;
+	*slot_count = 0;
+	for (int slot = 0; slot < PROC_SLOTS_BITMAP_SIZE * 8; slot++) {
+		if (PROC_SLOTS_BITMAP_TEST(bitmap, slot)) {
+			slots[(*slot_count)++] = slot;
+		}
+	}
+	return 0;
 }
 
 int proc_run_request(uint8_t proc_slot, int host, int timeout) {
-	csp_packet_t * packet = csp_buffer_get(0);
+	csp_packet_t * packet = proc_slot_request_packet(PROC_RUN_REQUEST, proc_slot);
 	if (packet == NULL)
 		return -2;
 
-	packet->data[0] = PROC_RUN_REQUEST;
+	return proc_transaction(packet, NULL, NULL, host, timeout);
+}
+
+int proc_run_priority_request(uint8_t proc_slot, uint8_t priority, int host, int timeout) {
+	csp_packet_t * packet = proc_slot_request_packet(PROC_RUN_REQUEST, proc_slot);
+	if (packet == NULL)
+		return -2;
+
+	packet->data[2] = priority;
+	packet->length = 3;
+
+	return proc_transaction(packet, NULL, NULL, host, timeout);
+}
+
+int proc_run_periodic_request(uint8_t proc_slot, uint32_t period_ms, uint32_t phase_ms, int host, int timeout) {
+	csp_packet_t * packet = proc_slot_request_packet(PROC_RUN_REQUEST, proc_slot);
+	if (packet == NULL)
+		return -2;
+
+	for (int i = 0; i < 4; i++) {
+		packet->data[2 + i] = period_ms >> (24 - 8 * i);
+		packet->data[6 + i] = phase_ms >> (24 - 8 * i);
+	}
+	packet->length = 10;
+
+	return proc_transaction(packet, NULL, NULL, host, timeout);
+}
+
+static uint32_t proc_read_u32(const uint8_t * data) {
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static void proc_write_u32(uint8_t * data, uint32_t value) {
+	data[0] = value >> 24;
+	data[1] = value >> 16;
+	data[2] = value >> 8;
+	data[3] = value;
+}
+
+static csp_packet_t * proc_timed_request_packet(uint8_t op) {
+	csp_packet_t * packet = csp_buffer_get(0);
+	if (packet == NULL)
+		return NULL;
+
+	packet->data[0] = PROC_TIMED_REQUEST;
 	packet->data[0] |= PROC_FLAG_END;
-	packet->data[1] = proc_slot;
+	packet->data[1] = op;
 	packet->id.pri = CSP_PRIO_HIGH;
 	packet->length = 2;
+	return packet;
+}
+
+static int proc_timed_add_callback(csp_packet_t * packet, void * arg) {
+	if (packet->length < 4) {
+		return -1;
+	}
+	*(uint16_t *)arg = (packet->data[2] << 8) | packet->data[3];
+	return 0;
+}
+
+int proc_timed_run_request(uint8_t proc_slot, uint32_t tv_sec, uint32_t tv_nsec, uint16_t * id, int host, int timeout) {
+	csp_packet_t * packet = proc_timed_request_packet(PROC_TIMED_OP_ADD);
+	if (packet == NULL)
+		return -2;
+
+	packet->data[2] = proc_slot;
+	proc_write_u32(packet->data + 3, tv_sec);
+	proc_write_u32(packet->data + 7, tv_nsec);
+	packet->length = 11;
+
+	uint16_t run_id = 0;
+	int ret = proc_transaction(packet, proc_timed_add_callback, &run_id, host, timeout);
+	if (ret == 0 && id != NULL) {
+		*id = run_id;
+	}
+	return ret;
+}
+
+int proc_timed_cancel_request(uint16_t id, int host, int timeout) {
+	csp_packet_t * packet = proc_timed_request_packet(PROC_TIMED_OP_CANCEL);
+	if (packet == NULL)
+		return -2;
+
+	packet->data[2] = id >> 8;
+	packet->data[3] = id;
+	packet->length = 4;
 
 	return proc_transaction(packet, NULL, NULL, host, timeout);
 }
+
+typedef struct {
+	proc_timed_run_t * runs;
+	int * count;
+	proc_timed_jitter_t * jitter;
+} proc_timed_list_t;
+
+static int proc_timed_list_callback(csp_packet_t * packet, void * arg) {
+	proc_timed_list_t * list = (proc_timed_list_t *)arg;
+	if (packet->length < PROC_TIMED_LIST_HEADER_SIZE) {
+		return -1;
+	}
+	int count = packet->data[2];
+	if (count > PROC_TIMED_LIST_MAX || packet->length < PROC_TIMED_LIST_HEADER_SIZE + count * PROC_TIMED_LIST_ENTRY_SIZE) {
+		return -1;
+	}
+
+	if (list->jitter != NULL) {
+		list->jitter->last_us = proc_read_u32(packet->data + 3);
+		list->jitter->max_us = proc_read_u32(packet->data + 7);
+	}
+	const uint8_t * entry = packet->data + PROC_TIMED_LIST_HEADER_SIZE;
+	for (int i = 0; i < count; i++, entry += PROC_TIMED_LIST_ENTRY_SIZE) {
+		list->runs[i].id = (entry[0] << 8) | entry[1];
+		list->runs[i].proc_slot = entry[2];
+		list->runs[i].tv_sec = proc_read_u32(entry + 3);
+		list->runs[i].tv_nsec = proc_read_u32(entry + 7);
+	}
+	if (list->jitter != NULL) {
+		list->jitter->failed = (packet->length >= entry - packet->data + 4) ? proc_read_u32(entry) : 0;  // unknown to old servers
+	}
+	*list->count = count;
+	return 0;
+}
+
+int proc_timed_list_request(proc_timed_run_t * runs, int * count, proc_timed_jitter_t * jitter, int host, int timeout) {
+	csp_packet_t * packet = proc_timed_request_packet(PROC_TIMED_OP_LIST);
+	if (packet == NULL)
+		return -2;
+
+	*count = 0;
+	proc_timed_list_t list = {.runs = runs, .count = count, .jitter = jitter};
+	return proc_transaction(packet, proc_timed_list_callback, &list, host, timeout);
+}
+
+int proc_session_open(proc_session_t * session, int host, int timeout) {
+	memset(session, 0, sizeof(*session));
+	session->host = host;
+	session->timeout = timeout;
+	session->conn = csp_connect(CSP_PRIO_HIGH, host, PROC_PORT_SERVER, 0, CSP_O_CRC32);
+	if (session->conn == NULL) {
+		printf("proc session failure\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int proc_session_callback(csp_packet_t * packet, void * arg) {
+	proc_session_request_t * request = (proc_session_request_t *)arg;
+	if ((packet->data[0] & PROC_TYPE_MASK) != request->response_type) {
+		printf("Unexpected proc session response\n");
+		return -1;
+	}
+	if (request->pull.procedure == NULL) {
+		return 0;
+	}
+	return proc_pull_callback(packet, &request->pull);
+}
+
+/**
+ * Read the response to the oldest pending request of a session.
+ */
+static void proc_session_read(proc_session_t * session) {
+	proc_session_request_t * request = &session->pending[session->pending_head];
+	session->pending_head = (session->pending_head + 1) % PROC_SESSION_PIPELINE;
+	session->pending_count--;
+
+	int ret = -1;
+	if (session->conn != NULL) {
+		ret = proc_transaction_read(session->conn, session->host, proc_session_callback, request, session->timeout);
+		if (ret == -1) {
+			// Lost track of the responses, the connection is reopened for the next request
+			csp_close(session->conn);
+			session->conn = NULL;
+		}
+	}
+	proc_segments_reset(&request->pull.segments);
+	if (request->result != NULL) {
+		*request->result = (ret == 0) ? 0 : -1;
+	}
+	session->failed += (ret != 0);
+}
+
+/**
+ * Reserve the next pending request of a session, reading the oldest response first if the pipeline is full.
+ *
+ * @return The pending request, or NULL if the connection could not be (re)opened
+ */
+static proc_session_request_t * proc_session_push_pending(proc_session_t * session, uint8_t response_type, int * result) {
+	if (session->pending_count == PROC_SESSION_PIPELINE) {
+		proc_session_read(session);
+	}
+	if (result != NULL) {
+		*result = -1;
+	}
+	if (session->conn == NULL) {
+		while (session->pending_count > 0) {
+			proc_session_read(session);
+		}
+		session->conn = csp_connect(CSP_PRIO_HIGH, session->host, PROC_PORT_SERVER, 0, CSP_O_CRC32);
+		if (session->conn == NULL) {
+			printf("proc session failure\n");
+			session->failed++;
+			return NULL;
+		}
+	}
+
+	int index = (session->pending_head + session->pending_count) % PROC_SESSION_PIPELINE;
+	proc_session_request_t * request = &session->pending[index];
+	memset(request, 0, sizeof(*request));
+	request->response_type = response_type;
+	request->result = result;
+	session->pending_count++;
+	return request;
+}
+
+/**
+ * Queue a request concerning a single slot on a session.
+ */
+static int proc_session_slot_request(proc_session_t * session, uint8_t type, uint8_t proc_slot, proc_t * procedure, int * result) {
+	proc_session_request_t * request = proc_session_push_pending(session, type + 1, result);
+	if (request == NULL) {
+		return -1;
+	}
+	request->pull.procedure = procedure;
+
+	csp_packet_t * packet = proc_slot_request_packet(type, proc_slot);
+	if (packet == NULL) {
+		session->pending_count--;
+		session->failed++;
+		return -2;
+	}
+	csp_send(session->conn, packet);
+	return 0;
+}
+
+int proc_session_del(proc_session_t * session, uint8_t proc_slot, int * result) {
+	return proc_session_slot_request(session, PROC_DEL_REQUEST, proc_slot, NULL, result);
+}
+
+int proc_session_pull(proc_session_t * session, proc_t * procedure, uint8_t proc_slot, int * result) {
+	return proc_session_slot_request(session, PROC_PULL_REQUEST, proc_slot, procedure, result);
+}
+
+int proc_session_run(proc_session_t * session, uint8_t proc_slot, int * result) {
+	return proc_session_slot_request(session, PROC_RUN_REQUEST, proc_slot, NULL, result);
+}
+
+int proc_session_push(proc_session_t * session, proc_t * procedure, uint8_t proc_slot, int * result) {
+	proc_session_request_t * request = proc_session_push_pending(session, PROC_PUSH_RESPONSE, result);
+	if (request == NULL) {
+		return -1;
+	}
+
+	int ret = proc_send_push(session->conn, procedure, proc_slot, proc_host_is_compact(session->host));
+	if (ret != 0) {
+		session->pending_count--;
+		session->failed++;
+		if (ret == -2) {
+			// Part of the procedure may have been sent, which the server cannot tell apart from the next request
+			while (session->pending_count > 0) {
+				proc_session_read(session);
+			}
+			csp_close(session->conn);
+			session->conn = NULL;
+		}
+	}
+	return ret;
+}
+
+int proc_session_flush(proc_session_t * session) {
+	while (session->pending_count > 0) {
+		proc_session_read(session);
+	}
+	int failed = session->failed;
+	session->failed = 0;
+	return failed;
+}
+
+int proc_session_close(proc_session_t * session) {
+	int failed = proc_session_flush(session);
+	if (session->conn != NULL) {
+		csp_close(session->conn);
+		session->conn = NULL;
+	}
+	return failed;
+}
+
+void proc_async_init(proc_async_t * async) {
+	memset(async, 0, sizeof(*async));
+}
+
+/**
+ * Finish an asynchronous request, reporting its result through its callback.
+ */
+static void proc_async_complete(proc_async_t * async, proc_async_request_t * request, int result) {
+	csp_close(request->conn);
+	request->conn = NULL;
+	proc_segments_reset(&request->pending.pull.segments);
+	async->pending--;
+	if (result != 0) {
+		result = -1;
+		async->failed++;
+	}
+	if (request->callback != NULL) {
+		request->callback(request->host, request->proc_slot, result, request->callback_arg);
+	}
+}
+
+/**
+ * Reserve a free asynchronous request and connect it to a host.
+ *
+ * @return The request, or NULL if all PROC_ASYNC_MAX requests are pending or the connection failed
+ */
+static proc_async_request_t * proc_async_start(
+	proc_async_t * async,
+	int host,
+	uint8_t proc_slot,
+	uint8_t response_type,
+	int timeout,
+	proc_async_callback_t callback,
+	void * callback_arg) {
+	proc_async_request_t * request = NULL;
+	for (int i = 0; i < PROC_ASYNC_MAX && request == NULL; i++) {
+		if (async->requests[i].conn == NULL) {
+			request = &async->requests[i];
+		}
+	}
+	if (request == NULL) {
+		printf("Too many pending proc requests\n");
+		return NULL;
+	}
+
+	memset(request, 0, sizeof(*request));
+	request->conn = csp_connect(CSP_PRIO_HIGH, host, PROC_PORT_SERVER, 0, CSP_O_CRC32);
+	if (request->conn == NULL) {
+		printf("proc transaction failure\n");
+		return NULL;
+	}
+	request->host = host;
+	request->proc_slot = proc_slot;
+	request->pending.response_type = response_type;
+	request->deadline = csp_get_ms() + timeout;
+	request->callback = callback;
+	request->callback_arg = callback_arg;
+	async->pending++;
+	return request;
+}
+
+/**
+ * Start an asynchronous request concerning a single slot.
+ */
+static int proc_async_slot_request(
+	proc_async_t * async,
+	uint8_t type,
+	int host,
+	uint8_t proc_slot,
+	proc_t * procedure,
+	int timeout,
+	proc_async_callback_t callback,
+	void * callback_arg) {
+	csp_packet_t * packet = proc_slot_request_packet(type, proc_slot);
+	if (packet == NULL)
+		return -2;
+
+	proc_async_request_t * request = proc_async_start(async, host, proc_slot, type + 1, timeout, callback, callback_arg);
+	if (request == NULL) {
+		csp_buffer_free(packet);
+		return -1;
+	}
+	request->pending.pull.procedure = procedure;
+	csp_send(request->conn, packet);
+	return 0;
+}
+
+int proc_async_del(proc_async_t * async, int host, uint8_t proc_slot, int timeout, proc_async_callback_t callback, void * callback_arg) {
+	return proc_async_slot_request(async, PROC_DEL_REQUEST, host, proc_slot, NULL, timeout, callback, callback_arg);
+}
+
+int proc_async_pull(proc_async_t * async, int host, proc_t * procedure, uint8_t proc_slot, int timeout, proc_async_callback_t callback, void * callback_arg) {
+	return proc_async_slot_request(async, PROC_PULL_REQUEST, host, proc_slot, procedure, timeout, callback, callback_arg);
+}
+
+int proc_async_run(proc_async_t * async, int host, uint8_t proc_slot, int timeout, proc_async_callback_t callback, void * callback_arg) {
+	return proc_async_slot_request(async, PROC_RUN_REQUEST, host, proc_slot, NULL, timeout, callback, callback_arg);
+}
+
+int proc_async_push(proc_async_t * async, int host, proc_t * procedure, uint8_t proc_slot, int timeout, proc_async_callback_t callback, void * callback_arg) {
+	proc_async_request_t * request = proc_async_start(async, host, proc_slot, PROC_PUSH_RESPONSE, timeout, callback, callback_arg);
+	if (request == NULL) {
+		return -1;
+	}
+
+	int ret = proc_send_push(request->conn, procedure, proc_slot, proc_host_is_compact(host));
+	if (ret != 0) {
+		// Not reported through the callback, as the caller learns of it right away
+		csp_close(request->conn);
+		request->conn = NULL;
+		async->pending--;
+	}
+	return ret;
+}
+
+int proc_async_poll(proc_async_t * async, int wait) {
+	int progress = 0;
+	proc_async_request_t * next = NULL;  // request with the earliest deadline, to wait on
+	for (int i = 0; i < PROC_ASYNC_MAX; i++) {
+		proc_async_request_t * request = &async->requests[i];
+		if (request->conn == NULL) {
+			continue;
+		}
+
+		csp_packet_t * packet;
+		int result = -1;
+		int done = 0;
+		while (!done && (packet = csp_read(request->conn, 0)) != NULL) {
+			done = proc_transaction_handle(packet, request->host, proc_session_callback, &request->pending, &result);
+			progress = 1;
+		}
+		if (done || (int32_t)(csp_get_ms() - request->deadline) >= 0) {
+			proc_async_complete(async, request, result);
+			progress = 1;
+		} else if (next == NULL || (int32_t)(request->deadline - next->deadline) < 0) {
+			next = request;
+		}
+	}
+
+	if (!progress && next != NULL && wait > 0) {
+		// Block on the request that times out first, the others are picked up by the next poll
+		int32_t remaining = (int32_t)(next->deadline - csp_get_ms());
+		csp_packet_t * packet = csp_read(next->conn, (remaining > 0 && remaining < wait) ? remaining : wait);
+		int result = -1;
+		if (packet != NULL && proc_transaction_handle(packet, next->host, proc_session_callback, &next->pending, &result)) {
+			proc_async_complete(async, next, result);
+		}
+	}
+
+	return async->pending;
+}
+
+int proc_async_wait_all(proc_async_t * async) {
+	while (proc_async_poll(async, PROC_ASYNC_POLL_INTERVAL) > 0) {
+	}
+	int failed = async->failed;
+	async->failed = 0;
+	return failed;
+}
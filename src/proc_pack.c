@@ -1,6 +1,7 @@
 #include <csp_proc/proc_pack.h>
 #include <csp_proc/proc_memory.h>
 
+#include <csp/csp_crc32.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
@@ -55,28 +56,48 @@ int calc_proc_size(proc_t * procedure) {
 	return total_size;
 }
 
-int pack_proc_into_csp_packet(proc_t * procedure, csp_packet_t * packet) {
+/**
+ * Copy a string into a procedure's string arena, advancing the arena cursor past it.
+ */
+static char * proc_arena_strcpy(char ** cursor, const char * str) {
+	size_t len = strlen(str) + 1;
+	char * copy = *cursor;
+	memcpy(copy, str, len);
+	*cursor += len;
+	return copy;
+}
+
+// Copy a string into the arena at cursor if given, or allocate it individually otherwise
+static char * proc_copy_string(char ** cursor, const char * str) {
+	return (cursor != NULL) ? proc_arena_strcpy(cursor, str) : proc_strdup(str);
+}
+
+static int proc_arena_contains(proc_t * procedure, const char * str) {
+	return procedure != NULL && procedure->strings != NULL && (uintptr_t)str >= (uintptr_t)procedure->strings && (uintptr_t)str < (uintptr_t)procedure->strings + procedure->strings_size;
+}
+
+int proc_pack(proc_t * procedure, uint8_t * buf, size_t size) {
 	int total_size = calc_proc_size(procedure);
 
-	if ((total_size + 2) > CSP_BUFFER_SIZE) {
-		return -1;  // Procedure is too large to fit into the packet
+	if (total_size < 0 || (size_t)total_size > size) {
+		return -1;  // Procedure is too large to fit into the buffer
 	}
 
-	int offset = 2;  // Skip the first byte for the packet type and flags, and the second byte for the procedure slot
+	int offset = 0;
 
 	// Pack instruction count
 	uint8_t instruction_count = (uint8_t)procedure->instruction_count;  // explicit uint8_t cast to save space in packet
-	memcpy(packet->data + offset, &instruction_count, sizeof(uint8_t));
+	memcpy(buf + offset, &instruction_count, sizeof(uint8_t));
 	offset += sizeof(uint8_t);
 
 	for (int i = 0; i < procedure->instruction_count; i++) {
 		// Pack node
-		memcpy(packet->data + offset, &(procedure->instructions[i].node), sizeof(uint16_t));
+		memcpy(buf + offset, &(procedure->instructions[i].node), sizeof(uint16_t));
 		offset += sizeof(uint16_t);
 
 		// Pack type
 		uint8_t type = (uint8_t)procedure->instructions[i].type;  // explicit uint8_t cast to save space in packet
-		memcpy(packet->data + offset, &type, sizeof(uint8_t));
+		memcpy(buf + offset, &type, sizeof(uint8_t));
 		offset += sizeof(uint8_t);
 
 		// Pack instruction
@@ -84,39 +105,39 @@ int pack_proc_into_csp_packet(proc_t * procedure, csp_packet_t * packet) {
 			// Ensure all strings are null-terminated !
 			case PROC_BLOCK:
 			case PROC_IFELSE:
-				memcpy(packet->data + offset, procedure->instructions[i].instruction.block.param_a, strlen(procedure->instructions[i].instruction.block.param_a) + 1);
+				memcpy(buf + offset, procedure->instructions[i].instruction.block.param_a, strlen(procedure->instructions[i].instruction.block.param_a) + 1);
 				offset += strlen(procedure->instructions[i].instruction.block.param_a) + 1;
-				memcpy(packet->data + offset, &(procedure->instructions[i].instruction.block.op), sizeof(comparison_op_t));
+				memcpy(buf + offset, &(procedure->instructions[i].instruction.block.op), sizeof(comparison_op_t));
 				offset += sizeof(comparison_op_t);
-				memcpy(packet->data + offset, procedure->instructions[i].instruction.block.param_b, strlen(procedure->instructions[i].instruction.block.param_b) + 1);
+				memcpy(buf + offset, procedure->instructions[i].instruction.block.param_b, strlen(procedure->instructions[i].instruction.block.param_b) + 1);
 				offset += strlen(procedure->instructions[i].instruction.block.param_b) + 1;
 				break;
 			case PROC_SET:
-				memcpy(packet->data + offset, procedure->instructions[i].instruction.set.param, strlen(procedure->instructions[i].instruction.set.param) + 1);
+				memcpy(buf + offset, procedure->instructions[i].instruction.set.param, strlen(procedure->instructions[i].instruction.set.param) + 1);
 				offset += strlen(procedure->instructions[i].instruction.set.param) + 1;
-				memcpy(packet->data + offset, procedure->instructions[i].instruction.set.value, strlen(procedure->instructions[i].instruction.set.value) + 1);
+				memcpy(buf + offset, procedure->instructions[i].instruction.set.value, strlen(procedure->instructions[i].instruction.set.value) + 1);
 				offset += strlen(procedure->instructions[i].instruction.set.value) + 1;
 				break;
 			case PROC_UNOP:
-				memcpy(packet->data + offset, procedure->instructions[i].instruction.unop.param, strlen(procedure->instructions[i].instruction.unop.param) + 1);
+				memcpy(buf + offset, procedure->instructions[i].instruction.unop.param, strlen(procedure->instructions[i].instruction.unop.param) + 1);
 				offset += strlen(procedure->instructions[i].instruction.unop.param) + 1;
-				memcpy(packet->data + offset, &(procedure->instructions[i].instruction.unop.op), sizeof(unary_op_t));
+				memcpy(buf + offset, &(procedure->instructions[i].instruction.unop.op), sizeof(unary_op_t));
 				offset += sizeof(unary_op_t);
-				memcpy(packet->data + offset, procedure->instructions[i].instruction.unop.result, strlen(procedure->instructions[i].instruction.unop.result) + 1);
+				memcpy(buf + offset, procedure->instructions[i].instruction.unop.result, strlen(procedure->instructions[i].instruction.unop.result) + 1);
 				offset += strlen(procedure->instructions[i].instruction.unop.result) + 1;
 				break;
 			case PROC_BINOP:
-				memcpy(packet->data + offset, procedure->instructions[i].instruction.binop.param_a, strlen(procedure->instructions[i].instruction.binop.param_a) + 1);
+				memcpy(buf + offset, procedure->instructions[i].instruction.binop.param_a, strlen(procedure->instructions[i].instruction.binop.param_a) + 1);
 				offset += strlen(procedure->instructions[i].instruction.binop.param_a) + 1;
-				memcpy(packet->data + offset, &(procedure->instructions[i].instruction.binop.op), sizeof(binary_op_t));
+				memcpy(buf + offset, &(procedure->instructions[i].instruction.binop.op), sizeof(binary_op_t));
 				offset += sizeof(binary_op_t);
-				memcpy(packet->data + offset, procedure->instructions[i].instruction.binop.param_b, strlen(procedure->instructions[i].instruction.binop.param_b) + 1);
+				memcpy(buf + offset, procedure->instructions[i].instruction.binop.param_b, strlen(procedure->instructions[i].instruction.binop.param_b) + 1);
 				offset += strlen(procedure->instructions[i].instruction.binop.param_b) + 1;
-				memcpy(packet->data + offset, procedure->instructions[i].instruction.binop.result, strlen(procedure->instructions[i].instruction.binop.result) + 1);
+				memcpy(buf + offset, procedure->instructions[i].instruction.binop.result, strlen(procedure->instructions[i].instruction.binop.result) + 1);
 				offset += strlen(procedure->instructions[i].instruction.binop.result) + 1;
 				break;
 			case PROC_CALL:
-				memcpy(packet->data + offset, &(procedure->instructions[i].instruction.call.procedure_slot), sizeof(uint8_t));
+				memcpy(buf + offset, &(procedure->instructions[i].instruction.call.procedure_slot), sizeof(uint8_t));
 				offset += sizeof(uint8_t);
 				break;
 			case PROC_NOOP:
@@ -127,98 +148,549 @@ int pack_proc_into_csp_packet(proc_t * procedure, csp_packet_t * packet) {
 		}
 	}
 
-	packet->length = total_size + 2;
+	return total_size;
+}
+
+int pack_proc_into_csp_packet(proc_t * procedure, csp_packet_t * packet) {
+	// Skip the first byte for the packet type and flags, and the second byte for the procedure slot
+	int size = proc_pack(procedure, packet->data + 2, CSP_BUFFER_SIZE - 2);
+	if (size < 0) {
+		return -1;
+	}
+	packet->length = size + 2;
+	return 0;
+}
 
+/**
+ * Read a fixed size field of a packed procedure, checking that it lies within the buffer.
+ */
+static int proc_unpack_field(void * field, size_t field_size, const uint8_t * buf, size_t length, size_t * offset) {
+	if (*offset + field_size > length) {
+		return -1;
+	}
+	memcpy(field, buf + *offset, field_size);
+	*offset += field_size;
 	return 0;
 }
 
-int unpack_proc_from_csp_packet(proc_t * procedure, csp_packet_t * packet) {
-	int offset = 2;  // Skip the first byte for the packet type and flags, and the second byte for the procedure slot
+/**
+ * Copy a string of a packed procedure into the strings arena, checking that it is terminated within the buffer.
+ */
+static char * proc_unpack_string(char ** cursor, const uint8_t * buf, size_t length, size_t * offset) {
+	if (*offset >= length || memchr(buf + *offset, '\0', length - *offset) == NULL) {
+		return NULL;
+	}
+	char * str = proc_arena_strcpy(cursor, (const char *)buf + *offset);
+	*offset += strlen(str) + 1;
+	return str;
+}
+
+int proc_unpack(proc_t * procedure, const uint8_t * buf, size_t length) {
+	size_t offset = 0;
+
+	procedure->instructions = NULL;
+	procedure->instruction_count = 0;
+	procedure->link = NULL;
+	procedure->strings = NULL;
+	procedure->strings_size = 0;
 
 	// Unpack instruction count
-	memcpy(&procedure->instruction_count, packet->data + offset, sizeof(uint8_t));
-	offset += sizeof(uint8_t);
+	uint8_t instruction_count;
+	if (proc_unpack_field(&instruction_count, sizeof(uint8_t), buf, length, &offset) != 0) {
+		return -1;
+	}
 
-	for (int i = 0; i < procedure->instruction_count; i++) {
-		// Unpack node
-		memcpy(&procedure->instructions[i].node, packet->data + offset, sizeof(uint16_t));
-		offset += sizeof(uint16_t);
+	// All operand strings are unpacked into a single arena, which the remainder of the buffer is an upper bound for
+	if (instruction_count > 0) {
+		if (length <= offset) {
+			return -1;
+		}
+		procedure->instructions = proc_malloc(instruction_count * sizeof(proc_instruction_t));
+		procedure->strings_size = length - offset;
+		procedure->strings = proc_malloc(procedure->strings_size);
+		if (procedure->instructions == NULL || procedure->strings == NULL) {
+			printf("Failed to allocate procedure\n");
+			return -1;
+		}
+	}
+	char * cursor = procedure->strings;
+
+	for (int i = 0; i < instruction_count; i++) {
+		proc_instruction_t * instruction = &procedure->instructions[i];
+		int ret = 0;
 
-		// Unpack type
+		// Unpack node and type
 		uint8_t type;
-		memcpy(&type, packet->data + offset, sizeof(uint8_t));
-		procedure->instructions[i].type = (int)type;
-		offset += sizeof(uint8_t);
+		ret |= proc_unpack_field(&instruction->node, sizeof(uint16_t), buf, length, &offset);
+		ret |= proc_unpack_field(&type, sizeof(uint8_t), buf, length, &offset);
+		if (ret != 0) {
+			printf("Truncated procedure\n");
+			return -1;
+		}
+		instruction->type = (int)type;
 
-		// Unpack instruction
-		switch (procedure->instructions[i].type) {
+		// Unpack instruction, operand strings are NULL if missing
+		switch (instruction->type) {
 			case PROC_BLOCK:
 			case PROC_IFELSE:
-				procedure->instructions[i].instruction.block.param_a = proc_strdup(packet->data + offset);
-				offset += strlen(packet->data + offset) + 1;
-				memcpy(&procedure->instructions[i].instruction.block.op, packet->data + offset, sizeof(comparison_op_t));
-				offset += sizeof(comparison_op_t);
-				procedure->instructions[i].instruction.block.param_b = proc_strdup(packet->data + offset);
-				offset += strlen(packet->data + offset) + 1;
+				instruction->instruction.block.param_a = proc_unpack_string(&cursor, buf, length, &offset);
+				ret |= proc_unpack_field(&instruction->instruction.block.op, sizeof(comparison_op_t), buf, length, &offset);
+				instruction->instruction.block.param_b = proc_unpack_string(&cursor, buf, length, &offset);
+				ret |= (instruction->instruction.block.param_a == NULL || instruction->instruction.block.param_b == NULL);
 				break;
 			case PROC_SET:
-				procedure->instructions[i].instruction.set.param = proc_strdup(packet->data + offset);
-				offset += strlen(packet->data + offset) + 1;
-				procedure->instructions[i].instruction.set.value = proc_strdup(packet->data + offset);
-				offset += strlen(packet->data + offset) + 1;
+				instruction->instruction.set.param = proc_unpack_string(&cursor, buf, length, &offset);
+				instruction->instruction.set.value = proc_unpack_string(&cursor, buf, length, &offset);
+				ret |= (instruction->instruction.set.param == NULL || instruction->instruction.set.value == NULL);
 				break;
 			case PROC_UNOP:
-				procedure->instructions[i].instruction.unop.param = proc_strdup(packet->data + offset);
-				offset += strlen(packet->data + offset) + 1;
-				memcpy(&procedure->instructions[i].instruction.unop.op, packet->data + offset, sizeof(unary_op_t));
-				offset += sizeof(unary_op_t);
-				procedure->instructions[i].instruction.unop.result = proc_strdup(packet->data + offset);
-				offset += strlen(packet->data + offset) + 1;
+				instruction->instruction.unop.param = proc_unpack_string(&cursor, buf, length, &offset);
+				ret |= proc_unpack_field(&instruction->instruction.unop.op, sizeof(unary_op_t), buf, length, &offset);
+				instruction->instruction.unop.result = proc_unpack_string(&cursor, buf, length, &offset);
+				ret |= (instruction->instruction.unop.param == NULL || instruction->instruction.unop.result == NULL);
 				break;
 			case PROC_BINOP:
-				procedure->instructions[i].instruction.binop.param_a = proc_strdup(packet->data + offset);
-				offset += strlen(packet->data + offset) + 1;
-				memcpy(&procedure->instructions[i].instruction.binop.op, packet->data + offset, sizeof(binary_op_t));
-				offset += sizeof(binary_op_t);
-				procedure->instructions[i].instruction.binop.param_b = proc_strdup(packet->data + offset);
-				offset += strlen(packet->data + offset) + 1;
-				procedure->instructions[i].instruction.binop.result = proc_strdup(packet->data + offset);
-				offset += strlen(packet->data + offset) + 1;
+				instruction->instruction.binop.param_a = proc_unpack_string(&cursor, buf, length, &offset);
+				ret |= proc_unpack_field(&instruction->instruction.binop.op, sizeof(binary_op_t), buf, length, &offset);
+				instruction->instruction.binop.param_b = proc_unpack_string(&cursor, buf, length, &offset);
+				instruction->instruction.binop.result = proc_unpack_string(&cursor, buf, length, &offset);
+				ret |= (instruction->instruction.binop.param_a == NULL || instruction->instruction.binop.param_b == NULL || instruction->instruction.binop.result == NULL);
 				break;
 			case PROC_CALL:
-				memcpy(&procedure->instructions[i].instruction.call.procedure_slot, packet->data + offset, sizeof(uint8_t));
-				offset += sizeof(uint8_t);
+				ret |= proc_unpack_field(&instruction->instruction.call.procedure_slot, sizeof(uint8_t), buf, length, &offset);
 				break;
 			case PROC_NOOP:
 				break;
 			default:
-				printf("Unknown instruction type %d\n", procedure->instructions[i].type);
+				printf("Unknown instruction type %d\n", instruction->type);
 				return -1;
 		}
+		procedure->instruction_count = i + 1;  // only unpacked instructions are freed, all their strings are in the arena
+		if (ret != 0) {
+			printf("Truncated procedure\n");
+			return -1;
+		}
 	}
 
 	return 0;
 }
 
-void proc_free_instruction(proc_instruction_t * instruction) {
+int unpack_proc_from_csp_packet(proc_t * procedure, csp_packet_t * packet) {
+	// Skip the first byte for the packet type and flags, and the second byte for the procedure slot
+	if (packet->length < 2) {
+		return -1;
+	}
+	return proc_unpack(procedure, packet->data + 2, packet->length - 2);
+}
+
+/*
+ * Compact encoding:
+ * - varint string count, followed by the distinct operand strings of the procedure (null-terminated)
+ * - uint8 instruction count, followed by the instructions, each made of
+ *   - uint8 type, with PROC_COMPACT_NODE set if the node differs from that of the previous instruction (0 before the first)
+ *   - varint node, if it differs
+ *   - uint8 operator (block, ifelse, unop, binop) or procedure slot (call)
+ *   - varint string table index of each operand string, in the order of the plain encoding
+ */
+
+#define PROC_COMPACT_NODE 0x80
+
+// Bounded writes into a buffer, or only counting the bytes if the buffer is NULL
+typedef struct {
+	uint8_t * buf;
+	size_t size;
+	size_t offset;
+} proc_writer_t;
+
+static int proc_write(proc_writer_t * writer, const void * data, size_t len) {
+	if (writer->buf != NULL) {
+		if (writer->offset + len > writer->size) {
+			return -1;
+		}
+		memcpy(writer->buf + writer->offset, data, len);
+	}
+	writer->offset += len;
+	return 0;
+}
+
+static int proc_write_varint(proc_writer_t * writer, uint32_t value) {
+	uint8_t byte;
+	do {
+		byte = value & 0x7F;
+		value >>= 7;
+		if (value != 0) {
+			byte |= 0x80;
+		}
+		if (proc_write(writer, &byte, sizeof(uint8_t)) != 0) {
+			return -1;
+		}
+	} while (value != 0);
+	return 0;
+}
+
+static int proc_read_varint(uint32_t * value, const uint8_t * buf, size_t length, size_t * offset) {
+	*value = 0;
+	for (int shift = 0; shift < 32; shift += 7) {
+		if (*offset >= length) {
+			return -1;
+		}
+		uint8_t byte = buf[(*offset)++];
+		*value |= (uint32_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Get pointers to the operand strings of an instruction, in the order they are packed.
+ *
+ * @return The number of operand strings, or -1 for an unknown instruction type
+ */
+static int proc_instruction_strings(proc_instruction_t * instruction, char ** strings[3]) {
+	switch (instruction->type) {
+		case PROC_BLOCK:
+		case PROC_IFELSE:
+			strings[0] = &instruction->instruction.block.param_a;
+			strings[1] = &instruction->instruction.block.param_b;
+			return 2;
+		case PROC_SET:
+			strings[0] = &instruction->instruction.set.param;
+			strings[1] = &instruction->instruction.set.value;
+			return 2;
+		case PROC_UNOP:
+			strings[0] = &instruction->instruction.unop.param;
+			strings[1] = &instruction->instruction.unop.result;
+			return 2;
+		case PROC_BINOP:
+			strings[0] = &instruction->instruction.binop.param_a;
+			strings[1] = &instruction->instruction.binop.param_b;
+			strings[2] = &instruction->instruction.binop.result;
+			return 3;
+		case PROC_CALL:
+		case PROC_NOOP:
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+// The single byte field of an instruction besides its operand strings (operator or procedure slot), NULL if it has none
+static uint8_t * proc_instruction_byte(proc_instruction_t * instruction) {
+	switch (instruction->type) {
+		case PROC_BLOCK:
+		case PROC_IFELSE:
+			return (uint8_t *)&instruction->instruction.block.op;
+		case PROC_UNOP:
+			return (uint8_t *)&instruction->instruction.unop.op;
+		case PROC_BINOP:
+			return (uint8_t *)&instruction->instruction.binop.op;
+		case PROC_CALL:
+			return &instruction->instruction.call.procedure_slot;
+		default:
+			return NULL;
+	}
+}
+
+// Index of a string in the string table, adding it if it is not there yet
+static uint32_t proc_intern(const char ** table, uint32_t * count, const char * str) {
+	for (uint32_t i = 0; i < *count; i++) {
+		if (strcmp(table[i], str) == 0) {
+			return i;
+		}
+	}
+	table[*count] = str;
+	return (*count)++;
+}
+
+static int proc_pack_compact_to(proc_t * procedure, proc_writer_t * writer) {
+	const char ** table = NULL;
+	uint32_t table_count = 0;
+	if (procedure->instruction_count > 0) {
+		table = proc_malloc(procedure->instruction_count * 3 * sizeof(char *));
+		if (table == NULL) {
+			return -1;
+		}
+	}
+
+	// Intern the operand strings
+	int ret = 0;
+	for (int i = 0; i < procedure->instruction_count && ret == 0; i++) {
+		char ** strings[3];
+		int string_count = proc_instruction_strings(&procedure->instructions[i], strings);
+		if (string_count < 0) {
+			printf("Unknown instruction type %d\n", procedure->instructions[i].type);
+			ret = -1;
+		}
+		for (int j = 0; j < string_count; j++) {
+			proc_intern(table, &table_count, *strings[j]);
+		}
+	}
+
+	ret |= proc_write_varint(writer, table_count);
+	for (uint32_t i = 0; i < table_count && ret == 0; i++) {
+		ret |= proc_write(writer, table[i], strlen(table[i]) + 1);
+	}
+
+	uint8_t instruction_count = (uint8_t)procedure->instruction_count;
+	ret |= proc_write(writer, &instruction_count, sizeof(uint8_t));
+
+	uint16_t node = 0;
+	for (int i = 0; i < procedure->instruction_count && ret == 0; i++) {
+		proc_instruction_t * instruction = &procedure->instructions[i];
+		uint8_t type = (uint8_t)instruction->type;
+		if (instruction->node != node) {
+			type |= PROC_COMPACT_NODE;
+		}
+		ret |= proc_write(writer, &type, sizeof(uint8_t));
+		if (instruction->node != node) {
+			ret |= proc_write_varint(writer, instruction->node);
+			node = instruction->node;
+		}
+
+		uint8_t * byte = proc_instruction_byte(instruction);
+		if (byte != NULL) {
+			ret |= proc_write(writer, byte, sizeof(uint8_t));
+		}
+
+		char ** strings[3];
+		int string_count = proc_instruction_strings(instruction, strings);
+		for (int j = 0; j < string_count; j++) {
+			ret |= proc_write_varint(writer, proc_intern(table, &table_count, *strings[j]));
+		}
+	}
+
+	proc_free(table);
+	return (ret == 0) ? (int)writer->offset : -1;
+}
+
+int calc_proc_compact_size(proc_t * procedure) {
+	proc_writer_t writer = {.buf = NULL};
+	return proc_pack_compact_to(procedure, &writer);
+}
+
+int proc_pack_compact(proc_t * procedure, uint8_t * buf, size_t size) {
+	proc_writer_t writer = {.buf = buf, .size = size};
+	return proc_pack_compact_to(procedure, &writer);
+}
+
+int proc_unpack_compact(proc_t * procedure, const uint8_t * buf, size_t length) {
+	size_t offset = 0;
+
+	procedure->instructions = NULL;
+	procedure->instruction_count = 0;
+	procedure->link = NULL;
+	procedure->strings = NULL;
+	procedure->strings_size = 0;
+
+	// The string table becomes the strings arena as is, shared by all instructions using a string
+	uint32_t string_count;
+	if (proc_read_varint(&string_count, buf, length, &offset) != 0 || string_count > length - offset) {
+		return -1;
+	}
+	size_t table_start = offset;
+	for (uint32_t i = 0; i < string_count; i++) {
+		const uint8_t * end = (offset < length) ? memchr(buf + offset, '\0', length - offset) : NULL;
+		if (end == NULL) {
+			printf("Truncated procedure\n");
+			return -1;
+		}
+		offset = end - buf + 1;
+	}
+
+	char ** table = NULL;
+	if (string_count > 0) {
+		table = proc_malloc(string_count * sizeof(char *));
+		procedure->strings_size = offset - table_start;
+		procedure->strings = proc_malloc(procedure->strings_size);
+		if (table == NULL || procedure->strings == NULL) {
+			printf("Failed to allocate procedure\n");
+			proc_free(table);
+			return -1;
+		}
+		memcpy(procedure->strings, buf + table_start, procedure->strings_size);
+		char * cursor = procedure->strings;
+		for (uint32_t i = 0; i < string_count; i++) {
+			table[i] = cursor;
+			cursor += strlen(cursor) + 1;
+		}
+	}
+
+	uint8_t instruction_count;
+	int ret = proc_unpack_field(&instruction_count, sizeof(uint8_t), buf, length, &offset);
+	if (ret == 0 && instruction_count > 0) {
+		procedure->instructions = proc_malloc(instruction_count * sizeof(proc_instruction_t));
+		if (procedure->instructions == NULL) {
+			printf("Failed to allocate procedure\n");
+			ret = -1;
+		}
+	}
+
+	uint16_t node = 0;
+	for (int i = 0; i < instruction_count && ret == 0; i++) {
+		proc_instruction_t * instruction = &procedure->instructions[i];
+
+		// Unpack type and node
+		uint8_t type;
+		if (proc_unpack_field(&type, sizeof(uint8_t), buf, length, &offset) != 0) {
+			ret = -1;
+			break;
+		}
+		if (type & PROC_COMPACT_NODE) {
+			uint32_t value;
+			if (proc_read_varint(&value, buf, length, &offset) != 0 || value > UINT16_MAX) {
+				ret = -1;
+				break;
+			}
+			node = value;
+		}
+		instruction->node = node;
+		instruction->type = (int)(type & ~PROC_COMPACT_NODE);
+
+		char ** strings[3];
+		int instruction_string_count = proc_instruction_strings(instruction, strings);
+		if (instruction_string_count < 0) {
+			printf("Unknown instruction type %d\n", instruction->type);
+			ret = -1;
+			break;
+		}
+
+		// Unpack operator or procedure slot, and operands (NULL if missing)
+		uint8_t * byte = proc_instruction_byte(instruction);
+		if (byte != NULL) {
+			ret |= proc_unpack_field(byte, sizeof(uint8_t), buf, length, &offset);
+		}
+		for (int j = 0; j < instruction_string_count; j++) {
+			uint32_t index;
+			if (proc_read_varint(&index, buf, length, &offset) != 0 || index >= string_count) {
+				*strings[j] = NULL;
+				ret = -1;
+			} else {
+				*strings[j] = table[index];
+			}
+		}
+		procedure->instruction_count = i + 1;  // only unpacked instructions are freed, all their strings are in the arena
+	}
+
+	proc_free(table);
+	if (ret != 0) {
+		printf("Truncated procedure\n");
+	}
+	return ret;
+}
+
+int proc_packed_instruction_count(const uint8_t * buf, size_t length, int compact) {
+	size_t offset = 0;
+	if (compact) {
+		// Skip the string table
+		uint32_t string_count;
+		if (proc_read_varint(&string_count, buf, length, &offset) != 0) {
+			return -1;
+		}
+		for (uint32_t i = 0; i < string_count; i++) {
+			const uint8_t * end = (offset < length) ? memchr(buf + offset, '\0', length - offset) : NULL;
+			if (end == NULL) {
+				return -1;
+			}
+			offset = end - buf + 1;
+		}
+	}
+	return (offset < length) ? buf[offset] : -1;
+}
+
+static void proc_write_u32(uint8_t * data, uint32_t value) {
+	data[0] = value >> 24;
+	data[1] = value >> 16;
+	data[2] = value >> 8;
+	data[3] = value;
+}
+
+static uint32_t proc_read_u32(const uint8_t * data) {
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+size_t proc_segment_fill(uint8_t * data, size_t capacity, const uint8_t * packed, size_t size, uint16_t index, size_t * offset) {
+	size_t header = PROC_SEGMENT_HEADER_SIZE;
+	data[0] = index >> 8;
+	data[1] = index;
+	if (index == 0) {
+		proc_write_u32(data + 2, size);
+		proc_write_u32(data + 6, csp_crc32_memory(packed, size));
+		header = PROC_SEGMENT_FIRST_HEADER_SIZE;
+	}
+
+	size_t chunk = (size - *offset < capacity - header) ? size - *offset : capacity - header;
+	memcpy(data + header, packed + *offset, chunk);
+	*offset += chunk;
+	return header + chunk;
+}
+
+int proc_segments_add(proc_segments_t * segments, const uint8_t * data, size_t length, int last) {
+	if (length < PROC_SEGMENT_HEADER_SIZE || ((data[0] << 8) | data[1]) != segments->next_index) {
+		return -1;  // a segment was lost or belongs to another transfer
+	}
+
+	size_t header = PROC_SEGMENT_HEADER_SIZE;
+	if (segments->next_index == 0) {
+		if (length < PROC_SEGMENT_FIRST_HEADER_SIZE) {
+			return -1;
+		}
+		segments->total = proc_read_u32(data + 2);
+		segments->crc = proc_read_u32(data + 6);
+		if (segments->total > PROC_MAX_PACKED_SIZE || (segments->packed = proc_malloc(segments->total + 1)) == NULL) {
+			return -1;
+		}
+		header = PROC_SEGMENT_FIRST_HEADER_SIZE;
+	}
+
+	size_t chunk = length - header;
+	if (chunk > segments->total - segments->length) {
+		return -1;
+	}
+	memcpy(segments->packed + segments->length, data + header, chunk);
+	segments->length += chunk;
+	segments->next_index++;
+
+	if (!last) {
+		return 0;
+	}
+	if (segments->length != segments->total || csp_crc32_memory(segments->packed, segments->total) != segments->crc) {
+		return -1;
+	}
+	return 1;
+}
+
+void proc_segments_reset(proc_segments_t * segments) {
+	proc_free(segments->packed);
+	memset(segments, 0, sizeof(*segments));
+}
+
+static void proc_free_string(proc_t * procedure, char * str) {
+	if (!proc_arena_contains(procedure, str)) {
+		proc_free(str);
+	}
+}
+
+void proc_free_instruction_in(proc_t * procedure, proc_instruction_t * instruction) {
 	switch (instruction->type) {
 		case PROC_BLOCK:
 		case PROC_IFELSE:
-			proc_free(instruction->instruction.block.param_a);
-			proc_free(instruction->instruction.block.param_b);
+			proc_free_string(procedure, instruction->instruction.block.param_a);
+			proc_free_string(procedure, instruction->instruction.block.param_b);
 			break;
 		case PROC_SET:
-			proc_free(instruction->instruction.set.param);
-			proc_free(instruction->instruction.set.value);
+			proc_free_string(procedure, instruction->instruction.set.param);
+			proc_free_string(procedure, instruction->instruction.set.value);
 			break;
 		case PROC_UNOP:
-			proc_free(instruction->instruction.unop.param);
-			proc_free(instruction->instruction.unop.result);
+			proc_free_string(procedure, instruction->instruction.unop.param);
+			proc_free_string(procedure, instruction->instruction.unop.result);
 			break;
 		case PROC_BINOP:
-			proc_free(instruction->instruction.binop.param_a);
-			proc_free(instruction->instruction.binop.param_b);
-			proc_free(instruction->instruction.binop.result);
+			proc_free_string(procedure, instruction->instruction.binop.param_a);
+			proc_free_string(procedure, instruction->instruction.binop.param_b);
+			proc_free_string(procedure, instruction->instruction.binop.result);
 			break;
 		case PROC_CALL:
 		case PROC_NOOP:
@@ -229,14 +701,21 @@ void proc_free_instruction(proc_instruction_t * instruction) {
 	}
 }
 
+void proc_free_instruction(proc_instruction_t * instruction) {
+	proc_free_instruction_in(NULL, instruction);
+}
+
 void free_proc(proc_t * procedure) {
 	for (int i = 0; i < procedure->instruction_count; i++) {
-		proc_free_instruction(&procedure->instructions[i]);
+		proc_free_instruction_in(procedure, &procedure->instructions[i]);
 	}
+	proc_free(procedure->instructions);
+	proc_free(procedure->strings);
+	proc_free(procedure->link);
 	proc_free(procedure);
 }
 
-int proc_copy_instruction(proc_instruction_t * instruction, proc_instruction_t * copy) {
+static int proc_copy_instruction_to(proc_instruction_t * instruction, proc_instruction_t * copy, char ** cursor) {
 	if (instruction == NULL || copy == NULL) {
 		printf("proc_copy_instruction: instruction or copy is NULL\n");
 		return -1;
@@ -248,23 +727,23 @@ int proc_copy_instruction(proc_instruction_t * instruction, proc_instruction_t *
 	switch (instruction->type) {
 		case PROC_BLOCK:
 		case PROC_IFELSE:
-			copy->instruction.block.param_a = proc_strdup(instruction->instruction.block.param_a);
-			copy->instruction.block.param_b = proc_strdup(instruction->instruction.block.param_b);
+			copy->instruction.block.param_a = proc_copy_string(cursor, instruction->instruction.block.param_a);
+			copy->instruction.block.param_b = proc_copy_string(cursor, instruction->instruction.block.param_b);
 			copy->instruction.block.op = instruction->instruction.block.op;
 			break;
 		case PROC_SET:
-			copy->instruction.set.param = proc_strdup(instruction->instruction.set.param);
-			copy->instruction.set.value = proc_strdup(instruction->instruction.set.value);
+			copy->instruction.set.param = proc_copy_string(cursor, instruction->instruction.set.param);
+			copy->instruction.set.value = proc_copy_string(cursor, instruction->instruction.set.value);
 			break;
 		case PROC_UNOP:
-			copy->instruction.unop.param = proc_strdup(instruction->instruction.unop.param);
-			copy->instruction.unop.result = proc_strdup(instruction->instruction.unop.result);
+			copy->instruction.unop.param = proc_copy_string(cursor, instruction->instruction.unop.param);
+			copy->instruction.unop.result = proc_copy_string(cursor, instruction->instruction.unop.result);
 			copy->instruction.unop.op = instruction->instruction.unop.op;
 			break;
 		case PROC_BINOP:
-			copy->instruction.binop.param_a = proc_strdup(instruction->instruction.binop.param_a);
-			copy->instruction.binop.param_b = proc_strdup(instruction->instruction.binop.param_b);
-			copy->instruction.binop.result = proc_strdup(instruction->instruction.binop.result);
+			copy->instruction.binop.param_a = proc_copy_string(cursor, instruction->instruction.binop.param_a);
+			copy->instruction.binop.param_b = proc_copy_string(cursor, instruction->instruction.binop.param_b);
+			copy->instruction.binop.result = proc_copy_string(cursor, instruction->instruction.binop.result);
 			copy->instruction.binop.op = instruction->instruction.binop.op;
 			break;
 		case PROC_CALL:
@@ -280,19 +759,47 @@ int proc_copy_instruction(proc_instruction_t * instruction, proc_instruction_t *
 	return 0;  // Success
 }
 
+int proc_copy_instruction(proc_instruction_t * instruction, proc_instruction_t * copy) {
+	return proc_copy_instruction_to(instruction, copy, NULL);
+}
+
 int deepcopy_proc(proc_t * original, proc_t * copy) {
 	if (original == NULL || copy == NULL) {
 		printf("deepcopy_proc: original or copy is NULL\n");
 		return -1;
 	}
 
-	copy->instruction_count = original->instruction_count;
+	// Strings are copied into a single arena, sized by the packed size of the procedure as an upper bound
+	int size = calc_proc_size(original);
+	if (size < 0) {
+		return -1;
+	}
+	copy->instruction_count = 0;
+	copy->instructions = (original->instruction_count > 0) ? proc_malloc(original->instruction_count * sizeof(proc_instruction_t)) : NULL;
+	copy->strings_size = size;
+	copy->strings = proc_malloc(size);
+	copy->link = NULL;
+	if ((original->instruction_count > 0 && copy->instructions == NULL) || copy->strings == NULL) {
+		printf("Failed to allocate procedure\n");
+		return -1;
+	}
+	char * cursor = copy->strings;
 
 	for (int i = 0; i < original->instruction_count; i++) {
-		if (proc_copy_instruction(&original->instructions[i], &copy->instructions[i]) != 0) {
+		if (proc_copy_instruction_to(&original->instructions[i], &copy->instructions[i], &cursor) != 0) {
 			printf("Failed to copy instruction %d\n", i);
 			return -1;
 		}
+		copy->instruction_count++;
+	}
+
+	if (original->link != NULL) {
+		copy->link = proc_malloc(original->link->size);
+		if (copy->link == NULL) {
+			printf("Failed to copy procedure link\n");
+			return -1;
+		}
+		memcpy(copy->link, original->link, original->link->size);
 	}
 
 	return 0;
@@ -5,8 +5,22 @@
 #include <csp_proc/proc_memory.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <csp/csp_types.h>
 #include <csp/csp.h>
+#include <csp/arch/csp_time.h>
+
+#ifndef PROC_LINK_ON_PUSH
+#define PROC_LINK_ON_PUSH (1)
+#endif
+
+#ifndef PROC_PUSH_TRANSFERS
+#define PROC_PUSH_TRANSFERS (4)
+#endif  // segmented pushes from different connections reassembled at once
+
+#ifndef PROC_PUSH_TRANSFER_TIMEOUT_MS
+#define PROC_PUSH_TRANSFER_TIMEOUT_MS (10000U)
+#endif  // a segmented push without new segments for this long can be replaced by a new one
 
 int proc_server_init() {
 	int ret = 0;
@@ -34,102 +48,237 @@ static void proc_serve_del_request(csp_packet_t * packet) {
 	uint8_t slot = packet->data[1];
 	delete_proc(slot);
 
-	packet->data[0] = PROC_DEL_RESPONSE;
+	packet->data[0] = PROC_DEL_RESPONSE | PROC_FLAG_COMPACT;
 	packet->data[0] |= PROC_FLAG_END;
 	packet->length = 1;
 
 	csp_sendto_reply(packet, packet, CSP_O_SAME);
 }
 
-static void proc_serve_pull_request(csp_packet_t * packet) {
-	uint8_t slot = packet->data[1];
+/**
+ * Reply with a packed procedure, segmented across as many packets as needed. The last segment is sent in the request packet.
+ *
+ * @return 0 on success, -1 on failure (the request packet has not been sent)
+ */
+static int proc_reply_segments(csp_packet_t * request, uint8_t type, const uint8_t * packed, size_t length) {
+	if (length <= PROC_SEGMENT_SIZE) {
+		request->data[0] = type | PROC_FLAG_END;
+		memcpy(request->data + 2, packed, length);
+		request->length = length + 2;
+		csp_sendto_reply(request, request, CSP_O_SAME);
+		return 0;
+	}
+
+	size_t offset = 0;
+	for (uint16_t index = 0;; index++) {
+		size_t header = (index == 0) ? PROC_SEGMENT_FIRST_HEADER_SIZE : PROC_SEGMENT_HEADER_SIZE;
+		int last = (length - offset <= PROC_SEGMENT_SIZE - header);
+		csp_packet_t * segment = last ? request : csp_buffer_get(0);
+		if (segment == NULL) {
+			return -1;
+		}
+		segment->data[0] = type | PROC_FLAG_SEGMENTED | (last ? PROC_FLAG_END : 0);
+		segment->data[1] = request->data[1];
+		segment->length = proc_segment_fill(segment->data + 2, PROC_SEGMENT_SIZE, packed, length, index, &offset) + 2;
+		csp_sendto_reply(request, segment, CSP_O_SAME);
+		if (last) {
+			return 0;
+		}
+	}
+}
+
+/**
+ * Pack the DSL procedure in a slot into a newly allocated buffer.
+ *
+ * @return The packed size, or -1 if the slot holds no DSL procedure or it could not be packed
+ */
+static int proc_pack_slot(uint8_t slot, int compact, uint8_t ** packed) {
+	*packed = NULL;
 	if (slot < RESERVED_PROC_SLOTS) {
 		printf("Reserved procedure requested\n");
-		packet->data[0] = PROC_PULL_RESPONSE;
-		packet->data[0] |= PROC_FLAG_END;
-		packet->data[0] |= PROC_FLAG_ERROR;
-		packet->length = 1;
-		csp_sendto_reply(packet, packet, CSP_O_SAME);
-		return;
+		return -1;
 	}
 
-	proc_union_t proc_union = get_proc(slot);
+	proc_union_t proc_union = acquire_proc(slot);  // keeps the procedure alive if the slot is overwritten while packing
 	proc_t * procedure = proc_union.proc.dsl_proc;
-	if (procedure == NULL) {
+	if (proc_union.type != PROC_TYPE_DSL) {
 		printf("Procedure not found\n");
-		packet->data[0] = PROC_PULL_RESPONSE;
-		packet->data[0] |= PROC_FLAG_END;
-		packet->data[0] |= PROC_FLAG_ERROR;
-		packet->length = 1;
-		csp_sendto_reply(packet, packet, CSP_O_SAME);
-		return;
+		release_proc(proc_union);
+		return -1;
 	}
 
-	int ret = pack_proc_into_csp_packet(procedure, packet);
+	int size = compact ? calc_proc_compact_size(procedure) : calc_proc_size(procedure);
+	*packed = (size > 0) ? proc_malloc(size) : NULL;
+	int ret = -1;
+	if (*packed != NULL) {
+		ret = compact ? proc_pack_compact(procedure, *packed, size) : proc_pack(procedure, *packed, size);
+	}
+	release_proc(proc_union);
 	if (ret < 0) {
 		printf("Failed to pack procedure to packet\n");
-		packet->data[0] = PROC_PULL_RESPONSE;
+		proc_free(*packed);
+		*packed = NULL;
+		return -1;
+	}
+	return size;
+}
+
+static void proc_serve_pull_request(csp_packet_t * packet) {
+	int compact = ((packet->data[0] & PROC_FLAG_COMPACT_MASK) == PROC_FLAG_COMPACT);
+	uint8_t * packed;
+	int size = proc_pack_slot(packet->data[1], compact, &packed);
+	if (size < 0 || proc_reply_segments(packet, PROC_PULL_RESPONSE | (compact ? PROC_FLAG_COMPACT : 0), packed, size) != 0) {
+		proc_free(packed);
+		packet->data[0] = PROC_PULL_RESPONSE | PROC_FLAG_COMPACT;
 		packet->data[0] |= PROC_FLAG_END;
 		packet->data[0] |= PROC_FLAG_ERROR;
 		packet->length = 1;
 		csp_sendto_reply(packet, packet, CSP_O_SAME);
 		return;
 	}
+	proc_free(packed);
+}
 
-	packet->data[0] = PROC_PULL_RESPONSE;
-	packet->data[0] |= PROC_FLAG_END;
+// Reassembly of a segmented push request, one per connection (source address and port)
+typedef struct {
+	int active;
+	int failed;  // segments are dropped until the last one, which is answered with an error
+	uint16_t src;
+	uint8_t sport;
+	uint8_t slot;
+	uint32_t last_ms;  // time of the latest segment
+	proc_segments_t segments;
+} proc_push_transfer_t;
 
-	csp_sendto_reply(packet, packet, CSP_O_SAME);
+static proc_push_transfer_t proc_push_transfers[PROC_PUSH_TRANSFERS];
+
+static void proc_push_transfer_reset(proc_push_transfer_t * transfer) {
+	proc_segments_reset(&transfer->segments);
+	memset(transfer, 0, sizeof(*transfer));
 }
 
-static void proc_serve_push_request(csp_packet_t * packet) {
+/**
+ * Get the transfer a segment belongs to. A first segment starts a new transfer for its connection, in place of
+ * one it abandoned, a free one, or one that has received no segment for PROC_PUSH_TRANSFER_TIMEOUT_MS.
+ *
+ * @return The transfer, or NULL if the segment continues no transfer or too many are in progress
+ */
+static proc_push_transfer_t * proc_push_transfer_get(csp_packet_t * packet) {
+	int first = packet->length >= 4 && packet->data[2] == 0 && packet->data[3] == 0;
+	uint32_t now = csp_get_ms();
+
+	proc_push_transfer_t * transfer = NULL;
+	for (int i = 0; i < PROC_PUSH_TRANSFERS && transfer == NULL; i++) {
+		if (proc_push_transfers[i].active && proc_push_transfers[i].src == packet->id.src && proc_push_transfers[i].sport == packet->id.sport) {
+			transfer = &proc_push_transfers[i];
+		}
+	}
+	for (int i = 0; i < PROC_PUSH_TRANSFERS && transfer == NULL && first; i++) {
+		if (!proc_push_transfers[i].active || now - proc_push_transfers[i].last_ms > PROC_PUSH_TRANSFER_TIMEOUT_MS) {
+			transfer = &proc_push_transfers[i];
+		}
+	}
+	if (transfer == NULL) {
+		printf("Dropping push segment, %s\n", first ? "too many segmented pushes in progress" : "no transfer in progress");
+		return NULL;
+	}
+
+	if (first) {
+		proc_push_transfer_reset(transfer);
+		transfer->active = 1;
+		transfer->src = packet->id.src;
+		transfer->sport = packet->id.sport;
+		transfer->slot = packet->data[1];
+	}
+	transfer->last_ms = now;
+	return transfer;
+}
+
+/**
+ * Unpack a pushed procedure and add it to the store.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int proc_push_store(uint8_t slot, const uint8_t * packed, size_t length, int compact) {
 	proc_t * procedure = proc_malloc(sizeof(proc_t));
 	if (procedure == NULL) {
 		printf("Failed to allocate memory for procedure\n");
-		packet->data[0] = PROC_PUSH_RESPONSE;
-		packet->data[0] |= PROC_FLAG_END;
-		packet->data[0] |= PROC_FLAG_ERROR;
-		packet->length = 1;
-		return;
+		return -1;
 	}
 
-	int ret = unpack_proc_from_csp_packet(procedure, packet);
+	int ret = compact ? proc_unpack_compact(procedure, packed, length) : proc_unpack(procedure, packed, length);
 	if (ret < 0) {
 		printf("Failed to unpack procedure from packet\n");
 		free_proc(procedure);
-		packet->data[0] = PROC_PUSH_RESPONSE;
-		packet->data[0] |= PROC_FLAG_END;
-		packet->data[0] |= PROC_FLAG_ERROR;
-		packet->length = 1;
-		csp_sendto_reply(packet, packet, CSP_O_SAME);
-		return;
+		return -1;
+	}
+
+	if (PROC_LINK_ON_PUSH && proc_runtime_link != NULL && proc_runtime_link(procedure) != 0) {
+		printf("Failed to link procedure, operands will be resolved at run time\n");
 	}
 
-	ret = set_proc(procedure, packet->data[1], 0);
+	ret = set_proc(procedure, slot, 0);
 	if (ret < 0) {
 		printf("Failed to set procedure\n");
 		free_proc(procedure);
-		packet->data[0] = PROC_PUSH_RESPONSE;
-		packet->data[0] |= PROC_FLAG_END;
-		packet->data[0] |= PROC_FLAG_ERROR;
-		packet->length = 1;
-		csp_sendto_reply(packet, packet, CSP_O_SAME);
-		return;
+		return -1;
+	}
+	proc_free(procedure);  // the store copied the procedure header and took over its instructions and strings
+	return 0;
+}
+
+static void proc_serve_push_request(csp_packet_t * packet) {
+	int end = ((packet->data[0] & PROC_FLAG_END_MASK) == PROC_FLAG_END);
+	int compact = ((packet->data[0] & PROC_FLAG_COMPACT_MASK) == PROC_FLAG_COMPACT);
+	int ret = -1;
+
+	if (packet->length < 2) {
+		printf("Malformed push request\n");
+	} else if ((packet->data[0] & PROC_FLAG_SEGMENTED_MASK) != PROC_FLAG_SEGMENTED) {
+		ret = proc_push_store(packet->data[1], packet->data + 2, packet->length - 2, compact);  // the whole procedure fits in one packet
+	} else {
+		proc_push_transfer_t * transfer = proc_push_transfer_get(packet);
+		int added = -1;
+		if (transfer != NULL && !transfer->failed) {
+			added = (transfer->slot == packet->data[1]) ? proc_segments_add(&transfer->segments, packet->data + 2, packet->length - 2, end) : -1;
+			if (added < 0) {
+				printf("Dropping segmented push to slot %d, segment lost, out of sequence or corrupt\n", transfer->slot);
+				transfer->failed = 1;
+			}
+		}
+		if (!end) {
+			csp_buffer_free(packet);  // only the last segment is answered
+			return;
+		}
+		if (added == 1) {
+			ret = proc_push_store(transfer->slot, transfer->segments.packed, transfer->segments.total, compact);
+		}
+		if (transfer != NULL) {
+			proc_push_transfer_reset(transfer);
+		}
 	}
 
-	packet->data[0] = PROC_PUSH_RESPONSE;
+	packet->data[0] = PROC_PUSH_RESPONSE | PROC_FLAG_COMPACT;
 	packet->data[0] |= PROC_FLAG_END;
+	if (ret != 0) {
+		packet->data[0] |= PROC_FLAG_ERROR;
+	}
 	packet->length = 1;
 
 	csp_sendto_reply(packet, packet, CSP_O_SAME);
 }
 
-static void proc_serve_slots_request(csp_packet_t * packet) {
+static void proc_serve_slots_list(csp_packet_t * packet) {
 	int * slots = get_proc_slots();
 
-	packet->data[0] = PROC_SLOTS_RESPONSE;
+	packet->data[0] = PROC_SLOTS_RESPONSE | PROC_FLAG_COMPACT;
 	packet->data[0] |= PROC_FLAG_END;
 	packet->length = 1;
+	if (slots == NULL) {
+		packet->data[0] |= PROC_FLAG_ERROR;
+		csp_sendto_reply(packet, packet, CSP_O_SAME);
+		return;
+	}
 
 	for (int i = 0; slots[i] != -1; i++) {
 		packet->data[i + 1] = slots[i];
@@ -140,12 +289,74 @@ static void proc_serve_slots_request(csp_packet_t * packet) {
 	csp_sendto_reply(packet, packet, CSP_O_SAME);
 }
 
+static void proc_serve_slots_request(csp_packet_t * packet) {
+	if (packet->length < 2 || get_proc_slots_bitmap == NULL) {
+		proc_serve_slots_list(packet);  // requested by an old client
+		return;
+	}
+	int with_info = (packet->data[1] & PROC_SLOTS_OPT_INFO) && get_proc_slot_info != NULL;
+
+	uint8_t bitmap[PROC_SLOTS_BITMAP_SIZE];
+	csp_packet_t * reply = NULL;
+	if (get_proc_slots_bitmap(bitmap) != 0 || (reply = csp_buffer_get(0)) == NULL) {
+		packet->data[0] = PROC_SLOTS_RESPONSE | PROC_FLAG_COMPACT | PROC_FLAG_BITMAP;
+		packet->data[0] |= PROC_FLAG_END;
+		packet->data[0] |= PROC_FLAG_ERROR;
+		packet->length = 1;
+		csp_sendto_reply(packet, packet, CSP_O_SAME);
+		return;
+	}
+
+	// Responses are built in a separate packet, the request is kept to address them and is sent last
+	memcpy(reply->data + 1, bitmap, PROC_SLOTS_BITMAP_SIZE);
+	reply->length = 1 + PROC_SLOTS_BITMAP_SIZE;
+
+	for (int slot = 0; slot < PROC_SLOTS_BITMAP_SIZE * 8 && with_info; slot++) {
+		proc_slot_info_t info = {.type = PROC_TYPE_NONE};
+		if (!PROC_SLOTS_BITMAP_TEST(bitmap, slot)) {
+			continue;
+		}
+		get_proc_slot_info(slot, &info);  // unknown if deleted in the meantime
+
+		if (reply->length + sizeof(info) > CSP_BUFFER_SIZE) {
+			csp_packet_t * next = csp_buffer_get(0);
+			if (next == NULL) {
+				break;  // the client finds the metadata incomplete
+			}
+			reply->data[0] = PROC_SLOTS_RESPONSE | PROC_FLAG_COMPACT | PROC_FLAG_BITMAP;
+			csp_sendto_reply(packet, reply, CSP_O_SAME);
+			reply = next;
+			reply->length = 1;
+		}
+		reply->data[reply->length++] = info.type;
+		reply->data[reply->length++] = info.instruction_count;
+	}
+
+	memcpy(packet->data + 1, reply->data + 1, reply->length - 1);
+	packet->data[0] = PROC_SLOTS_RESPONSE | PROC_FLAG_COMPACT | PROC_FLAG_BITMAP;
+	packet->data[0] |= PROC_FLAG_END;
+	packet->length = reply->length;
+	csp_buffer_free(reply);
+	csp_sendto_reply(packet, packet, CSP_O_SAME);
+}
+
+static uint32_t proc_read_u32(const uint8_t * data) {
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static void proc_write_u32(uint8_t * data, uint32_t value) {
+	data[0] = value >> 24;
+	data[1] = value >> 16;
+	data[2] = value >> 8;
+	data[3] = value;
+}
+
 static void proc_serve_run_request(csp_packet_t * packet) {
 	uint8_t slot = packet->data[1];
 
 	if (proc_runtime_run == NULL) {
 		printf("No csp_proc runtime available\n");
-		packet->data[0] = PROC_RUN_RESPONSE;
+		packet->data[0] = PROC_RUN_RESPONSE | PROC_FLAG_COMPACT;
 		packet->data[0] |= PROC_FLAG_END;
 		packet->data[0] |= PROC_FLAG_ERROR;
 		packet->length = 1;
@@ -153,10 +364,24 @@ static void proc_serve_run_request(csp_packet_t * packet) {
 		return;
 	}
 
-	int ret = proc_runtime_run(slot);
+	int ret;
+	if (packet->length >= 10) {
+		// Periodic variant, a period of 0 stops the periodic runs of the slot
+		uint32_t period_ms = proc_read_u32(packet->data + 2);
+		uint32_t phase_ms = proc_read_u32(packet->data + 6);
+		if (period_ms == 0) {
+			ret = (proc_runtime_stop_periodic != NULL) ? proc_runtime_stop_periodic(slot) : -1;
+		} else {
+			ret = (proc_runtime_run_periodic != NULL) ? proc_runtime_run_periodic(slot, period_ms, phase_ms) : -1;
+		}
+	} else if (packet->length == 3 && proc_runtime_run_priority != NULL) {
+		ret = proc_runtime_run_priority(slot, packet->data[2], NULL);
+	} else {
+		ret = proc_runtime_run(slot);
+	}
 	if (ret != 0) {
 		printf("Failed to run procedure\n");
-		packet->data[0] = PROC_RUN_RESPONSE;
+		packet->data[0] = PROC_RUN_RESPONSE | PROC_FLAG_COMPACT;
 		packet->data[0] |= PROC_FLAG_END;
 		packet->data[0] |= PROC_FLAG_ERROR;
 		packet->length = 1;
@@ -164,13 +389,128 @@ static void proc_serve_run_request(csp_packet_t * packet) {
 		return;
 	}
 
-	packet->data[0] = PROC_RUN_RESPONSE;
+	packet->data[0] = PROC_RUN_RESPONSE | PROC_FLAG_COMPACT;
 	packet->data[0] |= PROC_FLAG_END;
 	packet->length = 1;
 
 	csp_sendto_reply(packet, packet, CSP_O_SAME);
 }
 
+static void proc_serve_bulk_del_request(csp_packet_t * packet) {
+	// The status of each slot replaces it in the packet
+	for (int i = 1; i < packet->length; i++) {
+		uint8_t slot = packet->data[i];
+		packet->data[i] = (delete_proc(slot) == 0) ? PROC_BULK_STATUS_OK : PROC_BULK_STATUS_ERROR;
+	}
+
+	packet->data[0] = PROC_BULK_DEL_RESPONSE | PROC_FLAG_COMPACT;
+	packet->data[0] |= PROC_FLAG_END;
+
+	csp_sendto_reply(packet, packet, CSP_O_SAME);
+}
+
+/**
+ * Send the segments of one procedure of a bulk pull response, or a segment with PROC_BULK_STATUS_ERROR if packed is NULL.
+ *
+ * @return 0 on success, -1 if out of packet buffers
+ */
+static int proc_reply_bulk_segments(csp_packet_t * request, uint8_t type, uint8_t slot, const uint8_t * packed, int size) {
+	size_t offset = 0;
+	uint16_t index = 0;
+	do {
+		csp_packet_t * segment = csp_buffer_get(0);
+		if (segment == NULL) {
+			return -1;
+		}
+		segment->data[0] = type;
+		segment->data[1] = slot;
+		segment->data[2] = (packed == NULL) ? PROC_BULK_STATUS_ERROR : PROC_BULK_STATUS_OK;
+		segment->length = 3;
+		if (packed != NULL) {
+			segment->length += proc_segment_fill(segment->data + 3, PROC_BULK_SEGMENT_SIZE, packed, size, index++, &offset);
+		}
+		if (packed == NULL || offset == (size_t)size) {
+			segment->data[2] |= PROC_BULK_SEGMENT_LAST;
+		}
+		csp_sendto_reply(request, segment, CSP_O_SAME);
+	} while (packed != NULL && offset < (size_t)size);
+	return 0;
+}
+
+static void proc_serve_bulk_pull_request(csp_packet_t * packet) {
+	int compact = ((packet->data[0] & PROC_FLAG_COMPACT_MASK) == PROC_FLAG_COMPACT);
+	uint8_t type = PROC_BULK_PULL_RESPONSE | (compact ? PROC_FLAG_COMPACT : 0);
+	int ret = 0;
+
+	for (int i = 1; i < packet->length && ret == 0; i++) {
+		uint8_t * packed;
+		int size = proc_pack_slot(packet->data[i], compact, &packed);
+		ret = proc_reply_bulk_segments(packet, type, packet->data[i], packed, (size < 0) ? 0 : size);
+		proc_free(packed);
+	}
+
+	// The exchange ends with an empty packet, with the error flag if not all procedures could be sent
+	packet->data[0] = PROC_BULK_PULL_RESPONSE | PROC_FLAG_COMPACT;
+	packet->data[0] |= PROC_FLAG_END;
+	if (ret != 0) {
+		packet->data[0] |= PROC_FLAG_ERROR;
+	}
+	packet->length = 1;
+
+	csp_sendto_reply(packet, packet, CSP_O_SAME);
+}
+
+static void proc_serve_timed_request(csp_packet_t * packet) {
+	uint8_t op = (packet->length >= 2) ? packet->data[1] : 0xFF;
+	int ret = -1;
+
+	if (proc_runtime_run_at == NULL) {
+		printf("No csp_proc runtime with timed runs available\n");
+	} else if (op == PROC_TIMED_OP_ADD && packet->length >= 11) {
+		uint16_t id;
+		ret = proc_runtime_run_at(packet->data[2], proc_read_u32(packet->data + 3), proc_read_u32(packet->data + 7), &id);
+		packet->data[2] = id >> 8;
+		packet->data[3] = id;
+		packet->length = 4;
+	} else if (op == PROC_TIMED_OP_CANCEL && packet->length >= 4) {
+		ret = proc_runtime_cancel_at((packet->data[2] << 8) | packet->data[3]);
+		packet->length = 2;
+	} else if (op == PROC_TIMED_OP_LIST) {
+		proc_timed_run_t runs[PROC_TIMED_RUNS_MAX];
+		proc_timed_jitter_t jitter;
+		int count = proc_runtime_timed_runs(runs, (PROC_TIMED_LIST_MAX < PROC_TIMED_RUNS_MAX) ? PROC_TIMED_LIST_MAX : PROC_TIMED_RUNS_MAX, &jitter);
+		if (count >= 0) {
+			packet->data[2] = count;
+			proc_write_u32(packet->data + 3, jitter.last_us);
+			proc_write_u32(packet->data + 7, jitter.max_us);
+			uint8_t * entry = packet->data + PROC_TIMED_LIST_HEADER_SIZE;
+			for (int i = 0; i < count; i++, entry += PROC_TIMED_LIST_ENTRY_SIZE) {
+				entry[0] = runs[i].id >> 8;
+				entry[1] = runs[i].id;
+				entry[2] = runs[i].proc_slot;
+				proc_write_u32(entry + 3, runs[i].tv_sec);
+				proc_write_u32(entry + 7, runs[i].tv_nsec);
+			}
+			packet->length = PROC_TIMED_LIST_HEADER_SIZE + count * PROC_TIMED_LIST_ENTRY_SIZE;
+			if (packet->length + 4 <= CSP_BUFFER_SIZE) {
+				proc_write_u32(entry, jitter.failed);
+				packet->length += 4;
+			}
+			ret = 0;
+		}
+	}
+
+	packet->data[0] = PROC_TIMED_RESPONSE | PROC_FLAG_COMPACT;
+	packet->data[0] |= PROC_FLAG_END;
+	if (ret != 0) {
+		printf("Failed to handle timed run request\n");
+		packet->data[0] |= PROC_FLAG_ERROR;
+		packet->length = 2;
+	}
+
+	csp_sendto_reply(packet, packet, CSP_O_SAME);
+}
+
 void proc_serve(csp_packet_t * packet) {
 	switch (packet->data[0] & PROC_TYPE_MASK) {
 		case PROC_DEL_REQUEST:
@@ -188,6 +528,15 @@ void proc_serve(csp_packet_t * packet) {
 		case PROC_RUN_REQUEST:
 			proc_serve_run_request(packet);
 			break;
+		case PROC_BULK_DEL_REQUEST:
+			proc_serve_bulk_del_request(packet);
+			break;
+		case PROC_BULK_PULL_REQUEST:
+			proc_serve_bulk_pull_request(packet);
+			break;
+		case PROC_TIMED_REQUEST:
+			proc_serve_timed_request(packet);
+			break;
 		default:
 			printf("Unknown procedure request\n");
 			csp_buffer_free(packet);
@@ -7,6 +7,7 @@
 #include <csp/csp.h>
 
 #include <FreeRTOS.h>
+#include <queue.h>
 #include <semphr.h>
 #include <task.h>
 
@@ -18,11 +19,382 @@
 #define PROC_RUNTIME_TASK_PRIORITY (tskIDLE_PRIORITY + 2U)
 #endif
 
-// forward declaration
-int dsl_proc_exec(proc_union_t proc_union);
+#ifndef PROC_RUNTIME_STATIC_TASKS
+#define PROC_RUNTIME_STATIC_TASKS (0)
+#endif  // 1 = run procedures on MAX_PROC_CONCURRENT statically allocated tasks instead of creating a task per run
+
+// forward declarations
+int dsl_proc_exec(proc_analysis_t * analysis);
+int proc_param_cache_init();
+int proc_periodic_init();
+void proc_periodic_advance(uint32_t now_ms);
+int proc_timed_init();
+uint32_t proc_timed_service();
+int proc_run_queue_push(void * run, uint8_t priority, void ** dropped);
+void * proc_run_queue_pop();
+void proc_run_queue_get_stats(proc_run_queue_stats_t * stats);
 
 typedef struct {
-	proc_union_t * proc_union;
+	proc_union_t proc_union;
+	proc_analysis_t * analysis;  // DSL procedures only, holds a reference to the procedure snapshot
+	uint8_t proc_slot;
+	proc_run_handle_t handle;
+} proc_run_t;
+
+// Handles of the queued and running runs, PROC_RUN_HANDLE_NONE in free entries. Guarded by the runtime's run mutex.
+static proc_run_handle_t proc_live_runs[MAX_PROC_CONCURRENT + PROC_RUN_QUEUE_LENGTH];
+static proc_run_handle_t proc_last_handle = PROC_RUN_HANDLE_NONE;
+
+/**
+ * Hand out a handle to an accepted run and record it as live. Called with the run mutex held.
+ */
+static void proc_run_track(proc_run_t * run) {
+	do {
+		run->handle = ++proc_last_handle;
+	} while (run->handle == PROC_RUN_HANDLE_NONE);
+
+	for (size_t i = 0; i < MAX_PROC_CONCURRENT + PROC_RUN_QUEUE_LENGTH; i++) {
+		if (proc_live_runs[i] == PROC_RUN_HANDLE_NONE) {
+			proc_live_runs[i] = run->handle;
+			return;
+		}
+	}
+}
+
+/**
+ * Forget a run that has finished or was dropped. Called with the run mutex held.
+ */
+static void proc_run_untrack(proc_run_handle_t handle) {
+	for (size_t i = 0; i < MAX_PROC_CONCURRENT + PROC_RUN_QUEUE_LENGTH && handle != PROC_RUN_HANDLE_NONE; i++) {
+		if (proc_live_runs[i] == handle) {
+			proc_live_runs[i] = PROC_RUN_HANDLE_NONE;
+			return;
+		}
+	}
+}
+
+static int proc_run_tracked(proc_run_handle_t handle) {
+	for (size_t i = 0; i < MAX_PROC_CONCURRENT + PROC_RUN_QUEUE_LENGTH && handle != PROC_RUN_HANDLE_NONE; i++) {
+		if (proc_live_runs[i] == handle) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Advance the timer wheel of periodic runs and start due timed runs every PROC_TIMER_WHEEL_TICK_MS.
+ * Timed runs due before the next tick are waited for separately, down to the resolution of the RTOS tick.
+ */
+static void runtime_scheduler(void * pvParameters) {
+	(void)pvParameters;
+
+	TickType_t last_wake = xTaskGetTickCount();
+	const TickType_t period = (pdMS_TO_TICKS(PROC_TIMER_WHEEL_TICK_MS) > 0) ? pdMS_TO_TICKS(PROC_TIMER_WHEEL_TICK_MS) : 1;
+	while (1) {
+		vTaskDelayUntil(&last_wake, period);
+		proc_periodic_advance((uint32_t)(xTaskGetTickCount() * portTICK_PERIOD_MS));
+
+		uint32_t until_us = proc_timed_service();
+		while (until_us < (uint32_t)period * portTICK_PERIOD_MS * 1000) {
+			vTaskDelay((until_us / 1000 + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
+			until_us = proc_timed_service();
+		}
+	}
+}
+
+#if PROC_RUNTIME_STATIC_TASKS
+static StaticTask_t proc_scheduler_tcb;
+static StackType_t proc_scheduler_stack[PROC_RUNTIME_TASK_SIZE];
+#endif
+
+/**
+ * Start the task running periodic and timed procedures.
+ */
+static int proc_scheduler_start() {
+	if (proc_periodic_init() != 0 || proc_timed_init() != 0) {
+		return -1;
+	}
+#if PROC_RUNTIME_STATIC_TASKS
+	if (xTaskCreateStatic(runtime_scheduler, "RNTMSCHED", PROC_RUNTIME_TASK_SIZE, NULL, PROC_RUNTIME_TASK_PRIORITY, proc_scheduler_stack, &proc_scheduler_tcb) == NULL) {
+#else
+	if (xTaskCreate(runtime_scheduler, "RNTMSCHED", PROC_RUNTIME_TASK_SIZE, NULL, PROC_RUNTIME_TASK_PRIORITY, NULL) != pdPASS) {
+#endif
+		csp_print("Failed to create runtime scheduler\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int proc_exec_run(proc_run_t * run) {
+	int ret;
+	switch (run->proc_union.type) {
+		case PROC_TYPE_DSL:
+			ret = dsl_proc_exec(run->analysis);
+			break;
+		case PROC_TYPE_COMPILED:
+			ret = run->proc_union.proc.compiled_proc();
+			break;
+		default:
+			ret = -1;
+	}
+	// TODO: set error flag param if ret != 0
+	return ret;
+}
+
+/**
+ * Get a procedure from the store. DSL procedures are referenced through their shared analysis rather than copied.
+ */
+static int proc_run_prepare(uint8_t proc_slot, proc_run_t * run) {
+	run->proc_union = get_proc(proc_slot);
+	run->analysis = NULL;
+	run->proc_slot = proc_slot;
+	run->handle = PROC_RUN_HANDLE_NONE;
+
+	if (run->proc_union.type != PROC_TYPE_DSL && run->proc_union.type != PROC_TYPE_COMPILED) {
+		csp_print("Procedure in slot %d not found\n", proc_slot);
+		return -1;
+	}
+
+	if (run->proc_union.type == PROC_TYPE_DSL) {
+		run->analysis = proc_analysis_acquire(proc_slot);
+		if (run->analysis == NULL) {
+			csp_print("Error analyzing procedure\n");
+			return -1;
+		}
+		run->proc_union = run->analysis->proc_union;
+	}
+	return 0;
+}
+
+#if PROC_RUNTIME_STATIC_TASKS
+
+// Workers and their stacks are allocated statically, and runs wait for them in static records (free while their type
+// is PROC_TYPE_NONE), so starting a procedure doesn't touch the FreeRTOS heap (apart from analyzing DSL procedures on
+// their first run). The spare record holds a new run while the queue is full, until the overflow policy has decided
+// which run to drop.
+static StaticTask_t proc_worker_tcbs[MAX_PROC_CONCURRENT];
+static StackType_t proc_worker_stacks[MAX_PROC_CONCURRENT][PROC_RUNTIME_TASK_SIZE];
+static proc_run_t proc_queued_runs[PROC_RUN_QUEUE_LENGTH + 1];
+static StaticSemaphore_t proc_run_queue_mutex_buffer;
+static SemaphoreHandle_t proc_run_queue_mutex = NULL;
+static StaticSemaphore_t proc_run_queued_buffer;
+static SemaphoreHandle_t proc_run_queued = NULL;  // counts the queued runs
+static TaskHandle_t proc_worker_tasks[MAX_PROC_CONCURRENT];
+static proc_run_handle_t proc_worker_runs[MAX_PROC_CONCURRENT];  // run executed by each worker, guarded by the run mutex
+static volatile int proc_worker_cancel[MAX_PROC_CONCURRENT];  // cancel requested for the run executed by each worker
+
+/**
+ * Find the worker index of a task, -1 if it isn't a runtime worker.
+ */
+static int proc_worker_index(TaskHandle_t task_handle) {
+	for (size_t i = 0; i < MAX_PROC_CONCURRENT; i++) {
+		if (proc_worker_tasks[i] == task_handle) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Check whether the run executed by the calling worker has been cancelled.
+ * Checked by the interpreter between instructions and while blocking.
+ */
+int proc_runtime_cancelled() {
+	int worker = proc_worker_index(xTaskGetCurrentTaskHandle());
+	return worker >= 0 && proc_worker_cancel[worker];
+}
+
+static void runtime_worker(void * pvParameters) {
+	size_t worker = (size_t)pvParameters;
+
+	proc_run_t run;
+	while (1) {
+		if (xSemaphoreTake(proc_run_queued, portMAX_DELAY) != pdTRUE || xSemaphoreTake(proc_run_queue_mutex, portMAX_DELAY) != pdTRUE) {
+			continue;
+		}
+		proc_run_t * queued = proc_run_queue_pop();
+		if (queued != NULL) {
+			run = *queued;
+			queued->proc_union.type = PROC_TYPE_NONE;
+			proc_worker_runs[worker] = run.handle;
+			proc_worker_cancel[worker] = 0;
+		}
+		xSemaphoreGive(proc_run_queue_mutex);
+		if (queued == NULL) {
+			continue;
+		}
+
+		proc_exec_run(&run);
+
+		// Procedure finished (dsl_proc_exec releases the analysis)
+		if (xSemaphoreTake(proc_run_queue_mutex, portMAX_DELAY) == pdTRUE) {
+			proc_run_untrack(run.handle);
+			proc_worker_runs[worker] = PROC_RUN_HANDLE_NONE;
+			xSemaphoreGive(proc_run_queue_mutex);
+		}
+		csp_print("Procedure finished (%s)\n", pcTaskGetName(NULL));
+	}
+}
+
+int proc_runtime_init() {
+	proc_run_queue_mutex = xSemaphoreCreateMutexStatic(&proc_run_queue_mutex_buffer);
+	proc_run_queued = xSemaphoreCreateCountingStatic(PROC_RUN_QUEUE_LENGTH, 0, &proc_run_queued_buffer);
+	if (proc_run_queue_mutex == NULL || proc_run_queued == NULL) {
+		return -1;
+	}
+	if (proc_param_cache_init() != 0 || proc_analysis_cache_init() != 0 || proc_scheduler_start() != 0) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < MAX_PROC_CONCURRENT; i++) {
+		char task_name[configMAX_TASK_NAME_LEN];
+		snprintf(task_name, sizeof(task_name), "RNTM%d", (int)i);
+		proc_worker_tasks[i] = xTaskCreateStatic(runtime_worker, task_name, PROC_RUNTIME_TASK_SIZE, (void *)i, PROC_RUNTIME_TASK_PRIORITY, proc_worker_stacks[i], &proc_worker_tcbs[i]);
+		if (proc_worker_tasks[i] == NULL) {
+			csp_print("Failed to create runtime worker\n");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int proc_runtime_run_priority(uint8_t proc_slot, uint8_t priority, proc_run_handle_t * handle) {
+	csp_print("Running procedure %d\n", proc_slot);
+	if (handle != NULL) {
+		*handle = PROC_RUN_HANDLE_NONE;
+	}
+
+	proc_run_t run;
+	if (proc_run_prepare(proc_slot, &run) != 0) {
+		return -1;
+	}
+
+	if (xSemaphoreTake(proc_run_queue_mutex, portMAX_DELAY) != pdTRUE) {
+		proc_analysis_release(run.analysis);
+		return -1;
+	}
+	proc_run_t * record = NULL;
+	for (size_t i = 0; i < PROC_RUN_QUEUE_LENGTH + 1 && record == NULL; i++) {
+		if (proc_queued_runs[i].proc_union.type == PROC_TYPE_NONE) {
+			record = &proc_queued_runs[i];  // there is always one, see proc_queued_runs
+		}
+	}
+	proc_run_t * dropped;
+	if (proc_run_queue_push(record, priority, (void **)&dropped) != 0) {
+		xSemaphoreGive(proc_run_queue_mutex);
+		csp_print("Maximum number of pending procedures reached\n");
+		proc_analysis_release(run.analysis);
+		return -1;
+	}
+	*record = run;
+	if (dropped != NULL) {
+		// The new run takes the dropped run's place in the queue, so the count of queued runs stays the same
+		csp_print("Dropping pending run of procedure %d to make room\n", dropped->proc_slot);
+		proc_run_untrack(dropped->handle);
+		proc_analysis_release(dropped->analysis);
+		dropped->proc_union.type = PROC_TYPE_NONE;
+	} else {
+		xSemaphoreGive(proc_run_queued);
+	}
+	proc_run_track(record);
+	if (handle != NULL) {
+		*handle = record->handle;  // read before a worker can take the record
+	}
+	xSemaphoreGive(proc_run_queue_mutex);
+
+	return 0;
+}
+
+int proc_runtime_run_queue_stats(proc_run_queue_stats_t * stats) {
+	if (xSemaphoreTake(proc_run_queue_mutex, portMAX_DELAY) != pdTRUE) {
+		return -1;
+	}
+	proc_run_queue_get_stats(stats);
+	xSemaphoreGive(proc_run_queue_mutex);
+	return 0;
+}
+
+int proc_runtime_running(proc_run_handle_t handle) {
+	if (xSemaphoreTake(proc_run_queue_mutex, portMAX_DELAY) != pdTRUE) {
+		return 0;
+	}
+	int running = proc_run_tracked(handle);
+	xSemaphoreGive(proc_run_queue_mutex);
+	return running;
+}
+
+/**
+ * Cancel the run executed by a runtime worker. The worker is static, so it isn't deleted: it finishes the run at its
+ * next instruction (or when its current block instruction wakes up) and goes on with the next queued run.
+ *
+ * @param task_handle The worker executing the run
+ * @return 0 on success, -1 if the task isn't a runtime worker
+ */
+int proc_stop_runtime_task(TaskHandle_t task_handle) {
+	int worker = proc_worker_index(task_handle);
+	if (worker < 0 || xSemaphoreTake(proc_run_queue_mutex, portMAX_DELAY) != pdTRUE) {
+		return -1;
+	}
+	if (proc_worker_runs[worker] != PROC_RUN_HANDLE_NONE) {
+		proc_worker_cancel[worker] = 1;
+	}
+	xSemaphoreGive(proc_run_queue_mutex);
+
+	proc_runtime_param_changed();  // wake the run if it is blocked on local parameters
+	return 0;
+}
+
+/**
+ * Drop all queued runs and cancel the running ones, then wait up to PROC_RUNTIME_STOP_TIMEOUT_MS for the workers to finish them.
+ *
+ * @return 0 on success, -1 on failure or if a run was still running at the timeout
+ */
+int proc_stop_all_runtime_tasks() {
+	if (xSemaphoreTake(proc_run_queue_mutex, portMAX_DELAY) != pdTRUE) {
+		return -1;
+	}
+	proc_run_t * run;
+	while ((run = proc_run_queue_pop()) != NULL) {
+		xSemaphoreTake(proc_run_queued, 0);  // keep the count of queued runs
+		proc_run_untrack(run->handle);
+		proc_analysis_release(run->analysis);
+		run->proc_union.type = PROC_TYPE_NONE;
+	}
+	for (size_t i = 0; i < MAX_PROC_CONCURRENT; i++) {
+		if (proc_worker_runs[i] != PROC_RUN_HANDLE_NONE) {
+			proc_worker_cancel[i] = 1;
+		}
+	}
+	xSemaphoreGive(proc_run_queue_mutex);
+	proc_runtime_param_changed();
+
+	TickType_t start_tick = xTaskGetTickCount();
+	int busy = 1;
+	while (busy) {
+		if (xSemaphoreTake(proc_run_queue_mutex, portMAX_DELAY) != pdTRUE) {
+			return -1;
+		}
+		busy = 0;
+		for (size_t i = 0; i < MAX_PROC_CONCURRENT; i++) {
+			busy |= proc_worker_runs[i] != PROC_RUN_HANDLE_NONE;
+		}
+		xSemaphoreGive(proc_run_queue_mutex);
+		if (busy && xTaskGetTickCount() - start_tick >= pdMS_TO_TICKS(PROC_RUNTIME_STOP_TIMEOUT_MS)) {
+			csp_print("Runs did not stop in time\n");
+			return -1;
+		}
+		if (busy) {
+			vTaskDelay(1);
+		}
+	}
+	return 0;
+}
+
+#else
+
+typedef struct {
+	proc_run_t * run;
 	TaskHandle_t task_handle;
 } task_t;
 
@@ -35,9 +407,52 @@ int proc_runtime_init() {
 	if (running_tasks_mutex == NULL) {
 		return -1;
 	}
+	if (proc_param_cache_init() != 0 || proc_analysis_cache_init() != 0 || proc_scheduler_start() != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+static void proc_run_discard(proc_run_t * run) {
+	proc_run_untrack(run->handle);
+	proc_analysis_release(run->analysis);
+	proc_free(run);
+}
+
+void runtime_task(void * pvParameters);
+
+/**
+ * Start a task running a procedure. Called with running_tasks_mutex held.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int proc_task_start(proc_run_t * run) {
+	TaskHandle_t task_handle;
+	char task_name[configMAX_TASK_NAME_LEN];
+	snprintf(task_name, sizeof(task_name), "RNTM%d", run->proc_slot);
+	if (xTaskCreate(runtime_task, task_name, PROC_RUNTIME_TASK_SIZE, run, PROC_RUNTIME_TASK_PRIORITY, &task_handle) != pdPASS) {
+		csp_print("Failed to create task\n");
+		return -1;
+	}
+
+	// Add task to array
+	running_tasks = proc_realloc(running_tasks, ++running_tasks_count * sizeof(task_t));
+	running_tasks[running_tasks_count - 1] = (task_t){.run = run, .task_handle = task_handle};
 	return 0;
 }
 
+/**
+ * Start queued runs while there are fewer than MAX_PROC_CONCURRENT tasks. Called with running_tasks_mutex held.
+ */
+static void proc_task_start_queued() {
+	proc_run_t * run;
+	while (running_tasks_count < MAX_PROC_CONCURRENT && (run = proc_run_queue_pop()) != NULL) {
+		if (proc_task_start(run) != 0) {
+			proc_run_discard(run);
+		}
+	}
+}
+
 /**
  * Stop a runtime task and free its resources.
  *
@@ -53,28 +468,36 @@ int proc_stop_runtime_task(TaskHandle_t task_handle) {
 	for (size_t i = 0; i < running_tasks_count; i++) {
 		if (running_tasks[i].task_handle == task_handle) {
 			vTaskDelete(running_tasks[i].task_handle);
-			if (running_tasks[i].proc_union->type == PROC_TYPE_DSL) {
-				free_proc(running_tasks[i].proc_union->proc.dsl_proc);
-			}
+			proc_run_discard(running_tasks[i].run);
 			running_tasks[i] = running_tasks[running_tasks_count - 1];
 			running_tasks = proc_realloc(running_tasks, --running_tasks_count * sizeof(task_t));
 			break;
 		}
 	}
+	proc_task_start_queued();
 	xSemaphoreGive(running_tasks_mutex);
 
 	return 0;
 }
 
 /**
- * Stop all currently running runtime tasks.
+ * Stop all currently running runtime tasks, dropping queued runs first so they don't take their place.
  *
  * @return 0 on success, -1 on failure
  */
 int proc_stop_all_runtime_tasks() {
+	if (xSemaphoreTake(running_tasks_mutex, portMAX_DELAY) != pdTRUE) {
+		return -1;
+	}
+	proc_run_t * run;
+	while ((run = proc_run_queue_pop()) != NULL) {
+		proc_run_discard(run);
+	}
+	xSemaphoreGive(running_tasks_mutex);
+
 	int inf_loop_guard = 0;
 	while (running_tasks_count > 0 && (inf_loop_guard++ < 1000)) {
-		if (proc_stop_runtime_task(&running_tasks[0]) != 0) {
+		if (proc_stop_runtime_task(running_tasks[0].task_handle) != 0) {
 			return -1;
 		}
 	}
@@ -82,22 +505,11 @@ int proc_stop_all_runtime_tasks() {
 }
 
 void runtime_task(void * pvParameters) {
-	proc_union_t * proc_union = (proc_union_t *)pvParameters;
+	proc_run_t * run = (proc_run_t *)pvParameters;
 
-	int ret;
-	switch (proc_union->type) {
-		case PROC_TYPE_DSL:
-			ret = dsl_proc_exec(*proc_union);
-			break;
-		case PROC_TYPE_COMPILED:
-			ret = proc_union->proc.compiled_proc();
-			break;
-		default:
-			ret = -1;
-	}
-	// TODO: set error flag param if ret != 0
+	proc_exec_run(run);
 
-	// Procedure finished, clean up
+	// Procedure finished, clean up and hand the task slot to the next queued run
 	if (xSemaphoreTake(running_tasks_mutex, portMAX_DELAY) != pdTRUE) {
 		vTaskDelete(NULL);
 		return;
@@ -110,66 +522,84 @@ void runtime_task(void * pvParameters) {
 			break;
 		}
 	}
+	proc_run_untrack(run->handle);
+	proc_task_start_queued();
 	xSemaphoreGive(running_tasks_mutex);
-	proc_free(proc_union);
+	proc_free(run);
 	csp_print("Procedure finished (%s)\n", pcTaskGetName(task_handle));
 	vTaskDelete(NULL);
 }
 
-int proc_runtime_run(uint8_t proc_slot) {
+int proc_runtime_run_priority(uint8_t proc_slot, uint8_t priority, proc_run_handle_t * handle) {
 	csp_print("Running procedure %d\n", proc_slot);
-	if (running_tasks_count >= MAX_PROC_CONCURRENT) {
-		csp_print("Maximum number of concurrent procedures reached\n");
-		return -1;
+	if (handle != NULL) {
+		*handle = PROC_RUN_HANDLE_NONE;
 	}
 
-	proc_union_t * stored_proc = proc_malloc(sizeof(proc_union_t));
-	*stored_proc = get_proc(proc_slot);
-
-	if (stored_proc->type != PROC_TYPE_DSL && stored_proc->type != PROC_TYPE_COMPILED) {
-		csp_print("Procedure in slot %d not found\n", proc_slot);
+	proc_run_t * stored_proc = proc_malloc(sizeof(proc_run_t));
+	if (stored_proc == NULL || proc_run_prepare(proc_slot, stored_proc) != 0) {
+		proc_free(stored_proc);
 		return -1;
 	}
 
-	if (stored_proc->type == PROC_TYPE_DSL) {
-		// Copy procedure to detach from proc store
-		proc_t * detached_proc = proc_malloc(sizeof(proc_t));
-		if (deepcopy_proc(stored_proc->proc.dsl_proc, detached_proc) != 0) {
-			csp_print("Failed to copy procedure\n");
-			return -1;
-		}
-		stored_proc->proc.dsl_proc = detached_proc;
+	// Taking the mutex before checking the number of tasks, and before creating the task so it can't clean up before it's in the array
+	if (xSemaphoreTake(running_tasks_mutex, portMAX_DELAY) != pdTRUE) {
+		proc_run_discard(stored_proc);
+		return -1;
 	}
 
-	// Create task
-	if (xSemaphoreTake(running_tasks_mutex, portMAX_DELAY) != pdTRUE) {  // taking mutex early to prevent clean-up from the newly spawned task before it's added to the task array
-		if (stored_proc->type == PROC_TYPE_DSL) {
-			free_proc(stored_proc->proc.dsl_proc);
+	int ret = 0;
+	proc_run_track(stored_proc);  // before a started task can finish and forget it
+	proc_run_handle_t run_handle = stored_proc->handle;
+	if (running_tasks_count < MAX_PROC_CONCURRENT) {
+		ret = proc_task_start(stored_proc);
+		if (ret != 0) {
+			proc_run_discard(stored_proc);
 		}
-		proc_free(stored_proc);
-		return -1;
+	} else {
+		// Wait for a running task to finish
+		proc_run_t * dropped;
+		ret = proc_run_queue_push(stored_proc, priority, (void **)&dropped);
+		if (ret != 0) {
+			csp_print("Maximum number of pending procedures reached\n");
+			proc_run_discard(stored_proc);
+		} else if (dropped != NULL) {
+			csp_print("Dropping pending run of procedure %d to make room\n", dropped->proc_slot);
+			proc_run_discard(dropped);
+		}
+	}
+	if (ret == 0 && handle != NULL) {
+		*handle = run_handle;
 	}
+	xSemaphoreGive(running_tasks_mutex);
 
-	TaskHandle_t task_handle;
-	char task_name[configMAX_TASK_NAME_LEN];
-	sprintf(task_name, "RNTM%d", proc_slot);
-	BaseType_t task_create_ret;
-	task_create_ret = xTaskCreate(runtime_task, task_name, PROC_RUNTIME_TASK_SIZE, stored_proc, PROC_RUNTIME_TASK_PRIORITY, &task_handle);
+	return ret;
+}
 
-	if (task_create_ret != pdPASS) {
-		csp_print("Failed to create task\n");
-		if (stored_proc->type == PROC_TYPE_DSL) {
-			free_proc(stored_proc->proc.dsl_proc);
-		}
-		proc_free(stored_proc);
-		xSemaphoreGive(running_tasks_mutex);
+int proc_runtime_run_queue_stats(proc_run_queue_stats_t * stats) {
+	if (xSemaphoreTake(running_tasks_mutex, portMAX_DELAY) != pdTRUE) {
 		return -1;
 	}
+	proc_run_queue_get_stats(stats);
+	xSemaphoreGive(running_tasks_mutex);
+	return 0;
+}
 
-	// Add task to array
-	running_tasks = proc_realloc(running_tasks, ++running_tasks_count * sizeof(task_t));
-	running_tasks[running_tasks_count - 1] = (task_t){.proc_union = stored_proc, .task_handle = task_handle};
+int proc_runtime_running(proc_run_handle_t handle) {
+	if (xSemaphoreTake(running_tasks_mutex, portMAX_DELAY) != pdTRUE) {
+		return 0;
+	}
+	int running = proc_run_tracked(handle);
 	xSemaphoreGive(running_tasks_mutex);
+	return running;
+}
 
-	return 0;
+#endif  // PROC_RUNTIME_STATIC_TASKS
+
+int proc_runtime_run_async(uint8_t proc_slot, proc_run_handle_t * handle) {
+	return proc_runtime_run_priority(proc_slot, PROC_RUN_PRIORITY_DEFAULT, handle);
+}
+
+int proc_runtime_run(uint8_t proc_slot) {
+	return proc_runtime_run_priority(proc_slot, PROC_RUN_PRIORITY_DEFAULT, NULL);
 }
@@ -6,153 +6,369 @@
 
 #include <csp/csp.h>
 
+#include <errno.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <time.h>
 
-// forward declaration
-int dsl_proc_exec(proc_union_t proc_union);
+// forward declarations
+int dsl_proc_exec(proc_analysis_t * analysis);
+int proc_param_cache_init();
+int proc_periodic_init();
+void proc_periodic_advance(uint32_t now_ms);
+int proc_timed_init();
+uint32_t proc_timed_service();
+int proc_run_queue_push(void * run, uint8_t priority, void ** dropped);
+void * proc_run_queue_pop();
+int proc_run_queue_remove(void * run);
+void proc_run_queue_get_stats(proc_run_queue_stats_t * stats);
+
+typedef enum {
+	PROC_RUN_FREE,
+	PROC_RUN_QUEUED,
+	PROC_RUN_RUNNING,
+	PROC_RUN_DONE,
+} proc_run_state_t;
 
 typedef struct {
-	proc_union_t * proc_union;
-	pthread_t thread;
-} thread_t;
+	proc_union_t proc_union;
+	proc_analysis_t * analysis;  // DSL procedures only, holds a reference to the procedure snapshot
+	proc_run_handle_t handle;
+	proc_run_state_t state;
+	volatile int cancel_requested;
+	int result;
+} proc_run_t;
+
+// Records of queued, running and recently finished runs. Finished records are kept so their result can be awaited,
+// until they are reused for new runs (oldest first). The spare record holds a new run while the queue is full,
+// until the overflow policy has decided which run to drop.
+#define PROC_RUN_RECORDS (MAX_PROC_CONCURRENT + PROC_RUN_QUEUE_LENGTH + 1)
 
-thread_t * running_threads = NULL;
-volatile size_t running_threads_count = 0;
-pthread_mutex_t running_threads_mutex;
+static proc_run_t proc_runs[PROC_RUN_RECORDS];
+static proc_run_handle_t proc_next_run_handle = 1;
 
-pthread_key_t recursion_depth_key;
+static pthread_t proc_workers[MAX_PROC_CONCURRENT];
+static pthread_t proc_scheduler;
+static pthread_mutex_t proc_runs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t proc_run_queued_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t proc_run_done_cond = PTHREAD_COND_INITIALIZER;
+static pthread_key_t proc_run_key;  // the run executed by the current worker
+static int proc_runtime_initialized = 0;
+
+static void * runtime_worker(void * pvParameters);
+static void * runtime_scheduler(void * pvParameters);
 
 int proc_runtime_init() {
-	if (pthread_mutex_init(&running_threads_mutex, NULL) != 0) {
+	if (proc_runtime_initialized) {
+		return 0;  // the workers and scheduler are already running
+	}
+	if (pthread_key_create(&proc_run_key, NULL) != 0) {
+		csp_print("Error creating pthread key\n");
 		return -1;
 	}
+	if (proc_param_cache_init() != 0 || proc_analysis_cache_init() != 0 || proc_periodic_init() != 0 || proc_timed_init() != 0) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < MAX_PROC_CONCURRENT; i++) {
+		if (pthread_create(&proc_workers[i], NULL, runtime_worker, NULL) != 0) {
+			csp_print("Failed to create runtime worker\n");
+			return -1;
+		}
+		pthread_detach(proc_workers[i]);
+	}
+	if (pthread_create(&proc_scheduler, NULL, runtime_scheduler, NULL) != 0) {
+		csp_print("Failed to create runtime scheduler\n");
+		return -1;
+	}
+	pthread_detach(proc_scheduler);
+	proc_runtime_initialized = 1;
 	return 0;
 }
 
 /**
- * Stop a runtime thread and free its resources.
- *
- * @param thread The thread to stop
- * @return 0 on success, -1 on failure
+ * Check whether the run executed by the calling thread has been cancelled.
+ * Checked by the interpreter between instructions and while blocking.
  */
-int proc_stop_runtime_thread(pthread_t thread) {
-	int ret = pthread_mutex_lock(&running_threads_mutex);  // Prevent race condition on running_threads array
-	if (ret != 0) {
-		return -1;
+int proc_runtime_cancelled() {
+	proc_run_t * run = pthread_getspecific(proc_run_key);
+	return run != NULL && run->cancel_requested;
+}
+
+static void proc_run_release(proc_run_t * run) {
+	if (run->proc_union.type == PROC_TYPE_DSL) {
+		proc_analysis_release(run->analysis);
 	}
+	run->proc_union.type = PROC_TYPE_NONE;
+}
 
-	for (size_t i = 0; i < running_threads_count; i++) {
-		if (pthread_equal(running_threads[i].thread, thread)) {
-			pthread_cancel(running_threads[i].thread);
-			pthread_join(running_threads[i].thread, NULL);
-			if (running_threads[i].proc_union->type == PROC_TYPE_DSL) {
-				free_proc(running_threads[i].proc_union->proc.dsl_proc);
-			}
-			running_threads[i] = running_threads[running_threads_count - 1];
-			running_threads = proc_realloc(running_threads, --running_threads_count * sizeof(thread_t));
-			break;
+static proc_run_t * proc_run_find(proc_run_handle_t handle) {
+	for (size_t i = 0; i < PROC_RUN_RECORDS; i++) {
+		if (proc_runs[i].state != PROC_RUN_FREE && proc_runs[i].handle == handle) {
+			return &proc_runs[i];
 		}
 	}
-	pthread_mutex_unlock(&running_threads_mutex);
+	return NULL;
+}
 
-	return 0;
+/**
+ * Finish a queued run without starting it.
+ */
+static void proc_run_drop(proc_run_t * run) {
+	proc_run_release(run);
+	run->result = -1;
+	run->state = PROC_RUN_DONE;
+	pthread_cond_broadcast(&proc_run_done_cond);
 }
 
 /**
- * Stop all currently running runtime threads.
- *
- * @return 0 on success, -1 on failure
+ * Take a record for a new run: a free one, or else the oldest finished one.
  */
-int proc_stop_all_runtime_threads() {
-	int inf_loop_guard = 0;
-	while (running_threads_count > 0 && (inf_loop_guard++ < 1000)) {
-		if (proc_stop_runtime_thread(running_threads[0].thread) != 0) {
-			return -1;
+static proc_run_t * proc_run_alloc() {
+	proc_run_t * oldest_done = NULL;
+	for (size_t i = 0; i < PROC_RUN_RECORDS; i++) {
+		if (proc_runs[i].state == PROC_RUN_FREE) {
+			return &proc_runs[i];
+		}
+		if (proc_runs[i].state == PROC_RUN_DONE && (oldest_done == NULL || proc_runs[i].handle - oldest_done->handle > UINT32_MAX / 2)) {
+			oldest_done = &proc_runs[i];
 		}
 	}
-	return inf_loop_guard < 1000 ? 0 : -1;
+	return oldest_done;
 }
 
-void * runtime_thread(void * pvParameters) {
-	proc_union_t * proc_union = (proc_union_t *)pvParameters;
+static void * runtime_worker(void * pvParameters) {
+	(void)pvParameters;
 
-	int ret;
-	switch (proc_union->type) {
-		case PROC_TYPE_DSL:
-			if (pthread_key_create(&recursion_depth_key, NULL) != 0) {
-				csp_print("Error creating pthread key\n");
-				return -1;
-			}
-			ret = dsl_proc_exec(*proc_union);
-			pthread_key_delete(recursion_depth_key);
-			break;
-		case PROC_TYPE_COMPILED:
-			ret = proc_union->proc.compiled_proc();
-			break;
-		default:
-			ret = -1;
-	}
-	// TODO: set error flag param if ret != 0
+	while (1) {
+		pthread_mutex_lock(&proc_runs_mutex);
+		proc_run_t * run;
+		while ((run = proc_run_queue_pop()) == NULL) {
+			pthread_cond_wait(&proc_run_queued_cond, &proc_runs_mutex);
+		}
+		run->state = PROC_RUN_RUNNING;
+		pthread_mutex_unlock(&proc_runs_mutex);
 
-	// Procedure finished, clean up
-	pthread_mutex_lock(&running_threads_mutex);
-	pthread_t thread = pthread_self();
-	for (size_t i = 0; i < running_threads_count; i++) {
-		if (pthread_equal(running_threads[i].thread, thread)) {
-			running_threads[i] = running_threads[running_threads_count - 1];
-			running_threads = proc_realloc(running_threads, --running_threads_count * sizeof(thread_t));
-			break;
+		pthread_setspecific(proc_run_key, run);
+
+		int ret;
+		switch (run->proc_union.type) {
+			case PROC_TYPE_DSL:
+				ret = dsl_proc_exec(run->analysis);
+				break;
+			case PROC_TYPE_COMPILED:
+				ret = run->proc_union.proc.compiled_proc();
+				break;
+			default:
+				ret = -1;
 		}
+		// TODO: set error flag param if ret != 0
+
+		pthread_setspecific(proc_run_key, NULL);
+
+		// Procedure finished (dsl_proc_exec releases the analysis)
+		pthread_mutex_lock(&proc_runs_mutex);
+		run->proc_union.type = PROC_TYPE_NONE;
+		run->result = ret;
+		run->state = PROC_RUN_DONE;
+		pthread_cond_broadcast(&proc_run_done_cond);
+		pthread_mutex_unlock(&proc_runs_mutex);
+		csp_print("Procedure finished\n");
 	}
-	pthread_mutex_unlock(&running_threads_mutex);
-	proc_free(proc_union);
-	csp_print("Procedure finished\n");
+
 	return NULL;
 }
 
-int proc_runtime_run(uint8_t proc_slot) {
-	csp_print("Running procedure %d\n", proc_slot);
-	if (running_threads_count >= MAX_PROC_CONCURRENT) {
-		csp_print("Maximum number of concurrent procedures reached\n");
-		return -1;
+/**
+ * Advance the timer wheel of periodic runs and start due timed runs every PROC_TIMER_WHEEL_TICK_MS.
+ * Timed runs due before the next tick are slept for exactly, so they don't wait for the tick.
+ */
+static void * runtime_scheduler(void * pvParameters) {
+	(void)pvParameters;
+
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (1) {
+		next.tv_nsec += PROC_TIMER_WHEEL_TICK_MS * 1000000;
+		while (next.tv_nsec >= 1000000000) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		proc_periodic_advance((uint32_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000));
+
+		uint32_t until_us = proc_timed_service();
+		while (until_us < PROC_TIMER_WHEEL_TICK_MS * 1000) {
+			struct timespec sleep_time = {0, until_us * 1000};
+			nanosleep(&sleep_time, NULL);
+			until_us = proc_timed_service();
+		}
 	}
 
-	proc_union_t * stored_proc = proc_malloc(sizeof(proc_union_t));
-	*stored_proc = get_proc(proc_slot);
+	return NULL;
+}
+
+int proc_runtime_run_priority(uint8_t proc_slot, uint8_t priority, proc_run_handle_t * handle) {
+	csp_print("Running procedure %d\n", proc_slot);
 
-	if (stored_proc->type != PROC_TYPE_DSL && stored_proc->type != PROC_TYPE_COMPILED) {
+	proc_union_t proc_union = get_proc(proc_slot);
+	if (proc_union.type != PROC_TYPE_DSL && proc_union.type != PROC_TYPE_COMPILED) {
 		csp_print("Procedure in slot %d not found\n", proc_slot);
 		return -1;
 	}
 
-	if (stored_proc->type == PROC_TYPE_DSL) {
-		// Copy procedure to detach from proc store
-		proc_t * detached_proc = proc_malloc(sizeof(proc_t));
-		if (deepcopy_proc(stored_proc->proc.dsl_proc, detached_proc) != 0) {
-			csp_print("Failed to copy procedure\n");
+	proc_analysis_t * analysis = NULL;
+	if (proc_union.type == PROC_TYPE_DSL) {
+		// Take a reference to the current snapshot of the procedure, through its shared analysis
+		analysis = proc_analysis_acquire(proc_slot);
+		if (analysis == NULL) {
+			csp_print("Error analyzing procedure\n");
 			return -1;
 		}
-		stored_proc->proc.dsl_proc = detached_proc;
+		proc_union = analysis->proc_union;
 	}
 
-	// Create thread
-	pthread_mutex_lock(&running_threads_mutex);  // taking mutex early to prevent clean-up from the newly spawned thread before it's added to the thread array
-	pthread_t thread;
-	if (pthread_create(&thread, NULL, runtime_thread, stored_proc) != 0) {
-		csp_print("Failed to create thread\n");
-		if (stored_proc->type == PROC_TYPE_DSL) {
-			free_proc(stored_proc->proc.dsl_proc);
-		}
-		proc_free(stored_proc);
-		pthread_mutex_unlock(&running_threads_mutex);
+	pthread_mutex_lock(&proc_runs_mutex);
+	proc_run_t * run = proc_run_alloc();  // there is always one, see PROC_RUN_RECORDS
+	proc_run_t * dropped;
+	if (proc_run_queue_push(run, priority, (void **)&dropped) != 0) {
+		pthread_mutex_unlock(&proc_runs_mutex);
+		csp_print("Maximum number of pending procedures reached\n");
+		proc_analysis_release(analysis);
 		return -1;
 	}
+	if (dropped != NULL) {
+		csp_print("Dropping pending run %u to make room\n", (unsigned int)dropped->handle);
+		proc_run_drop(dropped);
+	}
 
-	// Add thread to array
-	running_threads = proc_realloc(running_threads, ++running_threads_count * sizeof(thread_t));
-	running_threads[running_threads_count - 1] = (thread_t){.proc_union = stored_proc, .thread = thread};
-	pthread_mutex_unlock(&running_threads_mutex);
+	run->proc_union = proc_union;
+	run->analysis = analysis;
+	run->handle = proc_next_run_handle++;
+	if (proc_next_run_handle == PROC_RUN_HANDLE_NONE) {
+		proc_next_run_handle++;
+	}
+	run->state = PROC_RUN_QUEUED;
+	run->cancel_requested = 0;
+	run->result = 0;
+	pthread_cond_signal(&proc_run_queued_cond);
+
+	if (handle != NULL) {
+		*handle = run->handle;
+	}
+	pthread_mutex_unlock(&proc_runs_mutex);
 
 	return 0;
 }
+
+int proc_runtime_run_async(uint8_t proc_slot, proc_run_handle_t * handle) {
+	return proc_runtime_run_priority(proc_slot, PROC_RUN_PRIORITY_DEFAULT, handle);
+}
+
+int proc_runtime_run(uint8_t proc_slot) {
+	return proc_runtime_run_priority(proc_slot, PROC_RUN_PRIORITY_DEFAULT, NULL);
+}
+
+int proc_runtime_run_queue_stats(proc_run_queue_stats_t * stats) {
+	pthread_mutex_lock(&proc_runs_mutex);
+	proc_run_queue_get_stats(stats);
+	pthread_mutex_unlock(&proc_runs_mutex);
+	return 0;
+}
+
+int proc_runtime_cancel(proc_run_handle_t handle) {
+	pthread_mutex_lock(&proc_runs_mutex);
+	proc_run_t * run = proc_run_find(handle);
+	if (run == NULL) {
+		pthread_mutex_unlock(&proc_runs_mutex);
+		return -1;
+	}
+
+	if (run->state == PROC_RUN_QUEUED) {
+		proc_run_queue_remove(run);
+		proc_run_drop(run);
+	} else if (run->state == PROC_RUN_RUNNING) {
+		run->cancel_requested = 1;
+	}
+	pthread_mutex_unlock(&proc_runs_mutex);
+
+	proc_runtime_param_changed();  // wake the run if it is blocked on local parameters
+	return 0;
+}
+
+int proc_runtime_running(proc_run_handle_t handle) {
+	pthread_mutex_lock(&proc_runs_mutex);
+	proc_run_t * run = proc_run_find(handle);
+	int running = run != NULL && (run->state == PROC_RUN_QUEUED || run->state == PROC_RUN_RUNNING);
+	pthread_mutex_unlock(&proc_runs_mutex);
+	return running;
+}
+
+int proc_runtime_await(proc_run_handle_t handle, uint32_t timeout_ms, int * result) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&proc_runs_mutex);
+	proc_run_t * run;
+	int ret = 0;
+	while ((run = proc_run_find(handle)) != NULL && run->state != PROC_RUN_DONE) {
+		if (pthread_cond_timedwait(&proc_run_done_cond, &proc_runs_mutex, &deadline) == ETIMEDOUT) {
+			ret = -1;
+			break;
+		}
+	}
+	if (run == NULL) {
+		ret = -1;  // unknown handle, or its record has since been reused
+	} else if (ret == 0 && result != NULL) {
+		*result = run->result;
+	}
+	pthread_mutex_unlock(&proc_runs_mutex);
+
+	return ret;
+}
+
+/**
+ * Cancel all queued and running procedures, and wait up to PROC_RUNTIME_STOP_TIMEOUT_MS in total for them to finish.
+ *
+ * @return 0 on success, -1 if a run could not be cancelled or was still running at the timeout
+ */
+int proc_stop_all_runtime_threads() {
+	pthread_mutex_lock(&proc_runs_mutex);
+	proc_run_handle_t handles[PROC_RUN_RECORDS];
+	size_t handle_count = 0;
+	for (size_t i = 0; i < PROC_RUN_RECORDS; i++) {
+		if (proc_runs[i].state == PROC_RUN_QUEUED || proc_runs[i].state == PROC_RUN_RUNNING) {
+			handles[handle_count++] = proc_runs[i].handle;
+		}
+	}
+	pthread_mutex_unlock(&proc_runs_mutex);
+
+	int ret = 0;
+	for (size_t i = 0; i < handle_count; i++) {
+		if (proc_runtime_cancel(handles[i]) != 0) {
+			ret = -1;
+		}
+	}
+
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < handle_count; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		uint32_t elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+		uint32_t remaining_ms = (elapsed_ms < PROC_RUNTIME_STOP_TIMEOUT_MS) ? PROC_RUNTIME_STOP_TIMEOUT_MS - elapsed_ms : 0;
+		if (proc_runtime_await(handles[i], remaining_ms, NULL) != 0 && proc_runtime_running(handles[i])) {
+			csp_print("Run %u did not stop in time\n", (unsigned int)handles[i]);
+			ret = -1;
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,308 @@
+// Cooperative csp_proc runtime: all procedures run on a single thread/task, which switches between them whenever
+// a run waits on a block instruction or has executed PROC_COOP_SLICE instructions. The thread/task also starts
+// periodic and timed runs, so the runtime needs one stack in total.
+
+#include <csp_proc/proc_runtime.h>
+#include <csp_proc/proc_analyze.h>
+
+#include <csp/csp.h>
+#include <csp/arch/csp_time.h>
+
+// forward declarations
+int proc_param_cache_init();
+int proc_periodic_init();
+void proc_periodic_advance(uint32_t now_ms);
+int proc_timed_init();
+uint32_t proc_timed_service();
+
+// Platform glue (proc_runtime_cooperative_<platform>.c): a lock with a condition to wait on, and the scheduler thread/task
+int proc_coop_platform_init();
+void proc_coop_lock();
+void proc_coop_unlock();
+void proc_coop_wait(uint32_t timeout_ms);  // called with the lock held, released while waiting, may return early
+void proc_coop_broadcast();                // called with the lock held, wakes all waiters
+
+typedef enum {
+	PROC_COOP_FREE,
+	PROC_COOP_READY,
+	PROC_COOP_WAITING,
+	PROC_COOP_RUNNING,
+	PROC_COOP_DONE,
+} proc_coop_state_t;
+
+typedef struct {
+	proc_union_t proc_union;
+	proc_analysis_t * analysis;  // DSL procedures until they start, then owned by exec
+	proc_exec_t * exec;          // DSL procedures once started
+	proc_run_handle_t handle;
+	proc_coop_state_t state;
+	uint32_t wake_ms;       // waiting runs are resumed at this time
+	int wait_local;         // or once a local parameter changes
+	uint32_t param_seq;     // proc_coop_param_seq when the run was last resumed
+	volatile int cancel_requested;
+	int result;
+} proc_coop_run_t;
+
+// Records of runs in progress and recently finished runs. Finished records are kept so their result can be awaited,
+// until they are reused for new runs (oldest first).
+static proc_coop_run_t proc_coop_runs[PROC_COOP_MAX_RUNS];
+static proc_run_handle_t proc_coop_next_handle = 1;
+static uint32_t proc_coop_param_seq = 0;  // incremented on every notified parameter change
+static proc_coop_run_t * proc_coop_current = NULL;  // the run being executed by the scheduler
+
+int proc_runtime_init() {
+	if (proc_param_cache_init() != 0 || proc_analysis_cache_init() != 0 || proc_periodic_init() != 0 || proc_timed_init() != 0) {
+		return -1;
+	}
+	return proc_coop_platform_init();
+}
+
+int proc_runtime_cancelled() {
+	proc_coop_run_t * run = proc_coop_current;
+	return run != NULL && run->cancel_requested;
+}
+
+void proc_runtime_param_changed() {
+	proc_coop_lock();
+	proc_coop_param_seq++;
+	proc_coop_broadcast();
+	proc_coop_unlock();
+}
+
+static proc_coop_run_t * proc_coop_find(proc_run_handle_t handle) {
+	for (size_t i = 0; i < PROC_COOP_MAX_RUNS; i++) {
+		if (proc_coop_runs[i].state != PROC_COOP_FREE && proc_coop_runs[i].handle == handle) {
+			return &proc_coop_runs[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Take a record for a new run: a free one, or else the oldest finished one.
+ */
+static proc_coop_run_t * proc_coop_alloc() {
+	proc_coop_run_t * oldest_done = NULL;
+	for (size_t i = 0; i < PROC_COOP_MAX_RUNS; i++) {
+		if (proc_coop_runs[i].state == PROC_COOP_FREE) {
+			return &proc_coop_runs[i];
+		}
+		if (proc_coop_runs[i].state == PROC_COOP_DONE && (oldest_done == NULL || proc_coop_runs[i].handle - oldest_done->handle > UINT32_MAX / 2)) {
+			oldest_done = &proc_coop_runs[i];
+		}
+	}
+	return oldest_done;
+}
+
+/**
+ * Check whether a run can be resumed, or else lower sleep_ms to the time until it can.
+ */
+static int proc_coop_runnable(proc_coop_run_t * run, uint32_t now_ms, uint32_t * sleep_ms) {
+	if (run->state == PROC_COOP_READY) {
+		return 1;
+	}
+	if (run->state != PROC_COOP_WAITING) {
+		return 0;
+	}
+	int32_t until_ms = (int32_t)(run->wake_ms - now_ms);
+	if (until_ms <= 0 || run->cancel_requested || (run->wait_local && run->param_seq != proc_coop_param_seq)) {
+		return 1;
+	}
+	if ((uint32_t)until_ms < *sleep_ms) {
+		*sleep_ms = until_ms;
+	}
+	return 0;
+}
+
+/**
+ * Execute a run until it finishes or yields. Called without the lock held.
+ *
+ * @return 0 or negative when the run has finished, PROC_EXEC_YIELD or PROC_EXEC_YIELD_LOCAL if it yielded
+ */
+static int proc_coop_resume(proc_coop_run_t * run, uint32_t * wait_ms) {
+	if (run->proc_union.type == PROC_TYPE_COMPILED) {
+		// Pre-compiled procedures can't yield, and hold up the other runs until they return
+		return (run->proc_union.proc.compiled_proc() == 0) ? 0 : -1;
+	}
+	if (run->exec == NULL) {
+		run->exec = proc_exec_create(run->analysis, 1);
+		run->analysis = NULL;  // released along with the execution
+		if (run->exec == NULL) {
+			return -1;
+		}
+	}
+	return proc_exec_step(run->exec, PROC_COOP_SLICE, wait_ms);
+}
+
+static void proc_coop_finish(proc_coop_run_t * run, int result) {
+	if (run->exec != NULL) {
+		proc_exec_destroy(run->exec);
+		run->exec = NULL;
+	} else if (run->analysis != NULL) {
+		proc_analysis_release(run->analysis);
+	}
+	run->analysis = NULL;
+	run->proc_union.type = PROC_TYPE_NONE;
+	run->result = result;
+	run->state = PROC_COOP_DONE;
+	proc_coop_broadcast();
+}
+
+/**
+ * Run the procedures, and start periodic and timed runs. Called by the scheduler thread/task, never returns.
+ */
+void proc_coop_loop() {
+	size_t next = 0;  // runs are resumed in turn, starting after the last one resumed
+	uint32_t tick_ms = csp_get_ms();
+
+	proc_coop_lock();
+	while (1) {
+		uint32_t now_ms = csp_get_ms();
+		if ((int32_t)(now_ms - tick_ms) >= 0) {
+			proc_coop_unlock();
+			proc_periodic_advance(now_ms);
+			uint32_t until_us = proc_timed_service();
+			proc_coop_lock();
+
+			tick_ms = now_ms + PROC_TIMER_WHEEL_TICK_MS;
+			if (until_us < PROC_TIMER_WHEEL_TICK_MS * 1000) {
+				tick_ms = now_ms + (until_us + 999) / 1000;  // a timed run is due before the next tick
+			}
+		}
+
+		uint32_t sleep_ms = ((int32_t)(tick_ms - now_ms) > 0) ? tick_ms - now_ms : 0;
+		proc_coop_run_t * run = NULL;
+		for (size_t i = 0; i < PROC_COOP_MAX_RUNS && run == NULL; i++) {
+			proc_coop_run_t * candidate = &proc_coop_runs[(next + i) % PROC_COOP_MAX_RUNS];
+			if (proc_coop_runnable(candidate, now_ms, &sleep_ms)) {
+				run = candidate;
+				next = (next + i + 1) % PROC_COOP_MAX_RUNS;
+			}
+		}
+		if (run == NULL) {
+			if (sleep_ms > 0) {
+				proc_coop_wait(sleep_ms);
+			}
+			continue;
+		}
+		if (run->cancel_requested) {
+			proc_coop_finish(run, -1);
+			continue;
+		}
+
+		run->state = PROC_COOP_RUNNING;
+		run->param_seq = proc_coop_param_seq;  // read before resuming, so a change while it runs isn't missed
+		proc_coop_current = run;
+		proc_coop_unlock();
+
+		uint32_t wait_ms = 0;
+		int ret = proc_coop_resume(run, &wait_ms);
+
+		proc_coop_lock();
+		proc_coop_current = NULL;
+		if (ret == PROC_EXEC_YIELD || ret == PROC_EXEC_YIELD_LOCAL) {
+			run->state = (wait_ms == 0) ? PROC_COOP_READY : PROC_COOP_WAITING;
+			run->wake_ms = csp_get_ms() + wait_ms;
+			run->wait_local = (ret == PROC_EXEC_YIELD_LOCAL);
+		} else {
+			// TODO: set error flag param if ret != 0
+			proc_coop_finish(run, ret);
+		}
+	}
+}
+
+int proc_runtime_run_async(uint8_t proc_slot, proc_run_handle_t * handle) {
+	csp_print("Running procedure %d\n", proc_slot);
+
+	proc_union_t proc_union = get_proc(proc_slot);
+	if (proc_union.type != PROC_TYPE_DSL && proc_union.type != PROC_TYPE_COMPILED) {
+		csp_print("Procedure in slot %d not found\n", proc_slot);
+		return -1;
+	}
+
+	proc_analysis_t * analysis = NULL;
+	if (proc_union.type == PROC_TYPE_DSL) {
+		// Take a reference to the current snapshot of the procedure, through its shared analysis
+		analysis = proc_analysis_acquire(proc_slot);
+		if (analysis == NULL) {
+			csp_print("Error analyzing procedure\n");
+			return -1;
+		}
+		proc_union = analysis->proc_union;
+	}
+
+	proc_coop_lock();
+	proc_coop_run_t * run = proc_coop_alloc();
+	if (run == NULL) {
+		proc_coop_unlock();
+		csp_print("Maximum number of concurrent procedures reached\n");
+		proc_analysis_release(analysis);
+		return -1;
+	}
+
+	run->proc_union = proc_union;
+	run->analysis = analysis;
+	run->exec = NULL;
+	run->handle = proc_coop_next_handle++;
+	if (proc_coop_next_handle == PROC_RUN_HANDLE_NONE) {
+		proc_coop_next_handle++;
+	}
+	run->state = PROC_COOP_READY;
+	run->cancel_requested = 0;
+	run->result = 0;
+	if (handle != NULL) {
+		*handle = run->handle;
+	}
+	proc_coop_broadcast();
+	proc_coop_unlock();
+
+	return 0;
+}
+
+int proc_runtime_run(uint8_t proc_slot) {
+	return proc_runtime_run_async(proc_slot, NULL);
+}
+
+int proc_runtime_cancel(proc_run_handle_t handle) {
+	proc_coop_lock();
+	proc_coop_run_t * run = proc_coop_find(handle);
+	if (run != NULL && run->state != PROC_COOP_DONE) {
+		// Finished by the scheduler when it next gets to it, or before the next instruction if it is running
+		run->cancel_requested = 1;
+		proc_coop_broadcast();
+	}
+	proc_coop_unlock();
+	return (run != NULL) ? 0 : -1;
+}
+
+int proc_runtime_running(proc_run_handle_t handle) {
+	proc_coop_lock();
+	proc_coop_run_t * run = proc_coop_find(handle);
+	int running = run != NULL && run->state != PROC_COOP_DONE;
+	proc_coop_unlock();
+	return running;
+}
+
+int proc_runtime_await(proc_run_handle_t handle, uint32_t timeout_ms, int * result) {
+	uint32_t deadline_ms = csp_get_ms() + timeout_ms;
+
+	proc_coop_lock();
+	proc_coop_run_t * run;
+	int ret = 0;
+	while ((run = proc_coop_find(handle)) != NULL && run->state != PROC_COOP_DONE) {
+		int32_t remaining_ms = (int32_t)(deadline_ms - csp_get_ms());
+		if (remaining_ms <= 0) {
+			ret = -1;
+			break;
+		}
+		proc_coop_wait(remaining_ms);
+	}
+	if (run == NULL) {
+		ret = -1;  // unknown handle, or its record has since been reused
+	} else if (ret == 0 && result != NULL) {
+		*result = run->result;
+	}
+	proc_coop_unlock();
+
+	return ret;
+}
@@ -0,0 +1,100 @@
+// FreeRTOS glue of the cooperative csp_proc runtime
+
+#include <csp/csp.h>
+
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include <task.h>
+
+#ifndef PROC_RUNTIME_TASK_SIZE
+#define PROC_RUNTIME_TASK_SIZE (512U)
+#endif
+
+#ifndef PROC_RUNTIME_TASK_PRIORITY
+#define PROC_RUNTIME_TASK_PRIORITY (tskIDLE_PRIORITY + 2U)
+#endif
+
+#ifndef PROC_RUNTIME_STATIC_TASKS
+#define PROC_RUNTIME_STATIC_TASKS (0)
+#endif
+
+#ifndef PROC_COOP_WAITERS
+#define PROC_COOP_WAITERS (4U)
+#endif  // tasks notified when waiting on the runtime (the scheduler and tasks awaiting runs), others poll
+
+// forward declarations
+void proc_coop_loop();
+
+static SemaphoreHandle_t proc_coop_mutex = NULL;
+static TaskHandle_t proc_coop_waiters[PROC_COOP_WAITERS];
+
+#if PROC_RUNTIME_STATIC_TASKS
+static StaticSemaphore_t proc_coop_mutex_buffer;
+static StaticTask_t proc_coop_tcb;
+static StackType_t proc_coop_stack[PROC_RUNTIME_TASK_SIZE];
+#endif
+
+static void runtime_cooperative(void * pvParameters) {
+	(void)pvParameters;
+	proc_coop_loop();
+}
+
+int proc_coop_platform_init() {
+#if PROC_RUNTIME_STATIC_TASKS
+	proc_coop_mutex = xSemaphoreCreateMutexStatic(&proc_coop_mutex_buffer);
+#else
+	proc_coop_mutex = xSemaphoreCreateMutex();
+#endif
+	if (proc_coop_mutex == NULL) {
+		return -1;
+	}
+
+#if PROC_RUNTIME_STATIC_TASKS
+	if (xTaskCreateStatic(runtime_cooperative, "RNTMCOOP", PROC_RUNTIME_TASK_SIZE, NULL, PROC_RUNTIME_TASK_PRIORITY, proc_coop_stack, &proc_coop_tcb) == NULL) {
+#else
+	if (xTaskCreate(runtime_cooperative, "RNTMCOOP", PROC_RUNTIME_TASK_SIZE, NULL, PROC_RUNTIME_TASK_PRIORITY, NULL) != pdPASS) {
+#endif
+		csp_print("Failed to create runtime scheduler\n");
+		return -1;
+	}
+	return 0;
+}
+
+void proc_coop_lock() {
+	xSemaphoreTake(proc_coop_mutex, portMAX_DELAY);
+}
+
+void proc_coop_unlock() {
+	xSemaphoreGive(proc_coop_mutex);
+}
+
+void proc_coop_wait(uint32_t timeout_ms) {
+	// Registered while holding the lock, so a broadcast made after the lock is released is never missed
+	int index = -1;
+	for (size_t i = 0; i < PROC_COOP_WAITERS && index == -1; i++) {
+		if (proc_coop_waiters[i] == NULL) {
+			proc_coop_waiters[i] = xTaskGetCurrentTaskHandle();
+			index = i;
+		}
+	}
+	TickType_t ticks = pdMS_TO_TICKS(timeout_ms);
+	if (ticks == 0 || index == -1) {
+		ticks = 1;  // not notified if unregistered, check again on the next tick
+	}
+
+	xSemaphoreGive(proc_coop_mutex);
+	ulTaskNotifyTake(pdTRUE, ticks);
+	xSemaphoreTake(proc_coop_mutex, portMAX_DELAY);
+
+	if (index != -1) {
+		proc_coop_waiters[index] = NULL;
+	}
+}
+
+void proc_coop_broadcast() {
+	for (size_t i = 0; i < PROC_COOP_WAITERS; i++) {
+		if (proc_coop_waiters[i] != NULL) {
+			xTaskNotifyGive(proc_coop_waiters[i]);
+		}
+	}
+}
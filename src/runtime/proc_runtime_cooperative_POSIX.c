@@ -0,0 +1,60 @@
+// POSIX glue of the cooperative csp_proc runtime
+
+#include <csp/csp.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+// forward declarations
+void proc_coop_loop();
+
+static pthread_mutex_t proc_coop_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t proc_coop_cond;
+static pthread_t proc_coop_thread;
+
+static void * runtime_cooperative(void * pvParameters) {
+	(void)pvParameters;
+	proc_coop_loop();
+	return NULL;
+}
+
+int proc_coop_platform_init() {
+	pthread_condattr_t attr;
+	if (pthread_condattr_init(&attr) != 0 || pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) != 0 || pthread_cond_init(&proc_coop_cond, &attr) != 0) {
+		csp_print("Failed to create runtime condition variable\n");
+		return -1;
+	}
+	pthread_condattr_destroy(&attr);
+
+	if (pthread_create(&proc_coop_thread, NULL, runtime_cooperative, NULL) != 0) {
+		csp_print("Failed to create runtime scheduler\n");
+		return -1;
+	}
+	pthread_detach(proc_coop_thread);
+	return 0;
+}
+
+void proc_coop_lock() {
+	pthread_mutex_lock(&proc_coop_mutex);
+}
+
+void proc_coop_unlock() {
+	pthread_mutex_unlock(&proc_coop_mutex);
+}
+
+void proc_coop_wait(uint32_t timeout_ms) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(&proc_coop_cond, &proc_coop_mutex, &deadline);
+}
+
+void proc_coop_broadcast() {
+	pthread_cond_broadcast(&proc_coop_cond);
+}
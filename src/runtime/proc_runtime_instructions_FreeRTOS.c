@@ -1,4 +1,5 @@
 #include "FreeRTOS.h"
+#include "task.h"
 
 #include <csp/csp.h>
 
@@ -6,31 +7,68 @@
 #include <csp_proc/proc_runtime.h>
 #include <csp_proc/proc_analyze.h>
 
-// NOTE: requires configNUM_THREAD_LOCAL_STORAGE_POINTERS > 0 in FreeRTOSConfig.h
-#ifndef TASK_STORAGE_RECURSION_DEPTH_INDEX
-#define TASK_STORAGE_RECURSION_DEPTH_INDEX 0
-#endif
+typedef struct proc_pull_batch_s proc_pull_batch_t;
 
 // forward declarations
-int proc_runtime_ifelse(proc_instruction_t * instruction);
-int proc_runtime_set(proc_instruction_t * instruction);
-int proc_runtime_unop(proc_instruction_t * instruction);
-int proc_runtime_binop(proc_instruction_t * instruction);
-int proc_runtime_call(proc_instruction_t * instruction, proc_analysis_t ** analysis, proc_t ** proc, int * i, if_else_flag_t * _if_else_flag);
+int proc_runtime_ifelse(proc_instruction_t * instruction, proc_instruction_link_t * instruction_link, int prefetched, proc_pull_batch_t * pull_batch);
+int proc_condition_is_local(proc_instruction_t * instruction, proc_instruction_link_t * instruction_link);
+uint32_t proc_block_poll_period(uint32_t period_ms, uint32_t remaining_ms);
+int __attribute__((weak)) proc_runtime_cancelled();  // only static runtime workers can be cancelled, others are deleted
+
+static TaskHandle_t proc_block_waiters[MAX_PROC_CONCURRENT];  // tasks blocked on local parameters
+
+void proc_runtime_param_changed() {
+	taskENTER_CRITICAL();
+	for (size_t i = 0; i < MAX_PROC_CONCURRENT; i++) {
+		if (proc_block_waiters[i] != NULL) {
+			xTaskNotifyGive(proc_block_waiters[i]);
+		}
+	}
+	taskEXIT_CRITICAL();
+}
+
+static int proc_block_waiter_register(TaskHandle_t task_handle) {
+	int ret = -1;
+	taskENTER_CRITICAL();
+	for (size_t i = 0; i < MAX_PROC_CONCURRENT; i++) {
+		if (proc_block_waiters[i] == NULL) {
+			proc_block_waiters[i] = task_handle;
+			ret = 0;
+			break;
+		}
+	}
+	taskEXIT_CRITICAL();
+	return ret;
+}
+
+static void proc_block_waiter_unregister(TaskHandle_t task_handle) {
+	taskENTER_CRITICAL();
+	for (size_t i = 0; i < MAX_PROC_CONCURRENT; i++) {
+		if (proc_block_waiters[i] == task_handle) {
+			proc_block_waiters[i] = NULL;
+		}
+	}
+	taskEXIT_CRITICAL();
+}
 
 /**
  * Execute a block instruction.
+ * Conditions on local parameters are re-evaluated when a change is notified (see proc_runtime_param_changed),
+ * conditions involving remote parameters are polled according to PROC_BLOCK_POLL_POLICY.
  *
  * @param instruction The instruction to execute
+ * @param instruction_link The linked form of the instruction (NULL if unavailable)
+ * @param pull_batch The pull batch of the execution, used to poll remote operands
  * @return int flag indicating the result of the block instruction (0 for success, -1 for error)
  */
-int proc_runtime_block(proc_instruction_t * instruction) {
+int proc_runtime_block(proc_instruction_t * instruction, proc_instruction_link_t * instruction_link, proc_pull_batch_t * pull_batch) {
 	if (instruction->type != PROC_BLOCK) {
 		csp_print("Invalid instruction type, expected PROC_BLOCK\n");
 		return -1;
 	}
 
-	TickType_t timeout_tick = xTaskGetTickCount() + pdMS_TO_TICKS(MAX_PROC_BLOCK_TIMEOUT_MS);
+	TickType_t start_tick = xTaskGetTickCount();
+	TickType_t timeout_ticks = pdMS_TO_TICKS(MAX_PROC_BLOCK_TIMEOUT_MS);
 
 	// Create a temporary ifelse instruction from the block instruction for compatibility with proc_runtime_ifelse
 	proc_instruction_t ifelse_instruction;
@@ -38,82 +76,48 @@ int proc_runtime_block(proc_instruction_t * instruction) {
 	ifelse_instruction.node = instruction->node;
 	ifelse_instruction.instruction.ifelse = instruction->instruction.block;
 
-	while (xTaskGetTickCount() < timeout_tick) {
-		int ifelse_result = proc_runtime_ifelse(&ifelse_instruction);
+	// Register before the first evaluation; notifications given in between are kept pending by the task
+	TaskHandle_t task_handle = xTaskGetCurrentTaskHandle();
+	int event_driven = proc_condition_is_local(instruction, instruction_link) && proc_block_waiter_register(task_handle) == 0;
+	if (event_driven) {
+		ulTaskNotifyTake(pdTRUE, 0);  // clear stale notifications
+	}
+
+	int ret = -1;
+	uint32_t period_ms = 0;
+	TickType_t elapsed_ticks;
+	while ((elapsed_ticks = xTaskGetTickCount() - start_tick) < timeout_ticks) {
+		if (proc_runtime_cancelled != NULL && proc_runtime_cancelled()) {
+			break;
+		}
+
+		int ifelse_result = proc_runtime_ifelse(&ifelse_instruction, instruction_link, 0, pull_batch);
 		if (ifelse_result == IF_ELSE_FLAG_ERR) {
 			csp_print("Error in if-else condition %d\n", ifelse_result);
-			return -1;
+			break;
 		} else if (ifelse_result == IF_ELSE_FLAG_TRUE) {
+			ret = 0;
 			break;
 		}
 
-		vTaskDelay(pdMS_TO_TICKS(MIN_PROC_BLOCK_PERIOD_MS));
-	}
-
-	if (xTaskGetTickCount() >= timeout_tick) {
-		csp_print("Timeout reached in proc_runtime_block\n");
-		return -1;
+		if (event_driven) {
+			TickType_t wait_ticks = timeout_ticks - elapsed_ticks;
+			if (PROC_BLOCK_EVENT_RECHECK_MS > 0 && pdMS_TO_TICKS(PROC_BLOCK_EVENT_RECHECK_MS) < wait_ticks) {
+				wait_ticks = pdMS_TO_TICKS(PROC_BLOCK_EVENT_RECHECK_MS);
+			}
+			ulTaskNotifyTake(pdTRUE, wait_ticks);
+		} else {
+			period_ms = proc_block_poll_period(period_ms, (timeout_ticks - elapsed_ticks) * portTICK_PERIOD_MS);
+			vTaskDelay(pdMS_TO_TICKS(period_ms));
+		}
 	}
 
-	return 0;
-}
-
-int proc_instructions_exec(proc_t * proc, proc_analysis_t * analysis) {
-	// NOTE: task local storage requires configNUM_THREAD_LOCAL_STORAGE_POINTERS > 0 in FreeRTOSConfig.h
-	int recursion_depth = (int)pvTaskGetThreadLocalStoragePointer(NULL, TASK_STORAGE_RECURSION_DEPTH_INDEX);
-	if (recursion_depth > MAX_PROC_RECURSION_DEPTH) {
-		csp_print("Error: maximum recursion depth exceeded\n");
-		return -1;
+	if (event_driven) {
+		proc_block_waiter_unregister(task_handle);
 	}
-	vTaskSetThreadLocalStoragePointer(NULL, TASK_STORAGE_RECURSION_DEPTH_INDEX, (void *)(recursion_depth + 1));
 
-	if_else_flag_t _if_else_flag = IF_ELSE_FLAG_NONE;
-	int ret = 0;
-
-	for (int i = 0; i < proc->instruction_count; i++) {
-
-		proc_instruction_t instruction = proc->instructions[i];
-
-		if (_if_else_flag == IF_ELSE_FLAG_FALSE) {  // skip instruction
-			_if_else_flag = IF_ELSE_FLAG_NONE;
-			continue;
-		} else if (_if_else_flag == IF_ELSE_FLAG_TRUE) {  // if-clause active, skip else-clause
-			_if_else_flag = IF_ELSE_FLAG_FALSE;
-		}
-
-		switch (instruction.type) {
-			case PROC_BLOCK:
-				ret = proc_runtime_block(&instruction);
-				break;
-			case PROC_IFELSE:
-				_if_else_flag = proc_runtime_ifelse(&instruction);
-				ret = (_if_else_flag <= IF_ELSE_FLAG_ERR) ? _if_else_flag : 0;
-				break;
-			case PROC_SET:
-				ret = proc_runtime_set(&instruction);
-				break;
-			case PROC_UNOP:
-				ret = proc_runtime_unop(&instruction);
-				break;
-			case PROC_BINOP:
-				ret = proc_runtime_binop(&instruction);
-				break;
-			case PROC_CALL:
-				ret = proc_runtime_call(&instruction, &analysis, &proc, &i, &_if_else_flag);
-				break;
-			case PROC_NOOP:
-				break;
-			default:
-				ret = -1;
-				break;
-		}
-
-		// Error handling - TODO: smarter way to differentiate between errors from different instructions - maybe return a struct with error code and instruction index?
-		if (ret != 0) {
-			vTaskSetThreadLocalStoragePointer(NULL, TASK_STORAGE_RECURSION_DEPTH_INDEX, (void *)(recursion_depth));
-			return ret;
-		}
+	if (ret != 0 && elapsed_ticks >= timeout_ticks) {
+		csp_print("Timeout reached in proc_runtime_block\n");
 	}
-	vTaskSetThreadLocalStoragePointer(NULL, TASK_STORAGE_RECURSION_DEPTH_INDEX, (void *)(recursion_depth));
 	return ret;
 }
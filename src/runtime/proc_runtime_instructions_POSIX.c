@@ -7,22 +7,73 @@
 #include <csp_proc/proc_runtime.h>
 #include <csp_proc/proc_analyze.h>
 
+typedef struct proc_pull_batch_s proc_pull_batch_t;
+
 // forward declarations
-int proc_runtime_ifelse(proc_instruction_t * instruction);
-int proc_runtime_set(proc_instruction_t * instruction);
-int proc_runtime_unop(proc_instruction_t * instruction);
-int proc_runtime_binop(proc_instruction_t * instruction);
-int proc_runtime_call(proc_instruction_t * instruction, proc_analysis_t ** analysis, proc_t ** proc, int * i, if_else_flag_t * _if_else_flag);
+int proc_runtime_ifelse(proc_instruction_t * instruction, proc_instruction_link_t * instruction_link, int prefetched, proc_pull_batch_t * pull_batch);
+int proc_condition_is_local(proc_instruction_t * instruction, proc_instruction_link_t * instruction_link);
+uint32_t proc_block_poll_period(uint32_t period_ms, uint32_t remaining_ms);
+int proc_runtime_cancelled();
+
+static pthread_mutex_t proc_param_change_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t proc_param_change_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t proc_param_change_seq = 0;  // incremented on every notified change
+
+void proc_runtime_param_changed() {
+	pthread_mutex_lock(&proc_param_change_mutex);
+	proc_param_change_seq++;
+	pthread_cond_broadcast(&proc_param_change_cond);
+	pthread_mutex_unlock(&proc_param_change_mutex);
+}
 
-extern pthread_key_t recursion_depth_key;
+static uint32_t proc_param_change_seq_get() {
+	pthread_mutex_lock(&proc_param_change_mutex);
+	uint32_t seq = proc_param_change_seq;
+	pthread_mutex_unlock(&proc_param_change_mutex);
+	return seq;
+}
+
+/**
+ * Wait until a parameter change is notified after `seq` was read, or until `deadline` (CLOCK_REALTIME).
+ */
+static void proc_param_change_wait(uint32_t seq, const struct timespec * deadline) {
+	pthread_mutex_lock(&proc_param_change_mutex);
+	while (proc_param_change_seq == seq) {
+		if (pthread_cond_timedwait(&proc_param_change_cond, &proc_param_change_mutex, deadline) != 0) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&proc_param_change_mutex);
+}
+
+static void timespec_add_ms(struct timespec * ts, uint32_t ms) {
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (ms % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static uint32_t timespec_diff_ms(const struct timespec * from, const struct timespec * to) {
+	return (uint32_t)((to->tv_sec - from->tv_sec) * 1000 + (to->tv_nsec - from->tv_nsec) / 1000000);
+}
+
+static int timespec_before(const struct timespec * a, const struct timespec * b) {
+	return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
 
 /**
  * Execute a block instruction.
+ * Conditions on local parameters are re-evaluated when a change is notified (see proc_runtime_param_changed),
+ * conditions involving remote parameters are polled according to PROC_BLOCK_POLL_POLICY.
  *
  * @param instruction The instruction to execute
+ * @param instruction_link The linked form of the instruction (NULL if unavailable)
+ * @param pull_batch The pull batch of the execution, used to poll remote operands
  * @return int flag indicating the result of the block instruction (0 for success, -1 for error)
  */
-int proc_runtime_block(proc_instruction_t * instruction) {
+int proc_runtime_block(proc_instruction_t * instruction, proc_instruction_link_t * instruction_link, proc_pull_batch_t * pull_batch) {
 	if (instruction->type != PROC_BLOCK) {
 		csp_print("Invalid instruction type, expected PROC_BLOCK\n");
 		return -1;
@@ -30,8 +81,7 @@ int proc_runtime_block(proc_instruction_t * instruction) {
 
 	struct timespec timeout;
 	clock_gettime(CLOCK_REALTIME, &timeout);
-	timeout.tv_sec += MAX_PROC_BLOCK_TIMEOUT_MS / 1000;
-	timeout.tv_nsec += (MAX_PROC_BLOCK_TIMEOUT_MS % 1000) * 1000000;
+	timespec_add_ms(&timeout, MAX_PROC_BLOCK_TIMEOUT_MS);
 
 	// Create a temporary ifelse instruction from the block instruction for compatibility with proc_runtime_ifelse
 	proc_instruction_t ifelse_instruction;
@@ -39,82 +89,42 @@ int proc_runtime_block(proc_instruction_t * instruction) {
 	ifelse_instruction.node = instruction->node;
 	ifelse_instruction.instruction.ifelse = instruction->instruction.block;
 
+	int event_driven = proc_condition_is_local(instruction, instruction_link);
+	uint32_t period_ms = 0;
+
 	struct timespec current_time;
-	while (clock_gettime(CLOCK_REALTIME, &current_time) == 0 && (current_time.tv_sec < timeout.tv_sec || (current_time.tv_sec == timeout.tv_sec && current_time.tv_nsec < timeout.tv_nsec))) {
-		int ifelse_result = proc_runtime_ifelse(&ifelse_instruction);
-		if (ifelse_result == IF_ELSE_FLAG_ERR) {
-			csp_print("Error in if-else condition %d\n", ifelse_result);
+	while (clock_gettime(CLOCK_REALTIME, &current_time) == 0 && timespec_before(&current_time, &timeout)) {
+		if (proc_runtime_cancelled()) {
 			return -1;
-		} else if (ifelse_result == IF_ELSE_FLAG_TRUE) {
-			break;
 		}
 
-		struct timespec sleep_time = {0, MIN_PROC_BLOCK_PERIOD_MS * 1000000};
-		nanosleep(&sleep_time, NULL);
-	}
-
-	if (clock_gettime(CLOCK_REALTIME, &current_time) == 0 && (current_time.tv_sec > timeout.tv_sec || (current_time.tv_sec == timeout.tv_sec && current_time.tv_nsec >= timeout.tv_nsec))) {
-		csp_print("Timeout reached in proc_runtime_block\n");
-		return -1;
-	}
-
-	return 0;
-}
-
-int proc_instructions_exec(proc_t * proc, proc_analysis_t * analysis) {
-	int recursion_depth = (int)pthread_getspecific(recursion_depth_key);
-	if (recursion_depth > MAX_PROC_RECURSION_DEPTH) {
-		csp_print("Error: maximum recursion depth exceeded\n");
-		return -1;
-	}
-	pthread_setspecific(recursion_depth_key, (void *)(recursion_depth + 1));
-
-	if_else_flag_t _if_else_flag = IF_ELSE_FLAG_NONE;
-	int ret = 0;
-
-	for (int i = 0; i < proc->instruction_count; i++) {
-
-		proc_instruction_t instruction = proc->instructions[i];
-
-		if (_if_else_flag == IF_ELSE_FLAG_FALSE) {  // skip instruction
-			_if_else_flag = IF_ELSE_FLAG_NONE;
-			continue;
-		} else if (_if_else_flag == IF_ELSE_FLAG_TRUE) {  // if-clause active, skip else-clause
-			_if_else_flag = IF_ELSE_FLAG_FALSE;
-		}
+		uint32_t seq = event_driven ? proc_param_change_seq_get() : 0;  // read before evaluating, so a change during evaluation isn't missed
 
-		switch (instruction.type) {
-			case PROC_BLOCK:
-				ret = proc_runtime_block(&instruction);
-				break;
-			case PROC_IFELSE:
-				_if_else_flag = proc_runtime_ifelse(&instruction);
-				ret = (_if_else_flag <= IF_ELSE_FLAG_ERR) ? _if_else_flag : 0;
-				break;
-			case PROC_SET:
-				ret = proc_runtime_set(&instruction);
-				break;
-			case PROC_UNOP:
-				ret = proc_runtime_unop(&instruction);
-				break;
-			case PROC_BINOP:
-				ret = proc_runtime_binop(&instruction);
-				break;
-			case PROC_CALL:
-				ret = proc_runtime_call(&instruction, &analysis, &proc, &i, &_if_else_flag);
-				break;
-			case PROC_NOOP:
-				break;
-			default:
-				ret = -1;
-				break;
+		int ifelse_result = proc_runtime_ifelse(&ifelse_instruction, instruction_link, 0, pull_batch);
+		if (ifelse_result == IF_ELSE_FLAG_ERR) {
+			csp_print("Error in if-else condition %d\n", ifelse_result);
+			return -1;
+		} else if (ifelse_result == IF_ELSE_FLAG_TRUE) {
+			return 0;
 		}
 
-		if (ret != 0) {
-			pthread_setspecific(recursion_depth_key, (void *)(recursion_depth));
-			return ret;
+		if (event_driven) {
+			struct timespec wake_time = timeout;
+			if (PROC_BLOCK_EVENT_RECHECK_MS > 0) {
+				struct timespec recheck_time = current_time;
+				timespec_add_ms(&recheck_time, PROC_BLOCK_EVENT_RECHECK_MS);
+				if (timespec_before(&recheck_time, &wake_time)) {
+					wake_time = recheck_time;
+				}
+			}
+			proc_param_change_wait(seq, &wake_time);
+		} else {
+			period_ms = proc_block_poll_period(period_ms, timespec_diff_ms(&current_time, &timeout));
+			struct timespec sleep_time = {period_ms / 1000, (period_ms % 1000) * 1000000};
+			nanosleep(&sleep_time, NULL);
 		}
 	}
-	pthread_setspecific(recursion_depth_key, (void *)(recursion_depth));
-	return ret;
+
+	csp_print("Timeout reached in proc_runtime_block\n");
+	return -1;
 }
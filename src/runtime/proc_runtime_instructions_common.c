@@ -1,8 +1,12 @@
 #include <csp/csp.h>
 #include <csp/csp_iflist.h>
+#include <csp/arch/csp_time.h>
 #include <param/param.h>
 #include <param/param_client.h>
+#include <param/param_queue.h>
+#include <param/param_server.h>
 #include <param/param_string.h>
+#include <string.h>
 
 #include <csp_proc/proc_types.h>
 #include <csp_proc/proc_runtime.h>
@@ -21,8 +25,45 @@
 #define PROC_FLOAT_EPSILON (1e-6)
 #endif
 
-// Forward declaration
+#ifndef PROC_PULL_QUEUE_SIZE
+#define PROC_PULL_QUEUE_SIZE (200)
+#endif
+
+#ifndef PROC_PULL_MAX_NODES
+#define PROC_PULL_MAX_NODES (2)
+#endif
+
+#ifndef PROC_BLOCK_PULL_CHECK_MS
+#define PROC_BLOCK_PULL_CHECK_MS (5)
+#endif  // how often a cooperative run checks for the responses to the pull of a remote block condition
+
+#ifndef PROC_PUSH_WRITE_BACK
+#define PROC_PUSH_WRITE_BACK (0)
+#endif
+
+#ifndef PROC_PUSH_QUEUE_SIZE
+#define PROC_PUSH_QUEUE_SIZE (200)
+#endif
+
+#ifndef PROC_RUNTIME_FRAMES
+#define PROC_RUNTIME_FRAMES (8U)
+#endif  // call frames allocated when a run starts, grown on demand up to MAX_PROC_RECURSION_DEPTH
+
+typedef struct proc_push_batch_s proc_push_batch_t;
+typedef struct proc_pull_batch_s proc_pull_batch_t;
+
+// Forward declarations
 int proc_instructions_exec(proc_t * proc, proc_analysis_t * analysis);
+int proc_runtime_link(proc_t * proc);
+uint32_t proc_param_cache_get_epoch();
+int proc_remote_list_is_fresh(uint16_t node);
+void proc_remote_list_mark_downloaded(uint16_t node);
+int proc_param_cache_get(const char * name, int node, param_t ** param, int * offset);
+void proc_param_cache_put(const char * name, int node, param_t * param, int offset);
+proc_instruction_link_t * proc_get_instruction_link(proc_t * proc, int i);
+int __attribute__((weak)) proc_runtime_block(proc_instruction_t * instruction, proc_instruction_link_t * instruction_link, proc_pull_batch_t * pull_batch);
+int __attribute__((weak)) proc_runtime_cancelled();
+
 
 /**
  * Simplified parameter type for performing arithmetic & logical operations.
@@ -179,15 +220,24 @@ int proc_param_scan_offset(char * arg) {
 	return offset;
 }
 
-param_t * proc_fetch_param(char * param_name, int node) {
+/**
+ * Resolve an operand name to a parameter in the libparam list.
+ *
+ * @param param_name The operand name, optionally suffixed by an array index, e.g. "param[2]"
+ * @param node The node the operand is located on
+ * @param offset Populated with the parsed array offset (-1 if not an array element)
+ * @param allow_download Download the parameter list of a remote node before searching it
+ * @return The resolved parameter, or NULL if not found
+ */
+static param_t * proc_resolve_param(char * param_name, int node, int * offset, int allow_download) {
 	int inf_loop_guard = 0;
 	param_t * param = NULL;
 
 	// Check if parameter is an array element
 	char * param_name_copy = proc_strdup(param_name);
-	int offset = proc_param_scan_offset(param_name_copy);
-	if (offset != -1) {
-		int index_length = snprintf(NULL, 0, "%d", offset);
+	*offset = proc_param_scan_offset(param_name_copy);
+	if (*offset != -1) {
+		int index_length = snprintf(NULL, 0, "%d", *offset);
 		param_name_copy[strlen(param_name_copy) - (index_length + 2)] = '\0';
 	}
 
@@ -203,12 +253,15 @@ param_t * proc_fetch_param(char * param_name, int node) {
 		}
 	}
 
-	if (is_remote_param) {  // TODO: Don't download list every time
+	int downloaded = 0;
+	if (is_remote_param && allow_download && !proc_remote_list_is_fresh(node)) {
 		int remote_params = param_list_download(node, PARAM_REMOTE_TIMEOUT_MS, 2, 1);
 		if (remote_params < 0) {
 			proc_free(param_name_copy);
 			return NULL;
 		}
+		proc_remote_list_mark_downloaded(node);
+		downloaded = 1;
 	}
 
 	param_list_iterator i = {};
@@ -229,26 +282,449 @@ param_t * proc_fetch_param(char * param_name, int node) {
 			continue;
 		}
 
-		if (param->node == 0) {
+		break;
+	}
+
+	proc_free(param_name_copy);
+
+	if (param == NULL && is_remote_param && allow_download && !downloaded) {
+		// The parameter may have been added on the remote node since its list was downloaded, refresh it once
+		proc_runtime_remote_list_invalidate(node);
+		return proc_resolve_param(param_name, node, offset, allow_download);
+	}
+
+	return param;
+}
+
+/**
+ * Look up the parameter referenced by an operand without fetching its value.
+ * Resolutions are cached (see proc_runtime_param_cache.c), so only the first lookup of a given operand scans the parameter list.
+ * Operands not found on a remote node are cached as well, so they don't download its list again on every lookup.
+ *
+ * @param param_name The operand name, optionally suffixed by an array index, e.g. "param[2]"
+ * @param node The node the operand is located on
+ * @param offset Populated with the parsed array offset (-1 if not an array element)
+ * @param allow_download Download the parameter list of a remote node if the operand is not cached
+ * @return The parameter, or NULL if not found
+ */
+param_t * proc_lookup_param(char * param_name, int node, int * offset, int allow_download) {
+	param_t * param = NULL;
+	if (!proc_param_cache_get(param_name, node, &param, offset)) {
+		param = proc_resolve_param(param_name, node, offset, allow_download);
+		if (param == NULL && !allow_download) {
+			return NULL;  // a remote list may not have been searched
+		}
+		proc_param_cache_put(param_name, node, param, *offset);  // a miss is only cached after searching a downloaded remote list
+	}
+	return param;
+}
+
+/**
+ * Resolve an operand, using its linked form when available and falling back to a lookup by name.
+ *
+ * @param param_name The operand name
+ * @param operand_link The linked operand (may be NULL)
+ * @param node The node the operand is located on
+ * @param offset Populated with the array offset (-1 if not an array element)
+ * @return The parameter, or NULL if not found
+ */
+param_t * proc_resolve_operand(char * param_name, proc_operand_link_t * operand_link, int node, int * offset) {
+	if (operand_link != NULL && operand_link->param != NULL) {
+		*offset = operand_link->offset;
+		return operand_link->param;
+	}
+	return proc_lookup_param(param_name, node, offset, 1);
+}
+
+static inline proc_operand_link_t * proc_operand_link(proc_instruction_link_t * instruction_link, int operand) {
+	return (instruction_link != NULL) ? &instruction_link->operands[operand] : NULL;
+}
+
+/**
+ * In write-back mode (PROC_PUSH_WRITE_BACK), consecutive remote writes to the same node are collected
+ * in a libparam queue and pushed together when the node changes, before any remote read,
+ * and at block, if-else and call boundaries and the end of the procedure.
+ */
+struct proc_push_batch_s {
+	param_queue_t queue;
+	uint16_t node;
+	char buffer[PROC_PUSH_QUEUE_SIZE];
+};
+
+/**
+ * Create a write-back buffer for one procedure execution.
+ *
+ * @return The buffer, or NULL if write-back is disabled (writes are then pushed immediately)
+ */
+proc_push_batch_t * proc_push_batch_create() {
+	if (!PROC_PUSH_WRITE_BACK) {
+		return NULL;
+	}
+	proc_push_batch_t * push_batch = proc_malloc(sizeof(proc_push_batch_t));
+	if (push_batch == NULL) {
+		csp_print("Error allocating memory for write-back buffer, pushing immediately\n");
+		return NULL;
+	}
+	param_queue_init(&push_batch->queue, push_batch->buffer, PROC_PUSH_QUEUE_SIZE, 0, PARAM_QUEUE_TYPE_SET, 2);
+	push_batch->node = 0;
+	return push_batch;
+}
+
+void proc_push_batch_destroy(proc_push_batch_t * push_batch) {
+	proc_free(push_batch);
+}
+
+/**
+ * Push all buffered writes.
+ *
+ * @param push_batch The write-back buffer (may be NULL)
+ * @return 0 on success, -1 if the push was not acknowledged
+ */
+int proc_push_batch_flush(proc_push_batch_t * push_batch) {
+	if (push_batch == NULL || push_batch->queue.used == 0) {
+		return 0;
+	}
+	int ret = param_push_queue(&push_batch->queue, 0, push_batch->node, PARAM_REMOTE_TIMEOUT_MS, 0, PARAM_ACK_ON_PUSH);
+	param_queue_init(&push_batch->queue, push_batch->buffer, PROC_PUSH_QUEUE_SIZE, 0, PARAM_QUEUE_TYPE_SET, 2);
+	if (ret < 0 && PARAM_ACK_ON_PUSH) {
+		csp_print("No response\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int proc_push_batch_add(proc_push_batch_t * push_batch, param_t * param, int offset, void * value) {
+	if (push_batch->queue.used != 0 && push_batch->node != param->node) {
+		if (proc_push_batch_flush(push_batch) != 0) {
+			return -1;
+		}
+	}
+	push_batch->node = param->node;
+
+	if (param_queue_add(&push_batch->queue, param, offset, value) < 0) {
+		// Queue is full, push what has been collected so far and start over
+		if (proc_push_batch_flush(push_batch) != 0) {
+			return -1;
+		}
+		if (param_queue_add(&push_batch->queue, param, offset, value) < 0) {
+			csp_print("Failed to queue %s\n", param->name);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Remote reads are collected in one libparam queue per node and pulled together,
+ * instead of issuing a param_pull_single round trip per operand.
+ */
+typedef struct {
+	param_queue_t queue;
+	uint16_t node;
+	char buffer[PROC_PULL_QUEUE_SIZE];
+} proc_pull_queue_t;
+
+struct proc_pull_batch_s {
+	proc_pull_queue_t queues[PROC_PULL_MAX_NODES];
+	int queue_count;
+	proc_push_batch_t * pending_writes;  // pushed before pulling, so reads observe earlier writes
+};
+
+/**
+ * Create the pull batch of one procedure execution.
+ * It is reused for every pull of the run, as its queue buffers are too large for the stack of a run task.
+ *
+ * @param pending_writes The write-back buffer of the execution (may be NULL)
+ * @return The batch, or NULL on allocation failure
+ */
+static proc_pull_batch_t * proc_pull_batch_create(proc_push_batch_t * pending_writes) {
+	proc_pull_batch_t * batch = proc_malloc(sizeof(proc_pull_batch_t));
+	if (batch == NULL) {
+		csp_print("Error allocating memory for pull batch\n");
+		return NULL;
+	}
+	batch->queue_count = 0;
+	batch->pending_writes = pending_writes;
+	return batch;
+}
+
+static int proc_pull_queue_flush(proc_pull_batch_t * batch, proc_pull_queue_t * pull_queue) {
+	if (pull_queue->queue.used == 0) {
+		return 0;
+	}
+	if (proc_push_batch_flush(batch->pending_writes) != 0) {
+		return -1;
+	}
+	int ret = param_pull_queue(&pull_queue->queue, CSP_PRIO_NORM, 0, pull_queue->node, PARAM_REMOTE_TIMEOUT_MS);
+	param_queue_init(&pull_queue->queue, pull_queue->buffer, PROC_PULL_QUEUE_SIZE, 0, PARAM_QUEUE_TYPE_GET, 2);
+	return (ret < 0) ? -1 : 0;
+}
+
+/**
+ * Send the pull request of a queue without waiting for the responses, which are applied by proc_pull_conn_receive.
+ * Used by cooperative runs, which must not block the scheduler while a remote node answers.
+ *
+ * @return The connection the responses arrive on, or NULL on failure
+ */
+static csp_conn_t * proc_pull_queue_send(proc_pull_queue_t * pull_queue) {
+	csp_conn_t * conn = NULL;
+	csp_packet_t * packet = csp_buffer_get(PROC_PULL_QUEUE_SIZE + 2);
+	if (packet == NULL) {
+		csp_print("Failed to get buffer for pull request\n");
+	} else if ((conn = csp_connect(CSP_PRIO_NORM, pull_queue->node, PARAM_PORT_SERVER, 0, CSP_O_CRC32)) == NULL) {
+		csp_buffer_free(packet);
+	} else {
+		packet->data[0] = PARAM_PULL_REQUEST_V2;
+		packet->data[1] = 0;
+		memcpy(&packet->data[2], pull_queue->queue.buffer, pull_queue->queue.used);
+		packet->length = pull_queue->queue.used + 2;
+		csp_send(conn, packet);
+	}
+	param_queue_init(&pull_queue->queue, pull_queue->buffer, PROC_PULL_QUEUE_SIZE, 0, PARAM_QUEUE_TYPE_GET, 2);
+	return conn;
+}
+
+/**
+ * Apply the responses that have arrived for a pull request sent by proc_pull_queue_send, without waiting for more.
+ *
+ * @return 1 once the last response has been applied, 0 while more are expected
+ */
+static int proc_pull_conn_receive(csp_conn_t * conn) {
+	csp_packet_t * packet;
+	while ((packet = csp_read(conn, 0)) != NULL) {
+		int end = 1;
+		if (packet->length >= 2) {
+			end = (packet->data[1] == PARAM_FLAG_END);
+			param_queue_t queue;
+			param_queue_init(&queue, &packet->data[2], packet->length - 2, packet->length - 2, PARAM_QUEUE_TYPE_SET, 2);
+			param_queue_apply(&queue, 0, packet->id.src);
+		}
+		csp_buffer_free(packet);
+		if (end) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int proc_pull_batch_flush(proc_pull_batch_t * batch) {
+	int ret = 0;
+	for (int i = 0; i < batch->queue_count; i++) {
+		if (proc_pull_queue_flush(batch, &batch->queues[i]) != 0) {
+			ret = -1;
+		}
+	}
+	batch->queue_count = 0;
+	return ret;
+}
+
+static int proc_pull_batch_add(proc_pull_batch_t * batch, param_t * param, int offset) {
+	if (param->node == 0) {  // Local parameter, nothing to pull
+		return 0;
+	}
+
+	proc_pull_queue_t * pull_queue = NULL;
+	for (int i = 0; i < batch->queue_count; i++) {
+		if (batch->queues[i].node == param->node) {
+			pull_queue = &batch->queues[i];
 			break;
 		}
+	}
 
-		if (param_pull_single(param, offset, CSP_PRIO_NORM, 0, node, PARAM_REMOTE_TIMEOUT_MS, 2) < 0) {
-			proc_free(param_name_copy);
-			return NULL;
+	if (pull_queue == NULL) {
+		if (batch->queue_count < PROC_PULL_MAX_NODES) {
+			pull_queue = &batch->queues[batch->queue_count++];
+			param_queue_init(&pull_queue->queue, pull_queue->buffer, PROC_PULL_QUEUE_SIZE, 0, PARAM_QUEUE_TYPE_GET, 2);
+		} else {  // Out of queues, pull the first one early and reuse it for the new node
+			pull_queue = &batch->queues[0];
+			if (proc_pull_queue_flush(batch, pull_queue) != 0) {
+				return -1;
+			}
 		}
+		pull_queue->node = param->node;
+	}
 
-		break;
+	if (param_queue_add(&pull_queue->queue, param, offset, NULL) < 0) {
+		// Queue is full, pull what has been collected so far and start over
+		if (proc_pull_queue_flush(batch, pull_queue) != 0 || param_queue_add(&pull_queue->queue, param, offset, NULL) < 0) {
+			return -1;
+		}
 	}
+	return 0;
+}
 
-	proc_free(param_name_copy);
-	return param;
+static int proc_pull_batch_add_operand(proc_pull_batch_t * batch, char * param_name, proc_operand_link_t * operand_link, int node) {
+	int offset;
+	param_t * param = proc_resolve_operand(param_name, operand_link, node, &offset);
+	if (param == NULL) {
+		csp_print("Failed to fetch %s\n", param_name);
+		return -1;
+	}
+	return proc_pull_batch_add(batch, param, offset);
+}
+
+/**
+ * Add the remote operands read by an instruction to a pull batch.
+ */
+static int proc_pull_batch_add_instruction(proc_pull_batch_t * batch, proc_instruction_t * instruction, proc_instruction_link_t * instruction_link) {
+	switch (instruction->type) {
+		case PROC_BLOCK:
+		case PROC_IFELSE:
+			if (proc_pull_batch_add_operand(batch, instruction->instruction.block.param_a, proc_operand_link(instruction_link, PROC_LINK_OPERAND_A), instruction->node) != 0 ||
+				proc_pull_batch_add_operand(batch, instruction->instruction.block.param_b, proc_operand_link(instruction_link, PROC_LINK_OPERAND_B), instruction->node) != 0) {
+				return -1;
+			}
+			break;
+		case PROC_UNOP: {
+			int fetch_node = (instruction->instruction.unop.op == OP_RMT) ? 0 : instruction->node;
+			if (proc_pull_batch_add_operand(batch, instruction->instruction.unop.param, proc_operand_link(instruction_link, PROC_LINK_OPERAND_A), fetch_node) != 0) {
+				return -1;
+			}
+			break;
+		}
+		case PROC_BINOP:
+			if (proc_pull_batch_add_operand(batch, instruction->instruction.binop.param_a, proc_operand_link(instruction_link, PROC_LINK_OPERAND_A), instruction->node) != 0 ||
+				proc_pull_batch_add_operand(batch, instruction->instruction.binop.param_b, proc_operand_link(instruction_link, PROC_LINK_OPERAND_B), instruction->node) != 0) {
+				return -1;
+			}
+			break;
+		default:
+			break;
+	}
+	return 0;
+}
+
+/**
+ * Pull the current values of all remote operands read by an instruction, with one queue pull per node.
+ * Without the pull batch of an execution, a temporary one is allocated.
+ */
+static int proc_pull_instruction_operands(proc_instruction_t * instruction, proc_instruction_link_t * instruction_link, proc_pull_batch_t * pull_batch) {
+	proc_pull_batch_t * batch = (pull_batch != NULL) ? pull_batch : proc_pull_batch_create(NULL);
+	if (batch == NULL) {
+		return -1;
+	}
+	int ret = 0;
+	if (proc_pull_batch_add_instruction(batch, instruction, instruction_link) != 0) {
+		batch->queue_count = 0;  // drop what was collected
+		ret = -1;
+	} else {
+		ret = proc_pull_batch_flush(batch);
+	}
+	if (batch != pull_batch) {
+		proc_free(batch);
+	}
+	return ret;
+}
+
+/**
+ * Check whether an instruction writes to a remote parameter (unresolvable results are assumed remote).
+ */
+static int proc_instruction_writes_remote(proc_instruction_t * instruction, proc_instruction_link_t * instruction_link) {
+	char * result_name;
+	int result_node = instruction->node;
+	proc_operand_link_t * result_link;
+	switch (instruction->type) {
+		case PROC_SET:
+			result_name = instruction->instruction.set.param;
+			result_link = proc_operand_link(instruction_link, PROC_LINK_OPERAND_A);
+			break;
+		case PROC_UNOP:
+			result_name = instruction->instruction.unop.result;
+			result_node = (instruction->instruction.unop.op == OP_RMT) ? instruction->node : 0;
+			result_link = proc_operand_link(instruction_link, PROC_LINK_OPERAND_RESULT);
+			break;
+		case PROC_BINOP:
+			result_name = instruction->instruction.binop.result;
+			result_link = proc_operand_link(instruction_link, PROC_LINK_OPERAND_RESULT);
+			break;
+		default:
+			return 0;
+	}
+
+	int offset;
+	param_t * param = proc_resolve_operand(result_name, result_link, result_node, &offset);
+	return param == NULL || param->node != 0;
+}
+
+/**
+ * Prefetch the remote operands of a straight-line run of instructions with one queue pull per node.
+ * The run starts at `start` and ends after the first if-else or remote write, or before the first block or call
+ * (blocks poll their own operands, and a called procedure may write to anything).
+ *
+ * @param proc The procedure being executed
+ * @param start The index of the first instruction of the run
+ * @param pull_batch The pull batch of the execution
+ * @return The index of the first instruction not covered by the prefetch (start if nothing was prefetched)
+ */
+int proc_runtime_prefetch(proc_t * proc, int start, proc_pull_batch_t * pull_batch) {
+	int end = start;
+	while (end < proc->instruction_count) {
+		proc_instruction_t * instruction = &proc->instructions[end];
+		if (instruction->type == PROC_BLOCK || instruction->type == PROC_CALL) {
+			break;
+		}
+
+		proc_instruction_link_t * instruction_link = proc_get_instruction_link(proc, end);
+		if (proc_pull_batch_add_instruction(pull_batch, instruction, instruction_link) != 0) {
+			pull_batch->queue_count = 0;
+			return start;  // Let the instruction handlers pull and report the failure
+		}
+		end++;
+
+		if (instruction->type == PROC_IFELSE || proc_instruction_writes_remote(instruction, instruction_link)) {
+			break;
+		}
+	}
+
+	if (proc_pull_batch_flush(pull_batch) != 0) {
+		return start;
+	}
+	return end;
+}
+
+/**
+ * Check whether both operands of a block or if-else condition are local parameters,
+ * in which case the condition can only change through a local write.
+ */
+int proc_condition_is_local(proc_instruction_t * instruction, proc_instruction_link_t * instruction_link) {
+	int offset;
+	param_t * param_a = proc_resolve_operand(instruction->instruction.block.param_a, proc_operand_link(instruction_link, PROC_LINK_OPERAND_A), instruction->node, &offset);
+	param_t * param_b = proc_resolve_operand(instruction->instruction.block.param_b, proc_operand_link(instruction_link, PROC_LINK_OPERAND_B), instruction->node, &offset);
+	return param_a != NULL && param_b != NULL && param_a->node == 0 && param_b->node == 0;
 }
 
-int fetch_operand_param_pair(char * param_name, operand_param_pair_t * pair, int node) {
-	int offset = proc_param_scan_offset(param_name);
+static uint32_t proc_block_polls = 0;
+
+uint32_t proc_runtime_block_poll_count() {
+	return __atomic_load_n(&proc_block_polls, __ATOMIC_RELAXED);
+}
 
-	pair->param = proc_fetch_param(param_name, node);
+/**
+ * Account for one poll of a remote block condition and get the time to wait before the next one.
+ * Waits are never longer than the time remaining until the block times out.
+ *
+ * @param period_ms The previous period (0 before the first poll)
+ * @param remaining_ms Time left until the block times out
+ * @return The period to wait before polling again
+ */
+uint32_t proc_block_poll_period(uint32_t period_ms, uint32_t remaining_ms) {
+	__atomic_fetch_add(&proc_block_polls, 1, __ATOMIC_RELAXED);
+
+	if (PROC_BLOCK_POLL_POLICY == PROC_BLOCK_POLL_BACKOFF && period_ms != 0) {
+		period_ms = (period_ms >= MAX_PROC_BLOCK_PERIOD_MS / PROC_BLOCK_POLL_BACKOFF_FACTOR) ? MAX_PROC_BLOCK_PERIOD_MS : period_ms * PROC_BLOCK_POLL_BACKOFF_FACTOR;
+	} else {
+		period_ms = MIN_PROC_BLOCK_PERIOD_MS;
+	}
+
+	return (period_ms < remaining_ms) ? period_ms : remaining_ms;
+}
+
+/**
+ * Resolve an operand and parse its current value. Remote operands must already have been pulled.
+ */
+int fetch_operand_param_pair(char * param_name, proc_operand_link_t * operand_link, operand_param_pair_t * pair, int node) {
+	int offset;
+	pair->param = proc_resolve_operand(param_name, operand_link, node, &offset);
 	if (pair->param == NULL) {
 		csp_print("Failed to fetch %s\n", param_name);
 		return -1;
@@ -314,15 +790,22 @@ char * proc_value_str_to_valuebuf(param_t * param, char * valuebuf, char * value
 	return 0;
 }
 
-int proc_set_param(char * param_name, operand_t * operand, char * value_str, int node) {
+/**
+ * Write a value to the parameter referenced by an operand.
+ * The value is given either as an operand, a string to be parsed, or an already parsed value buffer.
+ * Remote writes are buffered in push_batch when given, and pushed immediately otherwise.
+ */
+int proc_set_param(char * param_name, proc_operand_link_t * operand_link, operand_t * operand, char * value_str, void * value, int node, proc_push_batch_t * push_batch) {
 	param_t * param = NULL;
 
-	if (operand == NULL && value_str == NULL) {
+	if (operand == NULL && value_str == NULL && value == NULL) {
 		csp_print("No value provided\n");
 		return -1;
 	}
 
-	param = proc_fetch_param(param_name, node);
+	// The current value is about to be overwritten, so there is no need to pull it
+	int offset;
+	param = proc_resolve_operand(param_name, operand_link, node, &offset);
 	if (param == NULL) {
 		// TODO: add ability to add new parameters?
 		csp_print("Failed to fetch %s\n", param_name);
@@ -335,26 +818,35 @@ int proc_set_param(char * param_name, operand_t * operand, char * value_str, int
 	}
 
 	char valuebuf[128] __attribute__((aligned(16))) = {};
-	int ret = (value_str != NULL) ? proc_value_str_to_valuebuf(param, valuebuf, value_str) : operand_to_valuebuf(operand, valuebuf);
-	if (ret != 0) {
-		return ret;
+	if (value == NULL) {
+		int ret = (value_str != NULL) ? proc_value_str_to_valuebuf(param, valuebuf, value_str) : operand_to_valuebuf(operand, valuebuf);
+		if (ret != 0) {
+			return ret;
+		}
+		value = valuebuf;
 	}
 
-	int offset = proc_param_scan_offset(param_name);
-
 	if (param->node == 0) {  // Local parameter
 		if (offset < 0) {
 			for (int i = 0; i < param->array_size; i++) {
-				param_set(param, i, valuebuf);
+				param_set(param, i, value);
 			}
 		} else {
-			param_set(param, offset, valuebuf);
+			param_set(param, offset, value);
 		}
+		proc_runtime_param_changed();
 	} else {  // Remote parameter
 		csp_timestamp_t time_now;
 		csp_clock_get_time(&time_now);
 		*param->timestamp = 0;
-		if (param_push_single(param, offset, valuebuf, 0, node, PARAM_REMOTE_TIMEOUT_MS, 2, PARAM_ACK_ON_PUSH) < 0 && PARAM_ACK_ON_PUSH) {
+		if (push_batch != NULL && (offset >= 0 || param->array_size <= 1)) {
+			return proc_push_batch_add(push_batch, param, offset, value);
+		}
+		// Whole-array writes are pushed immediately, after anything buffered before them
+		if (proc_push_batch_flush(push_batch) != 0) {
+			return -1;
+		}
+		if (param_push_single(param, offset, value, 0, param->node, PARAM_REMOTE_TIMEOUT_MS, 2, PARAM_ACK_ON_PUSH) < 0 && PARAM_ACK_ON_PUSH) {
 			csp_print("No response\n");
 			return -1;
 		}
@@ -367,32 +859,39 @@ int proc_set_param(char * param_name, operand_t * operand, char * value_str, int
  * Execute an if-else instruction.
  *
  * @param instruction The instruction to execute
+ * @param instruction_link The linked form of the instruction (NULL if unavailable)
+ * @param prefetched Whether the remote operands have already been pulled by proc_runtime_prefetch
+ * @param pull_batch The pull batch of the execution (may be NULL)
  * @return if_else_flag_t flag indicating the result of the if-else instruction (true, false, error)
  */
-int proc_runtime_ifelse(proc_instruction_t * instruction) {
+int proc_runtime_ifelse(proc_instruction_t * instruction, proc_instruction_link_t * instruction_link, int prefetched, proc_pull_batch_t * pull_batch) {
 	if (instruction->type != PROC_IFELSE) {
 		csp_print("Invalid instruction type, expected PROC_IFELSE\n");
 		return IF_ELSE_FLAG_ERR;
 	}
 
-	param_t * param_a = proc_fetch_param(instruction->instruction.ifelse.param_a, instruction->node);
-	param_t * param_b = proc_fetch_param(instruction->instruction.ifelse.param_b, instruction->node);
-
-	if (param_a == NULL || param_b == NULL || param_a->type == PARAM_TYPE_INVALID || param_b->type == PARAM_TYPE_DATA) {
-		csp_print("Failed to fetch params or invalid param type\n");
+	if (!prefetched && proc_pull_instruction_operands(instruction, instruction_link, pull_batch) != 0) {
+		csp_print("Failed to fetch params\n");
 		return IF_ELSE_FLAG_ERR;
 	}
 
 	operand_param_pair_t op_par_pair_a, op_par_pair_b;
-	if (fetch_operand_param_pair(instruction->instruction.ifelse.param_a, &op_par_pair_a, instruction->node) != 0) {
+	if (fetch_operand_param_pair(instruction->instruction.ifelse.param_a, proc_operand_link(instruction_link, PROC_LINK_OPERAND_A), &op_par_pair_a, instruction->node) != 0) {
 		csp_print("Failed to fetch operand A\n");
 		return IF_ELSE_FLAG_ERR;
 	}
-	if (fetch_operand_param_pair(instruction->instruction.ifelse.param_b, &op_par_pair_b, instruction->node) != 0) {
+	if (fetch_operand_param_pair(instruction->instruction.ifelse.param_b, proc_operand_link(instruction_link, PROC_LINK_OPERAND_B), &op_par_pair_b, instruction->node) != 0) {
 		csp_print("Failed to fetch operand B\n");
 		return IF_ELSE_FLAG_ERR;
 	}
 
+	param_t * param_a = op_par_pair_a.param;
+	param_t * param_b = op_par_pair_b.param;
+	if (param_a->type == PARAM_TYPE_INVALID || param_b->type == PARAM_TYPE_DATA) {
+		csp_print("Invalid param type\n");
+		return IF_ELSE_FLAG_ERR;
+	}
+
 	switch (op_par_pair_a.operand.type) {
 		case OPERAND_TYPE_UINT: {
 			if (op_par_pair_b.operand.type != OPERAND_TYPE_UINT) {
@@ -490,19 +989,27 @@ int proc_runtime_ifelse(proc_instruction_t * instruction) {
 	return IF_ELSE_FLAG_ERR;
 }
 
-int proc_runtime_set(proc_instruction_t * instruction) {
+int proc_runtime_set(proc_instruction_t * instruction, proc_instruction_link_t * instruction_link, proc_push_batch_t * push_batch) {
 	if (instruction->type != PROC_SET) {
 		csp_print("Invalid instruction type, expected PROC_SET\n");
 		return -1;
 	}
 
+	void * value = NULL;
+	if (instruction_link != NULL && instruction_link->value_offset != 0) {
+		value = (char *)instruction_link + instruction_link->value_offset;
+	}
+
 	return proc_set_param(instruction->instruction.set.param,
+						  proc_operand_link(instruction_link, PROC_LINK_OPERAND_A),
 						  NULL,
 						  instruction->instruction.set.value,
-						  instruction->node);
+						  value,
+						  instruction->node,
+						  push_batch);
 }
 
-int proc_runtime_unop(proc_instruction_t * instruction) {
+int proc_runtime_unop(proc_instruction_t * instruction, proc_instruction_link_t * instruction_link, int prefetched, proc_pull_batch_t * pull_batch, proc_push_batch_t * push_batch) {
 	if (instruction->type != PROC_UNOP) {
 		csp_print("Invalid instruction type, expected PROC_UNOP\n");
 		return -1;
@@ -517,8 +1024,13 @@ int proc_runtime_unop(proc_instruction_t * instruction) {
 		result_node = 0;
 	}
 
+	if (!prefetched && proc_pull_instruction_operands(instruction, instruction_link, pull_batch) != 0) {
+		csp_print("Failed to fetch operand\n");
+		return -1;
+	}
+
 	operand_param_pair_t op_par_pair;
-	if (fetch_operand_param_pair(instruction->instruction.unop.param, &op_par_pair, fetch_node) != 0) {
+	if (fetch_operand_param_pair(instruction->instruction.unop.param, proc_operand_link(instruction_link, PROC_LINK_OPERAND_A), &op_par_pair, fetch_node) != 0) {
 		csp_print("Failed to fetch operand\n");
 		return -1;
 	}
@@ -567,22 +1079,30 @@ int proc_runtime_unop(proc_instruction_t * instruction) {
 
 	int ret = proc_set_param(
 		instruction->instruction.unop.result,
+		proc_operand_link(instruction_link, PROC_LINK_OPERAND_RESULT),
 		&op_par_pair.operand,
 		NULL,
-		result_node);
+		NULL,
+		result_node,
+		push_batch);
 
 	return ret;
 }
 
-int proc_runtime_binop(proc_instruction_t * instruction) {
+int proc_runtime_binop(proc_instruction_t * instruction, proc_instruction_link_t * instruction_link, int prefetched, proc_pull_batch_t * pull_batch, proc_push_batch_t * push_batch) {
 	if (instruction->type != PROC_BINOP) {
 		csp_print("Invalid instruction type, expected PROC_BINOP\n");
 		return -1;
 	}
 
+	if (!prefetched && proc_pull_instruction_operands(instruction, instruction_link, pull_batch) != 0) {
+		csp_print("Failed to fetch operands\n");
+		return -1;
+	}
+
 	operand_param_pair_t op_par_pair_a, op_par_pair_b;
-	if (fetch_operand_param_pair(instruction->instruction.binop.param_a, &op_par_pair_a, instruction->node) != 0 ||
-		fetch_operand_param_pair(instruction->instruction.binop.param_b, &op_par_pair_b, instruction->node) != 0) {
+	if (fetch_operand_param_pair(instruction->instruction.binop.param_a, proc_operand_link(instruction_link, PROC_LINK_OPERAND_A), &op_par_pair_a, instruction->node) != 0 ||
+		fetch_operand_param_pair(instruction->instruction.binop.param_b, proc_operand_link(instruction_link, PROC_LINK_OPERAND_B), &op_par_pair_b, instruction->node) != 0) {
 		csp_print("Failed to fetch operands\n");
 		return -1;
 	}
@@ -737,23 +1257,36 @@ int proc_runtime_binop(proc_instruction_t * instruction) {
 
 	int ret = proc_set_param(
 		instruction->instruction.binop.result,
+		proc_operand_link(instruction_link, PROC_LINK_OPERAND_RESULT),
 		&op_par_pair_a.operand,
 		NULL,
-		instruction->node);
+		NULL,
+		instruction->node,
+		push_batch);
 
 	return ret;
 }
 
-int proc_runtime_call(proc_instruction_t * instruction, proc_analysis_t ** analysis, proc_t ** proc, int * i, if_else_flag_t * _if_else_flag) {
+/**
+ * Execute a call instruction. Pre-compiled procedures are run right away, DSL procedures are left to the caller to enter.
+ *
+ * @param instruction The instruction to execute
+ * @param analysis The analysis of the calling procedure
+ * @param i The index of the instruction in the calling procedure
+ * @param called Set to the analysis of the DSL procedure to enter, or NULL
+ * @param tail_call Set if the calling procedure has nothing left to do after the call
+ * @return 0 on success, non-zero on failure
+ */
+int proc_runtime_call(proc_instruction_t * instruction, proc_analysis_t * analysis, int i, proc_analysis_t ** called, int * tail_call) {
+	*called = NULL;
 	if (instruction->type != PROC_CALL) {
 		csp_print("Invalid instruction type, expected PROC_CALL\n");
 		return -1;
 	}
-	proc_instruction_analysis_t * instruction_analysis = &((*analysis)->instruction_analyses[(*i)]);
 
 	int analysis_index = -1;
-	for (int j = 0; j < (*analysis)->procedure_slot_count; j++) {
-		if ((*analysis)->procedure_slots[j] == instruction->instruction.call.procedure_slot) {
+	for (int j = 0; j < analysis->procedure_slot_count; j++) {
+		if (analysis->procedure_slots[j] == instruction->instruction.call.procedure_slot) {
 			analysis_index = j;
 			break;
 		}
@@ -763,48 +1296,408 @@ int proc_runtime_call(proc_instruction_t * instruction, proc_analysis_t ** analy
 		return -1;
 	}
 
-	proc_analysis_t * called_proc_analysis = (*analysis)->sub_analyses[analysis_index];
+	proc_analysis_t * called_proc_analysis = analysis->sub_analyses[analysis_index];
 	if (called_proc_analysis->proc_union.type == PROC_TYPE_COMPILED) {
 		return called_proc_analysis->proc_union.proc.compiled_proc();
 	}
 
-	if (instruction_analysis->analysis.call.is_tail_call) {
-		// Avoid nesting procedure execution when tail call (reuse outer stack frame)
-		*analysis = called_proc_analysis;
-		*proc = (*analysis)->proc_union.proc.dsl_proc;
-		*_if_else_flag = IF_ELSE_FLAG_NONE;
-		*i = -1;  // It will be incremented to 0 at the start of the next loop iteration
-	} else {
-		return proc_instructions_exec(called_proc_analysis->proc_union.proc.dsl_proc, called_proc_analysis);
+	*called = called_proc_analysis;
+	*tail_call = analysis->instruction_analyses[i].analysis.call.is_tail_call;
+	return 0;
+}
+
+// Execution state of a procedure, kept on the frame stack while it waits for a non-tail call to return
+typedef struct {
+	proc_t * proc;
+	proc_analysis_t * analysis;
+	int pc;  // index of the next instruction
+	if_else_flag_t if_else_flag;
+} proc_frame_t;
+
+// Execution state of a run, kept between steps of a cooperative run (see proc_exec_step)
+struct proc_exec_s {
+	proc_analysis_t * analysis;  // NULL if the run doesn't own a reference to the analysis
+	proc_t * linked_proc;        // relinked copy in use, if the stored procedure's link was unusable (see proc_analysis_relinked_acquire)
+	proc_frame_t * frames;
+	size_t frame_capacity;
+	size_t depth;          // frames[depth] is the procedure being executed
+	int prefetched_until;  // remote operands of instructions of the current frame before this index have been pulled
+	proc_push_batch_t * push_batch;  // NULL unless write-back is enabled
+	proc_pull_batch_t * pull_batch;
+	int cooperative;                 // block instructions yield instead of waiting
+	// Block instruction waited on by a cooperative run
+	int block_active;
+	int block_local;
+	uint32_t block_deadline_ms;
+	uint32_t block_period_ms;
+	// Pulls of the operands of a remote block condition whose responses are outstanding
+	csp_conn_t * block_pulls[PROC_PULL_MAX_NODES];
+	int block_pull_count;
+	uint32_t block_pull_deadline_ms;
+};
+
+static int proc_exec_init(proc_exec_t * exec, proc_t * proc, proc_analysis_t * analysis) {
+	exec->frame_capacity = PROC_RUNTIME_FRAMES;
+	exec->frames = proc_malloc(exec->frame_capacity * sizeof(proc_frame_t));
+	if (exec->frames == NULL) {
+		csp_print("Failed to allocate call frames\n");
+		return -1;
+	}
+	exec->depth = 0;
+	exec->frames[0] = (proc_frame_t){.proc = proc, .analysis = analysis, .pc = 0, .if_else_flag = IF_ELSE_FLAG_NONE};
+	exec->prefetched_until = 0;
+	exec->push_batch = proc_push_batch_create();
+	exec->pull_batch = proc_pull_batch_create(exec->push_batch);
+	if (exec->pull_batch == NULL) {
+		proc_push_batch_destroy(exec->push_batch);
+		proc_free(exec->frames);
+		return -1;
+	}
+	exec->block_active = 0;
+	exec->block_pull_count = 0;
+	return 0;
+}
+
+static void proc_exec_block_pull_abort(proc_exec_t * exec) {
+	for (int i = 0; i < exec->block_pull_count; i++) {
+		if (exec->block_pulls[i] != NULL) {
+			csp_close(exec->block_pulls[i]);
+		}
+	}
+	exec->block_pull_count = 0;
+}
+
+/**
+ * Pull the remote operands of a block condition without blocking the scheduler of a cooperative run.
+ * The first call sends one pull request per node, later calls apply the responses that have arrived since.
+ *
+ * @return 1 once all responses have been applied, 0 while some are outstanding, -1 on failure or timeout
+ */
+static int proc_exec_block_pull(proc_exec_t * exec, proc_instruction_t * instruction, proc_instruction_link_t * instruction_link, uint32_t now_ms) {
+	proc_pull_batch_t * batch = exec->pull_batch;
+	if (exec->block_pull_count == 0) {
+		if (proc_pull_batch_add_instruction(batch, instruction, instruction_link) != 0) {
+			batch->queue_count = 0;
+			return -1;
+		}
+		for (int i = 0; i < batch->queue_count; i++) {
+			if (batch->queues[i].queue.used == 0) {
+				continue;
+			}
+			csp_conn_t * conn = proc_pull_queue_send(&batch->queues[i]);
+			if (conn == NULL) {
+				batch->queue_count = 0;
+				proc_exec_block_pull_abort(exec);
+				return -1;
+			}
+			exec->block_pulls[exec->block_pull_count++] = conn;
+		}
+		batch->queue_count = 0;
+		exec->block_pull_deadline_ms = now_ms + PARAM_REMOTE_TIMEOUT_MS;
+	}
+
+	int outstanding = 0;
+	for (int i = 0; i < exec->block_pull_count; i++) {
+		if (exec->block_pulls[i] != NULL && proc_pull_conn_receive(exec->block_pulls[i])) {
+			csp_close(exec->block_pulls[i]);
+			exec->block_pulls[i] = NULL;
+		}
+		outstanding |= (exec->block_pulls[i] != NULL);
+	}
+	if (!outstanding) {
+		exec->block_pull_count = 0;
+		return 1;
+	}
+	if ((int32_t)(exec->block_pull_deadline_ms - now_ms) <= 0) {
+		proc_exec_block_pull_abort(exec);
+		return -1;
 	}
 	return 0;
 }
 
-int dsl_proc_exec(proc_union_t proc_union) {
-	// Perform static analysis
-	proc_analysis_config_t analysis_config = {
-		.analyzed_procs = proc_calloc(MAX_PROC_SLOT + 1, sizeof(int)),
-		.analyses = proc_calloc(MAX_PROC_SLOT + 1, sizeof(proc_analysis_t *)),
-		.analyzed_proc_count = 0};
-	proc_analysis_t * analysis = proc_malloc(sizeof(proc_analysis_t));
-	if (analysis == NULL) {
-		csp_print("Error allocating memory for analysis\n");
+/**
+ * Evaluate the condition of a block instruction once, for a cooperative run.
+ * The wait until the condition should be evaluated again is left to the caller.
+ *
+ * @return 0 if the condition is met, -1 on error or timeout, PROC_EXEC_YIELD or PROC_EXEC_YIELD_LOCAL to wait wait_ms
+ */
+static int proc_exec_block(proc_exec_t * exec, proc_instruction_t * instruction, proc_instruction_link_t * instruction_link, uint32_t * wait_ms) {
+	uint32_t now_ms = csp_get_ms();
+	if (!exec->block_active) {
+		exec->block_active = 1;
+		exec->block_local = proc_condition_is_local(instruction, instruction_link);
+		exec->block_deadline_ms = now_ms + MAX_PROC_BLOCK_TIMEOUT_MS;
+		exec->block_period_ms = 0;
+	}
+	int32_t remaining_ms = (int32_t)(exec->block_deadline_ms - now_ms);
+	if (remaining_ms <= 0) {
+		csp_print("Timeout reached in proc_runtime_block\n");
+		proc_exec_block_pull_abort(exec);
+		exec->block_active = 0;
 		return -1;
 	}
 
-	if (proc_analyze(proc_union, analysis, &analysis_config) != 0) {
-		csp_print("Error analyzing procedure\n");
+	// Other runs are resumed while the remote operands are being pulled
+	if (!exec->block_local) {
+		int pulled = proc_exec_block_pull(exec, instruction, instruction_link, now_ms);
+		if (pulled < 0) {
+			csp_print("Failed to fetch params\n");
+			exec->block_active = 0;
+			return -1;
+		} else if (pulled == 0) {
+			*wait_ms = (PROC_BLOCK_PULL_CHECK_MS < (uint32_t)remaining_ms) ? PROC_BLOCK_PULL_CHECK_MS : (uint32_t)remaining_ms;
+			return PROC_EXEC_YIELD;
+		}
+	}
+
+	// Create a temporary ifelse instruction from the block instruction for compatibility with proc_runtime_ifelse
+	proc_instruction_t ifelse_instruction;
+	ifelse_instruction.type = PROC_IFELSE;
+	ifelse_instruction.node = instruction->node;
+	ifelse_instruction.instruction.ifelse = instruction->instruction.block;
+
+	int ifelse_result = proc_runtime_ifelse(&ifelse_instruction, instruction_link, !exec->block_local, exec->pull_batch);
+	if (ifelse_result <= IF_ELSE_FLAG_ERR) {
+		csp_print("Error in if-else condition %d\n", ifelse_result);
+		exec->block_active = 0;
 		return -1;
+	} else if (ifelse_result == IF_ELSE_FLAG_TRUE) {
+		exec->block_active = 0;
+		return 0;
+	}
+
+	if (exec->block_local) {
+		*wait_ms = (PROC_BLOCK_EVENT_RECHECK_MS > 0 && PROC_BLOCK_EVENT_RECHECK_MS < (uint32_t)remaining_ms) ? PROC_BLOCK_EVENT_RECHECK_MS : (uint32_t)remaining_ms;
+		return PROC_EXEC_YIELD_LOCAL;
 	}
+	exec->block_period_ms = proc_block_poll_period(exec->block_period_ms, remaining_ms);
+	*wait_ms = exec->block_period_ms;
+	return PROC_EXEC_YIELD;
+}
 
-	int ret = proc_instructions_exec(proc_union.proc.dsl_proc, analysis);
+int proc_exec_step(proc_exec_t * exec, uint32_t max_instructions, uint32_t * wait_ms) {
+	int ret = 0;
+	uint32_t executed = 0;
 
-	// Procedure finished, clean up
-	free_proc_analysis(analysis);
-	free_proc(proc_union.proc.dsl_proc);
+	while (ret == 0) {
+		proc_frame_t * frame = &exec->frames[exec->depth];
+		if (frame->pc >= frame->proc->instruction_count) {
+			if (exec->depth == 0) {
+				break;
+			}
+			exec->depth--;  // return to the instruction following the call
+			exec->prefetched_until = 0;
+			continue;
+		}
+		if (executed++ == max_instructions) {
+			// Writes of the slice are pushed before other runs get to read them
+			if (proc_push_batch_flush(exec->push_batch) != 0) {
+				ret = -1;
+				break;
+			}
+			*wait_ms = 0;
+			ret = PROC_EXEC_YIELD;
+			break;
+		}
 
-	proc_free(analysis_config.analyzed_procs);
-	proc_free(analysis_config.analyses);
+		int i = frame->pc++;
+		if_else_flag_t if_else_flag = frame->if_else_flag;  // restored if the instruction yields
+		proc_instruction_t instruction = frame->proc->instructions[i];
+		proc_instruction_link_t * instruction_link = proc_get_instruction_link(frame->proc, i);
 
+		if (frame->if_else_flag == IF_ELSE_FLAG_FALSE) {  // skip instruction
+			frame->if_else_flag = IF_ELSE_FLAG_NONE;
+			continue;
+		} else if (frame->if_else_flag == IF_ELSE_FLAG_TRUE) {  // if-clause active, skip else-clause
+			frame->if_else_flag = IF_ELSE_FLAG_FALSE;
+		}
+
+		if (proc_runtime_cancelled != NULL && proc_runtime_cancelled()) {
+			csp_print("Procedure cancelled\n");
+			ret = -1;
+			break;
+		}
+
+		if (i >= exec->prefetched_until) {
+			exec->prefetched_until = proc_runtime_prefetch(frame->proc, i, exec->pull_batch);
+		}
+		int prefetched = i < exec->prefetched_until;
+
+		proc_analysis_t * called = NULL;
+		int tail_call = 0;
+		switch (instruction.type) {
+			case PROC_BLOCK:
+				// Buffered writes are pushed before waiting on, branching on, or calling into anything that may depend on them
+				if (proc_push_batch_flush(exec->push_batch) != 0) {
+					ret = -1;
+				} else if (exec->cooperative) {
+					ret = proc_exec_block(exec, &instruction, instruction_link, wait_ms);
+				} else {
+					ret = (proc_runtime_block != NULL) ? proc_runtime_block(&instruction, instruction_link, exec->pull_batch) : -1;
+				}
+				if (ret > 0) {
+					// Evaluated again when the run is resumed
+					frame->pc = i;
+					frame->if_else_flag = if_else_flag;
+				}
+				break;
+			case PROC_IFELSE:
+				if (proc_push_batch_flush(exec->push_batch) != 0) {
+					ret = -1;
+					break;
+				}
+				frame->if_else_flag = proc_runtime_ifelse(&instruction, instruction_link, prefetched, exec->pull_batch);
+				ret = (frame->if_else_flag <= IF_ELSE_FLAG_ERR) ? frame->if_else_flag : 0;
+				break;
+			case PROC_SET:
+				ret = proc_runtime_set(&instruction, instruction_link, exec->push_batch);
+				break;
+			case PROC_UNOP:
+				ret = proc_runtime_unop(&instruction, instruction_link, prefetched, exec->pull_batch, exec->push_batch);
+				break;
+			case PROC_BINOP:
+				ret = proc_runtime_binop(&instruction, instruction_link, prefetched, exec->pull_batch, exec->push_batch);
+				break;
+			case PROC_CALL:
+				if (proc_push_batch_flush(exec->push_batch) != 0) {
+					ret = -1;
+					break;
+				}
+				ret = proc_runtime_call(&instruction, frame->analysis, i, &called, &tail_call);
+				exec->prefetched_until = 0;  // the next instruction may belong to another procedure
+				break;
+			case PROC_NOOP:
+				break;
+			default:
+				ret = -1;
+				break;
+		}
+
+		if (ret != 0 || called == NULL) {
+			continue;
+		}
+
+		if (!tail_call) {
+			// Keep the calling procedure's frame, a tail call reuses it instead
+			if (exec->depth >= MAX_PROC_RECURSION_DEPTH) {
+				csp_print("Error: maximum recursion depth exceeded\n");
+				ret = -1;
+				continue;
+			}
+			if (exec->depth + 1 == exec->frame_capacity) {
+				proc_frame_t * grown = proc_realloc(exec->frames, 2 * exec->frame_capacity * sizeof(proc_frame_t));
+				if (grown == NULL) {
+					csp_print("Failed to allocate call frames\n");
+					ret = -1;
+					continue;
+				}
+				exec->frames = grown;
+				exec->frame_capacity *= 2;
+			}
+			exec->depth++;
+		}
+		exec->frames[exec->depth] = (proc_frame_t){.proc = called->proc_union.proc.dsl_proc, .analysis = called, .pc = 0, .if_else_flag = IF_ELSE_FLAG_NONE};
+	}
+
+	// Writes preceding a failure or a yield are still carried out
+	if (proc_push_batch_flush(exec->push_batch) != 0 && ret >= 0) {
+		ret = -1;
+	}
 	return ret;
 }
+
+static void proc_exec_deinit(proc_exec_t * exec) {
+	proc_exec_block_pull_abort(exec);
+	proc_free(exec->pull_batch);
+	proc_push_batch_destroy(exec->push_batch);
+	proc_free(exec->frames);
+}
+
+/**
+ * Execute a DSL procedure, including the procedures it calls.
+ * Calls are executed in the same loop on a heap allocated frame stack rather than by recursion,
+ * so the C stack use of a run does not depend on its call depth.
+ */
+int proc_instructions_exec(proc_t * proc, proc_analysis_t * analysis) {
+	proc_exec_t exec = {.cooperative = 0};
+	if (proc_exec_init(&exec, proc, analysis) != 0) {
+		return -1;
+	}
+	uint32_t wait_ms;
+	int ret = proc_exec_step(&exec, UINT32_MAX, &wait_ms);
+	proc_exec_deinit(&exec);
+	return ret;
+}
+
+proc_exec_t * proc_exec_create(proc_analysis_t * analysis, int cooperative) {
+	proc_exec_t * exec = proc_malloc(sizeof(proc_exec_t));
+	if (exec == NULL) {
+		csp_print("Failed to allocate procedure execution\n");
+		proc_analysis_release(analysis);
+		return NULL;
+	}
+	exec->analysis = analysis;
+	exec->linked_proc = NULL;
+	exec->cooperative = cooperative;
+
+	// The procedure is a snapshot shared with the store and other runs, so it is never modified here.
+	// If it wasn't linked on push or its link has gone stale, a shallow copy is linked instead and shared with later runs
+	// of the analysis, so the procedure is relinked once per parameter cache epoch rather than on every run.
+	proc_t * proc = analysis->proc_union.proc.dsl_proc;
+	uint32_t epoch = proc_param_cache_get_epoch();
+	if (proc->link == NULL || proc->link->epoch != epoch) {
+		exec->linked_proc = proc_analysis_relinked_acquire(analysis, epoch);
+		if (exec->linked_proc == NULL) {
+			exec->linked_proc = proc_malloc(sizeof(proc_t));
+			if (exec->linked_proc != NULL) {
+				*exec->linked_proc = *proc;
+				exec->linked_proc->link = NULL;
+				exec->linked_proc->refcount = 1;  // this run's reference
+			}
+			if (exec->linked_proc != NULL && proc_runtime_link(exec->linked_proc) == 0) {
+				proc_analysis_relinked_publish(analysis, exec->linked_proc);
+			}
+		}
+		if (exec->linked_proc == NULL || exec->linked_proc->link == NULL) {
+			csp_print("Failed to link procedure, resolving operands by name\n");
+		} else {
+			proc = exec->linked_proc;
+		}
+	}
+
+	if (proc_exec_init(exec, proc, analysis) != 0) {
+		exec->frames = NULL;
+		proc_exec_destroy(exec);
+		return NULL;
+	}
+	return exec;
+}
+
+void proc_exec_destroy(proc_exec_t * exec) {
+	if (exec->frames != NULL) {
+		proc_exec_deinit(exec);
+	}
+	proc_analysis_relinked_release(exec->linked_proc);
+	proc_analysis_release(exec->analysis);
+	proc_free(exec);
+}
+
+/**
+ * Execute a DSL procedure from its analysis (see proc_analysis_acquire), releasing the analysis when done.
+ */
+int dsl_proc_exec(proc_analysis_t * analysis) {
+	proc_exec_t * exec = proc_exec_create(analysis, 0);
+	if (exec == NULL) {
+		return -1;
+	}
+	uint32_t wait_ms;
+	int ret = proc_exec_step(exec, UINT32_MAX, &wait_ms);
+	proc_exec_destroy(exec);
+	return ret;
+}
+
+void proc_runtime_param_callback(param_t * param, int offset) {
+	(void)param;
+	(void)offset;
+	proc_runtime_param_changed();
+}
@@ -0,0 +1,126 @@
+// Linking of DSL procedures against the libparam list ahead of execution
+
+#include <param/param.h>
+#include <param/param_string.h>
+
+#include <csp/csp.h>
+
+#include <csp_proc/proc_types.h>
+#include <csp_proc/proc_runtime.h>
+#include <csp_proc/proc_memory.h>
+
+// forward declarations
+param_t * proc_lookup_param(char * param_name, int node, int * offset, int allow_download);
+uint32_t proc_param_cache_get_epoch();
+
+#define PROC_LINK_VALUE_SIZE (sizeof(uint64_t))  // large enough for any numeric parameter type
+
+static void proc_link_operand(char * param_name, int node, proc_operand_link_t * operand_link) {
+	int offset = -1;
+	operand_link->param = proc_lookup_param(param_name, node, &offset, 0);
+	operand_link->offset = offset;
+}
+
+/**
+ * Only numeric values are pre-parsed, since their size is known up front.
+ * String and data values are still converted when the instruction is executed.
+ */
+static int proc_link_value_is_preparsable(param_t * param) {
+	switch (param->type) {
+		case PARAM_TYPE_STRING:
+		case PARAM_TYPE_DATA:
+		case PARAM_TYPE_INVALID:
+			return 0;
+		default:
+			return 1;
+	}
+}
+
+int proc_runtime_link(proc_t * proc) {
+	if (proc == NULL) {
+		return -1;
+	}
+
+	size_t set_count = 0;
+	for (int i = 0; i < proc->instruction_count; i++) {
+		if (proc->instructions[i].type == PROC_SET) {
+			set_count++;
+		}
+	}
+
+	uint32_t value_offset = sizeof(proc_link_t) + proc->instruction_count * sizeof(proc_instruction_link_t);
+	size_t size = value_offset + set_count * PROC_LINK_VALUE_SIZE;
+	proc_link_t * link = proc_calloc(1, size);
+	if (link == NULL) {
+		csp_print("Error allocating memory for procedure link\n");
+		return -1;
+	}
+	link->size = size;
+	link->epoch = proc_param_cache_get_epoch();  // read before resolving, so an invalidation during linking marks the link stale
+
+	// Remote parameters are only linked if their list has already been downloaded,
+	// since linking may run in the proc server context. Unresolved operands fall back to resolution by name.
+	for (int i = 0; i < proc->instruction_count; i++) {
+		proc_instruction_t * instruction = &proc->instructions[i];
+		proc_instruction_link_t * instruction_link = &link->instructions[i];
+
+		for (int j = 0; j < 3; j++) {
+			instruction_link->operands[j].offset = -1;
+		}
+
+		switch (instruction->type) {
+			case PROC_BLOCK:
+			case PROC_IFELSE:
+				proc_link_operand(instruction->instruction.block.param_a, instruction->node, &instruction_link->operands[PROC_LINK_OPERAND_A]);
+				proc_link_operand(instruction->instruction.block.param_b, instruction->node, &instruction_link->operands[PROC_LINK_OPERAND_B]);
+				break;
+			case PROC_SET: {
+				proc_operand_link_t * operand_link = &instruction_link->operands[PROC_LINK_OPERAND_A];
+				proc_link_operand(instruction->instruction.set.param, instruction->node, operand_link);
+				if (operand_link->param != NULL && proc_link_value_is_preparsable(operand_link->param)) {
+					if (param_str_to_value(operand_link->param->type, instruction->instruction.set.value, (char *)link + value_offset) >= 0) {
+						instruction_link->value_offset = ((char *)link + value_offset) - (char *)instruction_link;
+					}
+					value_offset += PROC_LINK_VALUE_SIZE;
+				}
+				break;
+			}
+			case PROC_UNOP: {
+				int rmt = instruction->instruction.unop.op == OP_RMT;
+				proc_link_operand(instruction->instruction.unop.param, rmt ? 0 : instruction->node, &instruction_link->operands[PROC_LINK_OPERAND_A]);
+				proc_link_operand(instruction->instruction.unop.result, rmt ? instruction->node : 0, &instruction_link->operands[PROC_LINK_OPERAND_RESULT]);
+				break;
+			}
+			case PROC_BINOP:
+				proc_link_operand(instruction->instruction.binop.param_a, instruction->node, &instruction_link->operands[PROC_LINK_OPERAND_A]);
+				proc_link_operand(instruction->instruction.binop.param_b, instruction->node, &instruction_link->operands[PROC_LINK_OPERAND_B]);
+				proc_link_operand(instruction->instruction.binop.result, instruction->node, &instruction_link->operands[PROC_LINK_OPERAND_RESULT]);
+				break;
+			case PROC_CALL:
+			case PROC_NOOP:
+				break;
+			default:
+				csp_print("Unknown instruction type %d\n", instruction->type);
+				proc_free(link);
+				return -1;
+		}
+	}
+
+	proc_free(proc->link);
+	proc->link = link;
+	return 0;
+}
+
+/**
+ * Get the linked form of an instruction.
+ *
+ * @param proc The procedure containing the instruction
+ * @param i The index of the instruction
+ * @return The linked instruction, or NULL if the procedure is unlinked or its link is stale
+ */
+proc_instruction_link_t * proc_get_instruction_link(proc_t * proc, int i) {
+	if (proc->link == NULL || proc->link->epoch != proc_param_cache_get_epoch()) {
+		return NULL;
+	}
+	return &proc->link->instructions[i];
+}
@@ -0,0 +1,250 @@
+// Resolved-parameter and remote parameter list caches shared by all procedure runtimes
+
+#include <csp_proc/proc_runtime.h>
+#include <csp_proc/proc_mutex.h>
+#include <csp_proc/proc_memory.h>
+
+#include <csp/csp.h>
+#include <param/param.h>
+
+#include <string.h>
+
+typedef struct {
+	char * name;  // operand name as written in the procedure, including any [index] suffix
+	int node;
+	param_t * param;  // NULL if the operand was not found in the downloaded list of a remote node
+	int offset;
+	uint32_t list_ms;  // download time of the remote list a NULL param was looked up in
+} proc_param_cache_entry_t;
+
+static proc_param_cache_entry_t proc_param_cache[PROC_PARAM_CACHE_SIZE];
+static proc_mutex_t * proc_param_cache_mutex = NULL;
+static volatile uint32_t proc_param_cache_epoch = 0;  // incremented on every invalidation
+
+typedef struct {
+	uint16_t node;
+	uint32_t downloaded_ms;
+	int valid;
+} proc_remote_list_entry_t;
+
+static proc_remote_list_entry_t proc_remote_lists[PROC_REMOTE_LIST_CACHE_SIZE];
+
+#define PROC_PARAM_CACHE_PROBES (4U)
+
+static uint32_t proc_remote_list_now_ms();
+
+static unsigned int proc_param_cache_hash(const char * name, int node) {
+	unsigned int hash = 5381;  // djb2
+	while (*name) {
+		hash = ((hash << 5) + hash) + (unsigned char)*name++;
+	}
+	return (hash ^ (unsigned int)node) % PROC_PARAM_CACHE_SIZE;
+}
+
+int proc_param_cache_init() {
+	if (proc_param_cache_mutex != NULL) {
+		return 0;
+	}
+	proc_param_cache_mutex = proc_mutex_create();
+	if (proc_param_cache_mutex == NULL) {
+		return -1;
+	}
+	memset(proc_param_cache, 0, sizeof(proc_param_cache));
+	memset(proc_remote_lists, 0, sizeof(proc_remote_lists));
+	return 0;
+}
+
+/**
+ * Find the downloaded parameter list of a remote node that is still within its TTL. The cache mutex must be held.
+ */
+static proc_remote_list_entry_t * proc_remote_list_find_fresh(uint16_t node) {
+	for (size_t i = 0; i < PROC_REMOTE_LIST_CACHE_SIZE; i++) {
+		proc_remote_list_entry_t * entry = &proc_remote_lists[i];
+		if (entry->valid && entry->node == node) {
+			if (PROC_REMOTE_LIST_TTL_MS == 0 || (uint32_t)(proc_remote_list_now_ms() - entry->downloaded_ms) < PROC_REMOTE_LIST_TTL_MS) {
+				return entry;
+			}
+			return NULL;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Look up a previously resolved operand.
+ * An operand that was not found in the downloaded list of a remote node is cached as not found, until the epoch
+ * changes or the list is downloaded again.
+ *
+ * @param name The operand name, including any [index] suffix
+ * @param node The node the operand was resolved against
+ * @param param Populated with the cached parameter on a hit, NULL if it is cached as not found
+ * @param offset Populated with the parsed array offset on a hit (-1 if not an array element)
+ * @return 1 on a hit, 0 if the operand must be resolved
+ */
+int proc_param_cache_get(const char * name, int node, param_t ** param, int * offset) {
+	int hit = 0;
+	if (proc_param_cache_mutex == NULL || proc_mutex_take(proc_param_cache_mutex) != PROC_MUTEX_OK) {
+		return 0;
+	}
+
+	unsigned int idx = proc_param_cache_hash(name, node);
+	for (unsigned int probe = 0; probe < PROC_PARAM_CACHE_PROBES; probe++) {
+		proc_param_cache_entry_t * entry = &proc_param_cache[(idx + probe) % PROC_PARAM_CACHE_SIZE];
+		if (entry->name == NULL) {
+			break;
+		}
+		if (entry->node == node && strcmp(entry->name, name) == 0) {
+			if (entry->param == NULL) {
+				proc_remote_list_entry_t * list = proc_remote_list_find_fresh(node);
+				if (list == NULL || list->downloaded_ms != entry->list_ms) {
+					break;  // the list has been downloaded again since, or must be
+				}
+			}
+			*param = entry->param;
+			*offset = entry->offset;
+			hit = 1;
+			break;
+		}
+	}
+
+	proc_mutex_give(proc_param_cache_mutex);
+	return hit;
+}
+
+/**
+ * Store a resolved operand. If all probed entries are taken, the entry at the home index is evicted.
+ *
+ * @param name The operand name, including any [index] suffix
+ * @param node The node the operand was resolved against
+ * @param param The resolved parameter, or NULL if it was not found in the downloaded list of the remote node
+ * @param offset The parsed array offset (-1 if not an array element)
+ */
+void proc_param_cache_put(const char * name, int node, param_t * param, int offset) {
+	if (proc_param_cache_mutex == NULL || proc_mutex_take(proc_param_cache_mutex) != PROC_MUTEX_OK) {
+		return;
+	}
+
+	uint32_t list_ms = 0;
+	if (param == NULL) {
+		proc_remote_list_entry_t * list = proc_remote_list_find_fresh(node);
+		if (list == NULL) {
+			proc_mutex_give(proc_param_cache_mutex);
+			return;  // not looked up in a downloaded list
+		}
+		list_ms = list->downloaded_ms;
+	}
+
+	unsigned int idx = proc_param_cache_hash(name, node);
+	proc_param_cache_entry_t * entry = &proc_param_cache[idx];
+	for (unsigned int probe = 0; probe < PROC_PARAM_CACHE_PROBES; probe++) {
+		proc_param_cache_entry_t * candidate = &proc_param_cache[(idx + probe) % PROC_PARAM_CACHE_SIZE];
+		if (candidate->name == NULL || (candidate->node == node && strcmp(candidate->name, name) == 0)) {
+			entry = candidate;
+			break;
+		}
+	}
+
+	char * name_copy = proc_strdup(name);
+	if (name_copy != NULL) {
+		proc_free(entry->name);
+		entry->name = name_copy;
+		entry->node = node;
+		entry->param = param;
+		entry->offset = offset;
+		entry->list_ms = list_ms;
+	}
+
+	proc_mutex_give(proc_param_cache_mutex);
+}
+
+/**
+ * Get the current cache epoch. Anything derived from cached resolutions (e.g. a proc_link_t) is stale once the epoch changes.
+ */
+uint32_t proc_param_cache_get_epoch() {
+	return proc_param_cache_epoch;
+}
+
+void proc_runtime_param_cache_invalidate() {
+	if (proc_param_cache_mutex == NULL || proc_mutex_take(proc_param_cache_mutex) != PROC_MUTEX_OK) {
+		return;
+	}
+
+	for (size_t i = 0; i < PROC_PARAM_CACHE_SIZE; i++) {
+		proc_free(proc_param_cache[i].name);
+		proc_param_cache[i].name = NULL;
+	}
+	proc_param_cache_epoch++;
+
+	proc_mutex_give(proc_param_cache_mutex);
+}
+
+static uint32_t proc_remote_list_now_ms() {
+	csp_timestamp_t now;
+	csp_clock_get_time(&now);
+	return now.tv_sec * 1000U + now.tv_nsec / 1000000U;
+}
+
+/**
+ * Check whether the parameter list of a remote node has been downloaded and is still within its TTL.
+ *
+ * @param node The remote node
+ * @return 1 if the list is fresh, 0 if it must be (re)downloaded
+ */
+int proc_remote_list_is_fresh(uint16_t node) {
+	if (proc_param_cache_mutex == NULL || proc_mutex_take(proc_param_cache_mutex) != PROC_MUTEX_OK) {
+		return 0;
+	}
+
+	int fresh = proc_remote_list_find_fresh(node) != NULL;
+
+	proc_mutex_give(proc_param_cache_mutex);
+	return fresh;
+}
+
+/**
+ * Record a successful download of the parameter list of a remote node.
+ * If the table is full, the least recently downloaded list is forgotten.
+ *
+ * @param node The remote node
+ */
+void proc_remote_list_mark_downloaded(uint16_t node) {
+	if (proc_param_cache_mutex == NULL || proc_mutex_take(proc_param_cache_mutex) != PROC_MUTEX_OK) {
+		return;
+	}
+
+	uint32_t now = proc_remote_list_now_ms();
+	proc_remote_list_entry_t * entry = &proc_remote_lists[0];
+	for (size_t i = 0; i < PROC_REMOTE_LIST_CACHE_SIZE; i++) {
+		proc_remote_list_entry_t * candidate = &proc_remote_lists[i];
+		if (candidate->valid && candidate->node == node) {
+			entry = candidate;
+			break;
+		}
+		if (!entry->valid) {
+			continue;  // keep the first free entry
+		}
+		if (!candidate->valid || (uint32_t)(now - candidate->downloaded_ms) > (uint32_t)(now - entry->downloaded_ms)) {
+			entry = candidate;
+		}
+	}
+
+	entry->node = node;
+	entry->downloaded_ms = now;
+	entry->valid = 1;
+
+	proc_mutex_give(proc_param_cache_mutex);
+}
+
+void proc_runtime_remote_list_invalidate(int node) {
+	if (proc_param_cache_mutex == NULL || proc_mutex_take(proc_param_cache_mutex) != PROC_MUTEX_OK) {
+		return;
+	}
+
+	for (size_t i = 0; i < PROC_REMOTE_LIST_CACHE_SIZE; i++) {
+		if (node < 0 || proc_remote_lists[i].node == node) {
+			proc_remote_lists[i].valid = 0;
+		}
+	}
+
+	proc_mutex_give(proc_param_cache_mutex);
+}
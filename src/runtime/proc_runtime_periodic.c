@@ -0,0 +1,189 @@
+// Periodic runs of procedures, scheduled on a timer wheel advanced by the runtime's scheduler thread/task
+
+#include <csp_proc/proc_runtime.h>
+#include <csp_proc/proc_mutex.h>
+
+#include <csp/csp.h>
+
+// A procedure run every period_ticks, linked into the wheel bucket of its due tick
+typedef struct {
+	int active;
+	uint8_t proc_slot;
+	uint32_t period_ticks;
+	uint32_t due_tick;
+	proc_run_handle_t handle;  // latest run, if the runtime hands out handles
+	int next;                  // next entry in the same bucket, -1 at the end
+} proc_periodic_t;
+
+static proc_periodic_t proc_periodics[PROC_PERIODIC_MAX];
+static int proc_timer_wheel[PROC_TIMER_WHEEL_SLOTS];  // first entry due in each bucket, -1 if empty
+static uint32_t proc_timer_wheel_tick = 0;
+static uint32_t proc_timer_wheel_time_ms = 0;  // time of the current tick
+static int proc_timer_wheel_started = 0;
+static proc_mutex_t * proc_periodic_mutex = NULL;
+
+int proc_periodic_init() {
+	for (size_t i = 0; i < PROC_TIMER_WHEEL_SLOTS; i++) {
+		proc_timer_wheel[i] = -1;
+	}
+	proc_periodic_mutex = proc_mutex_create();
+	if (proc_periodic_mutex == NULL) {
+		csp_print("Failed to create periodic run mutex\n");
+		return -1;
+	}
+	return 0;
+}
+
+static uint32_t proc_ms_to_ticks(uint32_t ms) {
+	return (ms + PROC_TIMER_WHEEL_TICK_MS - 1) / PROC_TIMER_WHEEL_TICK_MS;
+}
+
+static void proc_timer_wheel_insert(int index) {
+	int * bucket = &proc_timer_wheel[proc_periodics[index].due_tick % PROC_TIMER_WHEEL_SLOTS];
+	proc_periodics[index].next = *bucket;
+	*bucket = index;
+}
+
+static void proc_timer_wheel_remove(int index) {
+	int * link = &proc_timer_wheel[proc_periodics[index].due_tick % PROC_TIMER_WHEEL_SLOTS];
+	while (*link != -1 && *link != index) {
+		link = &proc_periodics[*link].next;
+	}
+	if (*link == index) {
+		*link = proc_periodics[index].next;
+	}
+}
+
+static int proc_periodic_find(uint8_t proc_slot) {
+	for (int i = 0; i < PROC_PERIODIC_MAX; i++) {
+		if (proc_periodics[i].active && proc_periodics[i].proc_slot == proc_slot) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Start a run of a periodic procedure, unless its previous run is still going.
+ *
+ * @return 0 if the run was started or the period skipped, -1 if the procedure has been deleted
+ */
+static int proc_periodic_fire(proc_periodic_t * periodic) {
+	proc_union_t proc_union = get_proc(periodic->proc_slot);
+	if (proc_union.type != PROC_TYPE_DSL && proc_union.type != PROC_TYPE_COMPILED) {
+		csp_print("Procedure in slot %d not found, no longer running it periodically\n", periodic->proc_slot);
+		return -1;
+	}
+
+	if (proc_runtime_run_async == NULL || proc_runtime_running == NULL) {
+		proc_runtime_run(periodic->proc_slot);
+		return 0;
+	}
+	if (periodic->handle != PROC_RUN_HANDLE_NONE && proc_runtime_running(periodic->handle)) {
+		csp_print("Periodic procedure %d still running, skipping period\n", periodic->proc_slot);
+		return 0;
+	}
+	if (proc_runtime_run_async(periodic->proc_slot, &periodic->handle) != 0) {
+		periodic->handle = PROC_RUN_HANDLE_NONE;
+	}
+	return 0;
+}
+
+void proc_periodic_advance(uint32_t now_ms) {
+	if (proc_mutex_take(proc_periodic_mutex) != PROC_MUTEX_OK) {
+		return;
+	}
+	if (!proc_timer_wheel_started) {
+		proc_timer_wheel_time_ms = now_ms;
+		proc_timer_wheel_started = 1;
+	}
+
+	uint32_t elapsed_ticks = (now_ms - proc_timer_wheel_time_ms) / PROC_TIMER_WHEEL_TICK_MS;
+	uint32_t target_tick = proc_timer_wheel_tick + elapsed_ticks;
+	proc_timer_wheel_time_ms += elapsed_ticks * PROC_TIMER_WHEEL_TICK_MS;
+	if (elapsed_ticks > PROC_TIMER_WHEEL_SLOTS) {
+		// One turn of the wheel visits every bucket, anything overdue is found on the way
+		proc_timer_wheel_tick = target_tick - PROC_TIMER_WHEEL_SLOTS;
+	}
+
+	while (proc_timer_wheel_tick != target_tick) {
+		proc_timer_wheel_tick++;
+		int * link = &proc_timer_wheel[proc_timer_wheel_tick % PROC_TIMER_WHEEL_SLOTS];
+		while (*link != -1) {
+			int index = *link;
+			proc_periodic_t * periodic = &proc_periodics[index];
+			if ((int32_t)(periodic->due_tick - proc_timer_wheel_tick) > 0) {
+				link = &periodic->next;  // due on a later turn of the wheel
+				continue;
+			}
+
+			*link = periodic->next;
+			if (proc_periodic_fire(periodic) != 0) {
+				periodic->active = 0;
+				continue;
+			}
+			// Periods missed while the scheduler was held up are skipped rather than run back to back
+			do {
+				periodic->due_tick += periodic->period_ticks;
+			} while ((int32_t)(periodic->due_tick - target_tick) <= 0);
+			proc_timer_wheel_insert(index);
+		}
+	}
+
+	proc_mutex_give(proc_periodic_mutex);
+}
+
+int proc_runtime_run_periodic(uint8_t proc_slot, uint32_t period_ms, uint32_t phase_ms) {
+	if (period_ms == 0) {
+		return -1;
+	}
+	proc_union_t proc_union = get_proc(proc_slot);
+	if (proc_union.type != PROC_TYPE_DSL && proc_union.type != PROC_TYPE_COMPILED) {
+		csp_print("Procedure in slot %d not found\n", proc_slot);
+		return -1;
+	}
+
+	if (proc_periodic_mutex == NULL || proc_mutex_take(proc_periodic_mutex) != PROC_MUTEX_OK) {
+		return -1;
+	}
+	int index = proc_periodic_find(proc_slot);
+	if (index != -1) {
+		proc_timer_wheel_remove(index);  // rescheduled with the new period
+	} else {
+		for (int i = 0; i < PROC_PERIODIC_MAX && index == -1; i++) {
+			if (!proc_periodics[i].active) {
+				index = i;
+				proc_periodics[i].handle = PROC_RUN_HANDLE_NONE;
+			}
+		}
+	}
+	if (index == -1) {
+		proc_mutex_give(proc_periodic_mutex);
+		csp_print("Maximum number of periodic procedures reached\n");
+		return -1;
+	}
+
+	proc_periodic_t * periodic = &proc_periodics[index];
+	periodic->active = 1;
+	periodic->proc_slot = proc_slot;
+	periodic->period_ticks = (proc_ms_to_ticks(period_ms) > 0) ? proc_ms_to_ticks(period_ms) : 1;
+	periodic->due_tick = proc_timer_wheel_tick + ((proc_ms_to_ticks(phase_ms) > 0) ? proc_ms_to_ticks(phase_ms) : 1);
+	proc_timer_wheel_insert(index);
+	proc_mutex_give(proc_periodic_mutex);
+
+	csp_print("Running procedure %d every %u ms\n", proc_slot, (unsigned int)period_ms);
+	return 0;
+}
+
+int proc_runtime_stop_periodic(uint8_t proc_slot) {
+	if (proc_periodic_mutex == NULL || proc_mutex_take(proc_periodic_mutex) != PROC_MUTEX_OK) {
+		return -1;
+	}
+	int index = proc_periodic_find(proc_slot);
+	if (index != -1) {
+		proc_timer_wheel_remove(index);
+		proc_periodics[index].active = 0;
+	}
+	proc_mutex_give(proc_periodic_mutex);
+	return (index != -1) ? 0 : -1;
+}
@@ -0,0 +1,128 @@
+// Runs waiting for a free worker of the runtime, ordered by priority, with PROC_RUN_QUEUE_OVERFLOW deciding what is
+// dropped when the queue is full. Not locked: the runtime calls these with the lock protecting its runs held.
+
+#include <csp_proc/proc_runtime.h>
+
+#include <csp/arch/csp_time.h>
+
+#include <string.h>
+
+typedef struct {
+	void * run;
+	uint8_t priority;
+	uint32_t seq;        // order the runs were queued in
+	uint32_t queued_ms;  // for the wait time counters
+} proc_run_queue_entry_t;
+
+static proc_run_queue_entry_t proc_run_queue_entries[PROC_RUN_QUEUE_LENGTH];  // highest priority first, oldest first within a priority
+static size_t proc_run_queue_count = 0;
+static uint32_t proc_run_queue_seq = 0;
+static proc_run_queue_stats_t proc_run_queue_counters = {0};
+
+static void proc_run_queue_remove_at(size_t i) {
+	memmove(&proc_run_queue_entries[i], &proc_run_queue_entries[i + 1], (proc_run_queue_count - i - 1) * sizeof(proc_run_queue_entry_t));
+	proc_run_queue_count--;
+}
+
+/**
+ * Pick the queued run to drop for a new run of the given priority when the queue is full.
+ *
+ * @return The index of the run, or -1 to refuse the new run
+ */
+static int proc_run_queue_victim(uint8_t priority) {
+	if (PROC_RUN_QUEUE_OVERFLOW == PROC_RUN_QUEUE_DROP_OLDEST) {
+		size_t oldest = 0;
+		for (size_t i = 1; i < proc_run_queue_count; i++) {
+			if (proc_run_queue_entries[i].seq - proc_run_queue_entries[oldest].seq > UINT32_MAX / 2) {
+				oldest = i;
+			}
+		}
+		return oldest;
+	}
+	if (PROC_RUN_QUEUE_OVERFLOW == PROC_RUN_QUEUE_DROP_LOWEST && proc_run_queue_entries[proc_run_queue_count - 1].priority < priority) {
+		return proc_run_queue_count - 1;
+	}
+	return -1;
+}
+
+/**
+ * Queue a run.
+ *
+ * @param run The run, opaque to the queue
+ * @param priority Runs of higher priority leave the queue first
+ * @param dropped Populated with a queued run dropped to make room, which the caller must finish, or NULL
+ *
+ * @return 0 if the run was queued, -1 if it was refused
+ */
+int proc_run_queue_push(void * run, uint8_t priority, void ** dropped) {
+	*dropped = NULL;
+	if (proc_run_queue_count == PROC_RUN_QUEUE_LENGTH) {
+		int victim = (PROC_RUN_QUEUE_LENGTH > 0) ? proc_run_queue_victim(priority) : -1;
+		if (victim < 0) {
+			proc_run_queue_counters.rejected++;
+			return -1;
+		}
+		*dropped = proc_run_queue_entries[victim].run;
+		proc_run_queue_remove_at(victim);
+		proc_run_queue_counters.dropped++;
+	}
+
+	size_t i = proc_run_queue_count;
+	while (i > 0 && proc_run_queue_entries[i - 1].priority < priority) {
+		i--;
+	}
+	memmove(&proc_run_queue_entries[i + 1], &proc_run_queue_entries[i], (proc_run_queue_count - i) * sizeof(proc_run_queue_entry_t));
+	proc_run_queue_entries[i] = (proc_run_queue_entry_t){
+		.run = run,
+		.priority = priority,
+		.seq = proc_run_queue_seq++,
+		.queued_ms = csp_get_ms(),
+	};
+	proc_run_queue_count++;
+	if (proc_run_queue_count > proc_run_queue_counters.max_depth) {
+		proc_run_queue_counters.max_depth = proc_run_queue_count;
+	}
+	return 0;
+}
+
+/**
+ * Take the next run to start off the queue.
+ *
+ * @return The run, NULL if the queue is empty
+ */
+void * proc_run_queue_pop() {
+	if (proc_run_queue_count == 0) {
+		return NULL;
+	}
+	void * run = proc_run_queue_entries[0].run;
+	uint32_t wait_ms = csp_get_ms() - proc_run_queue_entries[0].queued_ms;
+	proc_run_queue_remove_at(0);
+
+	proc_run_queue_counters.started++;
+	proc_run_queue_counters.last_wait_ms = wait_ms;
+	proc_run_queue_counters.total_wait_ms += wait_ms;
+	if (wait_ms > proc_run_queue_counters.max_wait_ms) {
+		proc_run_queue_counters.max_wait_ms = wait_ms;
+	}
+	return run;
+}
+
+/**
+ * Take a run off the queue without starting it, e.g. when it is cancelled.
+ *
+ * @return 0 on success, -1 if the run isn't queued
+ */
+int proc_run_queue_remove(void * run) {
+	for (size_t i = 0; i < proc_run_queue_count; i++) {
+		if (proc_run_queue_entries[i].run == run) {
+			proc_run_queue_remove_at(i);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void proc_run_queue_get_stats(proc_run_queue_stats_t * stats) {
+	*stats = proc_run_queue_counters;
+	stats->depth = proc_run_queue_count;
+}
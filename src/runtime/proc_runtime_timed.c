@@ -0,0 +1,328 @@
+// Runs of procedures scheduled at absolute onboard times, kept in a min-heap serviced by the runtime's scheduler thread/task
+
+#include <csp_proc/proc_runtime.h>
+#include <csp_proc/proc_mutex.h>
+
+#include <csp/csp.h>
+#include <csp/csp_crc32.h>
+
+#include <stddef.h>
+#include <string.h>
+
+#define PROC_TIMED_RUNS_MAGIC (0x50525451U)
+
+// Layout of the saved queue (see proc_timed_runs_save)
+typedef struct {
+	uint32_t magic;
+	uint16_t count;
+	uint16_t next_id;
+	proc_timed_run_t runs[PROC_TIMED_RUNS_MAX];
+	uint32_t crc;  // of everything before it
+} proc_timed_runs_image_t;
+
+static proc_timed_run_t proc_timed_runs[PROC_TIMED_RUNS_MAX];  // min-heap ordered by time
+static uint16_t proc_timed_run_count = 0;
+static uint16_t proc_timed_next_id = 1;
+static proc_timed_jitter_t proc_timed_jitter = {0};
+static proc_mutex_t * proc_timed_mutex = NULL;
+static uint32_t proc_timed_image_seq = 0;  // of the latest image of the timed runs, guarded by proc_timed_mutex
+static uint32_t proc_timed_saved_seq = 0;  // of the latest image saved, guarded by proc_timed_save_mutex
+static proc_mutex_t * proc_timed_save_mutex = NULL;
+
+/**
+ * Microseconds from a to b, saturated to the range of int32_t.
+ */
+static int32_t proc_timed_diff_us(uint32_t a_sec, uint32_t a_nsec, uint32_t b_sec, uint32_t b_nsec) {
+	int64_t diff = ((int64_t)b_sec - a_sec) * 1000000 + ((int64_t)b_nsec - a_nsec) / 1000;
+	if (diff > INT32_MAX) {
+		return INT32_MAX;
+	}
+	return (diff < INT32_MIN) ? INT32_MIN : (int32_t)diff;
+}
+
+static int proc_timed_before(const proc_timed_run_t * a, const proc_timed_run_t * b) {
+	return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void proc_timed_swap(int i, int j) {
+	proc_timed_run_t tmp = proc_timed_runs[i];
+	proc_timed_runs[i] = proc_timed_runs[j];
+	proc_timed_runs[j] = tmp;
+}
+
+static void proc_timed_sift_up(int i) {
+	while (i > 0 && proc_timed_before(&proc_timed_runs[i], &proc_timed_runs[(i - 1) / 2])) {
+		proc_timed_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void proc_timed_sift_down(int i) {
+	while (1) {
+		int first = i;
+		for (int child = 2 * i + 1; child <= 2 * i + 2 && child < proc_timed_run_count; child++) {
+			if (proc_timed_before(&proc_timed_runs[child], &proc_timed_runs[first])) {
+				first = child;
+			}
+		}
+		if (first == i) {
+			return;
+		}
+		proc_timed_swap(i, first);
+		i = first;
+	}
+}
+
+static void proc_timed_remove(int i) {
+	proc_timed_runs[i] = proc_timed_runs[--proc_timed_run_count];
+	if (i < proc_timed_run_count) {
+		proc_timed_sift_up(i);
+		proc_timed_sift_down(i);
+	}
+}
+
+/**
+ * Copy the timed runs into an image to save. Called with proc_timed_mutex held.
+ *
+ * @return The sequence number of the image, see proc_timed_save
+ */
+static uint32_t proc_timed_snapshot(proc_timed_runs_image_t * image) {
+	memset(image, 0, sizeof(*image));
+	image->magic = PROC_TIMED_RUNS_MAGIC;
+	image->count = proc_timed_run_count;
+	image->next_id = proc_timed_next_id;
+	memcpy(image->runs, proc_timed_runs, proc_timed_run_count * sizeof(proc_timed_run_t));
+	image->crc = csp_crc32_memory(image, offsetof(proc_timed_runs_image_t, crc));
+	return ++proc_timed_image_seq;
+}
+
+/**
+ * Save an image of the timed runs, unless a more recent one has been saved in the meantime.
+ * Called without proc_timed_mutex held, so a slow save doesn't hold up the scheduler and the server.
+ */
+static void proc_timed_save(const proc_timed_runs_image_t * image, uint32_t seq) {
+	if (proc_timed_runs_save == NULL || proc_mutex_take(proc_timed_save_mutex) != PROC_MUTEX_OK) {
+		return;
+	}
+	if ((int32_t)(seq - proc_timed_saved_seq) > 0) {
+		proc_timed_saved_seq = seq;
+		if (proc_timed_runs_save(image, sizeof(*image)) != 0) {
+			csp_print("Failed to save timed runs\n");
+		}
+	}
+	proc_mutex_give(proc_timed_save_mutex);
+}
+
+int proc_timed_init() {
+	proc_timed_mutex = proc_mutex_create();
+	proc_timed_save_mutex = proc_mutex_create();
+	if (proc_timed_mutex == NULL || proc_timed_save_mutex == NULL) {
+		csp_print("Failed to create timed run mutex\n");
+		return -1;
+	}
+
+	proc_timed_runs_image_t image;
+	if (proc_timed_runs_load == NULL || proc_timed_runs_load(&image, sizeof(image)) != 0) {
+		return 0;  // nothing saved
+	}
+	if (image.magic != PROC_TIMED_RUNS_MAGIC || image.count > PROC_TIMED_RUNS_MAX || image.crc != csp_crc32_memory(&image, offsetof(proc_timed_runs_image_t, crc))) {
+		csp_print("Discarding invalid saved timed runs\n");
+		return 0;
+	}
+	memcpy(proc_timed_runs, image.runs, image.count * sizeof(proc_timed_run_t));
+	proc_timed_run_count = image.count;
+	proc_timed_next_id = image.next_id;
+	return 0;
+}
+
+/**
+ * Start a due timed run.
+ *
+ * @return 0 if the run was started, 1 if it should be retried, -1 if its procedure has been deleted
+ */
+static int proc_timed_start(const proc_timed_run_t * run) {
+	proc_union_t proc_union = get_proc(run->proc_slot);
+	if (proc_union.type != PROC_TYPE_DSL && proc_union.type != PROC_TYPE_COMPILED) {
+		csp_print("Dropping timed run %d, procedure %d not found\n", run->id, run->proc_slot);
+		return -1;
+	}
+	if (proc_runtime_run(run->proc_slot) != 0) {
+		csp_print("Failed to start timed run %d of procedure %d, retrying in %u ms\n", run->id, run->proc_slot, (unsigned int)PROC_TIMED_RUN_RETRY_MS);
+		return 1;
+	}
+	return 0;
+}
+
+uint32_t proc_timed_service() {
+	proc_timed_run_t due[PROC_TIMED_RUNS_MAX];
+	uint32_t due_late_us[PROC_TIMED_RUNS_MAX];
+	int due_started[PROC_TIMED_RUNS_MAX];
+	int due_count = 0;
+	int changed = 0;
+	csp_timestamp_t now;
+
+	// Due runs are taken off the heap under the mutex, and started once it is released
+	if (proc_mutex_take(proc_timed_mutex) != PROC_MUTEX_OK) {
+		return UINT32_MAX;
+	}
+	csp_clock_get_time(&now);
+	while (proc_timed_run_count > 0) {
+		proc_timed_run_t run = proc_timed_runs[0];
+		int32_t until_us = proc_timed_diff_us(now.tv_sec, now.tv_nsec, run.tv_sec, run.tv_nsec);
+		if (until_us > 0) {
+			break;
+		}
+
+		proc_timed_remove(0);
+		changed = 1;
+		uint32_t late_us = (uint32_t)-until_us;
+		if (PROC_TIMED_RUN_MAX_LATE_MS > 0 && late_us / 1000 > PROC_TIMED_RUN_MAX_LATE_MS) {
+			csp_print("Dropping timed run %d of procedure %d, %u ms late\n", run.id, run.proc_slot, (unsigned int)(late_us / 1000));
+			continue;
+		}
+		due_late_us[due_count] = late_us;
+		due[due_count++] = run;
+	}
+	proc_mutex_give(proc_timed_mutex);
+
+	for (int i = 0; i < due_count; i++) {
+		due_started[i] = proc_timed_start(&due[i]);
+	}
+
+	// Runs that failed to start go back on the heap, so they aren't lost if the run queue is full for a while
+	proc_timed_runs_image_t image;
+	uint32_t seq = 0;
+	if (proc_mutex_take(proc_timed_mutex) != PROC_MUTEX_OK) {
+		return UINT32_MAX;
+	}
+	csp_clock_get_time(&now);
+	for (int i = 0; i < due_count; i++) {
+		if (due_started[i] == 0) {
+			proc_timed_jitter.last_us = due_late_us[i];
+			if (due_late_us[i] > proc_timed_jitter.max_us) {
+				proc_timed_jitter.max_us = due_late_us[i];
+			}
+			continue;
+		}
+		proc_timed_jitter.failed++;
+		if (due_started[i] < 0) {
+			continue;
+		}
+		if (proc_timed_run_count == PROC_TIMED_RUNS_MAX) {
+			csp_print("Dropping timed run %d of procedure %d, no room to retry it\n", due[i].id, due[i].proc_slot);
+			continue;
+		}
+		proc_timed_run_t * retry = &proc_timed_runs[proc_timed_run_count];
+		*retry = due[i];
+		retry->tv_sec = now.tv_sec + PROC_TIMED_RUN_RETRY_MS / 1000;
+		retry->tv_nsec = now.tv_nsec + (PROC_TIMED_RUN_RETRY_MS % 1000) * 1000000;
+		if (retry->tv_nsec >= 1000000000) {
+			retry->tv_sec++;
+			retry->tv_nsec -= 1000000000;
+		}
+		proc_timed_sift_up(proc_timed_run_count++);
+	}
+	if (changed) {
+		seq = proc_timed_snapshot(&image);
+	}
+	int32_t until_us = INT32_MAX;
+	if (proc_timed_run_count > 0) {
+		until_us = proc_timed_diff_us(now.tv_sec, now.tv_nsec, proc_timed_runs[0].tv_sec, proc_timed_runs[0].tv_nsec);
+		until_us = (until_us > 0) ? until_us : 0;  // added while the runs were started
+	}
+	proc_mutex_give(proc_timed_mutex);
+
+	if (changed) {
+		proc_timed_save(&image, seq);
+	}
+	return (uint32_t)until_us;
+}
+
+int proc_runtime_run_at(uint8_t proc_slot, uint32_t tv_sec, uint32_t tv_nsec, uint16_t * id) {
+	proc_union_t proc_union = get_proc(proc_slot);
+	if (proc_union.type != PROC_TYPE_DSL && proc_union.type != PROC_TYPE_COMPILED) {
+		csp_print("Procedure in slot %d not found\n", proc_slot);
+		return -1;
+	}
+	if (tv_nsec >= 1000000000) {
+		return -1;
+	}
+
+	if (proc_timed_mutex == NULL || proc_mutex_take(proc_timed_mutex) != PROC_MUTEX_OK) {
+		return -1;
+	}
+	if (proc_timed_run_count == PROC_TIMED_RUNS_MAX) {
+		proc_mutex_give(proc_timed_mutex);
+		csp_print("Maximum number of timed runs reached\n");
+		return -1;
+	}
+
+	proc_timed_run_t * run = &proc_timed_runs[proc_timed_run_count];
+	run->tv_sec = tv_sec;
+	run->tv_nsec = tv_nsec;
+	run->proc_slot = proc_slot;
+	run->id = proc_timed_next_id++;
+	if (proc_timed_next_id == 0) {
+		proc_timed_next_id++;  // 0 is never used as an id
+	}
+	if (id != NULL) {
+		*id = run->id;
+	}
+	proc_timed_sift_up(proc_timed_run_count++);
+	proc_timed_runs_image_t image;
+	uint32_t seq = proc_timed_snapshot(&image);
+	proc_mutex_give(proc_timed_mutex);
+
+	proc_timed_save(&image, seq);
+	return 0;
+}
+
+int proc_runtime_cancel_at(uint16_t id) {
+	if (proc_timed_mutex == NULL || proc_mutex_take(proc_timed_mutex) != PROC_MUTEX_OK) {
+		return -1;
+	}
+	int found = 0;
+	for (int i = 0; i < proc_timed_run_count && !found; i++) {
+		if (proc_timed_runs[i].id == id) {
+			proc_timed_remove(i);
+			found = 1;
+		}
+	}
+	proc_timed_runs_image_t image;
+	uint32_t seq = 0;
+	if (found) {
+		seq = proc_timed_snapshot(&image);
+	}
+	proc_mutex_give(proc_timed_mutex);
+
+	if (found) {
+		proc_timed_save(&image, seq);
+	}
+	return found ? 0 : -1;
+}
+
+int proc_runtime_timed_runs(proc_timed_run_t * runs, int max_runs, proc_timed_jitter_t * jitter) {
+	if (proc_timed_mutex == NULL || proc_mutex_take(proc_timed_mutex) != PROC_MUTEX_OK) {
+		return -1;
+	}
+	proc_timed_run_t sorted[PROC_TIMED_RUNS_MAX];
+	int count = proc_timed_run_count;
+	memcpy(sorted, proc_timed_runs, count * sizeof(proc_timed_run_t));
+	if (jitter != NULL) {
+		*jitter = proc_timed_jitter;
+	}
+	proc_mutex_give(proc_timed_mutex);
+
+	// The heap is only partially ordered
+	for (int i = 1; i < count; i++) {
+		proc_timed_run_t run = sorted[i];
+		int j = i;
+		for (; j > 0 && proc_timed_before(&run, &sorted[j - 1]); j--) {
+			sorted[j] = sorted[j - 1];
+		}
+		sorted[j] = run;
+	}
+	count = (count < max_runs) ? count : max_runs;
+	memcpy(runs, sorted, count * sizeof(proc_timed_run_t));
+	return count;
+}
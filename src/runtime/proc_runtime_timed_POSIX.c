@@ -0,0 +1,53 @@
+// File-backed persistence of the timed runs of the POSIX runtimes
+
+#include <csp_proc/proc_runtime.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifndef PROC_TIMED_RUNS_FILE
+#define PROC_TIMED_RUNS_FILE "csp_proc.timed"
+#endif
+
+int proc_timed_runs_save(const void * buf, uint32_t len) {
+	// Written to a temporary file first, so a crash while saving leaves the previous runs intact
+	FILE * file = fopen(PROC_TIMED_RUNS_FILE ".tmp", "wb");
+	if (file == NULL) {
+		return -1;
+	}
+	int ok = fwrite(buf, 1, len, file) == len;
+	ok = (fflush(file) == 0) && ok;
+	ok = (fsync(fileno(file)) == 0) && ok;  // on disk before it replaces the previous runs
+	ok = (fclose(file) == 0) && ok;
+	if (!ok || rename(PROC_TIMED_RUNS_FILE ".tmp", PROC_TIMED_RUNS_FILE) != 0) {
+		return -1;
+	}
+
+	// The rename itself is only durable once the directory holding the file is synced
+	char dir[] = PROC_TIMED_RUNS_FILE;
+	char * slash = strrchr(dir, '/');
+	if (slash == dir) {
+		slash[1] = '\0';  // file in the root directory
+	} else if (slash != NULL) {
+		*slash = '\0';
+	}
+	int fd = open((slash != NULL) ? dir : ".", O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	ok = fsync(fd) == 0;
+	close(fd);
+	return ok ? 0 : -1;
+}
+
+int proc_timed_runs_load(void * buf, uint32_t len) {
+	FILE * file = fopen(PROC_TIMED_RUNS_FILE, "rb");
+	if (file == NULL) {
+		return -1;
+	}
+	int ok = fread(buf, 1, len, file) == len;
+	fclose(file);
+	return ok ? 0 : -1;
+}
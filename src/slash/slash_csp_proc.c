@@ -19,7 +19,11 @@ Small enough to fit in a single CSP packet!
 - proc slots [node]
 	- List occupied procedure slots on node.
 - proc run <procedure slot> [node]
-	- Run the procedure in the specified slot.
+	- Run the procedure in the specified slot. With -r <priority> (0-255) it starts ahead of runs of lower priority waiting for a free runtime worker on the node.
+- proc at <procedure slot> <time> [node]
+	- Run the procedure in the specified slot at an absolute time of the node's clock, in seconds (with an optional fraction). A leading '+' makes the time relative to the local clock.
+- proc timed [node]
+	- List the timed runs scheduled on the node, and how late timed runs have started. Cancel one with -c <id>.
 
 Additionally, this adds the following commands to handle control-flow and operations within procedures. Result is always a parameter stored on the node hosting the corresponding procedure server (node 0 from its perspective) - Except when using the `rmt` unop operation, where it's switched with [node]!
 - proc block <param a> <op> <param b> [node]
@@ -47,6 +51,7 @@ Additionally, this adds the following commands to handle control-flow and operat
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <slash/slash.h>
@@ -54,6 +59,7 @@ Additionally, this adds the following commands to handle control-flow and operat
 #include <slash/dflopt.h>
 #include <csp_proc/proc_types.h>
 #include <csp_proc/proc_client.h>
+#include <csp_proc/proc_store.h>
 #include <csp_proc/proc_pack.h>
 #include <csp_proc/proc_memory.h>
 
@@ -135,6 +141,14 @@ int instruction_can_be_added() {
 		printf("Maximum number of instructions reached for this procedure.\n");
 		return 0;
 	}
+
+	// Procedures only hold as many instructions as they use, so make room for one more
+	proc_instruction_t * instructions = proc_realloc(current_procedure->instructions, (current_procedure->instruction_count + 1) * sizeof(proc_instruction_t));
+	if (instructions == NULL) {
+		printf("Failed to allocate memory for instruction\n");
+		return 0;
+	}
+	current_procedure->instructions = instructions;
 	return 1;
 }
 
@@ -149,7 +163,10 @@ int proc_new(struct slash * slash) {
 		printf("Failed to allocate memory for new procedure\n");
 		return SLASH_ENOMEM;
 	}
+	_new_proc->instructions = NULL;
 	_new_proc->instruction_count = 0;
+	_new_proc->strings = NULL;
+	_new_proc->link = NULL;
 
 	current_procedure = _new_proc;
 	printf("Created new procedure\n");
@@ -246,6 +263,10 @@ int proc_pull(struct slash * slash) {
 	}
 
 	current_procedure = proc_malloc(sizeof(proc_t));
+	current_procedure->instructions = NULL;
+	current_procedure->instruction_count = 0;
+	current_procedure->strings = NULL;
+	current_procedure->link = NULL;
 	int ret = proc_pull_request(current_procedure, proc_slot, node, timeout);
 	if (ret != 0) {
 		printf("Failed to pull procedure from slot %d on node %d with return code %d\n", proc_slot, node, ret);
@@ -352,7 +373,7 @@ int proc_pop(struct slash * slash) {
 		printf("Removed latest instruction from procedure\n");
 	} else if (step < current_procedure->instruction_count - 1) {
 		// free the memory of the removed instruction
-		proc_free_instruction(&current_procedure->instructions[step]);
+		proc_free_instruction_in(current_procedure, &current_procedure->instructions[step]);
 		for (int i = step; i < current_procedure->instruction_count - 1; i++) {
 			// shift remaining instructions one position left
 			if (proc_copy_instruction(&current_procedure->instructions[i + 1], &current_procedure->instructions[i]) != 0) {
@@ -419,13 +440,15 @@ slash_command_sub(proc, list, proc_list, "", "");
 int proc_slots(struct slash * slash) {
 	unsigned int node = slash_dfl_node;
 	unsigned int timeout = slash_dfl_timeout;
-	uint8_t slots[MAX_PROC_SLOT + 1];
-	uint8_t slot_count = 0;
+	uint8_t bitmap[PROC_SLOTS_BITMAP_SIZE];
+	proc_slot_info_t info[PROC_SLOTS_BITMAP_SIZE * 8];
+	int with_info = 0;
 
 	optparse_t * parser = optparse_new("proc slots", "[node]");
 	optparse_add_help(parser);
 	optparse_add_unsigned(parser, 'n', "node", "NUM", 0, &node, "node (default = <env>)");
 	optparse_add_unsigned(parser, 't', "timeout", "NUM", 0, &timeout, "timeout (default = <env>)");
+	optparse_add_set(parser, 'i', "info", 1, &with_info, "show the type and instruction count of each procedure");
 
 	int argi = optparse_parse(parser, slash->argc - 1, (const char **)slash->argv + 1);
 	if (argi < 0) {
@@ -437,16 +460,30 @@ int proc_slots(struct slash * slash) {
 		node = atoi(slash->argv[argi]);
 	}
 
-	int ret = proc_slots_request(slots, &slot_count, node, timeout);
+	int ret = proc_slots_info_request(bitmap, with_info ? info : NULL, node, timeout);
 	if (ret != 0) {
 		printf("Failed to list procedure slots on node %d with return code %d\n", node, ret);
 		optparse_del(parser);
 		return SLASH_EINVAL;
 	}
 
+	int slot_count = 0;
+	for (int slot = 0; slot < PROC_SLOTS_BITMAP_SIZE * 8; slot++) {
+		slot_count += PROC_SLOTS_BITMAP_TEST(bitmap, slot);
+	}
+
 	printf("%d occupied procedure slots on node %d:\n", slot_count, node);
-	for (int i = 0; i < slot_count; i++) {
-		printf("%d\n", slots[i]);
+	for (int slot = 0; slot < PROC_SLOTS_BITMAP_SIZE * 8; slot++) {
+		if (!PROC_SLOTS_BITMAP_TEST(bitmap, slot)) {
+			continue;
+		}
+		if (!with_info || info[slot].type == PROC_TYPE_NONE) {
+			printf("%d\n", slot);
+		} else if (info[slot].type == PROC_TYPE_COMPILED) {
+			printf("%d: pre-compiled\n", slot);
+		} else {
+			printf("%d: %d instructions\n", slot, info[slot].instruction_count);
+		}
 	}
 
 	optparse_del(parser);
@@ -454,16 +491,32 @@ int proc_slots(struct slash * slash) {
 }
 slash_command_sub(proc, slots, proc_slots, "[node]", "");
 
+static void proc_run_async_callback(int host, uint8_t proc_slot, int result, void * arg) {
+	if (result != 0) {
+		printf("Failed to run procedure in slot %d on node %d\n", proc_slot, host);
+	} else {
+		printf("Running procedure in slot %d on node %d\n", proc_slot, host);
+	}
+}
+
 int proc_run(struct slash * slash) {
 	unsigned int proc_slot;
 	unsigned int node = slash_dfl_node;
 	unsigned int timeout = slash_dfl_timeout;
+	unsigned int period = 0;
+	unsigned int phase = 0;
+	unsigned int priority = UINT32_MAX;  // none given
+	int stop = 0;
 
-	optparse_t * parser = optparse_new("proc run", "<procedure slot> [node]");
+	optparse_t * parser = optparse_new("proc run", "<procedure slot> [node...]");
 	optparse_add_help(parser);
 	optparse_add_unsigned(parser, 'p', "proc_slot", "NUM", 0, &proc_slot, "procedure slot");
 	optparse_add_unsigned(parser, 'n', "node", "NUM", 0, &node, "node (default = <env>)");
 	optparse_add_unsigned(parser, 't', "timeout", "NUM", 0, &timeout, "timeout (default = <env>)");
+	optparse_add_unsigned(parser, 'P', "period", "NUM", 0, &period, "run every NUM ms instead of once");
+	optparse_add_unsigned(parser, 'f', "phase", "NUM", 0, &phase, "delay in ms before the first periodic run (default = 0)");
+	optparse_add_set(parser, 's', "stop", 1, &stop, "stop the periodic runs of the procedure");
+	optparse_add_unsigned(parser, 'r', "priority", "NUM", 0, &priority, "run ahead of waiting runs of lower priority (0-255)");
 
 	int argi = optparse_parse(parser, slash->argc - 1, (const char **)slash->argv + 1);
 	if (argi < 0) {
@@ -488,6 +541,58 @@ int proc_run(struct slash * slash) {
 		return SLASH_EINVAL;
 	}
 
+	if (period > 0 || stop) {
+		int failed = 0;
+		do {
+			node = (argi < slash->argc) ? atoi(slash->argv[argi]) : node;
+			if (proc_run_periodic_request(proc_slot, stop ? 0 : period, phase, node, timeout) != 0) {
+				printf("Failed to %s periodic runs of procedure in slot %d on node %d\n", stop ? "stop" : "start", proc_slot, node);
+				failed++;
+			}
+		} while (++argi < slash->argc);
+		optparse_del(parser);
+		return (failed == 0) ? SLASH_SUCCESS : SLASH_EINVAL;
+	}
+
+	if (priority != UINT32_MAX) {
+		if (priority > UINT8_MAX) {
+			printf("Invalid priority %u\n", priority);
+			optparse_del(parser);
+			return SLASH_EINVAL;
+		}
+		int failed = 0;
+		do {
+			node = (argi < slash->argc) ? atoi(slash->argv[argi]) : node;
+			if (proc_run_priority_request(proc_slot, priority, node, timeout) != 0) {
+				printf("Failed to run procedure in slot %d on node %d\n", proc_slot, node);
+				failed++;
+			}
+		} while (++argi < slash->argc);
+		optparse_del(parser);
+		return (failed == 0) ? SLASH_SUCCESS : SLASH_EINVAL;
+	}
+
+	if (argi + 1 < slash->argc) {
+		// Several nodes: run on all of them in parallel
+		static proc_async_t async;
+		proc_async_init(&async);
+		int failed = 0;
+		for (; argi < slash->argc; argi++) {
+			node = atoi(slash->argv[argi]);
+			int ret;
+			while ((ret = proc_async_run(&async, node, proc_slot, timeout, proc_run_async_callback, NULL)) != 0 && async.pending == PROC_ASYNC_MAX) {
+				proc_async_poll(&async, PROC_ASYNC_POLL_INTERVAL);  // wait for a free request
+			}
+			if (ret != 0) {
+				printf("Failed to run procedure in slot %d on node %d with return code %d\n", proc_slot, node, ret);
+				failed++;
+			}
+		}
+		failed += proc_async_wait_all(&async);
+		optparse_del(parser);
+		return (failed == 0) ? SLASH_SUCCESS : SLASH_EINVAL;
+	}
+
 	int ret = proc_run_request(proc_slot, node, timeout);
 	if (ret != 0) {
 		printf("Failed to run procedure in slot %d on node %d with return code %d\n", proc_slot, node, ret);
@@ -499,7 +604,147 @@ int proc_run(struct slash * slash) {
 	optparse_del(parser);
 	return SLASH_SUCCESS;
 }
-slash_command_sub(proc, run, proc_run, "<procedure slot> [node]", "");
+slash_command_sub(proc, run, proc_run, "<procedure slot> [node...]", "");
+
+/**
+ * Parse a time in seconds with an optional fraction, e.g. "1700000000.25".
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int proc_parse_time(const char * str, uint32_t * tv_sec, uint32_t * tv_nsec) {
+	char * end;
+	*tv_sec = strtoul(str, &end, 10);
+	*tv_nsec = 0;
+	if (end == str) {
+		return -1;
+	}
+	if (*end == '.') {
+		uint32_t scale = 100000000;
+		for (end++; *end >= '0' && *end <= '9'; end++, scale /= 10) {
+			*tv_nsec += (*end - '0') * scale;
+		}
+	}
+	return (*end == '\0') ? 0 : -1;
+}
+
+int proc_at(struct slash * slash) {
+	unsigned int proc_slot;
+	unsigned int node = slash_dfl_node;
+	unsigned int timeout = slash_dfl_timeout;
+
+	optparse_t * parser = optparse_new("proc at", "<procedure slot> <time> [node]");
+	optparse_add_help(parser);
+	optparse_add_unsigned(parser, 'n', "node", "NUM", 0, &node, "node (default = <env>)");
+	optparse_add_unsigned(parser, 't', "timeout", "NUM", 0, &timeout, "timeout (default = <env>)");
+
+	int argi = optparse_parse(parser, slash->argc - 1, (const char **)slash->argv + 1);
+	if (argi < 0) {
+		optparse_del(parser);
+		return SLASH_EINVAL;
+	}
+
+	if (argi + 2 >= slash->argc) {
+		printf("Arguments <procedure slot> (uint8) and <time> required\n");
+		optparse_del(parser);
+		return SLASH_EINVAL;
+	}
+	proc_slot = atoi(slash->argv[++argi]);
+	const char * time_str = slash->argv[++argi];
+
+	if (++argi < slash->argc) {
+		node = atoi(slash->argv[argi]);
+	}
+
+	if (proc_slot < RESERVED_PROC_SLOTS || proc_slot > MAX_PROC_SLOT) {
+		printf("Invalid procedure slot %d\n", proc_slot);
+		optparse_del(parser);
+		return SLASH_EINVAL;
+	}
+
+	int relative = (time_str[0] == '+');
+	uint32_t tv_sec, tv_nsec;
+	if (proc_parse_time(time_str + relative, &tv_sec, &tv_nsec) != 0) {
+		printf("Invalid time %s\n", time_str);
+		optparse_del(parser);
+		return SLASH_EINVAL;
+	}
+	if (relative) {
+		csp_timestamp_t now;
+		csp_clock_get_time(&now);
+		tv_sec += now.tv_sec;
+		tv_nsec += now.tv_nsec;
+		if (tv_nsec >= 1000000000) {
+			tv_sec++;
+			tv_nsec -= 1000000000;
+		}
+	}
+
+	uint16_t id;
+	int ret = proc_timed_run_request(proc_slot, tv_sec, tv_nsec, &id, node, timeout);
+	if (ret != 0) {
+		printf("Failed to schedule procedure in slot %d on node %d with return code %d\n", proc_slot, node, ret);
+		optparse_del(parser);
+		return SLASH_EINVAL;
+	}
+	printf("Procedure in slot %d runs at %u.%09u on node %d (id %d)\n", proc_slot, (unsigned int)tv_sec, (unsigned int)tv_nsec, node, id);
+
+	optparse_del(parser);
+	return SLASH_SUCCESS;
+}
+slash_command_sub(proc, at, proc_at, "<procedure slot> <time> [node]", "");
+
+int proc_timed(struct slash * slash) {
+	unsigned int node = slash_dfl_node;
+	unsigned int timeout = slash_dfl_timeout;
+	int cancel_id = -1;
+
+	optparse_t * parser = optparse_new("proc timed", "[node]");
+	optparse_add_help(parser);
+	optparse_add_unsigned(parser, 'n', "node", "NUM", 0, &node, "node (default = <env>)");
+	optparse_add_unsigned(parser, 't', "timeout", "NUM", 0, &timeout, "timeout (default = <env>)");
+	optparse_add_int(parser, 'c', "cancel", "NUM", 0, &cancel_id, "cancel the timed run with this id");
+
+	int argi = optparse_parse(parser, slash->argc - 1, (const char **)slash->argv + 1);
+	if (argi < 0) {
+		optparse_del(parser);
+		return SLASH_EINVAL;
+	}
+
+	if (++argi < slash->argc) {
+		node = atoi(slash->argv[argi]);
+	}
+
+	if (cancel_id >= 0) {
+		int ret = proc_timed_cancel_request(cancel_id, node, timeout);
+		if (ret != 0) {
+			printf("Failed to cancel timed run %d on node %d with return code %d\n", cancel_id, node, ret);
+			optparse_del(parser);
+			return SLASH_EINVAL;
+		}
+		printf("Cancelled timed run %d on node %d\n", cancel_id, node);
+		optparse_del(parser);
+		return SLASH_SUCCESS;
+	}
+
+	proc_timed_run_t runs[PROC_TIMED_LIST_MAX];
+	proc_timed_jitter_t jitter;
+	int count;
+	int ret = proc_timed_list_request(runs, &count, &jitter, node, timeout);
+	if (ret != 0) {
+		printf("Failed to list timed runs on node %d with return code %d\n", node, ret);
+		optparse_del(parser);
+		return SLASH_EINVAL;
+	}
+
+	printf("%d timed runs on node %d (last started %u us late, at most %u us, %u failed starts):\n", count, node, (unsigned int)jitter.last_us, (unsigned int)jitter.max_us, (unsigned int)jitter.failed);
+	for (int i = 0; i < count; i++) {
+		printf("%d: slot %d at %u.%09u\n", runs[i].id, runs[i].proc_slot, (unsigned int)runs[i].tv_sec, (unsigned int)runs[i].tv_nsec);
+	}
+
+	optparse_del(parser);
+	return SLASH_SUCCESS;
+}
+slash_command_sub(proc, timed, proc_timed, "[node]", "");
 
 int proc_block(struct slash * slash) {
 	unsigned int node = slash_dfl_node;
@@ -1,4 +1,6 @@
 #include <csp_proc/proc_store.h>
+#include <csp_proc/proc_analyze.h>
+#include <csp_proc/proc_pack.h>
 #include <csp_proc/proc_mutex.h>
 #include <csp_proc/proc_memory.h>
 
@@ -6,18 +8,28 @@ compiled_proc_t proc_reserved_slots_array[RESERVED_PROC_SLOTS];
 proc_t * proc_store[MAX_PROC_SLOT + 1 - RESERVED_PROC_SLOTS];
 proc_mutex_t * proc_store_mutex = NULL;
 
+// Stored procedures are immutable snapshots. The store holds one reference to each, and runs take their own,
+// so a snapshot is freed by whichever releases it last.
+static void proc_store_release(proc_t * proc) {
+	if (proc != NULL && __atomic_sub_fetch(&proc->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+		free_proc(proc);
+	}
+}
+
+// Analyses are invalidated after giving back the store mutex, since the analysis cache acquires procedures while holding its own mutex
+static void proc_store_invalidate(uint8_t slot) {
+	if (proc_analysis_invalidate != NULL) {
+		proc_analysis_invalidate(slot);
+	}
+}
+
 int _delete_proc(uint8_t slot) {
 	if (slot < RESERVED_PROC_SLOTS || slot > MAX_PROC_SLOT) {
 		return -1;
 	}
 	int shifted_slot = slot - RESERVED_PROC_SLOTS;
-	if (proc_store[shifted_slot] != NULL) {
-		for (int i = 0; i < proc_store[shifted_slot]->instruction_count; i++) {
-			proc_free_instruction(&proc_store[shifted_slot]->instructions[i]);
-		}
-		proc_free(proc_store[shifted_slot]);
-		proc_store[shifted_slot] = NULL;
-	}
+	proc_store_release(proc_store[shifted_slot]);
+	proc_store[shifted_slot] = NULL;
 	return 0;
 }
 
@@ -27,6 +39,9 @@ int delete_proc(uint8_t slot) {
 	}
 	int ret = _delete_proc(slot);
 	proc_mutex_give(proc_store_mutex);
+	if (ret == 0) {
+		proc_store_invalidate(slot);
+	}
 	return ret;
 }
 
@@ -38,6 +53,9 @@ int reset_proc_store() {
 		_delete_proc(i);
 	}
 	proc_mutex_give(proc_store_mutex);
+	for (int i = RESERVED_PROC_SLOTS; i < MAX_PROC_SLOT + 1; i++) {
+		proc_store_invalidate(i);
+	}
 }
 
 int proc_store_init() {
@@ -52,6 +70,7 @@ void destroy_proc_store() {
 	if (proc_store != NULL) {
 		for (int i = 0; i < MAX_PROC_SLOT + 1; i++) {
 			_delete_proc(i);
+			proc_store_invalidate(i);
 		}
 	}
 	if (proc_store_mutex != NULL) {
@@ -70,25 +89,26 @@ int set_proc(proc_t * proc, uint8_t slot, int overwrite) {
 	}
 
 	int shifted_slot = slot - RESERVED_PROC_SLOTS;
-	// Free any existing procedure in the slot
-	if (proc_store[shifted_slot] != NULL) {
-		if (!overwrite) {
-			proc_mutex_give(proc_store_mutex);
-			return -1;
-		}
-
-		proc_free(proc_store[shifted_slot]);
+	if (proc_store[shifted_slot] != NULL && !overwrite) {
+		proc_mutex_give(proc_store_mutex);
+		return -1;
 	}
 
-	proc_store[shifted_slot] = proc_malloc(sizeof(proc_t));
-	if (proc_store[shifted_slot] == NULL) {
+	proc_t * snapshot = proc_malloc(sizeof(proc_t));
+	if (snapshot == NULL) {
 		proc_mutex_give(proc_store_mutex);
 		return -1;
 	}
+	memcpy(snapshot, proc, sizeof(proc_t));
+	snapshot->refcount = 1;  // the store's reference
 
-	memcpy(proc_store[shifted_slot], proc, sizeof(proc_t));
-
+	// Publish the new snapshot, runs still holding the previous one keep it alive until they finish
+	proc_t * previous = proc_store[shifted_slot];
+	proc_store[shifted_slot] = snapshot;
 	proc_mutex_give(proc_store_mutex);
+
+	proc_store_release(previous);
+	proc_store_invalidate(slot);
 	return slot;
 }
 
@@ -107,11 +127,34 @@ proc_union_t get_proc(uint8_t slot) {
 	return proc_union;
 }
 
+proc_union_t acquire_proc(uint8_t slot) {
+	proc_union_t proc_union = {.type = PROC_TYPE_NONE};
+	if (proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		return proc_union;
+	}
+	proc_union = get_proc(slot);
+	if (proc_union.type == PROC_TYPE_DSL) {
+		__atomic_add_fetch(&proc_union.proc.dsl_proc->refcount, 1, __ATOMIC_RELAXED);
+	}
+	proc_mutex_give(proc_store_mutex);
+	return proc_union;
+}
+
+void release_proc(proc_union_t proc_union) {
+	if (proc_union.type == PROC_TYPE_DSL) {
+		proc_store_release(proc_union.proc.dsl_proc);
+	}
+}
+
 int * get_proc_slots() {
 	int * slots = proc_malloc((MAX_PROC_SLOT + 2) * sizeof(int));
 	int count = 0;
 
+	if (slots == NULL) {
+		return NULL;
+	}
 	if (proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		proc_free(slots);
 		return NULL;
 	}
 	for (int i = 0; i < RESERVED_PROC_SLOTS; i++) {
@@ -129,3 +172,44 @@ int * get_proc_slots() {
 	proc_mutex_give(proc_store_mutex);
 	return slots;
 }
+
+int get_proc_slots_bitmap(uint8_t * bitmap) {
+	memset(bitmap, 0, PROC_SLOTS_BITMAP_SIZE);
+
+	if (proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		return -1;
+	}
+	for (int i = 0; i < RESERVED_PROC_SLOTS; i++) {
+		if (proc_reserved_slots_array[i] != NULL) {
+			PROC_SLOTS_BITMAP_SET(bitmap, i);
+		}
+	}
+	for (int i = RESERVED_PROC_SLOTS; i < MAX_PROC_SLOT + 1; i++) {
+		if (proc_store[i - RESERVED_PROC_SLOTS] != NULL) {
+			PROC_SLOTS_BITMAP_SET(bitmap, i);
+		}
+	}
+
+	proc_mutex_give(proc_store_mutex);
+	return 0;
+}
+
+int get_proc_slot_info(uint8_t slot, proc_slot_info_t * info) {
+	if (slot < RESERVED_PROC_SLOTS) {
+		info->type = PROC_TYPE_COMPILED;
+		info->instruction_count = 0;
+		return (proc_reserved_slots_array[slot] != NULL) ? 0 : -1;
+	}
+	if (slot > MAX_PROC_SLOT || proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		return -1;
+	}
+	int shifted_slot = slot - RESERVED_PROC_SLOTS;
+	int ret = -1;
+	if (proc_store[shifted_slot] != NULL) {
+		info->type = PROC_TYPE_DSL;
+		info->instruction_count = proc_store[shifted_slot]->instruction_count;
+		ret = 0;
+	}
+	proc_mutex_give(proc_store_mutex);
+	return ret;
+}
@@ -0,0 +1,519 @@
+// Persistent proc store, keeping procedures in their packed wire format in a journal on block storage (see proc_storage.h)
+//
+// The storage is split into two banks, one of which is active. A bank starts with a header, followed by records appended
+// one after another, each holding the packed procedure of a slot (or marking the slot deleted) and a CRC. A record only takes
+// effect once it has been completely written, so updating a slot is atomic: after a power loss, a torn record fails its CRC
+// and the slot keeps its previous procedure. When the active bank is full, the live records are compacted into the other bank,
+// which becomes active once its header has been written.
+//
+// Booting only scans the record headers to index the latest record of each slot, procedures are unpacked on first use.
+
+#include <csp_proc/proc_store.h>
+#include <csp_proc/proc_storage.h>
+#include <csp_proc/proc_analyze.h>
+#include <csp_proc/proc_pack.h>
+#include <csp_proc/proc_runtime.h>
+#include <csp_proc/proc_mutex.h>
+#include <csp_proc/proc_memory.h>
+
+#include <stddef.h>
+#include <csp/csp.h>
+#include <csp/csp_crc32.h>
+
+#define PROC_STORE_BANK_SIZE      (PROC_STORE_SIZE / 2)
+#define PROC_STORE_BANK_MAGIC     (0x50524F43U)  // "PROC"
+#define PROC_STORE_RECORD_MAGIC   (0x5052U)
+#define PROC_STORE_RECORD_END     (0xFFFFU)  // erased storage, the end of the journal
+#define PROC_STORE_RECORD_DELETED (1U << 0)
+#define PROC_STORE_RECORD_COMPACT (1U << 1)  // packed with proc_pack_compact rather than proc_pack
+
+#define PROC_STORE_ALIGN(size) (((size) + PROC_STORE_WRITE_ALIGN - 1) & ~(PROC_STORE_WRITE_ALIGN - 1))
+
+typedef struct {
+	uint32_t magic;
+	uint32_t generation;  // the valid bank with the highest generation is the active one
+	uint32_t crc;         // of the fields above
+} proc_store_bank_header_t;
+
+typedef struct {
+	uint32_t crc;  // of the rest of the header and the packed procedure
+	uint16_t magic;
+	uint8_t slot;
+	uint8_t flags;
+	uint16_t length;  // of the packed procedure following the header
+	uint16_t reserved;
+} proc_store_record_header_t;
+
+#define PROC_STORE_RECORDS_START      PROC_STORE_ALIGN(sizeof(proc_store_bank_header_t))
+#define PROC_STORE_RECORD_MAX_LENGTH  PROC_MAX_PACKED_SIZE
+#define PROC_STORE_RECORD_BUFFER_SIZE PROC_STORE_ALIGN(sizeof(proc_store_record_header_t) + PROC_STORE_RECORD_MAX_LENGTH)
+#define PROC_STORE_COPY_SIZE          PROC_STORE_ALIGN(64)  // records are copied in chunks of this size during compaction
+
+_Static_assert(PROC_STORE_BANK_SIZE % PROC_STORE_ERASE_SIZE == 0 && PROC_STORE_BANK_SIZE >= PROC_STORE_RECORDS_START + PROC_STORE_RECORD_BUFFER_SIZE,
+               "PROC_STORE_SIZE must be two banks of whole erase blocks, each large enough for a procedure");
+
+// Location of the packed procedure of a slot in the active bank
+typedef struct {
+	uint32_t offset;
+	uint16_t length;  // 0 if the slot is empty
+	uint8_t flags;
+	uint8_t instruction_count;
+} proc_store_index_t;
+
+compiled_proc_t proc_reserved_slots_array[RESERVED_PROC_SLOTS];
+proc_t * proc_store[MAX_PROC_SLOT + 1 - RESERVED_PROC_SLOTS];  // procedures unpacked so far, see proc_store_dynamic.c
+proc_mutex_t * proc_store_mutex = NULL;
+
+static proc_store_index_t proc_store_index[MAX_PROC_SLOT + 1 - RESERVED_PROC_SLOTS];
+static uint32_t proc_store_compacted_offsets[MAX_PROC_SLOT + 1 - RESERVED_PROC_SLOTS];
+static uint8_t proc_store_active_bank = 0;
+static uint32_t proc_store_generation = 0;
+static uint32_t proc_store_write_offset = 0;  // end of the journal in the active bank
+
+// Buffers only used with the store mutex held
+static uint8_t proc_store_record[PROC_STORE_RECORD_BUFFER_SIZE] __attribute__((aligned(4)));
+static uint8_t proc_store_copy_buffer[PROC_STORE_COPY_SIZE] __attribute__((aligned(4)));
+
+static uint32_t proc_store_bank_base(uint8_t bank) {
+	return bank * PROC_STORE_BANK_SIZE;
+}
+
+static uint32_t proc_store_record_crc(proc_store_record_header_t * header) {
+	return csp_crc32_memory((uint8_t *)header + sizeof(header->crc), sizeof(*header) - sizeof(header->crc) + header->length);
+}
+
+static void proc_store_release(proc_t * proc) {
+	if (proc != NULL && __atomic_sub_fetch(&proc->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+		free_proc(proc);
+	}
+}
+
+// Analyses are invalidated after giving back the store mutex, since the analysis cache acquires procedures while holding its own mutex
+static void proc_store_invalidate(uint8_t slot) {
+	if (proc_analysis_invalidate != NULL) {
+		proc_analysis_invalidate(slot);
+	}
+}
+
+/**
+ * Copy the live records of the active bank into the other bank and make that the active one.
+ * The active bank is left untouched until the new bank's header is written, so a power loss during compaction loses nothing.
+ */
+static int proc_store_compact() {
+	uint8_t bank = !proc_store_active_bank;
+	uint32_t base = proc_store_bank_base(bank);
+	if (proc_storage_erase(base, PROC_STORE_BANK_SIZE) != 0) {
+		return -1;
+	}
+
+	uint32_t offset = PROC_STORE_RECORDS_START;
+	for (int i = 0; i < MAX_PROC_SLOT + 1 - RESERVED_PROC_SLOTS; i++) {
+		proc_store_index_t * entry = &proc_store_index[i];
+		if (entry->length == 0) {
+			continue;
+		}
+		uint32_t size = PROC_STORE_ALIGN(sizeof(proc_store_record_header_t) + entry->length);
+		uint32_t record_offset = proc_store_bank_base(proc_store_active_bank) + entry->offset - sizeof(proc_store_record_header_t);
+		for (uint32_t copied = 0; copied < size; copied += PROC_STORE_COPY_SIZE) {
+			uint32_t chunk = (size - copied < PROC_STORE_COPY_SIZE) ? size - copied : PROC_STORE_COPY_SIZE;
+			if (proc_storage_read(record_offset + copied, proc_store_copy_buffer, chunk) != 0 || proc_storage_write(base + offset + copied, proc_store_copy_buffer, chunk) != 0) {
+				return -1;
+			}
+		}
+		proc_store_compacted_offsets[i] = offset + sizeof(proc_store_record_header_t);
+		offset += size;
+	}
+
+	// Writing the header (after everything else is durable) is what makes the bank active
+	proc_store_bank_header_t header = {.magic = PROC_STORE_BANK_MAGIC, .generation = proc_store_generation + 1};
+	header.crc = csp_crc32_memory(&header, offsetof(proc_store_bank_header_t, crc));
+	memset(proc_store_copy_buffer, 0xFF, PROC_STORE_RECORDS_START);
+	memcpy(proc_store_copy_buffer, &header, sizeof(header));
+	if (proc_storage_sync() != 0 || proc_storage_write(base, proc_store_copy_buffer, PROC_STORE_RECORDS_START) != 0 || proc_storage_sync() != 0) {
+		return -1;
+	}
+
+	proc_store_active_bank = bank;
+	proc_store_generation = header.generation;
+	proc_store_write_offset = offset;
+	for (int i = 0; i < MAX_PROC_SLOT + 1 - RESERVED_PROC_SLOTS; i++) {
+		proc_store_index[i].offset = proc_store_compacted_offsets[i];
+	}
+	return 0;
+}
+
+/**
+ * Append a record to the journal of the active bank, compacting it first if it is full.
+ * Must be called with the store mutex held, and the packed procedure (if any) in the record buffer after the header.
+ *
+ * @return 0 on success, -1 on failure (the slot is unchanged)
+ */
+static int proc_store_append(uint8_t slot, uint8_t flags, uint16_t length) {
+	uint32_t size = PROC_STORE_ALIGN(sizeof(proc_store_record_header_t) + length);
+	if (proc_store_write_offset + size > PROC_STORE_BANK_SIZE && (proc_store_compact() != 0 || proc_store_write_offset + size > PROC_STORE_BANK_SIZE)) {
+		csp_print("Proc store is full\n");
+		return -1;
+	}
+
+	proc_store_record_header_t * header = (proc_store_record_header_t *)proc_store_record;
+	header->magic = PROC_STORE_RECORD_MAGIC;
+	header->slot = slot;
+	header->flags = flags;
+	header->length = length;
+	header->reserved = 0xFFFF;
+	memset((uint8_t *)(header + 1) + length, 0xFF, size - sizeof(*header) - length);
+	header->crc = proc_store_record_crc(header);
+
+	if (proc_storage_write(proc_store_bank_base(proc_store_active_bank) + proc_store_write_offset, proc_store_record, size) != 0 || proc_storage_sync() != 0) {
+		return -1;
+	}
+
+	proc_store_index_t * entry = &proc_store_index[slot - RESERVED_PROC_SLOTS];
+	entry->offset = proc_store_write_offset + sizeof(*header);
+	entry->length = (flags & PROC_STORE_RECORD_DELETED) ? 0 : length;
+	entry->flags = flags;
+	proc_store_write_offset += size;
+	return 0;
+}
+
+/**
+ * Index the latest record of each slot in the journal of the active bank.
+ *
+ * @return 0 on success, 1 if the journal ends in a torn record, -1 on failure
+ */
+static int proc_store_scan() {
+	memset(proc_store_index, 0, sizeof(proc_store_index));
+	uint32_t base = proc_store_bank_base(proc_store_active_bank);
+	proc_store_record_header_t * header = (proc_store_record_header_t *)proc_store_record;
+
+	proc_store_write_offset = PROC_STORE_RECORDS_START;
+	while (proc_store_write_offset + sizeof(*header) <= PROC_STORE_BANK_SIZE) {
+		if (proc_storage_read(base + proc_store_write_offset, header, sizeof(*header)) != 0) {
+			return -1;
+		}
+		if (header->magic == PROC_STORE_RECORD_END) {
+			// The end of the journal, unless a record was torn before its magic was written
+			for (size_t i = 0; i < sizeof(*header); i++) {
+				if (((uint8_t *)header)[i] != 0xFF) {
+					return 1;
+				}
+			}
+			break;
+		}
+
+		uint32_t size = PROC_STORE_ALIGN(sizeof(*header) + header->length);
+		if (header->magic != PROC_STORE_RECORD_MAGIC || header->length > PROC_STORE_RECORD_MAX_LENGTH || proc_store_write_offset + size > PROC_STORE_BANK_SIZE
+			|| proc_storage_read(base + proc_store_write_offset + sizeof(*header), header + 1, header->length) != 0 || header->crc != proc_store_record_crc(header)) {
+			return 1;
+		}
+
+		if (header->slot >= RESERVED_PROC_SLOTS) {
+			proc_store_index_t * entry = &proc_store_index[header->slot - RESERVED_PROC_SLOTS];
+			entry->offset = proc_store_write_offset + sizeof(*header);
+			entry->length = (header->flags & PROC_STORE_RECORD_DELETED) ? 0 : header->length;
+			entry->flags = header->flags;
+			entry->instruction_count = proc_packed_instruction_count((uint8_t *)(header + 1), header->length, header->flags & PROC_STORE_RECORD_COMPACT);
+		}
+		proc_store_write_offset += size;
+	}
+	return 0;
+}
+
+static int proc_store_read_bank_header(uint8_t bank, uint32_t * generation) {
+	proc_store_bank_header_t header;
+	if (proc_storage_read(proc_store_bank_base(bank), &header, sizeof(header)) != 0) {
+		return -1;
+	}
+	if (header.magic != PROC_STORE_BANK_MAGIC || header.crc != csp_crc32_memory(&header, offsetof(proc_store_bank_header_t, crc))) {
+		return -1;
+	}
+	*generation = header.generation;
+	return 0;
+}
+
+static int proc_store_mount() {
+	uint32_t generations[2];
+	int valid[2];
+	for (uint8_t bank = 0; bank < 2; bank++) {
+		valid[bank] = proc_store_read_bank_header(bank, &generations[bank]) == 0;
+	}
+
+	if (!valid[0] && !valid[1]) {
+		csp_print("Formatting proc store\n");
+		memset(proc_store_index, 0, sizeof(proc_store_index));
+		proc_store_active_bank = 1;
+		proc_store_generation = 0;
+		return proc_store_compact();
+	}
+
+	proc_store_active_bank = (valid[0] && (!valid[1] || (int32_t)(generations[0] - generations[1]) > 0)) ? 0 : 1;
+	proc_store_generation = generations[proc_store_active_bank];
+
+	int ret = proc_store_scan();
+	if (ret == 1) {
+		// Nothing can be appended past a torn record, so continue from a compacted copy of the journal
+		csp_print("Proc store journal ends in an incomplete record, compacting\n");
+		ret = proc_store_compact();
+	}
+	return ret;
+}
+
+/**
+ * Get the procedure of a slot, unpacking it from storage on first use.
+ * Must be called with the store mutex held.
+ */
+static proc_t * proc_store_load(uint8_t slot) {
+	int shifted_slot = slot - RESERVED_PROC_SLOTS;
+	proc_store_index_t * entry = &proc_store_index[shifted_slot];
+	if (proc_store[shifted_slot] != NULL || entry->length == 0) {
+		return proc_store[shifted_slot];
+	}
+
+	proc_t * proc = proc_calloc(1, sizeof(proc_t));
+	if (proc == NULL) {
+		return NULL;
+	}
+	int ret = proc_storage_read(proc_store_bank_base(proc_store_active_bank) + entry->offset, proc_store_record, entry->length);
+	if (ret == 0) {
+		ret = (entry->flags & PROC_STORE_RECORD_COMPACT) ? proc_unpack_compact(proc, proc_store_record, entry->length) : proc_unpack(proc, proc_store_record, entry->length);
+	}
+	if (ret != 0) {
+		csp_print("Failed to load procedure in slot %d\n", slot);
+		free_proc(proc);
+		return NULL;
+	}
+	proc->refcount = 1;  // the store's reference
+
+	if (proc_runtime_link != NULL) {
+		proc_runtime_link(proc);  // unlinked operands are resolved by name at run time
+	}
+	proc_store[shifted_slot] = proc;
+	return proc;
+}
+
+static proc_union_t _get_proc(uint8_t slot) {
+	proc_union_t proc_union;
+	if (slot < RESERVED_PROC_SLOTS) {
+		proc_union.type = PROC_TYPE_COMPILED;
+		proc_union.proc.compiled_proc = proc_reserved_slots_array[slot];
+	} else {
+		proc_union.type = PROC_TYPE_DSL;
+		proc_union.proc.dsl_proc = proc_store_load(slot);
+	}
+	if (proc_union.proc.compiled_proc == NULL && proc_union.proc.dsl_proc == NULL) {
+		proc_union.type = PROC_TYPE_NONE;
+	}
+	return proc_union;
+}
+
+int _delete_proc(uint8_t slot) {
+	if (slot < RESERVED_PROC_SLOTS || slot > MAX_PROC_SLOT) {
+		return -1;
+	}
+	int shifted_slot = slot - RESERVED_PROC_SLOTS;
+	if (proc_store_index[shifted_slot].length > 0 && proc_store_append(slot, PROC_STORE_RECORD_DELETED, 0) != 0) {
+		return -1;
+	}
+	proc_store_release(proc_store[shifted_slot]);
+	proc_store[shifted_slot] = NULL;
+	return 0;
+}
+
+int delete_proc(uint8_t slot) {
+	if (proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		return PROC_MUTEX_ERR;
+	}
+	int ret = _delete_proc(slot);
+	proc_mutex_give(proc_store_mutex);
+	if (ret == 0) {
+		proc_store_invalidate(slot);
+	}
+	return ret;
+}
+
+int reset_proc_store() {
+	if (proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		return PROC_MUTEX_ERR;
+	}
+	for (int i = 0; i < MAX_PROC_SLOT + 1 - RESERVED_PROC_SLOTS; i++) {
+		proc_store_release(proc_store[i]);
+		proc_store[i] = NULL;
+	}
+	memset(proc_store_index, 0, sizeof(proc_store_index));
+	int ret = proc_store_compact();  // start over with an empty journal
+	proc_mutex_give(proc_store_mutex);
+
+	for (int i = RESERVED_PROC_SLOTS; i < MAX_PROC_SLOT + 1; i++) {
+		proc_store_invalidate(i);
+	}
+	return ret;
+}
+
+int proc_store_init() {
+	if (proc_storage_read == NULL || proc_storage_write == NULL || proc_storage_erase == NULL || proc_storage_sync == NULL) {
+		csp_print("Persistent proc store requires a proc storage implementation\n");
+		return -1;
+	}
+	if (proc_storage_init != NULL && proc_storage_init() != 0) {
+		csp_print("Failed to initialize proc storage\n");
+		return -1;
+	}
+
+	proc_store_mutex = proc_mutex_create();
+	if (proc_store_mutex == NULL) {
+		return -1;
+	}
+	if (proc_store_mount() != 0) {
+		csp_print("Failed to mount proc store\n");
+		proc_mutex_destroy(proc_store_mutex);
+		proc_store_mutex = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+void destroy_proc_store() {
+	for (int i = 0; i < MAX_PROC_SLOT + 1 - RESERVED_PROC_SLOTS; i++) {
+		proc_store_release(proc_store[i]);
+		proc_store[i] = NULL;
+		proc_store_invalidate(i + RESERVED_PROC_SLOTS);
+	}
+	if (proc_store_mutex != NULL) {
+		proc_mutex_destroy(proc_store_mutex);
+		proc_store_mutex = NULL;
+	}
+}
+
+int set_proc(proc_t * proc, uint8_t slot, int overwrite) {
+	if (slot < RESERVED_PROC_SLOTS || slot > MAX_PROC_SLOT) {
+		return -1;
+	}
+
+	if (proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		return PROC_MUTEX_ERR;
+	}
+
+	int shifted_slot = slot - RESERVED_PROC_SLOTS;
+	if (proc_store_index[shifted_slot].length > 0 && !overwrite) {
+		proc_mutex_give(proc_store_mutex);
+		return -1;
+	}
+
+	// Persist the packed procedure before publishing it
+	proc_t * snapshot = proc_malloc(sizeof(proc_t));
+	int length = (snapshot != NULL) ? proc_pack_compact(proc, proc_store_record + sizeof(proc_store_record_header_t), PROC_STORE_RECORD_MAX_LENGTH) : -1;
+	if (length < 0 || proc_store_append(slot, PROC_STORE_RECORD_COMPACT, length) != 0) {
+		csp_print("Failed to persist procedure in slot %d\n", slot);
+		proc_free(snapshot);
+		proc_mutex_give(proc_store_mutex);
+		return -1;
+	}
+	memcpy(snapshot, proc, sizeof(proc_t));
+	snapshot->refcount = 1;  // the store's reference
+	proc_store_index[shifted_slot].instruction_count = proc->instruction_count;
+
+	proc_t * previous = proc_store[shifted_slot];
+	proc_store[shifted_slot] = snapshot;
+	proc_mutex_give(proc_store_mutex);
+
+	proc_store_release(previous);
+	proc_store_invalidate(slot);
+	return slot;
+}
+
+proc_union_t get_proc(uint8_t slot) {
+	proc_union_t proc_union = {.type = PROC_TYPE_NONE};
+	if (proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		return proc_union;
+	}
+	proc_union = _get_proc(slot);
+	proc_mutex_give(proc_store_mutex);
+	return proc_union;
+}
+
+proc_union_t acquire_proc(uint8_t slot) {
+	proc_union_t proc_union = {.type = PROC_TYPE_NONE};
+	if (proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		return proc_union;
+	}
+	proc_union = _get_proc(slot);
+	if (proc_union.type == PROC_TYPE_DSL) {
+		__atomic_add_fetch(&proc_union.proc.dsl_proc->refcount, 1, __ATOMIC_RELAXED);
+	}
+	proc_mutex_give(proc_store_mutex);
+	return proc_union;
+}
+
+void release_proc(proc_union_t proc_union) {
+	if (proc_union.type == PROC_TYPE_DSL) {
+		proc_store_release(proc_union.proc.dsl_proc);
+	}
+}
+
+int * get_proc_slots() {
+	int * slots = proc_malloc((MAX_PROC_SLOT + 2) * sizeof(int));
+	int count = 0;
+
+	if (slots == NULL) {
+		return NULL;
+	}
+	if (proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		proc_free(slots);
+		return NULL;
+	}
+	for (int i = 0; i < RESERVED_PROC_SLOTS; i++) {
+		if (proc_reserved_slots_array[i] != NULL) {
+			slots[count++] = i;
+		}
+	}
+	for (int i = RESERVED_PROC_SLOTS; i < MAX_PROC_SLOT + 1; i++) {
+		if (proc_store_index[i - RESERVED_PROC_SLOTS].length > 0) {
+			slots[count++] = i;
+		}
+	}
+	slots[count] = -1;  // Terminate the array with -1
+
+	proc_mutex_give(proc_store_mutex);
+	return slots;
+}
+
+int get_proc_slots_bitmap(uint8_t * bitmap) {
+	memset(bitmap, 0, PROC_SLOTS_BITMAP_SIZE);
+
+	if (proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		return -1;
+	}
+	for (int i = 0; i < RESERVED_PROC_SLOTS; i++) {
+		if (proc_reserved_slots_array[i] != NULL) {
+			PROC_SLOTS_BITMAP_SET(bitmap, i);
+		}
+	}
+	for (int i = RESERVED_PROC_SLOTS; i < MAX_PROC_SLOT + 1; i++) {
+		if (proc_store_index[i - RESERVED_PROC_SLOTS].length > 0) {
+			PROC_SLOTS_BITMAP_SET(bitmap, i);
+		}
+	}
+
+	proc_mutex_give(proc_store_mutex);
+	return 0;
+}
+
+int get_proc_slot_info(uint8_t slot, proc_slot_info_t * info) {
+	if (slot < RESERVED_PROC_SLOTS) {
+		info->type = PROC_TYPE_COMPILED;
+		info->instruction_count = 0;
+		return (proc_reserved_slots_array[slot] != NULL) ? 0 : -1;
+	}
+	if (slot > MAX_PROC_SLOT || proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		return -1;
+	}
+	int shifted_slot = slot - RESERVED_PROC_SLOTS;
+	int ret = -1;
+	if (proc_store_index[shifted_slot].length > 0) {
+		info->type = PROC_TYPE_DSL;
+		info->instruction_count = proc_store_index[shifted_slot].instruction_count;
+		ret = 0;
+	}
+	proc_mutex_give(proc_store_mutex);
+	return ret;
+}
@@ -1,4 +1,6 @@
 #include <csp_proc/proc_store.h>
+#include <csp_proc/proc_analyze.h>
+#include <csp_proc/proc_pack.h>
 #include <csp_proc/proc_mutex.h>
 #include <csp_proc/proc_memory.h>
 
@@ -6,15 +8,28 @@ compiled_proc_t proc_reserved_slots_array[RESERVED_PROC_SLOTS];
 proc_t proc_store[MAX_PROC_SLOT + 1 - RESERVED_PROC_SLOTS] = {0};
 proc_mutex_t * proc_store_mutex = NULL;
 
+// Analyses are invalidated after giving back the store mutex, since the analysis cache acquires procedures while holding its own mutex
+static void proc_store_invalidate(uint8_t slot) {
+	if (proc_analysis_invalidate != NULL) {
+		proc_analysis_invalidate(slot);
+	}
+}
+
 int _delete_proc(uint8_t slot) {
 	if (slot < RESERVED_PROC_SLOTS || slot > MAX_PROC_SLOT) {
 		return -1;
 	}
 	int shifted_slot = slot - RESERVED_PROC_SLOTS;
 	for (int i = 0; i < proc_store[shifted_slot].instruction_count; i++) {
-		proc_free_instruction(&proc_store[shifted_slot].instructions[i]);
+		proc_free_instruction_in(&proc_store[shifted_slot], &proc_store[shifted_slot].instructions[i]);
 	}
 	proc_store[shifted_slot].instruction_count = 0;
+	proc_free(proc_store[shifted_slot].instructions);
+	proc_store[shifted_slot].instructions = NULL;
+	proc_free(proc_store[shifted_slot].strings);
+	proc_store[shifted_slot].strings = NULL;
+	proc_free(proc_store[shifted_slot].link);
+	proc_store[shifted_slot].link = NULL;
 	return 0;
 }
 
@@ -24,6 +39,9 @@ int delete_proc(uint8_t slot) {
 	}
 	int ret = _delete_proc(slot);
 	proc_mutex_give(proc_store_mutex);
+	if (ret == 0) {
+		proc_store_invalidate(slot);
+	}
 	return ret;
 }
 
@@ -35,6 +53,9 @@ int reset_proc_store() {
 		_delete_proc(i);
 	}
 	proc_mutex_give(proc_store_mutex);
+	for (int i = RESERVED_PROC_SLOTS; i < MAX_PROC_SLOT + 1; i++) {
+		proc_store_invalidate(i);
+	}
 }
 
 int proc_store_init() {
@@ -56,15 +77,18 @@ int set_proc(proc_t * proc, uint8_t slot, int overwrite) {
 	int ret = -1;
 	int shifted_slot = slot - RESERVED_PROC_SLOTS;
 	if (proc_store[shifted_slot].instruction_count == 0) {
-		_delete_proc(shifted_slot);
+		_delete_proc(slot);
 		proc_store[shifted_slot] = *proc;
 		ret = slot;
 	} else if (overwrite) {
-		_delete_proc(shifted_slot);
+		_delete_proc(slot);
 		proc_store[shifted_slot] = *proc;
 		ret = slot;
 	}
 	proc_mutex_give(proc_store_mutex);
+	if (ret >= 0) {
+		proc_store_invalidate(slot);
+	}
 	return ret;
 }
 
@@ -86,11 +110,44 @@ proc_union_t get_proc(uint8_t slot) {
 	return proc_union;
 }
 
+proc_union_t acquire_proc(uint8_t slot) {
+	proc_union_t proc_union = {.type = PROC_TYPE_NONE};
+	if (proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		return proc_union;
+	}
+	proc_union = get_proc(slot);
+	if (proc_union.type == PROC_TYPE_DSL) {
+		// Slots are overwritten in place, so references are detached copies
+		proc_t * copy = proc_calloc(1, sizeof(proc_t));
+		if (copy == NULL || deepcopy_proc(proc_union.proc.dsl_proc, copy) != 0) {
+			if (copy != NULL) {
+				free_proc(copy);
+			}
+			proc_union.type = PROC_TYPE_NONE;
+		} else {
+			copy->refcount = 1;
+			proc_union.proc.dsl_proc = copy;
+		}
+	}
+	proc_mutex_give(proc_store_mutex);
+	return proc_union;
+}
+
+void release_proc(proc_union_t proc_union) {
+	if (proc_union.type == PROC_TYPE_DSL && __atomic_sub_fetch(&proc_union.proc.dsl_proc->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+		free_proc(proc_union.proc.dsl_proc);
+	}
+}
+
 int * get_proc_slots() {
 	int * slots = proc_malloc((MAX_PROC_SLOT + 2) * sizeof(int));
 	int count = 0;
 
+	if (slots == NULL) {
+		return NULL;
+	}
 	if (proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		proc_free(slots);
 		return NULL;
 	}
 	for (int i = 0; i < RESERVED_PROC_SLOTS; i++) {
@@ -108,3 +165,44 @@ int * get_proc_slots() {
 	proc_mutex_give(proc_store_mutex);
 	return slots;
 }
+
+int get_proc_slots_bitmap(uint8_t * bitmap) {
+	memset(bitmap, 0, PROC_SLOTS_BITMAP_SIZE);
+
+	if (proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		return -1;
+	}
+	for (int i = 0; i < RESERVED_PROC_SLOTS; i++) {
+		if (proc_reserved_slots_array[i] != NULL) {
+			PROC_SLOTS_BITMAP_SET(bitmap, i);
+		}
+	}
+	for (int i = RESERVED_PROC_SLOTS; i < MAX_PROC_SLOT + 1; i++) {
+		if (proc_store[i - RESERVED_PROC_SLOTS].instruction_count > 0) {
+			PROC_SLOTS_BITMAP_SET(bitmap, i);
+		}
+	}
+
+	proc_mutex_give(proc_store_mutex);
+	return 0;
+}
+
+int get_proc_slot_info(uint8_t slot, proc_slot_info_t * info) {
+	if (slot < RESERVED_PROC_SLOTS) {
+		info->type = PROC_TYPE_COMPILED;
+		info->instruction_count = 0;
+		return (proc_reserved_slots_array[slot] != NULL) ? 0 : -1;
+	}
+	if (slot > MAX_PROC_SLOT || proc_mutex_take(proc_store_mutex) != PROC_MUTEX_OK) {
+		return -1;
+	}
+	int shifted_slot = slot - RESERVED_PROC_SLOTS;
+	int ret = -1;
+	if (proc_store[shifted_slot].instruction_count > 0) {
+		info->type = PROC_TYPE_DSL;
+		info->instruction_count = proc_store[shifted_slot].instruction_count;
+		ret = 0;
+	}
+	proc_mutex_give(proc_store_mutex);
+	return ret;
+}
@@ -1,8 +1,197 @@
+#include <stdio.h>
+#include <string.h>
+
 #include <criterion/criterion.h>
 #include <csp_proc_test/csp_network_test_harness.h>
 
+#include <csp_proc/proc_client.h>
+#include <csp_proc/proc_pack.h>
+#include <csp_proc/proc_store.h>
+
+#define TEST_TIMEOUT 1000
+
 Test(csp_network, test_network_init) {
 	cr_assert(node1_fixture->iface->addr == 1);
 	cr_assert(node2_fixture->iface->addr == 2);
 	cr_assert(node3_fixture->iface->addr == 3);
 }
+
+static void setup_proc_network(void) {
+	setup_network();
+	cr_assert(proc_server_init() == 0);
+}
+
+TestSuite(proc_client_server, .init = setup_proc_network, .fini = teardown_network);
+
+static char test_values[64][40];
+
+/**
+ * Fill a procedure with set instructions writing distinct values, so it packs to about 24 bytes per instruction.
+ */
+static void make_proc(proc_t * procedure, proc_instruction_t * instructions, int instruction_count) {
+	for (int i = 0; i < instruction_count; i++) {
+		snprintf(test_values[i], sizeof(test_values[i]), "value_%d_of_the_procedure", i);
+		instructions[i].node = 0;
+		instructions[i].type = PROC_SET;
+		instructions[i].instruction.set.param = "p_uint8_1";
+		instructions[i].instruction.set.value = test_values[i];
+	}
+	memset(procedure, 0, sizeof(proc_t));
+	procedure->instructions = instructions;
+	procedure->instruction_count = instruction_count;
+}
+
+static void assert_proc_eq(proc_t * procedure, int instruction_count) {
+	cr_assert(procedure->instruction_count == instruction_count);
+	for (int i = 0; i < instruction_count; i++) {
+		cr_assert(procedure->instructions[i].type == PROC_SET);
+		cr_assert_str_eq(procedure->instructions[i].instruction.set.param, "p_uint8_1");
+		cr_assert_str_eq(procedure->instructions[i].instruction.set.value, test_values[i]);
+	}
+}
+
+static void free_pulled_proc(proc_t * procedure) {
+	proc_t * pulled = proc_malloc(sizeof(proc_t));
+	*pulled = *procedure;
+	free_proc(pulled);
+}
+
+Test(proc_client_server, test_push_pull_segmented) {
+	proc_instruction_t instructions[40];
+	proc_t procedure;
+	make_proc(&procedure, instructions, 40);
+	cr_assert(calc_proc_size(&procedure) > PROC_SEGMENT_SIZE * 2);  // three segments or more
+
+	cr_assert(proc_push_request(&procedure, 10, 1, TEST_TIMEOUT) == 0);
+	cr_assert(proc_push_request(&procedure, 10, 1, TEST_TIMEOUT) != 0);  // occupied
+
+	proc_t pulled;
+	cr_assert(proc_pull_request(&pulled, 10, 1, TEST_TIMEOUT) == 0);
+	assert_proc_eq(&pulled, 40);
+	free_pulled_proc(&pulled);
+
+	cr_assert(proc_pull_request(&pulled, 11, 1, TEST_TIMEOUT) != 0);  // empty
+}
+
+Test(proc_client_server, test_bulk_push_pull_del) {
+	proc_instruction_t large_instructions[40];
+	proc_instruction_t small_instructions[3];
+	proc_t procedures[4];
+	make_proc(&procedures[0], large_instructions, 40);
+	make_proc(&procedures[1], small_instructions, 3);
+	procedures[2] = procedures[1];
+	procedures[3] = procedures[0];
+	cr_assert(proc_push_request(&procedures[1], 23, 1, TEST_TIMEOUT) == 0);
+
+	uint8_t push_slots[4] = {20, 21, 23, 22};  // slot 23 is occupied
+	int push_results[4];
+	cr_assert(proc_bulk_push_request(procedures, push_slots, 4, push_results, 1, TEST_TIMEOUT) == 1);
+	cr_assert(push_results[0] == 0 && push_results[1] == 0 && push_results[2] != 0 && push_results[3] == 0);
+
+	// The large procedures span several segments of the exchange, around the empty slot
+	uint8_t pull_slots[4] = {20, 24, 21, 22};
+	int pull_results[4];
+	proc_t pulled[4];
+	cr_assert(proc_bulk_pull_request(pulled, pull_slots, 4, pull_results, 1, TEST_TIMEOUT) == 1);
+	cr_assert(pull_results[0] == 0 && pull_results[1] != 0 && pull_results[2] == 0 && pull_results[3] == 0);
+	assert_proc_eq(&pulled[0], 40);
+	assert_proc_eq(&pulled[2], 3);
+	assert_proc_eq(&pulled[3], 40);
+	free_pulled_proc(&pulled[0]);
+	free_pulled_proc(&pulled[2]);
+	free_pulled_proc(&pulled[3]);
+
+	uint8_t del_slots[3] = {20, 21, 22};
+	int del_results[3];
+	cr_assert(proc_bulk_del_request(del_slots, 3, del_results, 1, TEST_TIMEOUT) == 0);
+	cr_assert(del_results[0] == 0 && del_results[1] == 0 && del_results[2] == 0);
+
+	uint8_t slots[256];
+	uint8_t slot_count;
+	cr_assert(proc_slots_request(slots, &slot_count, 1, TEST_TIMEOUT) == 0);
+	cr_assert(slot_count == 1 && slots[0] == 23);
+}
+
+Test(proc_client_server, test_slots_bitmap_info) {
+	proc_instruction_t large_instructions[40];
+	proc_instruction_t small_instructions[3];
+	proc_t large, small;
+	make_proc(&large, large_instructions, 40);
+	make_proc(&small, small_instructions, 3);
+	cr_assert(proc_push_request(&small, 5, 1, TEST_TIMEOUT) == 0);
+	cr_assert(proc_push_request(&large, 200, 1, TEST_TIMEOUT) == 0);
+	cr_assert(proc_push_request(&small, 255, 1, TEST_TIMEOUT) == 0);
+
+	uint8_t bitmap[PROC_SLOTS_BITMAP_SIZE];
+	static proc_slot_info_t info[PROC_SLOTS_BITMAP_SIZE * 8];
+	cr_assert(proc_slots_info_request(bitmap, info, 1, TEST_TIMEOUT) == 0);
+	for (int slot = 0; slot < PROC_SLOTS_BITMAP_SIZE * 8; slot++) {
+		cr_assert(PROC_SLOTS_BITMAP_TEST(bitmap, slot) == (slot == 5 || slot == 200 || slot == 255));
+	}
+	cr_assert(info[5].type == PROC_TYPE_DSL && info[5].instruction_count == 3);
+	cr_assert(info[200].type == PROC_TYPE_DSL && info[200].instruction_count == 40);
+	cr_assert(info[255].type == PROC_TYPE_DSL && info[255].instruction_count == 3);
+
+	// Without the metadata, only the bitmap is requested
+	memset(bitmap, 0, sizeof(bitmap));
+	cr_assert(proc_slots_info_request(bitmap, NULL, 1, TEST_TIMEOUT) == 0);
+	cr_assert(PROC_SLOTS_BITMAP_TEST(bitmap, 5) && PROC_SLOTS_BITMAP_TEST(bitmap, 200) && !PROC_SLOTS_BITMAP_TEST(bitmap, 6));
+
+	uint8_t slots[256];
+	uint8_t slot_count;
+	cr_assert(proc_slots_request(slots, &slot_count, 1, TEST_TIMEOUT) == 0);
+	cr_assert(slot_count == 3 && slots[0] == 5 && slots[1] == 200 && slots[2] == 255);
+}
+
+// Timed runs for test builds without the runtime, whose own definitions take precedence otherwise
+static proc_timed_run_t test_timed_runs[4];
+static int test_timed_run_count = 0;
+static uint16_t test_timed_next_id = 1;
+
+__attribute__((weak)) int proc_runtime_run_at(uint8_t proc_slot, uint32_t tv_sec, uint32_t tv_nsec, uint16_t * id) {
+	if (test_timed_run_count == 4) {
+		return -1;
+	}
+	test_timed_runs[test_timed_run_count] = (proc_timed_run_t){.tv_sec = tv_sec, .tv_nsec = tv_nsec, .id = test_timed_next_id++, .proc_slot = proc_slot};
+	*id = test_timed_runs[test_timed_run_count++].id;
+	return 0;
+}
+
+__attribute__((weak)) int proc_runtime_cancel_at(uint16_t id) {
+	for (int i = 0; i < test_timed_run_count; i++) {
+		if (test_timed_runs[i].id == id) {
+			memmove(&test_timed_runs[i], &test_timed_runs[i + 1], (--test_timed_run_count - i) * sizeof(proc_timed_run_t));
+			return 0;
+		}
+	}
+	return -1;
+}
+
+__attribute__((weak)) int proc_runtime_timed_runs(proc_timed_run_t * runs, int max_runs, proc_timed_jitter_t * jitter) {
+	int count = (test_timed_run_count < max_runs) ? test_timed_run_count : max_runs;
+	memcpy(runs, test_timed_runs, count * sizeof(proc_timed_run_t));
+	memset(jitter, 0, sizeof(proc_timed_jitter_t));
+	return count;
+}
+
+Test(proc_client_server, test_timed_add_list_cancel) {
+	// Far enough in the future that the runs stay scheduled
+	uint16_t first, second;
+	cr_assert(proc_timed_run_request(7, 4000000000U, 999999999, &first, 1, TEST_TIMEOUT) == 0);
+	cr_assert(proc_timed_run_request(8, 4000000060U, 0, &second, 1, TEST_TIMEOUT) == 0);
+	cr_assert(first != second);
+
+	proc_timed_run_t runs[PROC_TIMED_LIST_MAX];
+	proc_timed_jitter_t jitter;
+	int count;
+	cr_assert(proc_timed_list_request(runs, &count, &jitter, 1, TEST_TIMEOUT) == 0);
+	cr_assert(count == 2);
+	cr_assert(runs[0].id == first && runs[0].proc_slot == 7 && runs[0].tv_sec == 4000000000U && runs[0].tv_nsec == 999999999);
+	cr_assert(runs[1].id == second && runs[1].proc_slot == 8 && runs[1].tv_sec == 4000000060U && runs[1].tv_nsec == 0);
+
+	cr_assert(proc_timed_cancel_request(first, 1, TEST_TIMEOUT) == 0);
+	cr_assert(proc_timed_cancel_request(first, 1, TEST_TIMEOUT) != 0);  // already cancelled
+
+	cr_assert(proc_timed_list_request(runs, &count, NULL, 1, TEST_TIMEOUT) == 0);
+	cr_assert(count == 1 && runs[0].id == second);
+}
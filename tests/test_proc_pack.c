@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <criterion/criterion.h>
 #include <criterion/theories.h>
@@ -12,9 +14,11 @@ TheoryDataPoints(proc_pack_unpack, test_pack_unpack_instruction_types) = {
 };
 
 Theory((proc_instruction_type_t type), proc_pack_unpack, test_pack_unpack_instruction_types) {
+	proc_instruction_t instructions[1];
 	proc_t original_proc;
 	csp_packet_t packet;
 
+	original_proc.instructions = instructions;
 	original_proc.instruction_count = 1;
 	original_proc.instructions[0].node = 1;
 	original_proc.instructions[0].type = type;
@@ -100,9 +104,11 @@ Theory((proc_instruction_type_t type), proc_pack_unpack, test_pack_unpack_instru
 }
 
 Test(proc_pack_unpack, test_pack_unpack_variety) {
+	proc_instruction_t instructions[7];
 	proc_t original_proc;
 	csp_packet_t packet;
 
+	original_proc.instructions = instructions;
 	original_proc.instruction_count = 7;
 	original_proc.instructions[0].node = 1;
 	original_proc.instructions[0].type = PROC_BLOCK;
@@ -194,9 +200,11 @@ Test(proc_pack_unpack, test_pack_unpack_variety) {
 }
 
 Test(proc_pack_unpack, test_pack_does_not_mutate) {
+	proc_instruction_t instructions[2], copy_instructions[2];
 	proc_t original_proc, copy_proc;
 	csp_packet_t packet;
 
+	original_proc.instructions = instructions;
 	original_proc.instruction_count = 2;
 
 	original_proc.instructions[0].node = 1;
@@ -214,6 +222,8 @@ Test(proc_pack_unpack, test_pack_does_not_mutate) {
 
 	// Create a copy of original_proc for later comparison
 	copy_proc = original_proc;
+	memcpy(copy_instructions, instructions, sizeof(instructions));
+	copy_proc.instructions = copy_instructions;
 
 	// Pack the proc
 	int pack_result = pack_proc_into_csp_packet(&original_proc, &packet);
@@ -243,3 +253,141 @@ Test(proc_pack_unpack, test_pack_does_not_mutate) {
 		}
 	}
 }
+
+Test(proc_pack_unpack, test_unpack_and_copy_use_strings_arena) {
+	proc_instruction_t instructions[2];
+	proc_t original_proc;
+	csp_packet_t packet;
+
+	original_proc.instructions = instructions;
+	original_proc.instruction_count = 2;
+
+	original_proc.instructions[0].node = 1;
+	original_proc.instructions[0].type = PROC_SET;
+	original_proc.instructions[0].instruction.set.param = "param";
+	original_proc.instructions[0].instruction.set.value = "42";
+
+	original_proc.instructions[1].node = 4;
+	original_proc.instructions[1].type = PROC_BINOP;
+	original_proc.instructions[1].instruction.binop.param_a = "param[63]";
+	original_proc.instructions[1].instruction.binop.op = OP_LSH;
+	original_proc.instructions[1].instruction.binop.param_b = "param[5]";
+	original_proc.instructions[1].instruction.binop.result = "result[0]";
+
+	int pack_result = pack_proc_into_csp_packet(&original_proc, &packet);
+	cr_assert(pack_result == 0, "Packing failed");
+
+	proc_t new_proc;
+	int unpack_result = unpack_proc_from_csp_packet(&new_proc, &packet);
+	cr_assert(unpack_result == 0, "Unpacking failed");
+
+	// All operand strings are stored back to back in the arena
+	cr_assert_not_null(new_proc.strings, "Unpacked procedure has no strings arena");
+	cr_assert(new_proc.instructions[0].instruction.set.param == new_proc.strings, "First string is not at the start of the arena");
+	cr_assert(new_proc.instructions[1].instruction.binop.result + strlen("result[0]") + 1 <= new_proc.strings + new_proc.strings_size, "Strings exceed the arena");
+	cr_assert_str_eq(new_proc.instructions[1].instruction.binop.param_b, "param[5]", "Binop param_b does not match");
+
+	proc_t * copy_proc = malloc(sizeof(proc_t));
+	cr_assert(deepcopy_proc(&new_proc, copy_proc) == 0, "Copying failed");
+	cr_assert(copy_proc->strings != new_proc.strings, "Copy shares the arena of the original");
+	cr_assert(copy_proc->instructions[0].instruction.set.value >= copy_proc->strings && copy_proc->instructions[0].instruction.set.value < copy_proc->strings + copy_proc->strings_size, "Copied string is not in the arena of the copy");
+	cr_assert_str_eq(copy_proc->instructions[0].instruction.set.value, "42", "Set value does not match");
+
+	free_proc(copy_proc);
+	free(new_proc.instructions);
+	free(new_proc.strings);
+}
+
+Test(proc_pack_unpack, test_unpack_rejects_truncated_procedure) {
+	proc_instruction_t instructions[2];
+	proc_t original_proc;
+	uint8_t packed[64];
+
+	original_proc.instructions = instructions;
+	original_proc.instruction_count = 2;
+
+	original_proc.instructions[0].node = 1;
+	original_proc.instructions[0].type = PROC_SET;
+	original_proc.instructions[0].instruction.set.param = "param";
+	original_proc.instructions[0].instruction.set.value = "42";
+
+	original_proc.instructions[1].node = 2;
+	original_proc.instructions[1].type = PROC_CALL;
+	original_proc.instructions[1].instruction.call.procedure_slot = 7;
+
+	int size = proc_pack(&original_proc, packed, sizeof(packed));
+	cr_assert(size == calc_proc_size(&original_proc), "Packing failed");
+	cr_assert(proc_pack(&original_proc, packed, size - 1) == -1, "Packing into a too small buffer succeeded");
+	cr_assert(proc_packed_instruction_count(packed, size, 0) == 2, "Packed instruction count does not match");
+
+	// Every strict prefix of the packed procedure, e.g. from a lost segment, must be rejected
+	for (int length = 0; length < size; length++) {
+		proc_t * new_proc = malloc(sizeof(proc_t));
+		cr_assert(proc_unpack(new_proc, packed, length) == -1, "Unpacking a truncated procedure succeeded");
+		free_proc(new_proc);
+	}
+
+	proc_t * new_proc = malloc(sizeof(proc_t));
+	cr_assert(proc_unpack(new_proc, packed, size) == 0, "Unpacking failed");
+	cr_assert(new_proc->instruction_count == 2, "Instruction count does not match");
+	cr_assert(new_proc->instructions[1].instruction.call.procedure_slot == 7, "Call slot does not match");
+	free_proc(new_proc);
+}
+
+Test(proc_pack_unpack, test_pack_unpack_compact) {
+	proc_instruction_t instructions[4];
+	proc_t original_proc;
+	uint8_t packed[128];
+
+	original_proc.instructions = instructions;
+	original_proc.instruction_count = 4;
+
+	original_proc.instructions[0].node = 300;
+	original_proc.instructions[0].type = PROC_BINOP;
+	original_proc.instructions[0].instruction.binop.param_a = "lat_diff";
+	original_proc.instructions[0].instruction.binop.op = OP_MUL;
+	original_proc.instructions[0].instruction.binop.param_b = "lat_diff";
+	original_proc.instructions[0].instruction.binop.result = "lat_diff";
+
+	original_proc.instructions[1].node = 300;
+	original_proc.instructions[1].type = PROC_IFELSE;
+	original_proc.instructions[1].instruction.ifelse.param_a = "lat_diff";
+	original_proc.instructions[1].instruction.ifelse.op = OP_LT;
+	original_proc.instructions[1].instruction.ifelse.param_b = "_zero";
+
+	original_proc.instructions[2].node = 0;
+	original_proc.instructions[2].type = PROC_CALL;
+	original_proc.instructions[2].instruction.call.procedure_slot = 9;
+
+	original_proc.instructions[3].node = 0;
+	original_proc.instructions[3].type = PROC_SET;
+	original_proc.instructions[3].instruction.set.param = "_zero";
+	original_proc.instructions[3].instruction.set.value = "0";
+
+	int size = proc_pack_compact(&original_proc, packed, sizeof(packed));
+	cr_assert(size > 0 && size == calc_proc_compact_size(&original_proc), "Packing failed");
+	cr_assert(size < calc_proc_size(&original_proc), "Compact encoding is not smaller");
+	cr_assert(proc_pack_compact(&original_proc, packed, size - 1) == -1, "Packing into a too small buffer succeeded");
+	cr_assert(proc_packed_instruction_count(packed, size, 1) == 4, "Packed instruction count does not match");
+
+	for (int length = 0; length < size; length++) {
+		proc_t * new_proc = malloc(sizeof(proc_t));
+		cr_assert(proc_unpack_compact(new_proc, packed, length) == -1, "Unpacking a truncated procedure succeeded");
+		free_proc(new_proc);
+	}
+
+	proc_t * new_proc = malloc(sizeof(proc_t));
+	cr_assert(proc_unpack_compact(new_proc, packed, size) == 0, "Unpacking failed");
+	cr_assert(new_proc->instruction_count == 4, "Instruction count does not match");
+	cr_assert(new_proc->instructions[0].node == 300 && new_proc->instructions[1].node == 300 && new_proc->instructions[3].node == 0, "Nodes do not match");
+	cr_assert(new_proc->instructions[0].instruction.binop.op == OP_MUL, "Binop op does not match");
+	cr_assert(new_proc->instructions[1].instruction.ifelse.op == OP_LT, "Ifelse op does not match");
+	cr_assert(new_proc->instructions[2].instruction.call.procedure_slot == 9, "Call slot does not match");
+	cr_assert_str_eq(new_proc->instructions[1].instruction.ifelse.param_b, "_zero", "Ifelse param_b does not match");
+	cr_assert_str_eq(new_proc->instructions[3].instruction.set.value, "0", "Set value does not match");
+
+	// Repeated operands are unpacked once
+	cr_assert(new_proc->instructions[0].instruction.binop.result == new_proc->instructions[1].instruction.ifelse.param_a, "Repeated operand is not shared");
+	cr_assert(new_proc->strings_size == strlen("lat_diff") + 1 + strlen("_zero") + 1 + strlen("0") + 1, "String table is not deduplicated");
+	free_proc(new_proc);
+}
@@ -0,0 +1,194 @@
+#include <string.h>
+
+#include <criterion/criterion.h>
+
+#include <csp_proc/proc_types.h>
+#include <csp_proc/proc_pack.h>
+#include <csp_proc/proc_store.h>
+#include <csp_proc/proc_storage.h>
+#include <csp_proc/proc_memory.h>
+
+// Not part of the store interface, used here to unmount the store
+void destroy_proc_store();
+
+// In-memory storage with flash semantics (writes can only clear bits), which can cut the power after a number of written bytes
+static uint8_t storage[PROC_STORE_SIZE];
+static int storage_initialized = 0;
+static uint32_t storage_reads = 0;
+static uint32_t storage_erases = 0;
+static int32_t storage_write_budget = -1;  // bytes written before the power is cut, -1 = no limit
+
+int proc_storage_init() {
+	if (!storage_initialized) {
+		memset(storage, 0xFF, sizeof(storage));
+		storage_initialized = 1;
+	}
+	return 0;
+}
+
+int proc_storage_read(uint32_t offset, void * buf, uint32_t len) {
+	if (offset + len > PROC_STORE_SIZE) {
+		return -1;
+	}
+	memcpy(buf, storage + offset, len);
+	storage_reads++;
+	return 0;
+}
+
+int proc_storage_write(uint32_t offset, const void * buf, uint32_t len) {
+	if (offset + len > PROC_STORE_SIZE) {
+		return -1;
+	}
+	for (uint32_t i = 0; i < len; i++) {
+		if (storage_write_budget == 0) {
+			return -1;
+		}
+		if (storage_write_budget > 0) {
+			storage_write_budget--;
+		}
+		storage[offset + i] &= ((const uint8_t *)buf)[i];
+	}
+	return 0;
+}
+
+int proc_storage_erase(uint32_t offset, uint32_t len) {
+	if (offset + len > PROC_STORE_SIZE) {
+		return -1;
+	}
+	memset(storage + offset, 0xFF, len);
+	storage_erases++;
+	return 0;
+}
+
+int proc_storage_sync() {
+	return 0;
+}
+
+/**
+ * Create a procedure of `instruction_count` set instructions writing `value`, allocated like procedures unpacked by the server.
+ */
+static proc_t * make_proc(int instruction_count, const char * value) {
+	proc_instruction_t instructions[32];
+	cr_assert(instruction_count <= 32);
+	for (int i = 0; i < instruction_count; i++) {
+		instructions[i].node = 0;
+		instructions[i].type = PROC_SET;
+		instructions[i].instruction.set.param = "test_param";
+		instructions[i].instruction.set.value = (char *)value;
+	}
+	proc_t original = {.instructions = instructions, .instruction_count = instruction_count};
+
+	uint8_t packed[PROC_MAX_PACKED_SIZE];
+	int size = proc_pack(&original, packed, sizeof(packed));
+	cr_assert(size > 0);
+	proc_t * proc = proc_malloc(sizeof(proc_t));
+	cr_assert(proc_unpack(proc, packed, size) == 0);
+	return proc;
+}
+
+static void store_proc(uint8_t slot, int instruction_count, const char * value) {
+	proc_t * proc = make_proc(instruction_count, value);
+	cr_assert(set_proc(proc, slot, 1) == slot);
+	proc_free(proc);  // the store took over the instructions and strings
+}
+
+static void assert_proc(uint8_t slot, int instruction_count, const char * value) {
+	proc_union_t proc_union = get_proc(slot);
+	cr_assert(proc_union.type == PROC_TYPE_DSL);
+	cr_assert(proc_union.proc.dsl_proc->instruction_count == instruction_count);
+	cr_assert_str_eq(proc_union.proc.dsl_proc->instructions[instruction_count - 1].instruction.set.value, value);
+}
+
+static void remount() {
+	destroy_proc_store();
+	cr_assert(proc_store_init() == 0);
+}
+
+Test(proc_store_persistent, test_torn_record_keeps_previous_procedure) {
+	cr_assert(proc_store_init() == 0);
+	store_proc(10, 2, "old");
+
+	// Cut the power at several points of the record replacing the procedure
+	int32_t budgets[] = {16, 11, 6, 2};
+	for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+		storage_write_budget = budgets[i];
+		proc_t * proc = make_proc(3, "new");
+		cr_assert(set_proc(proc, 10, 1) < 0);
+		free_proc(proc);
+		storage_write_budget = -1;
+
+		remount();
+		assert_proc(10, 2, "old");
+	}
+
+	// The journal continues after the torn record was compacted away
+	store_proc(11, 4, "next");
+	remount();
+	assert_proc(10, 2, "old");
+	assert_proc(11, 4, "next");
+}
+
+Test(proc_store_persistent, test_compaction_when_bank_full) {
+	cr_assert(proc_store_init() == 0);
+	uint32_t format_erases = storage_erases;
+	store_proc(20, 2, "kept");
+
+	// Overwriting a slot appends a record every time, filling the bank many times over
+	char value[16];
+	for (int i = 0; i < 200; i++) {
+		snprintf(value, sizeof(value), "value_%d", i);
+		store_proc(21, 16, value);
+	}
+	cr_assert(storage_erases > format_erases);
+
+	assert_proc(20, 2, "kept");
+	assert_proc(21, 16, "value_199");
+	remount();
+	assert_proc(20, 2, "kept");
+	assert_proc(21, 16, "value_199");
+}
+
+Test(proc_store_persistent, test_mount_picks_higher_generation_bank) {
+	cr_assert(proc_store_init() == 0);
+	store_proc(30, 2, "old");
+
+	// Fill the first bank until its live records are compacted into the second one
+	uint32_t erases = storage_erases;
+	for (int i = 0; storage_erases == erases; i++) {
+		cr_assert(i < 1000);
+		store_proc(31, 16, "filler");
+	}
+	store_proc(30, 2, "new");
+
+	// Both banks have a valid header, the second one with the higher generation
+	remount();
+	assert_proc(30, 2, "new");
+
+	// Without the second bank's header, the first bank with the older journal is mounted
+	memset(storage + PROC_STORE_SIZE / 2, 0x00, 16);
+	remount();
+	assert_proc(30, 2, "old");
+}
+
+Test(proc_store_persistent, test_lazy_load_after_remount) {
+	cr_assert(proc_store_init() == 0);
+	store_proc(40, 3, "first");
+	store_proc(41, 5, "second");
+	remount();
+
+	// Slot metadata comes from the index built while mounting
+	uint32_t reads = storage_reads;
+	proc_slot_info_t info;
+	cr_assert(get_proc_slot_info(41, &info) == 0);
+	cr_assert(info.type == PROC_TYPE_DSL && info.instruction_count == 5);
+	cr_assert(get_proc_slot_info(42, &info) != 0);
+	cr_assert(storage_reads == reads);
+
+	// Procedures are only read from storage on first use
+	assert_proc(40, 3, "first");
+	cr_assert(storage_reads == reads + 1);
+	assert_proc(40, 3, "first");
+	cr_assert(storage_reads == reads + 1);
+	assert_proc(41, 5, "second");
+	cr_assert(storage_reads == reads + 2);
+}